@@ -0,0 +1,52 @@
+#ifndef __AR_TARGET_H__
+#define __AR_TARGET_H__
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "AlphaBetaTracker.h"
+
+// Everything NAR keeps about one AR object between frames, see NAR::AddARObject.
+// Its sigs are [sig_begin, sig_end) of the index shared by all the targets.
+struct ARTarget
+{
+    // Geometry, never changes
+    int width, height;
+    cv::Mat image_pts; // 4 corners, image points
+    cv::Mat world_pts; // 4 corners, world points
+    size_t sig_begin, sig_end;
+
+    // From pose estimation
+    cv::Mat rotation;
+    cv::Mat translation;
+    cv::Point2i corners[4]; // last pose projected onto the image
+
+    // For smoothing out the pose estimation
+    AlphaBetaTracker tracker;
+    bool tracking; // found recently, a failed detection is a PREDICTION instead of BAD
+    int failed_frames; // number of consecutive failed detection
+    bool use_search_region;
+    cv::Point2i region_start, region_end; // where the target is expected in the next frame
+
+    // Optical flow assist
+    std::vector <cv::Point2f> prev_optical_flow_pts;
+    std::vector <cv::Point2f> prev_AR_object_pts;
+    int optical_flow_frame_count; // increments where this significant movement
+    cv::Point2f avg_optical_flow;
+    int last_optical_flow_size;
+    cv::Mat prev_grey;
+
+    ARTarget()
+    {
+        width = height = 0;
+        sig_begin = sig_end = 0;
+        tracking = false;
+        failed_frames = 0;
+        use_search_region = false;
+        optical_flow_frame_count = 0;
+        avg_optical_flow = cv::Point2f(0, 0);
+        last_optical_flow_size = 0;
+    }
+};
+
+#endif
@@ -1,12 +1,31 @@
 #include "BaseThread.h"
+#include "StageScheduler.h"
+#include <assert.h>
 #include <iostream>
 
 using namespace std;
 
 BaseThread::BaseThread()
 {
+    m_scheduler = NULL;
+    m_next_thread = NULL;
     m_buffer_limit = 5;
+    m_overflow_policy = DROP_NEWEST;
+    m_serial = true;
+    m_attached = false;
+    m_running = 0;
     m_fps = 0.0f;
+    m_total_time = 0;
+    m_frame_count = 0;
+}
+
+BaseThread::~BaseThread()
+{
+}
+
+void BaseThread::SetScheduler(StageScheduler *scheduler)
+{
+    m_scheduler = scheduler;
 }
 
 void BaseThread::SetBufferLimit(unsigned int limit)
@@ -14,29 +33,35 @@ void BaseThread::SetBufferLimit(unsigned int limit)
     m_buffer_limit = limit;
 }
 
-void BaseThread::Run()
+void BaseThread::SetOverflowPolicy(OverflowPolicy policy)
 {
-    m_thread = boost::thread(boost::bind(&BaseThread::DoWork, this));
+    m_overflow_policy = policy;
 }
 
-void BaseThread::Done()
+void BaseThread::SetSerial(bool serial)
 {
-    m_done = true;
-    m_thread.join();
+    m_serial = serial;
 }
 
-void BaseThread::AddJob(const ThreadJob &job)
+void BaseThread::Run()
 {
-    boost::mutex::scoped_lock lock(m_base_mutex);
+    assert(m_scheduler);
+    m_scheduler->Attach(this);
+}
 
-    if(m_jobs.size() < m_buffer_limit) {
-        m_jobs.push_back(job);
-    }
-    else {
-        cout << m_name << ": buffer full" << endl;
+void BaseThread::Done()
+{
+    if(m_scheduler) {
+        m_scheduler->Detach(this);
     }
 }
 
+void BaseThread::AddJob(const ThreadJobPtr &job)
+{
+    assert(m_scheduler);
+    m_scheduler->Push(this, job);
+}
+
 void BaseThread::SetNextThread(BaseThread *thread)
 {
     m_next_thread = thread;
@@ -52,3 +77,20 @@ float BaseThread::GetFPS()
     boost::mutex::scoped_lock lock(m_fps_mutex);
     return m_fps;
 }
+
+void BaseThread::UpdateFPS(unsigned int ms)
+{
+    boost::mutex::scoped_lock lock(m_fps_mutex);
+
+    m_total_time += ms;
+    m_frame_count++;
+
+    if(m_frame_count >= 8) {
+        if(m_total_time > 0) {
+            m_fps = m_frame_count*1000.0f / m_total_time;
+        }
+
+        m_frame_count = 0;
+        m_total_time = 0;
+    }
+}
@@ -1,40 +1,64 @@
 #ifndef __BASE_THREAD_H__
 #define __BASE_THREAD_H__
 
-#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 #include <deque>
 #include <string>
 
 #include "ThreadJob.h"
 
+class StageScheduler;
+
+// A stage in the processing pipeline.
+// Stages don't own a thread, jobs are run by the worker pool of the StageScheduler they are attached to.
 class BaseThread
 {
 public:
+    // What AddJob does when the job buffer is full
+    enum OverflowPolicy {DROP_NEWEST=0, DROP_OLDEST, BLOCK};
+
     BaseThread();
+    virtual ~BaseThread();
 
-    void Run();
-	void Done();
-    void AddJob(const ThreadJob &job);
+    void Run(); // attach to the scheduler, jobs start getting processed
+	void Done(); // detach from the scheduler, waits for jobs in progress
+    void AddJob(const ThreadJobPtr &job);
 
+    void SetScheduler(StageScheduler *scheduler);
 	void SetNextThread(BaseThread *thread);
     void SetName(const std::string &name);
     void SetBufferLimit(unsigned int limit);
+    void SetOverflowPolicy(OverflowPolicy policy);
+    void SetSerial(bool serial); // serial stages process one job at a time, in the order they were added
 
+    const std::string& GetName() const { return m_name; }
     virtual float GetFPS();
 
 protected:
-    virtual void DoWork() = 0;
+    virtual void DoWork(const ThreadJobPtr &job) = 0; // process one job, called from a scheduler worker
+    void UpdateFPS(unsigned int ms); // time spent on one job, m_fps is updated every 8 jobs
 
 protected:
-    boost::thread m_thread;
-    boost::mutex m_base_mutex;
+    StageScheduler *m_scheduler;
     boost::mutex m_fps_mutex;
-    bool m_done;
-    std::deque <ThreadJob> m_jobs;
     BaseThread *m_next_thread;
     std::string m_name;
-    unsigned int m_buffer_limit;
     float m_fps;
+
+private:
+    friend class StageScheduler;
+
+    // Everything below is guarded by the scheduler's mutex
+    std::deque <ThreadJobPtr> m_jobs;
+    unsigned int m_buffer_limit;
+    OverflowPolicy m_overflow_policy;
+    bool m_serial;
+    bool m_attached;
+    int m_running; // jobs being processed right now
+
+    // Guarded by m_fps_mutex
+    unsigned int m_total_time;
+    unsigned int m_frame_count;
 };
 
 #endif
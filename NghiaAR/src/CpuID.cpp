@@ -5,6 +5,8 @@
 #elif __linux__
 	#define __cpuid(out, infoType)\
 	asm("cpuid": "=a" (out[0]), "=b" (out[1]), "=c" (out[2]), "=d" (out[3]): "a" (infoType));
+	#define __cpuidex(out, infoType, subLeaf)\
+	asm("cpuid": "=a" (out[0]), "=b" (out[1]), "=c" (out[2]), "=d" (out[3]): "a" (infoType), "c" (subLeaf));
 #else
     #error "Platform not supported or tested"
 #endif
@@ -23,3 +25,51 @@ void GetCpuidFeatures(CpuidFeatures *featureStruct)
 {
 	__cpuid(featureStruct->CPUInfo, FeatureSupport);
 }
+
+void GetCpuidExtendedFeatures(CpuidExtendedFeatures *featureStruct)
+{
+	int info[4];
+	__cpuid(info, String);
+
+	if(info[0] < ExtendedFeatureSupport) {
+		for(int i=0; i < 4; i++) {
+			featureStruct->CPUInfo[i] = 0;
+		}
+
+		return;
+	}
+
+	__cpuidex(featureStruct->CPUInfo, ExtendedFeatureSupport, 0);
+}
+
+bool GetOSSupportsAVX()
+{
+	CpuidFeatures features;
+	GetCpuidFeatures(&features);
+
+	if(!features.AVX256 || !features.OSXSAVE) {
+		return false;
+	}
+
+	// XCR0 bit 1 = SSE state, bit 2 = AVX state
+	unsigned int xcr0 = 0;
+
+#if defined(_MSC_VER) && (_MSC_FULL_VER >= 160040219) // VS2010 SP1
+	xcr0 = (unsigned int)_xgetbv(0);
+#elif defined(__GNUC__)
+	unsigned int edx;
+	asm(".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0), "=d" (edx) : "c" (0)); // xgetbv
+#else
+	return false;
+#endif
+
+	return (xcr0 & 6) == 6;
+}
+
+bool GetCpuSupportsAVX2()
+{
+	CpuidExtendedFeatures ext;
+	GetCpuidExtendedFeatures(&ext);
+
+	return ext.AVX2 && GetOSSupportsAVX();
+}
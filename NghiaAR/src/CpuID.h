@@ -6,7 +6,7 @@
 
 enum CPUIDInfoType
 {
-	String = 0, FeatureSupport = 1
+	String = 0, FeatureSupport = 1, ExtendedFeatureSupport = 7
 };
 
 struct CpuidString
@@ -109,7 +109,38 @@ struct CpuidFeatures
 	};
 };
 
+// Leaf 7, sub-leaf 0
+struct CpuidExtendedFeatures
+{
+	union
+	{
+		int CPUInfo[4];
+		struct
+		{
+			// EAX
+			unsigned MaxSubLeaf		:32;//32	0-31
+			// EBX
+			unsigned FSGSBASE		:1;//1		0
+			unsigned TSCAdjust		:1;//2		1
+			unsigned SGX			:1;//3		2
+			unsigned BMI1			:1;//4		3
+			unsigned HLE			:1;//5		4
+			unsigned AVX2			:1;//6		5
+			unsigned Reserved21		:2;//8		6-7
+			unsigned BMI2			:1;//9		8
+			unsigned Reserved22		:23;//32	9-31
+			// ECX
+			unsigned Reserved3		:32;//32	0-31
+			// EDX
+			unsigned Reserved4		:32;//32	0-31
+		};
+	};
+};
+
 void GetCpuidString(CpuidString *stringStruct);
 void GetCpuidFeatures(CpuidFeatures *featureStruct);
+void GetCpuidExtendedFeatures(CpuidExtendedFeatures *featureStruct);
+bool GetOSSupportsAVX(); // CPU has AVX and the OS saves the YMM registers on a context switch
+bool GetCpuSupportsAVX2(); // AVX2 instructions can be used
 
 #endif
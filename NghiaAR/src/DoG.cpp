@@ -1,97 +1,350 @@
 #include <iostream>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "NAR_Config.h"
 #include "DoG.h"
+#include "CpuID.h"
+
+#ifdef NAR_HAVE_AVX2
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-static bool KeyPointLocalisation(const cv::Mat &grey, int x, int y, float &ret_x, float &ret_y);
-static float SubPixel(const cv::Mat &grey, float x, float y);
+/*
+Both blurs and the DoG are done in fixed point on 16 bit integers, 8 pixels per SSE2 instruction.
+Only the search region plus a BORDER margin, which the patch extraction reads, is filtered.
+Blurs are separable with Q14 weights, each pass rounds back to Q7, so the DoG keeps 7 fractional bits.
+*/
+
+static const int MAX_RADIUS = 8; // 3 sigma of the larger blur
+static const int DOG_SHIFT = 7; // fractional bits of the blurs and DoG
+static const float DOG_SCALE = 1.0f / (1 << DOG_SHIFT);
+static const int WEIGHT_SHIFT = 14;
+
+struct GaussKernel
+{
+    int radius;
+    int w[2*MAX_RADIUS + 2]; // Q14, sums to 1, padded with a 0 so the taps can be paired up
+};
+
+static GaussKernel MakeKernel(double sigma)
+{
+    GaussKernel k;
+    double f[2*MAX_RADIUS + 1];
+    double sum = 0;
+    int total = 0;
+
+    k.radius = min((int)ceil(sigma*3.0), MAX_RADIUS);
+
+    for(int i=-k.radius; i <= k.radius; i++) {
+        f[i + k.radius] = exp(-i*i / (2.0*sigma*sigma));
+        sum += f[i + k.radius];
+    }
+
+    memset(k.w, 0, sizeof(k.w));
+
+    for(int i=0; i <= 2*k.radius; i++) {
+        k.w[i] = (int)(f[i]*(1 << WEIGHT_SHIFT)/sum + 0.5);
+        total += k.w[i];
+    }
+
+    // Rounding error goes to the centre so the weights sum to exactly 1
+    k.w[k.radius] += (1 << WEIGHT_SHIFT) - total;
+
+    return k;
+}
+
+// Weights i and i+1 packed for _mm_madd_epi16
+static inline __m128i WeightPair(const GaussKernel &k, int i)
+{
+    return _mm_set1_epi32((k.w[i + 1 + k.radius] << 16) | (k.w[i + k.radius] & 0xffff));
+}
+
+// Q14 sums back to 16 bits
+static inline __m128i Round(__m128i lo, __m128i hi, int shift)
+{
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), shift);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), shift);
+
+    return _mm_packs_epi32(lo, hi);
+}
+
+static bool HaveAVX2()
+{
+#ifdef NAR_HAVE_AVX2
+    return GetCpuSupportsAVX2();
+#else
+    return false;
+#endif
+}
+
+// Initialised before any thread starts
+static const GaussKernel g_kernel1 = MakeKernel(1.6);
+static const GaussKernel g_kernel2 = MakeKernel(1.6*1.6);
+static const bool g_use_avx2 = HaveAVX2();
+
+static bool KeyPointLocalisation(const cv::Mat &dog, int x, int y, float &ret_x, float &ret_y);
+static float SubPixel(const cv::Mat &dog, float x, float y);
+
+// Pixels i and i+1 from x, interleaved for _mm_madd_epi16. src[MAX_RADIUS + x] is output pixel x
+static inline void LoadPair(const unsigned char *src, int i, __m128i &lo, __m128i &hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + MAX_RADIUS + i)), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + MAX_RADIUS + i + 1)), zero);
+
+    lo = _mm_unpacklo_epi16(a, b);
+    hi = _mm_unpackhi_epi16(a, b);
+}
+
+// Horizontal pass to Q7, width is a multiple of 8. Both blurs share the pixel loads.
+static void BlurRowsH(const unsigned char *src, int width, short *dst1, short *dst2)
+{
+    const int r1 = g_kernel1.radius;
+    const int r2 = g_kernel2.radius;
+    const int shift = WEIGHT_SHIFT - DOG_SHIFT;
+
+    for(int x=0; x < width; x += 8) {
+        __m128i lo1 = _mm_setzero_si128(), hi1 = _mm_setzero_si128();
+        __m128i lo2 = _mm_setzero_si128(), hi2 = _mm_setzero_si128();
+
+        for(int i=-r2; i <= r2; i += 2) {
+            __m128i lo, hi;
+
+            LoadPair(src + x, i, lo, hi);
+
+            __m128i w2 = WeightPair(g_kernel2, i);
+
+            lo2 = _mm_add_epi32(lo2, _mm_madd_epi16(lo, w2));
+            hi2 = _mm_add_epi32(hi2, _mm_madd_epi16(hi, w2));
+        }
+
+        for(int i=-r1; i <= r1; i += 2) {
+            __m128i lo, hi;
+
+            LoadPair(src + x, i, lo, hi);
+
+            __m128i w1 = WeightPair(g_kernel1, i);
+
+            lo1 = _mm_add_epi32(lo1, _mm_madd_epi16(lo, w1));
+            hi1 = _mm_add_epi32(hi1, _mm_madd_epi16(hi, w1));
+        }
+
+        _mm_storeu_si128((__m128i*)(dst1 + x), Round(lo1, hi1, shift));
+        _mm_storeu_si128((__m128i*)(dst2 + x), Round(lo2, hi2, shift));
+    }
+}
+
+// Vertical pass on 8 columns of Q7 rows, stays in Q7
+static inline __m128i BlurColumnV(const short *src, int stride, const GaussKernel &k)
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    for(int i=-k.radius; i <= k.radius; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i*stride));
+        __m128i b = (i < k.radius) ? _mm_loadu_si128((const __m128i*)(src + (i+1)*stride)) : a; // odd tap out, weight is 0
+        __m128i w = WeightPair(k, i);
+
+        lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+        hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+    }
+
+    return Round(lo, hi, WEIGHT_SHIFT);
+}
+
+static void BlurRowsV(const short *src1, const short *src2, int stride, int width, short *dog, unsigned char *blur)
+{
+    const __m128i round = _mm_set1_epi16(1 << (DOG_SHIFT - 1));
+
+    for(int x=0; x < width; x += 8) {
+        __m128i v1 = BlurColumnV(src1 + x, stride, g_kernel1);
+        __m128i v2 = BlurColumnV(src2 + x, stride, g_kernel2);
+
+        _mm_storeu_si128((__m128i*)(dog + x), _mm_sub_epi16(v1, v2));
+
+        __m128i b = _mm_srai_epi16(_mm_add_epi16(v1, round), DOG_SHIFT);
+        _mm_storel_epi64((__m128i*)(blur + x), _mm_packus_epi16(b, b));
+    }
+}
+
+// Bit i set if pixel x+i is a strict 8-neighbour extremum with |DoG| >= threshold
+static inline int ExtremaMask8(const short *p, int stride, int threshold)
+{
+    const __m128i cur = _mm_loadu_si128((const __m128i*)p);
+    const int offsets[8] = {-stride-1, -stride, -stride+1, -1, 1, stride-1, stride, stride+1};
+
+    __m128i is_max = _mm_set1_epi16(-1);
+    __m128i is_min = _mm_set1_epi16(-1);
+
+    for(int i=0; i < 8; i++) {
+        __m128i n = _mm_loadu_si128((const __m128i*)(p + offsets[i]));
+
+        is_max = _mm_and_si128(is_max, _mm_cmpgt_epi16(cur, n));
+        is_min = _mm_and_si128(is_min, _mm_cmplt_epi16(cur, n));
+    }
+
+    __m128i contrast = _mm_or_si128(_mm_cmpgt_epi16(cur, _mm_set1_epi16((short)(threshold - 1))),
+                                    _mm_cmplt_epi16(cur, _mm_set1_epi16((short)(1 - threshold))));
+
+    __m128i mask = _mm_and_si128(_mm_or_si128(is_max, is_min), contrast);
+
+    return _mm_movemask_epi8(_mm_packs_epi16(mask, _mm_setzero_si128())) & 0xff;
+}
+
+#ifdef NAR_HAVE_AVX2
+// Same as ExtremaMask8, 16 pixels
+NAR_TARGET("avx2")
+static int ExtremaMask16(const short *p, int stride, int threshold)
+{
+    const __m256i cur = _mm256_loadu_si256((const __m256i*)p);
+    const int offsets[8] = {-stride-1, -stride, -stride+1, -1, 1, stride-1, stride, stride+1};
+
+    __m256i is_max = _mm256_set1_epi16(-1);
+    __m256i is_min = _mm256_set1_epi16(-1);
+
+    for(int i=0; i < 8; i++) {
+        __m256i n = _mm256_loadu_si256((const __m256i*)(p + offsets[i]));
+
+        is_max = _mm256_and_si256(is_max, _mm256_cmpgt_epi16(cur, n));
+        is_min = _mm256_and_si256(is_min, _mm256_cmpgt_epi16(n, cur));
+    }
+
+    __m256i contrast = _mm256_or_si256(_mm256_cmpgt_epi16(cur, _mm256_set1_epi16((short)(threshold - 1))),
+                                       _mm256_cmpgt_epi16(_mm256_set1_epi16((short)(1 - threshold)), cur));
+
+    __m256i mask = _mm256_and_si256(_mm256_or_si256(is_max, is_min), contrast);
+
+    // 2 bits per pixel, keep one
+    unsigned int bits = (unsigned int)_mm256_movemask_epi8(mask);
+    int ret = 0;
+
+    for(int i=0; i < 16; i++) {
+        ret |= ((bits >> (i*2)) & 1) << i;
+    }
+
+    return ret;
+}
+#endif
 
 void DoGKeyPointExtraction(const cv::Mat &grey, bool sub_pixel, std::vector <cv::Point2f> &keypoints, cv::Mat &blur,
                            bool use_search_region, const cv::Point2i &start, const cv::Point2i &end)
 {
-    const double sigma1 = 1.6;
-    const double sigma2 = 1.6*1.6;
-    const float low_contrast = 7.0f;
+    assert(grey.type() == CV_8U);
+
+    const int low_contrast = (int)(7.0f / DOG_SCALE);
     const float edge_threshold = 12.1f;
+    const int border = BORDER;
+
+    // Pixels tested for extrema
+    int x0 = border;
+    int y0 = border;
+    int x1 = grey.cols - border;
+    int y1 = grey.rows - border;
+
+    if(use_search_region) {
+        x0 = max(x0, start.x);
+        y0 = max(y0, start.y);
+        x1 = min(x1, end.x + 1);
+        y1 = min(y1, end.y + 1);
+    }
+
+    if(x0 >= x1 || y0 >= y1) {
+        grey.copyTo(blur);
+        return;
+    }
 
-    cv::Mat grey2, blur1, blur2, dog, maxima;
+    // Filtered area, the extrema region plus the border read by the patch extraction
+    const int bx0 = max(0, x0 - border);
+    const int by0 = max(0, y0 - border);
+    const int bx1 = min(grey.cols, x1 + border);
+    const int by1 = min(grey.rows, y1 + border);
+    const int width = bx1 - bx0;
+    const int height = by1 - by0;
+    const int stride = (width + 15) & ~15; // whole SSE2/AVX2 registers, the extra columns are thrown away
+
+    if(bx0 == 0 && by0 == 0 && bx1 == grey.cols && by1 == grey.rows) {
+        blur.create(grey.size(), CV_8U);
+    }
+    else {
+        grey.copyTo(blur); // outside the filtered area
+    }
 
-    grey.convertTo(grey2, CV_32F);
+    // Horizontal pass, MAX_RADIUS extra rows above and below, edges are replicated
+    const int hrows = height + 2*MAX_RADIUS;
 
-    cv::GaussianBlur(grey2, blur1, cv::Size(), sigma1);
-    cv::GaussianBlur(grey2, blur2, cv::Size(), sigma2);
-    cv::subtract(blur1, blur2, dog);
+    vector <unsigned char> row(stride + 2*MAX_RADIUS + 8); // + 8, LoadPair reads one past the last tap
+    vector <short> h1(hrows*stride), h2(hrows*stride);
+    vector <short> dog(height*stride);
+    vector <unsigned char> blur_row(stride);
 
-    blur1.convertTo(blur, CV_8U);
+    for(int j=0; j < hrows; j++) {
+        int gy = min(max(by0 - MAX_RADIUS + j, 0), grey.rows - 1);
+        const unsigned char *src = grey.ptr<unsigned char>(gy);
 
-    int stride = (int)grey.step1();
-    const int border = BORDER;
+        for(int k=0; k < (int)row.size(); k++) {
+            int gx = min(max(bx0 - MAX_RADIUS + k, 0), grey.cols - 1);
+            row[k] = src[gx];
+        }
 
-    for(int y=border; y < grey.rows - border; y++) {
-        for(int x=border; x < grey.cols - border; x++) {
-            if(use_search_region) {
-                if(x < start.x) continue;
-                if(y < start.y) continue;
-                if(x > end.x) continue;
-                if(y > end.y) continue;
-            }
+        BlurRowsH(&row[0], stride, &h1[j*stride], &h2[j*stride]);
+    }
 
-            float *dog_ptr = (float*)(dog.data) + y*stride + x;
+    // Vertical pass, gives the blurred image and the DoG
+    for(int y=0; y < height; y++) {
+        int hy = (y + MAX_RADIUS)*stride;
 
-            float cur = *dog_ptr;
+        BlurRowsV(&h1[hy], &h2[hy], stride, stride, &dog[y*stride], &blur_row[0]);
+        memcpy(blur.ptr<unsigned char>(by0 + y) + bx0, &blur_row[0], width);
+    }
+
+    cv::Mat dog_mat(height, width, CV_16S, &dog[0], stride*sizeof(short));
+
+    const int step = g_use_avx2 ? 16 : 8;
+
+    for(int y=y0; y < y1; y++) {
+        const short *dog_row = &dog[(y - by0)*stride];
 
-            if(fabs(cur) < low_contrast) {
-                continue;
+        for(int x=x0; x < x1; x += step) {
+            const short *dog_ptr = dog_row + (x - bx0);
+            int mask;
+
+#ifdef NAR_HAVE_AVX2
+            if(g_use_avx2) {
+                mask = ExtremaMask16(dog_ptr, stride, low_contrast);
+            }
+            else
+#endif
+            {
+                mask = ExtremaMask8(dog_ptr, stride, low_contrast);
             }
 
-            bool extrema = false;
-
-            // determine whether to search for minima or maxima
-            if(cur < *(dog_ptr - stride - 1)) {
-                if(cur < *(dog_ptr - stride)) {
-                    if(cur < *(dog_ptr - stride + 1)) {
-                        if(cur < *(dog_ptr - 1)) {
-                            if(cur < *(dog_ptr + 1)) {
-                                if(cur < *(dog_ptr + stride - 1)) {
-                                    if(cur < *(dog_ptr + stride)) {
-                                        if(cur < *(dog_ptr + stride + 1)) {
-                                            extrema = true;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+            if(x + step > x1) {
+                mask &= (1 << (x1 - x)) - 1;
             }
-            else {
-                if(cur > *(dog_ptr - stride)) {
-                    if(cur > *(dog_ptr - stride + 1)) {
-                        if(cur > *(dog_ptr - 1)) {
-                            if(cur > *(dog_ptr + 1)) {
-                                if(cur > *(dog_ptr + stride - 1)) {
-                                    if(cur > *(dog_ptr + stride)) {
-                                        if(cur > *(dog_ptr + stride + 1)) {
-                                            extrema = true;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
+
+            for(int i=0; mask; i++, mask >>= 1) {
+                if(!(mask & 1)) {
+                    continue;
                 }
-            }
 
-            if(extrema) {
+                const short *p = dog_ptr + i;
+
                 // eliminate edges
-                float aa = *(dog_ptr) + *(dog_ptr);
-                float Dxx = *(dog_ptr - 1) - aa + *(dog_ptr + 1);
-                float Dyy = *(dog_ptr - stride) - aa + *(dog_ptr + stride);
+                float aa = (float)(p[0] + p[0]);
+                float Dxx = p[-1] - aa + p[1];
+                float Dyy = p[-stride] - aa + p[stride];
 
-                float Dx1 = *(dog_ptr - stride + 1) - *(dog_ptr - stride - 1);
-                float Dx2 = *(dog_ptr + stride + 1) - *(dog_ptr + stride - 1);
+                float Dx1 = (float)(p[-stride + 1] - p[-stride - 1]);
+                float Dx2 = (float)(p[stride + 1] - p[stride - 1]);
                 float Dxy = (Dx2 - Dx1)*0.25f;//*0.5f;
 
                 float tr = Dxx + Dyy;
@@ -109,12 +362,12 @@ void DoGKeyPointExtraction(const cv::Mat &grey, bool sub_pixel, std::vector <cv:
 
                 if(sub_pixel) {
                     float ret_x, ret_y;
-                    if(KeyPointLocalisation(dog, x, y, ret_x, ret_y)) {
-                        keypoints.push_back(cv::Point2f(ret_x, ret_y));
+                    if(KeyPointLocalisation(dog_mat, x + i - bx0, y - by0, ret_x, ret_y)) {
+                        keypoints.push_back(cv::Point2f(ret_x + bx0, ret_y + by0));
                     }
                 }
                 else {
-                    keypoints.push_back(cv::Point2f((float)x, (float)y));
+                    keypoints.push_back(cv::Point2f((float)(x + i), (float)y));
                 }
             }
         }
@@ -181,6 +434,7 @@ static bool KeyPointLocalisation(const cv::Mat &grey, int x, int y, float &ret_x
 
 static float SubPixel(const cv::Mat &grey, float x, float y)
 {
+    // grey is the fixed point DoG
     int x1 = (int)x;
     int x2 = x1 + 1;
 
@@ -198,9 +452,9 @@ static float SubPixel(const cv::Mat &grey, float x, float y)
     float wy2 = y - y1;
     float wy1 = 1.0f - wy2;
 
-    float a = wx1*grey.at<float>(y1,x1) + wx2*grey.at<float>(y1,x2);
-    float b = wx1*grey.at<float>(y2,x1) + wx2*grey.at<float>(y2,x2);
+    float a = wx1*grey.at<short>(y1,x1) + wx2*grey.at<short>(y1,x2);
+    float b = wx1*grey.at<short>(y2,x1) + wx2*grey.at<short>(y2,x2);
     float ret = wy1*a + wy2*b;
 
-    return ret;
+    return ret*DOG_SCALE;
 }
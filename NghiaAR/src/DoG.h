@@ -4,6 +4,8 @@
 #include <vector>
 #include <opencv2/core/core.hpp>
 
+// With use_search_region only the region, plus a BORDER margin for the patches, is filtered.
+// blur is the full image, unfiltered outside that area.
 void DoGKeyPointExtraction(const cv::Mat &grey, bool sub_pixel, std::vector <cv::Point2f> &keypoints, cv::Mat &blur,
                            bool use_search_region, const cv::Point2i &start, const cv::Point2i &end);
 
@@ -4,33 +4,107 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 #include <smmintrin.h>
 
+#ifdef NAR_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
 #include "KeyPointThread.h"
 #include "DoG.h"
+#include "CpuID.h"
 
 using namespace std;
 
-ExtractFeatureThread::ExtractFeatureThread()
+static const int ORIENTATION_BINS = 360; // 1 degree
+static const int PATCH_RADIUS = NAR_PATCH_SIZE/2;
+
+/*
+Everything about the patch geometry that doesn't depend on the image, worked out once.
+For each orientation bin and patch sample: integer offset of the top left pixel from the keypoint
+and Q7 bilinear weights, so GetRotatedPatch is just loads and integer multiplies.
+For CalcOrientation: the x range of each row of the circular window.
+*/
+struct PatchTables
+{
+    PatchTables();
+
+    short dx[ORIENTATION_BINS][NAR_PATCH_SQ];
+    short dy[ORIENTATION_BINS][NAR_PATCH_SQ];
+    unsigned char wx[ORIENTATION_BINS][NAR_PATCH_SQ]; // weight of the right pixel, 0-128
+    unsigned char wy[ORIENTATION_BINS][NAR_PATCH_SQ]; // weight of the bottom pixel, 0-128
+
+    int disc_start[NAR_PATCH_SIZE]; // per row of the window, y = -PATCH_RADIUS first
+    int disc_end[NAR_PATCH_SIZE];
+    int disc_count;
+};
+
+PatchTables::PatchTables()
 {
-    for(int i=0; i < 360; i++) {
-        m_sin[i] = (float)sin(TO_RAD(i));
-        m_cos[i] = (float)cos(TO_RAD(i));
+    for(int bin=0; bin < ORIENTATION_BINS; bin++) {
+        double orientation = bin*2.0*CV_PI/ORIENTATION_BINS;
+        int k = 0;
+
+        for(int y=-PATCH_RADIUS; y < PATCH_RADIUS; y+=NAR_PATCH_SAMPLING) {
+            for(int x=-PATCH_RADIUS; x < PATCH_RADIUS; x+=NAR_PATCH_SAMPLING) {
+                double a = atan2((double)y, (double)x) + orientation;
+                double r = sqrt((double)(x*x + y*y));
+
+                double xf = r*cos(a);
+                double yf = r*sin(a);
+                double ix = floor(xf);
+                double iy = floor(yf);
+
+                dx[bin][k] = (short)ix;
+                dy[bin][k] = (short)iy;
+                wx[bin][k] = (unsigned char)((xf - ix)*128.0 + 0.5);
+                wy[bin][k] = (unsigned char)((yf - iy)*128.0 + 0.5);
+
+                k++;
+            }
+        }
     }
 
-    int k = 0;
-    for(int dy=-NAR_PATCH_SIZE/2; dy < NAR_PATCH_SIZE/2; dy+=NAR_PATCH_SAMPLING) {
-        for(int dx=-NAR_PATCH_SIZE/2; dx < NAR_PATCH_SIZE/2; dx+=NAR_PATCH_SAMPLING) {
-            float a = atan2((float)dy,(float)dx);
-            float r = sqrt((float)(dx*dx + dy*dy));
+    const int radius_sq = PATCH_RADIUS*PATCH_RADIUS;
 
-            m_angle_cache[k] = a;
-            m_radius_cache[k] = r;
+    disc_count = 0;
 
-            k++;
+    for(int y=-PATCH_RADIUS; y < PATCH_RADIUS; y++) {
+        int start = PATCH_RADIUS;
+        int end = -PATCH_RADIUS;
+
+        for(int x=-PATCH_RADIUS; x < PATCH_RADIUS; x++) {
+            if(x*x + y*y < radius_sq) {
+                start = min(start, x);
+                end = max(end, x + 1);
+            }
         }
+
+        disc_start[y + PATCH_RADIUS] = start;
+        disc_end[y + PATCH_RADIUS] = end;
+        disc_count += max(0, end - start);
     }
+}
+
+// Built before any thread starts
+static const PatchTables g_patch;
+
+#if defined(USE_SSE4) && defined(NAR_HAVE_AVX2)
+static const bool g_use_avx2 = GetCpuSupportsAVX2();
+#endif
 
+static inline int HorizontalSum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
+    v = _mm_add_epi32(v, _mm_srli_si128(v, 4));
+
+    return _mm_cvtsi128_si32(v);
+}
+
+ExtractFeatureThread::ExtractFeatureThread()
+{
     m_next_thread = NULL;
 }
 
@@ -39,108 +113,107 @@ ExtractFeatureThread::~ExtractFeatureThread()
     Done();
 }
 
-void ExtractFeatureThread::DoWork()
+void ExtractFeatureThread::DoWork(const ThreadJobPtr &job)
 {
     boost::posix_time::ptime t1, t2;
 
     assert(m_next_thread);
 
-    unsigned int total_time = 0;
-    unsigned int frame_count = 0;
-
-    m_done = false;
-
-    while(!m_done) {
-		boost::mutex::scoped_lock lock(m_base_mutex);
+    t1 = boost::posix_time::microsec_clock::local_time();
 
-        if(!m_jobs.empty()) {
-            ThreadJob job = m_jobs.front();
-            m_jobs.pop_front();
-			lock.unlock();
+    vector <cv::Point2f> &kp = job->keypoints;
 
-            t1 = boost::posix_time::microsec_clock::local_time();
+    for(size_t i=0; i < kp.size(); i++) {
+        NAR_Sig new_feature;
 
-            vector <cv::Point2f> &kp = job.keypoints;
+        // t1 = boost::posix_time::microsec_clock::local_time();
+        float orientation = CalcOrientation(job->blurred, (int)(kp[i].x+0.5f), (int)(kp[i].y+0.5)); // orientation of the FAST corner
+        // t2 = boost::posix_time::microsec_clock::local_time();
+        // cout << "CalcOrientation " << (t2-t1).total_microseconds() << endl;
 
-            for(size_t i=0; i < kp.size(); i++) {
-                NAR_Sig new_feature;
+        unsigned char patch[NAR_PATCH_SQ];
 
-                // t1 = boost::posix_time::microsec_clock::local_time();
-                float orientation = CalcOrientation(job.blurred, (int)(kp[i].x+0.5f), (int)(kp[i].y+0.5)); // orientation of the FAST corner
-                // t2 = boost::posix_time::microsec_clock::local_time();
-                // cout << "CalcOrientation " << (t2-t1).total_microseconds() << endl;
+        if(GetRotatedPatch(job->blurred, (int)(kp[i].x+0.5), (int)(kp[i].y+0.5), orientation, patch)) {
+            GetPatchFeatureDescriptor(patch, new_feature.feature);
 
-                unsigned char patch[NAR_PATCH_SQ];
+            new_feature.x = kp[i].x;
+            new_feature.y = kp[i].y;
+            new_feature.orientation = orientation;
+            new_feature.scale = job->scale;
 
-                if(GetRotatedPatch(job.blurred, (int)(kp[i].x+0.5), (int)(kp[i].y+0.5), orientation, patch)) {
-                    GetPatchFeatureDescriptor(patch, new_feature.feature);
-
-                    new_feature.x = kp[i].x;
-                    new_feature.y = kp[i].y;
-                    new_feature.orientation = orientation;
-                    new_feature.scale = job.scale;
+            job->sigs.push_back(new_feature);
+        }
+    }
 
-                    job.sigs.push_back(new_feature);
-                }
-            }
+    if(job->scale != 1.0f) {
+        float unscale = 1.0f/job->scale;
 
-            if(job.scale != 1.0f) {
-                float unscale = 1.0f/job.scale;
+        for(size_t i=0; i < job->sigs.size(); i++) {
+            job->sigs[i].x *= unscale;
+            job->sigs[i].y *= unscale;
+        }
+    }
 
-                for(size_t i=0; i < job.sigs.size(); i++) {
-                    job.sigs[i].x *= unscale;
-                    job.sigs[i].y *= unscale;
-                }
-            }
+    t2 = boost::posix_time::microsec_clock::local_time();
 
-            m_next_thread->AddJob(job);
+    job->timing[ThreadJob::EXTRACT_TIME] = (t2-t1).total_microseconds()*0.001f;
 
-            t2 = boost::posix_time::microsec_clock::local_time();
-            //cout << m_name << ": " << job.sigs.size() << " keypoints in " << (t2-t1).total_milliseconds() << " ms" << " " << endl;
+    m_next_thread->AddJob(job);
 
-            total_time += (unsigned int)(t2-t1).total_milliseconds();
-            frame_count++;
+    //cout << m_name << ": " << job->sigs.size() << " keypoints in " << (t2-t1).total_milliseconds() << " ms" << " " << endl;
 
-            if(frame_count >= 8) {
-                boost::mutex::scoped_lock lock2(m_fps_mutex);
-                m_fps = frame_count*1000.0f / total_time;
-                frame_count = 0;
-                total_time = 0;
-            }
-        }
-        else {
-            boost::thread::yield();
-        }
-    }
+    UpdateFPS((unsigned int)(t2-t1).total_milliseconds());
 }
 
 float ExtractFeatureThread::CalcOrientation(const cv::Mat &grey, int cx, int cy)
 {
     // assume a blurrd image
-    const int patch_radius = NAR_PATCH_SIZE/2;
-    const int radius_sq = patch_radius*patch_radius;
+    const int step = (int)grey.step;
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sxx = _mm_setzero_si128();
+    __m128i syy = _mm_setzero_si128();
+    __m128i sxy = _mm_setzero_si128();
 
     int ix = 0;
     int iy = 0;
     int ixy = 0;
-    int count = 0;
-
-    for(int y=-patch_radius; y < patch_radius; y++) {
-        for(int x=-patch_radius; x < patch_radius; x++) {
-            int r2 = x*x + y*y;
+    int count = g_patch.disc_count;
+
+    // Central differences over the circular window, 8 pixels at a time
+    for(int y=-PATCH_RADIUS; y < PATCH_RADIUS; y++) {
+        const unsigned char *row = grey.data + (cy+y)*step + cx;
+        int x = g_patch.disc_start[y + PATCH_RADIUS];
+        int end = g_patch.disc_end[y + PATCH_RADIUS];
+
+        for(; x + 8 <= end; x += 8) {
+            __m128i left = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x - 1)), zero);
+            __m128i right = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x + 1)), zero);
+            __m128i up = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x - step)), zero);
+            __m128i down = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x + step)), zero);
+
+            __m128i dx = _mm_sub_epi16(right, left);
+            __m128i dy = _mm_sub_epi16(down, up);
+
+            sxx = _mm_add_epi32(sxx, _mm_madd_epi16(dx, dx));
+            syy = _mm_add_epi32(syy, _mm_madd_epi16(dy, dy));
+            sxy = _mm_add_epi32(sxy, _mm_madd_epi16(dx, dy));
+        }
 
-            if(r2 < radius_sq) {
-                int dx = grey.at<uchar>(cy+y, cx+x+1) - grey.at<uchar>(cy+y, cx+x-1);
-                int dy = grey.at<uchar>(cy+y+1, cx+x) - grey.at<uchar>(cy+y-1, cx+x);
+        for(; x < end; x++) {
+            int dx = row[x+1] - row[x-1];
+            int dy = row[x+step] - row[x-step];
 
-                ix += dx*dx;
-                iy += dy*dy;
-                ixy += dx*dy;
-                count++;
-            }
+            ix += dx*dx;
+            iy += dy*dy;
+            ixy += dx*dy;
         }
     }
 
+    ix += HorizontalSum(sxx);
+    iy += HorizontalSum(syy);
+    ixy += HorizontalSum(sxy);
+
     // Prevents overflow
     ix /= (count<<2); // extra multiply by 4
     iy /= (count<<2);
@@ -177,33 +250,102 @@ bool ExtractFeatureThread::GetRotatedPatch(const cv::Mat &grey, int x, int y, fl
         return false;
     }
 
-    for(int i=0; i < NAR_PATCH_SQ; i++) {
-        float a = m_angle_cache[i] + orientation;
-        float r = m_radius_cache[i];
+    int bin = (int)floor(TO_DEG(orientation)*ORIENTATION_BINS/360.0 + 0.5) % ORIENTATION_BINS;
 
-        // This uses a lookup table
-        int aidx = (int)TO_DEG(a);
+    if(bin < 0) {
+        bin += ORIENTATION_BINS;
+    }
 
-        if(aidx < 0) aidx += 360;
-        if(aidx >= 360) aidx = aidx - 360;
+    const short *dx = g_patch.dx[bin];
+    const short *dy = g_patch.dy[bin];
+    const unsigned char *wx = g_patch.wx[bin];
+    const unsigned char *wy = g_patch.wy[bin];
 
-        float xf = x + r*m_cos[aidx];
-        float yf = y + r*m_sin[aidx];
+    const int step = (int)grey.step;
+    const unsigned char *centre = grey.data + y*step + x;
 
-/*
-        float xf = x + r*cos(a);
-        float yf = y + r*sin(a);
-*/
-        float v = Bilinear(grey, xf, yf);
+    for(int i=0; i < NAR_PATCH_SQ; i++) {
+        const unsigned char *p = centre + dy[i]*step + dx[i];
 
-        ret[i] = (unsigned char)v;
+        int wx1 = wx[i];
+        int wx0 = 128 - wx1;
+        int wy1 = wy[i];
+        int wy0 = 128 - wy1;
+
+        int top = p[0]*wx0 + p[1]*wx1;
+        int bottom = p[step]*wx0 + p[step+1]*wx1;
+
+        ret[i] = (unsigned char)((top*wy0 + bottom*wy1 + 8192) >> 14);
     }
 
     return true;
 }
 
+#ifdef USE_SSE4
+// Needs NAR_PATCH_SQ to be a multiple of 16. Bit j of each output byte is patch[k] > mean,
+// which is the byte order _mm_movemask_epi8 gives.
+static void PatchFeatureDescriptorSSE4(const unsigned char patch[NAR_PATCH_SQ], unsigned char ret[FEATURE_BYTES])
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+
+    for(int i=0; i < NAR_PATCH_SQ; i += 16) {
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(patch + i)), zero));
+    }
+
+    int mean = (_mm_extract_epi32(sum, 0) + _mm_extract_epi32(sum, 2)) / NAR_PATCH_SQ;
+    const __m128i m = _mm_set1_epi8((char)mean);
+
+    for(int i=0; i < NAR_PATCH_SQ; i += 16) {
+        __m128i above = _mm_subs_epu8(_mm_loadu_si128((const __m128i*)(patch + i)), m); // 0 unless > mean
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(above, zero)) ^ 0xffff;
+
+        ret[i/8] = (unsigned char)bits;
+        ret[i/8 + 1] = (unsigned char)(bits >> 8);
+    }
+}
+
+#ifdef NAR_HAVE_AVX2
+// Same as above, NAR_PATCH_SQ has to be a multiple of 32
+NAR_TARGET("avx2")
+static void PatchFeatureDescriptorAVX2(const unsigned char patch[NAR_PATCH_SQ], unsigned char ret[FEATURE_BYTES])
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero;
+
+    for(int i=0; i < NAR_PATCH_SQ; i += 32) {
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(patch + i)), zero));
+    }
+
+    __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    int mean = (_mm_extract_epi32(sum128, 0) + _mm_extract_epi32(sum128, 2)) / NAR_PATCH_SQ;
+    const __m256i m = _mm256_set1_epi8((char)mean);
+
+    for(int i=0; i < NAR_PATCH_SQ; i += 32) {
+        __m256i above = _mm256_subs_epu8(_mm256_loadu_si256((const __m256i*)(patch + i)), m);
+        unsigned int bits = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(above, zero));
+
+        memcpy(ret + i/8, &bits, 4); // little endian, same as the scalar version
+    }
+}
+#endif
+#endif
+
 void ExtractFeatureThread::GetPatchFeatureDescriptor(const unsigned char patch[NAR_PATCH_SQ], unsigned char ret[FEATURE_BYTES])
 {
+#ifdef USE_SSE4
+#ifdef NAR_HAVE_AVX2
+    if(g_use_avx2 && NAR_PATCH_SQ % 32 == 0) {
+        PatchFeatureDescriptorAVX2(patch, ret);
+        return;
+    }
+#endif
+    if(NAR_PATCH_SQ % 16 == 0) {
+        PatchFeatureDescriptorSSE4(patch, ret);
+        return;
+    }
+#endif
+
     int mean = 0;
     for(int i=0; i < NAR_PATCH_SQ; i++) {
         mean += patch[i];
@@ -0,0 +1,298 @@
+#include "HammingMatcher.h"
+#include "CpuID.h"
+
+#include <cstring>
+#include <nmmintrin.h>
+
+#ifdef NAR_HAVE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#ifdef NAR_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+typedef unsigned long long uint64;
+
+static const int WORDS = FEATURE_BYTES / 8; // 64 bit words per descriptor
+static const int CHUNK = 256; // descriptors scored per Distances call in Match()
+
+static inline uint64 LoadWord(const unsigned char *p)
+{
+    uint64 w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline int BitCount64(uint64 x)
+{
+    // http://en.wikipedia.org/wiki/Hamming_weight
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static void DistancesScalar(const unsigned char *query, const unsigned char *desc, int n, int *dists)
+{
+    uint64 q[WORDS];
+
+    for(int w=0; w < WORDS; w++) {
+        q[w] = LoadWord(query + w*8);
+    }
+
+    for(int i=0; i < n; i++) {
+        int d = 0;
+
+        for(int w=0; w < WORDS; w++) {
+            d += BitCount64(LoadWord(desc + w*8) ^ q[w]);
+        }
+
+        dists[i] = d;
+        desc += FEATURE_BYTES;
+    }
+}
+
+NAR_TARGET("popcnt")
+static void DistancesPopcnt(const unsigned char *query, const unsigned char *desc, int n, int *dists)
+{
+    uint64 q[WORDS];
+
+    for(int w=0; w < WORDS; w++) {
+        q[w] = LoadWord(query + w*8);
+    }
+
+    for(int i=0; i < n; i++) {
+        int d = 0;
+
+        for(int w=0; w < WORDS; w++) {
+            uint64 x = LoadWord(desc + w*8) ^ q[w];
+#if defined(_M_X64) || defined(__x86_64__)
+            d += (int)_mm_popcnt_u64(x);
+#else
+            d += _mm_popcnt_u32((unsigned int)x) + _mm_popcnt_u32((unsigned int)(x >> 32));
+#endif
+        }
+
+        dists[i] = d;
+        desc += FEATURE_BYTES;
+    }
+}
+
+#ifdef NAR_HAVE_SSSE3
+// Nibble lookup popcount, _mm_sad_epu8 sums the bytes of each 64 bit word.
+// The query is tiled across the register, so this needs WORDS to divide 2.
+NAR_TARGET("ssse3")
+static void DistancesSSSE3(const unsigned char *query, const unsigned char *desc, int n, int *dists)
+{
+    unsigned char tiled[16];
+
+    for(int i=0; i < 16; i++) {
+        tiled[i] = query[i % FEATURE_BYTES];
+    }
+
+    const __m128i q = _mm_loadu_si128((const __m128i*)tiled);
+    const __m128i lut = _mm_setr_epi8(0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4);
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    const int total_words = n*WORDS;
+    int w = 0;
+
+    memset(dists, 0, sizeof(int)*n);
+
+    for(; w + 2 <= total_words; w += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(desc + w*8)), q);
+        __m128i lo = _mm_and_si128(v, low_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_mask);
+        __m128i cnt = _mm_add_epi8(_mm_shuffle_epi8(lut, lo), _mm_shuffle_epi8(lut, hi));
+        __m128i sum = _mm_sad_epu8(cnt, zero);
+
+        dists[w / WORDS] += _mm_cvtsi128_si32(sum);
+        dists[(w+1) / WORDS] += _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+    }
+
+    for(; w < total_words; w++) {
+        dists[w / WORDS] += BitCount64(LoadWord(desc + w*8) ^ LoadWord(query + (w % WORDS)*8));
+    }
+}
+#endif
+
+#ifdef NAR_HAVE_AVX2
+// Same as the SSSE3 version, 4 words at a time. Needs WORDS to divide 4.
+NAR_TARGET("avx2")
+static void DistancesAVX2(const unsigned char *query, const unsigned char *desc, int n, int *dists)
+{
+    unsigned char tiled[32];
+
+    for(int i=0; i < 32; i++) {
+        tiled[i] = query[i % FEATURE_BYTES];
+    }
+
+    const __m256i q = _mm256_loadu_si256((const __m256i*)tiled);
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4,
+                                         0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    const int total_words = n*WORDS;
+    int w = 0;
+
+    memset(dists, 0, sizeof(int)*n);
+
+    for(; w + 4 <= total_words; w += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(desc + w*8)), q);
+        __m256i lo = _mm256_and_si256(v, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+        __m256i sum = _mm256_sad_epu8(cnt, zero);
+
+        long long s[4];
+        _mm256_storeu_si256((__m256i*)s, sum);
+
+        dists[w / WORDS] += (int)s[0];
+        dists[(w+1) / WORDS] += (int)s[1];
+        dists[(w+2) / WORDS] += (int)s[2];
+        dists[(w+3) / WORDS] += (int)s[3];
+    }
+
+    for(; w < total_words; w++) {
+        dists[w / WORDS] += BitCount64(LoadWord(desc + w*8) ^ LoadWord(query + (w % WORDS)*8));
+    }
+}
+#endif
+
+static bool Supported(HammingMatcher::Impl impl)
+{
+    CpuidFeatures features;
+    GetCpuidFeatures(&features);
+
+    switch(impl) {
+        case HammingMatcher::SCALAR:
+            return true;
+
+        case HammingMatcher::POPCNT:
+            return features.POPCNT != 0;
+
+        case HammingMatcher::SSSE3:
+#ifdef NAR_HAVE_SSSE3
+            return features.SupplSSE3 && (2 % WORDS == 0);
+#else
+            return false;
+#endif
+
+        case HammingMatcher::AVX2:
+#ifdef NAR_HAVE_AVX2
+        {
+            CpuidExtendedFeatures ext;
+            GetCpuidExtendedFeatures(&ext);
+            return ext.AVX2 && GetOSSupportsAVX() && (4 % WORDS == 0);
+        }
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+HammingMatcher::HammingMatcher()
+{
+    m_impl = DetectImpl();
+}
+
+HammingMatcher::Impl HammingMatcher::DetectImpl()
+{
+    // Sorted fastest first
+    const Impl order[] = {AVX2, SSSE3, POPCNT, SCALAR};
+
+    for(int i=0; i < 4; i++) {
+        if(Supported(order[i])) {
+            return order[i];
+        }
+    }
+
+    return SCALAR;
+}
+
+const char* HammingMatcher::GetImplName(Impl impl)
+{
+    switch(impl) {
+        case SCALAR: return "scalar";
+        case POPCNT: return "popcnt";
+        case SSSE3: return "SSSE3";
+        case AVX2: return "AVX2";
+    }
+
+    return "unknown";
+}
+
+void HammingMatcher::SetImpl(Impl impl)
+{
+    // Step down until we find something the CPU can do
+    while(impl != SCALAR && !Supported(impl)) {
+        impl = (Impl)(impl - 1);
+    }
+
+    m_impl = impl;
+}
+
+void HammingMatcher::Distances(const unsigned char *query, const unsigned char *descriptors, int n, int *dists) const
+{
+    switch(m_impl) {
+#ifdef NAR_HAVE_AVX2
+        case AVX2: DistancesAVX2(query, descriptors, n, dists); break;
+#endif
+#ifdef NAR_HAVE_SSSE3
+        case SSSE3: DistancesSSSE3(query, descriptors, n, dists); break;
+#endif
+        case POPCNT: DistancesPopcnt(query, descriptors, n, dists); break;
+        default: DistancesScalar(query, descriptors, n, dists); break;
+    }
+}
+
+int HammingMatcher::Match(const unsigned char *query, const unsigned char *descriptors, int n, int k, float ratio, HammingMatch *ret) const
+{
+    int dists[CHUNK];
+    int found = 0;
+
+    if(k <= 0) {
+        return 0;
+    }
+
+    for(int start=0; start < n; start += CHUNK) {
+        int count = n - start;
+
+        if(count > CHUNK) {
+            count = CHUNK;
+        }
+
+        Distances(query, descriptors + start*FEATURE_BYTES, count, dists);
+
+        for(int i=0; i < count; i++) {
+            int d = dists[i];
+
+            if(found == k && d >= ret[k-1].dist) {
+                continue;
+            }
+
+            // Insertion sort into the top k
+            int j = (found < k) ? found++ : k-1;
+
+            while(j > 0 && ret[j-1].dist > d) {
+                ret[j] = ret[j-1];
+                j--;
+            }
+
+            ret[j].index = start + i;
+            ret[j].dist = d;
+        }
+    }
+
+    if(ratio < 1.0f && found >= 2 && ret[0].dist >= ratio*ret[1].dist) {
+        return 0;
+    }
+
+    return found;
+}
@@ -0,0 +1,42 @@
+#ifndef __HAMMING_MATCHER_H__
+#define __HAMMING_MATCHER_H__
+
+/*
+Scores one query descriptor against a contiguous block of FEATURE_BYTES descriptors.
+The fastest implementation the CPU supports is picked at runtime (see CpuID.h),
+from plain C up to AVX2, which scores 4 descriptors per instruction.
+*/
+
+#include "NAR_Config.h"
+
+struct HammingMatch
+{
+    int index; // into the descriptor block
+    int dist;
+};
+
+class HammingMatcher
+{
+public:
+    enum Impl {SCALAR=0, POPCNT, SSSE3, AVX2};
+
+    HammingMatcher(); // uses DetectImpl()
+
+    static Impl DetectImpl(); // best implementation for this CPU
+    static const char* GetImplName(Impl impl);
+
+    void SetImpl(Impl impl); // falls back to a supported implementation if the CPU can't do it
+    Impl GetImpl() const { return m_impl; }
+
+    // dists[i] = Hamming distance between query and descriptors[i*FEATURE_BYTES]
+    void Distances(const unsigned char *query, const unsigned char *descriptors, int n, int *dists) const;
+
+    // Up to k best matches sorted by distance, returns how many were found.
+    // ratio < 1 applies the ratio test, nothing is returned unless best < ratio*second best.
+    int Match(const unsigned char *query, const unsigned char *descriptors, int n, int k, float ratio, HammingMatch *ret) const;
+
+private:
+    Impl m_impl;
+};
+
+#endif
@@ -1,12 +1,27 @@
 #include "KTree.h"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
+static const int MAX_KMAJORITY_ITER = 10;
+static const int MAX_BRANCHING = 32;
+
+typedef pair <int, const KNode*> Branch; // Hamming distance to the branch centre, branch
+
+// Only compares distance, comparing the pointers would make the search order depend on where the nodes were allocated
+static bool FurtherBranch(const Branch &a, const Branch &b)
+{
+    return a.first > b.first;
+}
+
 KTree::KTree()
 {
     root = NULL;
     m_id = 0;
+    m_branching = 4;
+    m_max_checks = 256;
 }
 
 KTree::~KTree()
@@ -14,12 +29,25 @@ KTree::~KTree()
     Free();
 }
 
+void KTree::SetBranching(int branching)
+{
+    m_branching = max(2, min(branching, MAX_BRANCHING));
+}
+
+void KTree::SetMaxChecks(int max_checks)
+{
+    m_max_checks = max_checks;
+}
+
 void KTree::Create(const vector<NAR_Sig> &sigs, int levels, int min_pts_per_node)
 {
+    Free();
+
     root = new KNode();
     root->level = 0;
     root->indexes.resize(sigs.size());
-    root->id = m_id++;
+    memset(root->centre, 0, FEATURE_BYTES);
+    m_id++;
 
     for(unsigned int i=0; i < sigs.size(); i++) {
         root->indexes[i] = i;
@@ -31,185 +59,359 @@ void KTree::Create(const vector<NAR_Sig> &sigs, int levels, int min_pts_per_node
     toVisit.push_back(root);
 
     while(!toVisit.empty()) {
-        vector <KNode*> nextSearch;
+        KNode *node = toVisit.back();
+        toVisit.pop_back();
+
+        if(node->level < levels && (int)node->indexes.size() > min_pts_per_node) {
+            Split(sigs, node);
+        }
 
-        while(!toVisit.empty()) {
-            KNode *node = toVisit.back();
-            toVisit.pop_back();
+        if(!node->IsLeaf()) {
+            toVisit.insert(toVisit.end(), node->children.begin(), node->children.end());
+            continue;
+        }
+
+        // Pack the features of each leaf so they can be matched as one block
+        node->descriptors.resize(node->indexes.size()*FEATURE_BYTES);
 
-            node->left = NULL;
-            node->right = NULL;
+        for(size_t i=0; i < node->indexes.size(); i++) {
+            memcpy(&node->descriptors[i*FEATURE_BYTES], sigs[node->indexes[i]].feature, FEATURE_BYTES);
+        }
+    }
 
-            if(node->level < levels) {
-                if((int)node->indexes.size() > min_pts_per_node) {
-                    KNode *left = new KNode();
-                    KNode *right = new KNode();
+	cout << "Done, " << m_id << " nodes, " << GetSizeBytes() << " bytes" << endl;
+}
 
-                    left->level = node->level+1;
-                    right->level = node->level+1;
-                    left->id = m_id++;
-                    right->id = m_id++;
+void KTree::Split(const vector <NAR_Sig> &sigs, KNode *node)
+{
+    const vector <int> &indexes = node->indexes;
+    const int n = (int)indexes.size();
+    const int k = min(m_branching, n);
+
+    vector <unsigned char> centres(k*FEATURE_BYTES);
+    vector <int> labels(n, -1);
+    vector <int> bit_count(k*FEATURE_LENGTH);
+    vector <int> count(k);
+    int dists[MAX_BRANCHING];
+
+    // Seed with features spread evenly through the node, deterministic so the same object gives the same tree
+    for(int c=0; c < k; c++) {
+        memcpy(&centres[c*FEATURE_BYTES], sigs[indexes[(c*n)/k]].feature, FEATURE_BYTES);
+    }
 
-                    Split(sigs, node->indexes, left, right);
+    for(int iter=0; iter < MAX_KMAJORITY_ITER; iter++) {
+        bool changed = false;
 
-                    // Clear current indexes
-                    {
-                        vector <int> dummy;
-                        node->indexes.swap(dummy);
-                    }
+        // Assign to the closest centre
+        for(int i=0; i < n; i++) {
+            m_matcher.Distances(sigs[indexes[i]].feature, &centres[0], k, dists);
 
-                    node->left = left;
-                    node->right = right;
-                    node->_left = left->id;
-                    node->_right = right->id;
+            int best = (int)(min_element(dists, dists + k) - dists);
 
-                    nextSearch.push_back(left);
-                    nextSearch.push_back(right);
-                }
+            if(best != labels[i]) {
+                labels[i] = best;
+                changed = true;
             }
         }
 
-        toVisit = nextSearch;
-    }
+        if(!changed) {
+            break;
+        }
 
-	cout << "Done" << endl;
-}
+        // New centre is the majority vote of each bit
+        fill(bit_count.begin(), bit_count.end(), 0);
+        fill(count.begin(), count.end(), 0);
 
-void KTree::Split(const vector <NAR_Sig> &sigs, const vector <int> &indexes, KNode *left, KNode *right)
-{
-    if(indexes.size() == 0) {
-        left = NULL;
-        right = NULL;
-    }
+        for(int i=0; i < n; i++) {
+            const NAR_Sig &sig = sigs[indexes[i]];
+            int *bits = &bit_count[labels[i]*FEATURE_LENGTH];
+
+            for(int j=0; j < FEATURE_LENGTH; j++) {
+                bits[j] += sig.Get(j);
+            }
 
-    left->indexes.clear();
-    right->indexes.clear();
+            count[labels[i]]++;
+        }
 
-    CvMat *samples = cvCreateMat((int)indexes.size(), FEATURE_LENGTH, CV_32F);
-    CvMat *labels = cvCreateMat((int)indexes.size(), 1, CV_32S);
+        for(int c=0; c < k; c++) {
+            if(count[c] == 0) {
+                continue; // keep the old centre, it'll stay empty and be dropped
+            }
 
-    for(unsigned int i=0; i < indexes.size(); i++) {
-        int idx = indexes[i];
+            unsigned char *centre = &centres[c*FEATURE_BYTES];
+            const int *bits = &bit_count[c*FEATURE_LENGTH];
 
-        const NAR_Sig &sig = sigs[idx];
+            memset(centre, 0, FEATURE_BYTES);
 
-        for(int j=0; j < FEATURE_LENGTH; j++) {
-            samples->data.fl[i*FEATURE_LENGTH + j] = (float)sig.Get(j);
+            for(int j=0; j < FEATURE_LENGTH; j++) {
+                if(bits[j]*2 > count[c]) {
+                    centre[j >> 3] |= (1 << (j % 8));
+                }
+            }
         }
     }
 
-    cvKMeans2(samples, 2, labels, cvTermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 100, 0.1));
+    vector <KNode*> children(k, (KNode*)NULL);
+    int non_empty = 0;
 
-    // Calc the centres
-    float centres[2][FEATURE_LENGTH];
-    int count[2];
+    for(int i=0; i < n; i++) {
+        int c = labels[i];
 
-    memset(centres[0], 0, sizeof(float)*FEATURE_LENGTH);
-    memset(centres[1], 0, sizeof(float)*FEATURE_LENGTH);
+        if(children[c] == NULL) {
+            children[c] = new KNode();
+            children[c]->level = node->level + 1;
+            memcpy(children[c]->centre, &centres[c*FEATURE_BYTES], FEATURE_BYTES);
+            non_empty++;
+        }
 
-    count[0] = 0;
-    count[1] = 0;
+        children[c]->indexes.push_back(indexes[i]);
+    }
 
-    KNode *nodes[2];
-    nodes[0] = left;
-    nodes[1] = right;
+    // All features identical, can't split
+    if(non_empty < 2) {
+        for(int c=0; c < k; c++) {
+            delete children[c];
+        }
 
-    for(unsigned int i=0; i < indexes.size(); i++) {
-        int idx = labels->data.i[i];
+        return;
+    }
 
-        for(int j=0; j < FEATURE_LENGTH; j++) {
-           centres[idx][j] += samples->data.fl[i*FEATURE_LENGTH + j];
+    for(int c=0; c < k; c++) {
+        if(children[c] == NULL) {
+            continue;
         }
 
-        nodes[idx]->indexes.push_back(indexes[i]);
-        count[idx]++;
+        node->children.push_back(children[c]);
+        node->child_centres.insert(node->child_centres.end(), children[c]->centre, children[c]->centre + FEATURE_BYTES);
+        m_id++;
     }
 
-    for(int j=0; j < FEATURE_LENGTH; j++) {
-        centres[0][j] /= count[0];
-        centres[1][j] /= count[1];
+    // Clear current indexes
+    {
+        vector <int> dummy;
+        node->indexes.swap(dummy);
     }
+}
 
-    memcpy(left->centre, centres[0], sizeof(float)*FEATURE_LENGTH);
-    memcpy(right->centre, centres[1], sizeof(float)*FEATURE_LENGTH);
+void KTree::Search(const NAR_Sig &sig, vector <int> &indexes) const
+{
+    vector <const KNode*> leaves;
+
+    SearchLeaves(sig, leaves);
+
+    indexes.clear();
 
-    cvReleaseMat(&samples);
-    cvReleaseMat(&labels);
+    for(size_t i=0; i < leaves.size(); i++) {
+        indexes.insert(indexes.end(), leaves[i]->indexes.begin(), leaves[i]->indexes.end());
+    }
 }
 
-void KTree::Search(const NAR_Sig &sig, vector <int> &indexes) const
+void KTree::SearchLeaves(const NAR_Sig &sig, vector <const KNode*> &leaves) const
 {
-    float sigF[FEATURE_LENGTH];
+    vector <Branch> branches; // min heap of unexplored branches
+    int dists[MAX_BRANCHING];
+    int checks = 0;
 
-    for(int i=0; i < FEATURE_LENGTH; i++) {
-        sigF[i] = (float)sig.Get(i);
+    leaves.clear();
+
+    if(!root) {
+        return;
     }
 
-    indexes.clear();
+    branches.push_back(Branch(0, root));
 
-    vector <KNode*> toVisit;
-    toVisit.push_back(root);
+    while(!branches.empty() && (checks < m_max_checks || leaves.empty())) {
+        pop_heap(branches.begin(), branches.end(), FurtherBranch);
+        const KNode *node = branches.back().second;
+        branches.pop_back();
 
-    while(!toVisit.empty()) {
-        vector <KNode*> nextSearch;
+        // Go down the closest child, remember the others for backtracking
+        while(!node->IsLeaf()) {
+            int k = (int)node->children.size();
 
-        while(!toVisit.empty()) {
-            KNode *node = toVisit.back();
-            toVisit.pop_back();
+            m_matcher.Distances(sig.feature, &node->child_centres[0], k, dists);
 
-            // Check if this is the end node
-            if(node->left != NULL) {
-                float right_dist = DistanceSq(sigF, node->right->centre);
-                float left_dist = DistanceSq(sigF, node->left->centre);
+            int best = (int)(min_element(dists, dists + k) - dists);
 
-                if(left_dist < right_dist)
-                    nextSearch.push_back(node->left);
-                else
-                    nextSearch.push_back(node->right);
-            }
-            else {
-                // Must have reached the end, append indexes to output
-                indexes.insert(indexes.end(), node->indexes.begin(), node->indexes.end());
+            for(int c=0; c < k; c++) {
+                if(c != best) {
+                    branches.push_back(Branch(dists[c], node->children[c]));
+                    push_heap(branches.begin(), branches.end(), FurtherBranch);
+                }
             }
+
+            node = node->children[best];
         }
 
-        toVisit = nextSearch;
+        leaves.push_back(node);
+        checks += (int)node->indexes.size();
     }
 }
 
+size_t KTree::GetSizeBytes() const
+{
+    if(!root) {
+        return 0;
+    }
+
+    size_t bytes = 0;
+    vector <const KNode*> toVisit;
+
+    toVisit.push_back(root);
+
+    while(!toVisit.empty()) {
+        const KNode *node = toVisit.back();
+        toVisit.pop_back();
+
+        bytes += sizeof(KNode);
+        bytes += node->children.capacity()*sizeof(KNode*);
+        bytes += node->child_centres.capacity();
+        bytes += node->indexes.capacity()*sizeof(int);
+        bytes += node->descriptors.capacity();
+
+        toVisit.insert(toVisit.end(), node->children.begin(), node->children.end());
+    }
+
+    return bytes;
+}
+
 void KTree::Free()
 {
-    if(!root)
+    // Children are deleted by their parents
+    delete root;
+    root = NULL;
+    m_id = 0;
+}
+
+// Node record: level, number of children, centre, number of indexes, indexes
+static void Write(vector <unsigned char> &buf, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    buf.insert(buf.end(), p, p + size);
+}
+
+static bool Read(const unsigned char *&p, const unsigned char *end, void *data, size_t size)
+{
+    if((size_t)(end - p) < size) {
+        return false;
+    }
+
+    memcpy(data, p, size);
+    p += size;
+
+    return true;
+}
+
+void KTree::Save(vector <unsigned char> &buf) const
+{
+    buf.clear();
+
+    if(!root) {
         return;
+    }
 
-    // Non-recursive way
-    vector <KNode*> toVisit;
-    vector <KNode*> toDelete;
+    vector <const KNode*> toVisit;
 
     toVisit.push_back(root);
 
     while(!toVisit.empty()) {
+        const KNode *node = toVisit.back();
+        toVisit.pop_back();
 
-        vector <KNode*> nextSearch;
+        int num_children = (int)node->children.size();
+        int num_indexes = (int)node->indexes.size();
 
-        while(!toVisit.empty()) {
-            KNode *node = toVisit.back();
-            toVisit.pop_back();
+        Write(buf, &node->level, sizeof(int));
+        Write(buf, &num_children, sizeof(int));
+        Write(buf, node->centre, FEATURE_BYTES);
+        Write(buf, &num_indexes, sizeof(int));
 
-            if(node->left != NULL) {
-                nextSearch.push_back(node->left);
-                nextSearch.push_back(node->right);
+        if(num_indexes) {
+            Write(buf, &node->indexes[0], num_indexes*sizeof(int));
+        }
+
+        // Reversed so the first child comes out first
+        toVisit.insert(toVisit.end(), node->children.rbegin(), node->children.rend());
+    }
+}
+
+bool KTree::Load(const vector <NAR_Sig> &sigs, const unsigned char *data, size_t size)
+{
+    Free();
+
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+
+    vector <KNode*> parents; // nodes still waiting for children
+    vector <int> remaining; // children still to come for each of parents
+
+    while(p < end) {
+        int level, num_children, num_indexes;
+        unsigned char centre[FEATURE_BYTES];
+
+        if(!Read(p, end, &level, sizeof(int)) ||
+           !Read(p, end, &num_children, sizeof(int)) ||
+           !Read(p, end, centre, FEATURE_BYTES) ||
+           !Read(p, end, &num_indexes, sizeof(int))) {
+            break;
+        }
+
+        if(num_children < 0 || num_children > MAX_BRANCHING || num_indexes < 0 ||
+           (size_t)num_indexes > (size_t)(end - p)/sizeof(int) || (root && parents.empty())) {
+            break;
+        }
+
+        KNode *node = new KNode();
+
+        node->level = level;
+        memcpy(node->centre, centre, FEATURE_BYTES);
+        node->indexes.resize(num_indexes);
+
+        if(num_indexes) {
+            Read(p, end, &node->indexes[0], num_indexes*sizeof(int));
+        }
+
+        if(parents.empty()) {
+            root = node;
+        }
+        else {
+            KNode *parent = parents.back();
+
+            parent->children.push_back(node);
+            parent->child_centres.insert(parent->child_centres.end(), node->centre, node->centre + FEATURE_BYTES);
+
+            if(--remaining.back() == 0) {
+                parents.pop_back();
+                remaining.pop_back();
             }
         }
 
-        toVisit = nextSearch;
-        toDelete.insert(toDelete.end(), nextSearch.begin(), nextSearch.end());
+        m_id++;
+
+        if(num_children) {
+            parents.push_back(node);
+            remaining.push_back(num_children);
+            continue;
+        }
+
+        node->descriptors.resize(node->indexes.size()*FEATURE_BYTES);
+
+        for(size_t i=0; i < node->indexes.size(); i++) {
+            int idx = node->indexes[i];
+
+            if(idx < 0 || idx >= (int)sigs.size()) {
+                Free();
+                return false;
+            }
+
+            memcpy(&node->descriptors[i*FEATURE_BYTES], sigs[idx].feature, FEATURE_BYTES);
+        }
     }
 
-    for(unsigned int i=0; i < toDelete.size(); i++) {
-        delete toDelete[i];
+    if(p != end || !parents.empty() || !root) {
+        Free();
+        return false;
     }
 
-    delete root;
-    root = NULL;
+    return true;
 }
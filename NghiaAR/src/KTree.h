@@ -2,22 +2,19 @@
 #define __KNODE__
 
 /*
-A simplified Hierarchical K-Mean tree.
-Searches only goes down the tree, never back up.
-This works in practice provided the tree is not too deep (around 6 level or less)
+A Hierarchical K-Majority tree, a K-Mean tree working directly on the binary features.
+Node centres are the bitwise majority of their features and distances are Hamming distances,
+so a centre costs FEATURE_BYTES instead of FEATURE_LENGTH floats.
 
-TODO: change code to use new C++ syntax
+Search is best-bin-first: it goes down the closest branch and then backtracks into the
+next closest unexplored branches until max_checks features have been collected.
 */
 
-#include <vector>
-
-#include <opencv2/core/core.hpp>
-#include <opencv2/core/core_c.h>
+#include <vector>
 
 #include "NAR_Sig.h"
 #include "NAR_Config.h"
-
-#include <xmmintrin.h>
+#include "HammingMatcher.h"
 
 // Node in K-Tree
 class KNode
@@ -26,82 +23,60 @@ public:
     KNode()
     {
         level = -1;
+    }
 
-        left = NULL;
-        right = NULL;
-
-        _left = -1;
-        _right = -1;
+    ~KNode()
+    {
+        for(size_t i=0; i < children.size(); i++) {
+            delete children[i];
+        }
     }
 
-    float centre[FEATURE_LENGTH];
+    unsigned char centre[FEATURE_BYTES];
     int level;
-    std::vector <int> indexes;
-    std::vector <int> tmpIndexes;
 
-    KNode *left;
-    KNode *right;
+    // Inner nodes
+    std::vector <KNode*> children;
+    std::vector <unsigned char> child_centres; // centres of children packed back to back for HammingMatcher
 
-    int id; // for GPU
-    int _left, _right; // for GPU
-};
+    // Leaf only
+    std::vector <int> indexes;
+    std::vector <unsigned char> descriptors; // features of indexes packed back to back for HammingMatcher
 
-// A point in the K-Tree node
-struct KTreePoint
-{
-    float coords[FEATURE_LENGTH];
-    unsigned char sig[FEATURE_BYTES];
+    bool IsLeaf() const { return children.empty(); }
 };
+
 class KTree
 {
 public:
     KTree();
     ~KTree();
 
+    void SetBranching(int branching); // children per node, default 4
+    void SetMaxChecks(int max_checks); // features collected by Search before it stops backtracking, default 256
+
     void Create(const std::vector <NAR_Sig> &sigs, int levels, int min_pts_per_node = 50);
     void Search(const NAR_Sig &sig, std::vector <int> &indexes) const;
+    void SearchLeaves(const NAR_Sig &sig, std::vector <const KNode*> &leaves) const; // closest leaf first
     KNode* GetRoot() const { return root; }
     int GetNumNodes() const { return m_id; }
+    size_t GetSizeBytes() const; // memory used by the tree
+
+    // Flat pre-order dump of the nodes, for caching the tree on disk (see SigDatabase.h).
+    // Leaf descriptors aren't stored, Load() repacks them from sigs. Load returns false on a corrupt buffer.
+    void Save(std::vector <unsigned char> &buf) const;
+    bool Load(const std::vector <NAR_Sig> &sigs, const unsigned char *data, size_t size);
 
 private:
     void Free();
-    void Split(const std::vector <NAR_Sig> &sigs, const std::vector <int> &indexes, KNode *left, KNode *right);
-
-    inline float DistanceSq(const float a[FEATURE_LENGTH], const float b[FEATURE_LENGTH]) const;
+    void Split(const std::vector <NAR_Sig> &sigs, KNode *node); // k-majority clustering of node->indexes into its children
 
 private:
     KNode *root;
     int m_id;
+    int m_branching;
+    int m_max_checks;
+    HammingMatcher m_matcher;
 };
 
-inline float KTree::DistanceSq(const float a[FEATURE_LENGTH], const float b[FEATURE_LENGTH]) const
-{
-    __m128 sum = _mm_setzero_ps(); // zero out the memory
-
-    // process 4 floats at a time
-    for(int i=0; i < FEATURE_LENGTH; i+=4) {
-        __m128 aa = _mm_loadu_ps(&a[i]); // load
-        __m128 bb = _mm_loadu_ps(&b[i]); // load
-        __m128 cc = _mm_sub_ps(aa, bb); // subtraction
-        cc = _mm_mul_ps(cc, cc); // square
-        sum = _mm_add_ps(sum, cc); // accumulation
-    }
-
-    float res[4];
-
-    _mm_storeu_ps(res, sum);
-
-    return res[0] + res[1] + res[2] + res[3];
-
-/*
-    float ret = 0;
-    for(int i=0; i < SIG_SIZE; i++) {
-        ret += (a[i] - b[i])*(a[i] - b[i]);
-    }
-
-
-    return ret;
-*/
-}
-
 #endif
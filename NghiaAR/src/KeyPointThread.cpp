@@ -20,47 +20,33 @@ KeyPointThread::~KeyPointThread()
     Done();
 }
 
-void KeyPointThread::DoWork()
+void KeyPointThread::DoWork(const ThreadJobPtr &job)
 {
     boost::posix_time::ptime t1, t2;
 
     assert(m_next_thread);
 
-    m_done = false;
+    bool use_search_region;
+    cv::Point2i start, end;
 
-    unsigned int total_time = 0;
-    unsigned int frame_count = 0;
-
-    while(!m_done) {
-		boost::mutex::scoped_lock lock(m_base_mutex);
-
-        if(!m_jobs.empty()) {
-            ThreadJob job = m_jobs.front();
-            m_jobs.pop_front();
-			lock.unlock();
+    {
+        boost::mutex::scoped_lock lock(m_search_region_mutex);
+        use_search_region = m_use_search_region;
+        start = m_start;
+        end = m_end;
+    }
 
-            t1 = boost::posix_time::microsec_clock::local_time();
-            DoGKeyPointExtraction(job.grey, job.sub_pixel, job.keypoints, job.blurred, m_use_search_region, m_start, m_end);
-            t2 = boost::posix_time::microsec_clock::local_time();
+    t1 = boost::posix_time::microsec_clock::local_time();
+    DoGKeyPointExtraction(job->grey, job->sub_pixel, job->keypoints, job->blurred, use_search_region, start, end);
+    t2 = boost::posix_time::microsec_clock::local_time();
 
-            m_next_thread->AddJob(job);
+    job->timing[ThreadJob::KEYPOINT_TIME] = (t2-t1).total_microseconds()*0.001f;
 
-            //cout << m_name << ": " << job.keypoints.size() << " keypoints in " << (t2-t1).total_milliseconds() << " ms " << endl;
+    m_next_thread->AddJob(job);
 
-            total_time += (unsigned int)(t2-t1).total_milliseconds();
-            frame_count++;
+    //cout << m_name << ": " << job->keypoints.size() << " keypoints in " << (t2-t1).total_milliseconds() << " ms " << endl;
 
-            if(frame_count >= 8) {
-                boost::mutex::scoped_lock lock2(m_fps_mutex);
-                m_fps = frame_count*1000.0f / total_time;
-                frame_count = 0;
-                total_time = 0;
-            }
-        }
-        else {
-            boost::thread::yield();
-        }
-    }
+    UpdateFPS((unsigned int)(t2-t1).total_milliseconds());
 }
 
 void KeyPointThread::SetSearchRegion(const cv::Point2i &start, const cv::Point2i &end)
@@ -18,7 +18,7 @@ public:
     void TurnOffSearchRegion();
 
 private:
-    virtual void DoWork();
+    virtual void DoWork(const ThreadJobPtr &job);
 
     boost::mutex m_search_region_mutex;
     bool m_use_search_region;
@@ -3,8 +3,10 @@
 #include <cstdio>
 #include <cmath>
 #include <sstream>
-#include <nmmintrin.h>
+#include <climits>
+#include <algorithm>
 
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/video/tracking.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
@@ -43,11 +45,18 @@ NAR::NAR()
 		m_fov = 60.0;
 		m_RANSAC_threshold = 4.0;
 		m_search_depth = 6;
+		m_search_branching = 4;
+		m_search_checks = 256;
 		m_max_sig_dist = FEATURE_LENGTH * 2/10; // used to threshold good/bad matches
+		m_match_ratio = 1.0f;
 		m_min_inliers = 10;
 		m_search_region_padding = 0;
-		m_failed_frames = 0;
 		m_max_consecutive_fails = 3;
+		m_deterministic = false;
+		m_flow_tracking = false;
+		m_redetect_interval = 10;
+		m_max_flow_error = 2.0;
+		m_min_flow_inliers = 20;
         m_max_optical_flow_tracks = 100;
 
 		SetAlphaBeta(0.25, 0.25);
@@ -61,10 +70,20 @@ NAR::NAR()
         m_scale_factor = 0.5f;
         m_nscales = 3;
         m_max_feature_labels = 500;
+        m_learn_threads = 0;
 	}
 
+    cout << "Feature matching using " << HammingMatcher::GetImplName(m_matcher.GetImpl()) << endl;
+
+    m_scheduler.Start();
+
+    // FindARObject keeps tracking state between frames, so the NAR stage is serial.
+    // The keypoint and feature stages can work on several frames at once.
     SetName("NAR Thread");
+    SetScheduler(&m_scheduler);
     SetBufferLimit(30);
+    SetOverflowPolicy(BLOCK);
+    SetSerial(true);
 
     for(int i=0; i < KEYPOINT_LEVELS; i++) {
 		stringstream str;
@@ -72,74 +91,176 @@ NAR::NAR()
 		str << "KeyPoint thread " << i;
         m_keypoint_thread[i].SetName(str.str());
         m_keypoint_thread[i].SetNextThread(&m_extract_feature_thread[i]);
+        m_keypoint_thread[i].SetScheduler(&m_scheduler);
+        m_keypoint_thread[i].SetOverflowPolicy(DROP_OLDEST); // new frames are more useful than old ones
+        m_keypoint_thread[i].SetSerial(false);
 
 		str.str("");
 		str << "ExtractFeature thread " << i;
         m_extract_feature_thread[i].SetName(str.str());
         m_extract_feature_thread[i].SetNextThread(this);
+        m_extract_feature_thread[i].SetScheduler(&m_scheduler);
+        m_extract_feature_thread[i].SetOverflowPolicy(BLOCK); // don't throw away work already done
+        m_extract_feature_thread[i].SetSerial(false);
 
         m_keypoint_thread[i].Run();
         m_extract_feature_thread[i].Run();
     }
 
-    m_optical_flow_frame_count = 0;
+    m_last_group_id = 0;
+    m_group_processed = false;
+    m_index_key = 0;
+    m_index_built = false;
+    m_flow_locked = false;
+    m_frames_since_detection = 0;
+    m_redetect_pending = false;
+    m_redetect_group_id = 0;
 }
 
 NAR::~NAR()
 {
     Done();
+    m_scheduler.Stop();
 }
 
 void NAR::SetARObject(const cv::Mat &AR_object)
 {
-    m_AR_object_width = AR_object.cols;
-    m_AR_object_height = AR_object.rows;
+    m_targets.clear();
+    m_AR_object_sigs.clear();
+    m_sig_target.clear();
+
+    AddARObject(AR_object);
+}
+
+int NAR::AddARObject(const cv::Mat &AR_object)
+{
+    ARTarget target;
 
-    // Find the largest dimension needed for creating temporary warped images
-    int size = (int)sqrt(m_AR_object_width*m_AR_object_width*0.25 + m_AR_object_height*m_AR_object_height*0.25)*2;
-    size = (size/4)*4 + 4;
+    target.width = AR_object.cols;
+    target.height = AR_object.rows;
 
     cv::Mat AR_object_grey;
-    cv::cvtColor(AR_object, AR_object_grey, CV_BGR2GRAY);
+
+    if(AR_object.channels() == 3) {
+        cv::cvtColor(AR_object, AR_object_grey, CV_BGR2GRAY);
+    }
+    else {
+        AR_object_grey = AR_object;
+    }
 
     // Initialse other matrices
-    m_AR_object_image_pts = cv::Mat::zeros(3,4,CV_64F);
+    target.image_pts = cv::Mat::zeros(3,4,CV_64F);
 
     // 4 corner points of the model
     // top left
-    m_AR_object_image_pts.at<double>(0,0) = 0;
-    m_AR_object_image_pts.at<double>(1,0) = 0;
-    m_AR_object_image_pts.at<double>(2,0) = 1;
+    target.image_pts.at<double>(0,0) = 0;
+    target.image_pts.at<double>(1,0) = 0;
+    target.image_pts.at<double>(2,0) = 1;
 
     // top right
-    m_AR_object_image_pts.at<double>(0,1) = m_AR_object_width;
-    m_AR_object_image_pts.at<double>(1,1) = 0;
-    m_AR_object_image_pts.at<double>(2,1) = 1;
+    target.image_pts.at<double>(0,1) = target.width;
+    target.image_pts.at<double>(1,1) = 0;
+    target.image_pts.at<double>(2,1) = 1;
 
     // bottom left
-    m_AR_object_image_pts.at<double>(0,2) = m_AR_object_width;
-    m_AR_object_image_pts.at<double>(1,2) = m_AR_object_height;
-    m_AR_object_image_pts.at<double>(2,2) = 1;
+    target.image_pts.at<double>(0,2) = target.width;
+    target.image_pts.at<double>(1,2) = target.height;
+    target.image_pts.at<double>(2,2) = 1;
 
     // bottom right
-    m_AR_object_image_pts.at<double>(0,3) = 0;
-    m_AR_object_image_pts.at<double>(1,3) = m_AR_object_height;
-    m_AR_object_image_pts.at<double>(2,3) = 1;
+    target.image_pts.at<double>(0,3) = 0;
+    target.image_pts.at<double>(1,3) = target.height;
+    target.image_pts.at<double>(2,3) = 1;
 
-    double scale = 1.0 / (double)m_AR_object_width;
+    double scale = 1.0 / (double)target.width;
     cv::Mat normalise_2D_mat = cv::Mat::eye(3,3,CV_64F);
     normalise_2D_mat.at<double>(0,0) = scale;
     normalise_2D_mat.at<double>(1,1) = scale;
-    normalise_2D_mat.at<double>(0,2) = -scale*m_AR_object_width*0.5;
-    normalise_2D_mat.at<double>(1,2) = -scale*m_AR_object_height*0.5;
+    normalise_2D_mat.at<double>(0,2) = -scale*target.width*0.5;
+    normalise_2D_mat.at<double>(1,2) = -scale*target.height*0.5;
+
+    target.world_pts = normalise_2D_mat*target.image_pts;
+
+    for(int i=0; i < target.world_pts.cols; i++) {
+        target.world_pts.at<double>(2,i) = 0.0; // z value
+    }
+
+    target.tracker.SetAlphaBeta(m_alpha, m_beta);
+
+    int target_id = (int)m_targets.size();
+    SigDatabaseKey key = GetSigDatabaseKey(AR_object_grey);
+    vector <NAR_Sig> sigs;
+
+    if(target_id == 0) {
+        m_index_key = SigDatabaseHash("NAR index", 9);
+    }
+
+    LearnARObject(AR_object_grey, key, sigs);
+
+    m_index_key = SigDatabaseHash(&key, sizeof(key), m_index_key);
+
+    target.sig_begin = m_AR_object_sigs.size();
+    m_AR_object_sigs.insert(m_AR_object_sigs.end(), sigs.begin(), sigs.end());
+    target.sig_end = m_AR_object_sigs.size();
+    m_sig_target.resize(m_AR_object_sigs.size(), target_id);
+
+    m_targets.push_back(target);
+
+    // The index is built once all the targets are in, see FinishAddingObjects
+    m_index_built = false;
+
+    return target_id;
+}
 
-    m_AR_oject_worlds_pts = normalise_2D_mat*m_AR_object_image_pts;
+void NAR::FinishAddingObjects()
+{
+    if(m_index_built || m_targets.empty()) {
+        return;
+    }
+
+    BuildIndex();
+
+    m_index_built = true;
+}
+
+void NAR::BuildIndex()
+{
+    boost::posix_time::ptime t1, t2;
+    string cache_file;
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+
+    // The tree parameters only matter here, the targets' keys don't include them
+    int params[] = {m_search_depth, m_search_branching};
+    SigDatabaseKey index_key = SigDatabaseHash(params, sizeof(params), m_index_key);
+
+    m_ktree.SetBranching(m_search_branching);
+    m_ktree.SetMaxChecks(m_search_checks);
+
+    if(!m_sig_cache_dir.empty()) {
+        vector <NAR_Sig> sigs;
 
-    for(int i=0; i < m_AR_oject_worlds_pts.cols; i++) {
-        m_AR_oject_worlds_pts.at<double>(2,i) = 0.0; // z value
+        cache_file = SigDatabaseFilename(m_sig_cache_dir, index_key);
+
+        if(LoadSigDatabase(cache_file, index_key, sigs, m_ktree) && sigs.size() == m_AR_object_sigs.size()) {
+            t2 = boost::posix_time::microsec_clock::local_time();
+
+            cout << "Loaded index of " << m_targets.size() << " AR objects from " << cache_file << " in " << (t2-t1).total_milliseconds() << " ms" << endl;
+            return;
+        }
     }
 
-	LearnARObject(AR_object_grey);
+    cout << "Building index of " << m_targets.size() << " AR objects, " << m_AR_object_sigs.size() << " features" << endl;
+
+    m_ktree.Create(m_AR_object_sigs, m_search_depth);
+
+    t2 = boost::posix_time::microsec_clock::local_time();
+
+    cout << "Building index took " << (t2-t1).total_milliseconds() << " ms" << endl;
+
+    if(!cache_file.empty() && !SaveSigDatabase(cache_file, index_key, m_AR_object_sigs, m_ktree)) {
+        cerr << "Can't save index to " << cache_file << endl;
+    }
 }
 
 void NAR::DumpMatches()
@@ -170,7 +291,26 @@ void NAR::DumpMatches()
 
 }
 
-bool NAR::FeatureMatching(ThreadJob &job, vector <NAR_Sig> &matches)
+// A query sig matched to a cell of an AR object, see FeatureMatching
+struct MatchCandidate
+{
+    int target_id;
+    int cell; // half resolution (x,y) on the AR object
+    float dist;
+    int query_idx;
+    int model_idx;
+
+    // Best match of each cell first, ties go to the first query like before
+    bool operator<(const MatchCandidate &b) const
+    {
+        if(target_id != b.target_id) return target_id < b.target_id;
+        if(cell != b.cell) return cell < b.cell;
+        if(dist != b.dist) return dist < b.dist;
+        return query_idx < b.query_idx;
+    }
+};
+
+bool NAR::FeatureMatching(ThreadJob &job, map <int, vector<NAR_Sig> > &matches)
 {
     boost::posix_time::ptime t1, t2;
 
@@ -180,43 +320,76 @@ bool NAR::FeatureMatching(ThreadJob &job, vector <NAR_Sig> &matches)
     vector <int> indexes; // index points to m_marker_sig
     vector <float> dists;
 
-    // Using K-Tree
+    vector <const KNode*> leaves;
+
+    // Using K-Tree, each leaf's features are scored as one block
     indexes.resize(job.sigs.size());
     dists.resize(job.sigs.size());
 
     for(size_t i=0; i < job.sigs.size(); i++) {
-        vector <int> ret_indexes;
-        m_ktree.Search(job.sigs[i], ret_indexes);
+        m_ktree.SearchLeaves(job.sigs[i], leaves);
 
-        int best_dist = FEATURE_LENGTH;
-        int best_idx = 0;
+        // Best two over all the leaves visited
+        HammingMatch best[2];
+        int found = 0;
 
-        for(size_t j=0; j < ret_indexes.size(); j++) {
-            int idx = ret_indexes[j];
+        for(size_t j=0; j < leaves.size(); j++) {
+            const KNode *leaf = leaves[j];
+            HammingMatch leaf_best[2];
+
+            if(leaf->indexes.empty()) {
+                continue;
+            }
 
-            int d = HammingDistance(job.sigs[i].feature, m_AR_object_sigs[idx].feature);
+            int n = m_matcher.Match(job.sigs[i].feature, &leaf->descriptors[0], (int)leaf->indexes.size(), 2, 1.0f, leaf_best);
 
-            if(d < best_dist) {
-                best_dist = d;
-                best_idx = ret_indexes[j];
+            for(int k=0; k < n; k++) {
+                leaf_best[k].index = leaf->indexes[leaf_best[k].index];
+
+                if(found < 2) {
+                    best[found++] = leaf_best[k];
+                }
+                else if(leaf_best[k].dist < best[1].dist) {
+                    best[1] = leaf_best[k];
+                }
+
+                if(found == 2 && best[1].dist < best[0].dist) {
+                    swap(best[0], best[1]);
+                }
             }
         }
 
-        indexes[i] = best_idx;
-        dists[i] = (float)best_dist;
+        if(found == 2 && m_match_ratio < 1.0f && best[0].dist >= m_match_ratio*best[1].dist) {
+            found = 0;
+        }
+
+        if(found > 0) {
+            indexes[i] = best[0].index;
+            dists[i] = (float)best[0].dist;
+        }
+        else {
+            indexes[i] = 0;
+            dists[i] = (float)FEATURE_LENGTH;
+        }
     }
 
     // We'll get sigs with duplicate (x,y) (but diff pose)
-    // Keep the best matching one only
-    vector <float> score_map(m_AR_object_width*m_AR_object_height/4, FLT_MAX);
-    vector <int> query_index_map(m_AR_object_width*m_AR_object_height/4, -1);
-    vector <int> model_sig_index_map(m_AR_object_width*m_AR_object_height/4, -1); // using down size map
+    // Keep the best matching one only, per target.
+    // Sorting the good matches instead of a score map per target keeps this independent of the number of targets.
+    vector <MatchCandidate> candidates;
 
-    int half_width = m_AR_object_width/2;
-    int half_height = m_AR_object_height/2;
+    candidates.reserve(job.sigs.size());
 
     for(size_t i=0; i < job.sigs.size(); i++) {
+        if(dists[i] >= m_max_sig_dist) {
+            continue;
+        }
+
         int idx = indexes[i];
+        const ARTarget &target = m_targets[m_sig_target[idx]];
+
+        int half_width = target.width/2;
+        int half_height = target.height/2;
 
         int x = (int)(m_AR_object_sigs[idx].x/2 + 0.5f);
         int y = (int)(m_AR_object_sigs[idx].y/2 + 0.5f);
@@ -227,48 +400,49 @@ bool NAR::FeatureMatching(ThreadJob &job, vector <NAR_Sig> &matches)
         x = max(x, 0);
         y = max(y, 0);
 
-        if(dists[i] < score_map[y*half_width + x]) {
-            score_map[y*half_width + x] = dists[i];
-            query_index_map[y*half_width+ x] = (int)i;
-            model_sig_index_map[y*half_width + x] = idx;
-        }
-    }
+        MatchCandidate c;
 
-    for(size_t i=0; i < query_index_map.size(); i++) {
-        int query_idx = query_index_map[i];
+        c.target_id = m_sig_target[idx];
+        c.cell = y*half_width + x;
+        c.dist = dists[i];
+        c.query_idx = (int)i;
+        c.model_idx = idx;
 
-        if(query_idx != -1 && score_map[i] < m_max_sig_dist) {
-            int model_sig_idx = model_sig_index_map[i];
+        candidates.push_back(c);
+    }
 
-            float a = job.sigs[query_idx].orientation;
-            float b = m_AR_object_sigs[model_sig_idx].orientation;
+    sort(candidates.begin(), candidates.end());
 
-            job.sigs[query_idx].orientation_diff = ShortestAngle(a,b);
-            job.sigs[query_idx].match_x = m_AR_object_sigs[model_sig_idx].x;
-            job.sigs[query_idx].match_y = m_AR_object_sigs[model_sig_idx].y;
-            //job.sigs[query_idx].match_idx = model_sig_idx;
-            //job.sigs[query_idx].score = score_map[i];
+    for(size_t i=0; i < candidates.size(); i++) {
+        const MatchCandidate &c = candidates[i];
 
-            matches.push_back(job.sigs[query_idx]);
+        if(i > 0 && c.target_id == candidates[i-1].target_id && c.cell == candidates[i-1].cell) {
+            continue;
         }
+
+        NAR_Sig &query = job.sigs[c.query_idx];
+        const NAR_Sig &model = m_AR_object_sigs[c.model_idx];
+
+        query.orientation_diff = ShortestAngle(query.orientation, model.orientation);
+        query.match_x = model.x;
+        query.match_y = model.y;
+
+        matches[c.target_id].push_back(query);
     }
 
     t2 = boost::posix_time::microsec_clock::local_time();
+    job.timing[ThreadJob::MATCHING_TIME] = (t2-t1).total_microseconds()*0.001f;
 
     cout << "Feature matching: " << ((t2-t1).total_milliseconds()) << " ms, total: " << job.sigs.size() << endl;
 
-    if((int)matches.size() < m_min_inliers) {
-        return false;
-    }
-
-    return true;
+    return !matches.empty();
 }
 
-bool NAR::Homography(ThreadJob &job, const std::vector <NAR_Sig> &matches, cv::Mat &H)
+bool NAR::Homography(ThreadJob &job, ARTarget &target, TargetResult &result, const std::vector <NAR_Sig> &matches, cv::Mat &H)
 {
     boost::posix_time::ptime t1, t2;
     vector <cv::Point2f> src2, dst2;
-    const cv::Mat &cur_grey = job.blurred;
+    const cv::Mat &cur_grey = job.grey; // blurred is only filtered inside the search region
 
     t1 = boost::posix_time::microsec_clock::local_time();
 
@@ -281,32 +455,34 @@ bool NAR::Homography(ThreadJob &job, const std::vector <NAR_Sig> &matches, cv::M
     // The more points the better the homography!
     int OF_index_offset = (int)src2.size();
 
-    if(!m_prev_optical_flow_pts.empty()) {
+    if(!target.prev_optical_flow_pts.empty()) {
         vector <cv::Point2f> cur_pts, cur_pts2;
         vector <uchar> of_status;
         vector <float> of_err;
 
-        cv::calcOpticalFlowPyrLK(m_prev_grey, cur_grey, m_prev_optical_flow_pts, cur_pts, of_status, of_err, cv::Size(21,21), 3);
+        cv::calcOpticalFlowPyrLK(target.prev_grey, cur_grey, target.prev_optical_flow_pts, cur_pts, of_status, of_err, cv::Size(21,21), 3);
 
-        m_avg_optical_flow.x = 0;
-        m_avg_optical_flow.y = 0;
+        target.avg_optical_flow.x = 0;
+        target.avg_optical_flow.y = 0;
 
         for(size_t i=0; i < cur_pts.size(); i++) {
             if(of_status[i]) {
-                src2.push_back(m_prev_AR_object_pts[i]);
+                src2.push_back(target.prev_AR_object_pts[i]);
                 dst2.push_back(cur_pts[i]);
 
                 cur_pts2.push_back(cur_pts[i]);
 
-                m_avg_optical_flow.x += (cur_pts[i].x - m_prev_optical_flow_pts[i].x);
-                m_avg_optical_flow.y += (cur_pts[i].y - m_prev_optical_flow_pts[i].y);
+                target.avg_optical_flow.x += (cur_pts[i].x - target.prev_optical_flow_pts[i].x);
+                target.avg_optical_flow.y += (cur_pts[i].y - target.prev_optical_flow_pts[i].y);
             }
         }
 
-        m_avg_optical_flow.x /= cur_pts2.size();
-        m_avg_optical_flow.y /= cur_pts2.size();
+        if(!cur_pts2.empty()) {
+            target.avg_optical_flow.x /= cur_pts2.size();
+            target.avg_optical_flow.y /= cur_pts2.size();
+        }
 
-        m_prev_optical_flow_pts = cur_pts2;
+        target.prev_optical_flow_pts = cur_pts2;
     }
 
     int best_inliers;
@@ -317,11 +493,12 @@ bool NAR::Homography(ThreadJob &job, const std::vector <NAR_Sig> &matches, cv::M
 
     best_inliers = accumulate(mask2.begin(), mask2.end(), 0);
     t2 = boost::posix_time::microsec_clock::local_time();
+    job.timing[ThreadJob::HOMOGRAPHY_TIME] += (t2-t1).total_microseconds()*0.001f;
 
     // Move back up later
     if(best_inliers < m_min_inliers) {
         cout << "Not enough inliers: " << best_inliers << endl;
-        cout << "Homography: " << job.matches.size() << " - " <<  (t2-t1).total_milliseconds() << " ms" << endl;
+        cout << "Homography: " << matches.size() << " - " <<  (t2-t1).total_milliseconds() << " ms" << endl;
         return false;
     }
 
@@ -346,77 +523,99 @@ bool NAR::Homography(ThreadJob &job, const std::vector <NAR_Sig> &matches, cv::M
 
     H = cv::findHomography(src3, dst3, 0);
 
-    job.matches = dst3;
+    result.matches = dst3;
 
+    t1 = t2;
     t2 = boost::posix_time::microsec_clock::local_time();
+    job.timing[ThreadJob::HOMOGRAPHY_TIME] += (t2-t1).total_microseconds()*0.001f;
 
-    cout << "Homography: " << job.matches.size() << " - " <<  (t2-t1).total_milliseconds() << " ms" << endl;
+    cout << "Homography: " << result.matches.size() << " - " <<  (t2-t1).total_milliseconds() << " ms" << endl;
 
     return true;
 }
 
-bool NAR::PoseEstimation(const cv::Mat &H)
+bool NAR::PoseEstimation(ThreadJob &job, ARTarget &target, const cv::Mat &H)
 {
     boost::posix_time::ptime t1, t2;
 
     t1 = boost::posix_time::microsec_clock::local_time();
 
-    cv::Mat image_pts = m_inv_camera_intrinsics * H * m_AR_object_image_pts;
+    cv::Mat image_pts = m_inv_camera_intrinsics * H * target.image_pts;
 
     double obj_err, img_err;
     int it;
 
-    bool status = RPP::Rpp(m_AR_oject_worlds_pts, image_pts, m_AR_object_rotation, m_AR_object_translation, it, obj_err, img_err);
+    bool status = RPP::Rpp(target.world_pts, image_pts, target.rotation, target.translation, it, obj_err, img_err);
+
+    t2 = boost::posix_time::microsec_clock::local_time();
+    job.timing[ThreadJob::POSE_TIME] += (t2-t1).total_microseconds()*0.001f;
 
     if(!status) {
         return false;
     }
 
-    t2 = boost::posix_time::microsec_clock::local_time();
-
     cout << "RPP: " << (t2-t1).total_milliseconds() << " ms" << endl;
 
     return true;
 }
 
-void NAR::UpdateAlphaBetaTracker(ThreadJob &job)
+void NAR::UpdateAlphaBetaTracker(ARTarget &target, TargetResult &result)
 {
     double yaw = 0, pitch = 0, roll = 0;
     double x, y, z;
 
-    x = m_AR_object_translation.at<double>(0,0);
-    y = m_AR_object_translation.at<double>(1,0);
-    z = m_AR_object_translation.at<double>(2,0);
-
-    GetYPR(m_AR_object_rotation, yaw, pitch, roll);
+    x = target.translation.at<double>(0,0);
+    y = target.translation.at<double>(1,0);
+    z = target.translation.at<double>(2,0);
 
-    m_tracker.SetState(x, y, z, yaw, pitch, roll);
+    GetYPR(target.rotation, yaw, pitch, roll);
 
-    if(m_tracker.Ready()) {
-        m_tracker.GetCorrectedState(&x, &y, &z, &yaw, &pitch, &roll);
+    target.tracker.SetState(x, y, z, yaw, pitch, roll);
 
-        m_AR_object_rotation = MakeRotation3x3(yaw, pitch, roll);
-        m_AR_object_translation.at<double>(0,0) = x;
-        m_AR_object_translation.at<double>(1,0) = y;
-        m_AR_object_translation.at<double>(2,0) = z;
+    if(target.tracker.Ready()) {
+        target.tracker.GetCorrectedState(&x, &y, &z, &yaw, &pitch, &roll);
 
-        ProjectModel(x, y, z, yaw, pitch, roll, job.corners);
+        target.rotation = MakeRotation3x3(yaw, pitch, roll);
+        target.translation.at<double>(0,0) = x;
+        target.translation.at<double>(1,0) = y;
+        target.translation.at<double>(2,0) = z;
     }
 
-    job.rotation = m_AR_object_rotation;
-    job.translation = m_AR_object_translation;
+    ProjectModel(target, x, y, z, yaw, pitch, roll, target.corners);
+
+    // The target keeps updating its pose in place, the result is handed to another thread
+    result.rotation = target.rotation.clone();
+    result.translation = target.translation.clone();
+
+    for(int i=0; i < 4; i++) {
+        result.corners[i] = target.corners[i];
+    }
 }
 
 void NAR::UpdateSearchRegion(ThreadJob &job)
 {
-    cv::Point region_start;
-    cv::Point region_end;
-
-    if(m_tracker.Ready() && m_failed_frames < m_max_consecutive_fails) {
-        job.use_search_region = true;
+    // Only search part of the image when every target is being tracked,
+    // otherwise the ones not found yet would never be found
+    bool use_search_region = !m_targets.empty();
+    cv::Point region_start(INT_MAX, INT_MAX);
+    cv::Point region_end(INT_MIN, INT_MIN);
+
+    for(size_t i=0; i < m_targets.size(); i++) {
+        const ARTarget &target = m_targets[i];
+
+        if(!target.tracking || !target.use_search_region) {
+            use_search_region = false;
+            break;
+        }
 
-        PredictSearchRegion(region_start, region_end);
+        region_start.x = min(region_start.x, target.region_start.x);
+        region_start.y = min(region_start.y, target.region_start.y);
+        region_end.x = max(region_end.x, target.region_end.x);
+        region_end.y = max(region_end.y, target.region_end.y);
+    }
 
+    if(use_search_region) {
+        job.use_search_region = true;
         job.search_region_start = region_start;
         job.search_region_end = region_end;
 
@@ -435,22 +634,22 @@ void NAR::UpdateSearchRegion(ThreadJob &job)
     }
 }
 
-void NAR::UpdateOpticalFlowTracks(ThreadJob &job, const cv::Mat &H, const cv::Mat &cur_grey)
+void NAR::UpdateOpticalFlowTracks(ARTarget &target, TargetResult &result, const cv::Mat &H, const cv::Mat &cur_grey)
 {
-    if(m_optical_flow_frame_count >= 16) {
-        m_prev_optical_flow_pts.clear();
+    if(target.optical_flow_frame_count >= 16) {
+        target.prev_optical_flow_pts.clear();
 
-        m_optical_flow_frame_count = 0;
-        m_avg_optical_flow.x = 0;
-        m_avg_optical_flow.y = 0;
-        m_last_optical_flow_size = 0;
+        target.optical_flow_frame_count = 0;
+        target.avg_optical_flow.x = 0;
+        target.avg_optical_flow.y = 0;
+        target.last_optical_flow_size = 0;
     }
-    else if(m_prev_optical_flow_pts.empty()) {
-        cv::Mat mask2 = cv::Mat::zeros(job.img.size(), CV_8U);
-        cv::rectangle(mask2, job.search_region_start, job.search_region_end, cv::Scalar(255), CV_FILLED);
-        cv::goodFeaturesToTrack(cur_grey, m_prev_optical_flow_pts, m_max_optical_flow_tracks, 0.04, 8.0, mask2);
+    else if(target.prev_optical_flow_pts.empty() && target.use_search_region) {
+        cv::Mat mask2 = cv::Mat::zeros(cur_grey.size(), CV_8U);
+        cv::rectangle(mask2, target.region_start, target.region_end, cv::Scalar(255), CV_FILLED);
+        cv::goodFeaturesToTrack(cur_grey, target.prev_optical_flow_pts, m_max_optical_flow_tracks, 0.04, 8.0, mask2);
 
-        cout << "OF tracks " << m_prev_optical_flow_pts.size() << endl;
+        cout << "OF tracks " << target.prev_optical_flow_pts.size() << endl;
 
         // Reverse transform
         cv::Mat inv = H.inv();
@@ -458,46 +657,42 @@ void NAR::UpdateOpticalFlowTracks(ThreadJob &job, const cv::Mat &H, const cv::Ma
         cv::Mat X2(3,1,CV_64F);
         X.at<double>(2,0) = 1.0;
 
-        m_prev_AR_object_pts.resize(m_prev_optical_flow_pts.size());
+        target.prev_AR_object_pts.resize(target.prev_optical_flow_pts.size());
 
-        for(size_t i=0; i < m_prev_optical_flow_pts.size(); i++) {
-            X.at<double>(0,0) = m_prev_optical_flow_pts[i].x;
-            X.at<double>(1,0) = m_prev_optical_flow_pts[i].y;
+        for(size_t i=0; i < target.prev_optical_flow_pts.size(); i++) {
+            X.at<double>(0,0) = target.prev_optical_flow_pts[i].x;
+            X.at<double>(1,0) = target.prev_optical_flow_pts[i].y;
             X.at<double>(2,0) = 1.0;
 
             X2 = inv*X;
 
-            m_prev_AR_object_pts[i].x = (float)(X2.at<double>(0,0) / X2.at<double>(2,0));
-            m_prev_AR_object_pts[i].y = (float)(X2.at<double>(1,0) / X2.at<double>(2,0));
+            target.prev_AR_object_pts[i].x = (float)(X2.at<double>(0,0) / X2.at<double>(2,0));
+            target.prev_AR_object_pts[i].y = (float)(X2.at<double>(1,0) / X2.at<double>(2,0));
         }
 
-        m_optical_flow_frame_count = 0;
-        m_avg_optical_flow.x = 0;
-        m_avg_optical_flow.y = 0;
-        m_last_optical_flow_size = (int)m_prev_optical_flow_pts.size();
+        target.optical_flow_frame_count = 0;
+        target.avg_optical_flow.x = 0;
+        target.avg_optical_flow.y = 0;
+        target.last_optical_flow_size = (int)target.prev_optical_flow_pts.size();
     }
 
-    if(fabs(m_avg_optical_flow.x) + fabs(m_avg_optical_flow.y) > 20) { // significant movement
+    if(fabs(target.avg_optical_flow.x) + fabs(target.avg_optical_flow.y) > 20) { // significant movement
         cout << "     Significant movement" << endl;
-        m_optical_flow_frame_count++;
+        target.optical_flow_frame_count++;
     }
-    else if(m_prev_optical_flow_pts.size() < m_last_optical_flow_size*7/10) { // we've lost too many optical flow tracks
+    else if((int)target.prev_optical_flow_pts.size() < target.last_optical_flow_size*7/10) { // we've lost too many optical flow tracks
         cout << "     Lost too many optical flow tracks" << endl;
-        m_optical_flow_frame_count++;
+        target.optical_flow_frame_count++;
     }
 
-    job.optical_flow_tracks = m_prev_optical_flow_pts;
+    result.optical_flow_tracks = target.prev_optical_flow_pts;
 }
 
 int NAR::FindARObject(ThreadJob &job)
 {
-    if(m_AR_object_sigs.empty()) {
+    if(m_targets.empty()) {
         cerr << "You forgot to call SetARObject()" << endl;
-        assert(m_AR_object_sigs.empty());
-    }
-
-    if((int)job.sigs.size() < m_min_inliers) {
-        return BAD;
+        assert(!m_targets.empty());
     }
 
     if(m_cx == -1 || m_cy == -1) {
@@ -505,75 +700,326 @@ int NAR::FindARObject(ThreadJob &job)
         assert(0);
     }
 
-    boost::posix_time::ptime t1, t2;
-    cv::Mat H(3,3,CV_64F);
-    vector <NAR_Sig> matches;
-    cv::Mat &cur_grey = job.blurred;
+    map <int, vector<NAR_Sig> > matches;
+    vector <int> target_ids;
 
     cout << endl;
 
+    if((int)job.sigs.size() >= m_min_inliers) {
+        FeatureMatching(job, matches);
+    }
+
+    // Targets matched in this frame, plus the ones being tracked that weren't,
+    // the rest of the registered targets cost nothing
+    for(map <int, vector<NAR_Sig> >::iterator it = matches.begin(); it != matches.end(); ++it) {
+        target_ids.push_back(it->first);
+    }
+
+    for(size_t i=0; i < m_targets.size(); i++) {
+        if(m_targets[i].tracking && matches.find((int)i) == matches.end()) {
+            target_ids.push_back((int)i);
+        }
+    }
+
+    sort(target_ids.begin(), target_ids.end());
+
+    for(size_t i=0; i < target_ids.size(); i++) {
+        TrackTarget(job, target_ids[i], matches[target_ids[i]]);
+    }
+
+    UpdateSearchRegion(job);
+    UpdateFlowLock(job);
+
+    return SingleTargetResult(job);
+}
+
+int NAR::SingleTargetResult(ThreadJob &job)
+{
+    // The single target fields are target 0's
+    for(size_t i=0; i < job.targets.size(); i++) {
+        const TargetResult &result = job.targets[i];
+
+        if(result.target_id != 0) {
+            continue;
+        }
+
+        job.rotation = result.rotation;
+        job.translation = result.translation;
+        job.matches = result.matches;
+        job.optical_flow_tracks = result.optical_flow_tracks;
+
+        for(int j=0; j < 4; j++) {
+            job.corners[j] = result.corners[j];
+        }
+
+        return result.status;
+    }
+
+    return BAD;
+}
+
+void NAR::TrackTarget(ThreadJob &job, int target_id, vector <NAR_Sig> &matches)
+{
+    ARTarget &target = m_targets[target_id];
+    TargetResult result;
+    cv::Mat H(3,3,CV_64F);
+    cv::Mat &cur_grey = job.grey;
+
+    result.target_id = target_id;
+
     // goto for the win! :)
-    if(!FeatureMatching(job, matches)) goto fail;
+    if((int)matches.size() < m_min_inliers) goto fail;
     if(!FilterOrientation(matches, matches, 1)) goto fail;
-    if(!Homography(job, matches, H)) goto fail;
-    if(!PoseEstimation(H)) goto fail;
-    UpdateAlphaBetaTracker(job);
-    UpdateSearchRegion(job);
-    UpdateOpticalFlowTracks(job, H, cur_grey);
+    if(!Homography(job, target, result, matches, H)) goto fail;
+    if(!PoseEstimation(job, target, H)) goto fail;
+    UpdateAlphaBetaTracker(target, result);
+
+    if(target.tracker.Ready()) {
+        target.use_search_region = true;
+        PredictSearchRegion(target, target.region_start, target.region_end);
+    }
 
-    m_prev_grey = cur_grey;
-    m_failed_frames = 0;
+    UpdateOpticalFlowTracks(target, result, H, cur_grey);
+
+    target.prev_grey = cur_grey;
+    target.failed_frames = 0;
+    target.tracking = true;
     cout << "Found match!" << endl;
 
-    return NAR::GOOD;
+    result.status = GOOD;
+    job.targets.push_back(result);
+
+    return;
+
+fail:
+    result.status = DetectionFailed(target);
+
+    // Hold the last pose
+    if(result.status == PREDICTION) {
+        result.rotation = target.rotation.clone();
+        result.translation = target.translation.clone();
+
+        for(int i=0; i < 4; i++) {
+            result.corners[i] = target.corners[i];
+        }
+
+        job.targets.push_back(result);
+    }
+}
+
+int NAR::TrackFlow(ThreadJob &job)
+{
+    // Only the targets locked on to have flow tracks, the rest wait for the next detection
+    for(size_t i=0; i < m_targets.size(); i++) {
+        if(m_targets[i].tracking) {
+            FlowTrackTarget(job, (int)i);
+        }
+    }
+
+    UpdateSearchRegion(job);
+    UpdateFlowLock(job);
+
+    return SingleTargetResult(job);
+}
+
+void NAR::FlowTrackTarget(ThreadJob &job, int target_id)
+{
+    ARTarget &target = m_targets[target_id];
+    TargetResult result;
+    cv::Mat H(3,3,CV_64F);
+    cv::Mat &cur_grey = job.grey;
+
+    result.target_id = target_id;
+
+    if(!FlowHomography(job, target, result, H)) goto fail;
+    if(!PoseEstimation(job, target, H)) goto fail;
+    UpdateAlphaBetaTracker(target, result);
+
+    if(target.tracker.Ready()) {
+        target.use_search_region = true;
+        PredictSearchRegion(target, target.region_start, target.region_end);
+    }
+
+    UpdateOpticalFlowTracks(target, result, H, cur_grey);
+
+    target.prev_grey = cur_grey;
+    target.failed_frames = 0;
+
+    result.status = GOOD;
+    job.targets.push_back(result);
+
+    return;
 
 fail:
-    int status = DetectionFailed();
-    return status;
+    result.status = DetectionFailed(target);
+
+    if(result.status == PREDICTION) {
+        result.rotation = target.rotation.clone();
+        result.translation = target.translation.clone();
+
+        for(int i=0; i < 4; i++) {
+            result.corners[i] = target.corners[i];
+        }
+
+        job.targets.push_back(result);
+    }
+}
+
+bool NAR::FlowHomography(ThreadJob &job, ARTarget &target, TargetResult &result, cv::Mat &H)
+{
+    boost::posix_time::ptime t1, t2;
+    const cv::Mat &cur_grey = job.grey;
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+
+    if((int)target.prev_optical_flow_pts.size() < m_min_flow_inliers) {
+        return false;
+    }
+
+    vector <cv::Point2f> cur_pts;
+    vector <uchar> of_status;
+    vector <float> of_err;
+    vector <cv::Point2f> src, dst, prev;
+
+    cv::calcOpticalFlowPyrLK(target.prev_grey, cur_grey, target.prev_optical_flow_pts, cur_pts, of_status, of_err, cv::Size(21,21), 3);
+
+    for(size_t i=0; i < cur_pts.size(); i++) {
+        if(of_status[i]) {
+            src.push_back(target.prev_AR_object_pts[i]);
+            dst.push_back(cur_pts[i]);
+            prev.push_back(target.prev_optical_flow_pts[i]);
+        }
+    }
+
+    if((int)dst.size() < m_min_flow_inliers) {
+        cout << "Flow: lost too many tracks " << dst.size() << endl;
+        return false;
+    }
+
+    vector <uchar> mask;
+
+    H = cv::findHomography(src, dst, CV_RANSAC, m_RANSAC_threshold, mask);
+
+    // Keep the inliers only so outliers don't drag the next frames
+    vector <cv::Point2f> src2, dst2;
+    double err = 0.0;
+
+    target.avg_optical_flow.x = 0;
+    target.avg_optical_flow.y = 0;
+
+    for(size_t i=0; i < mask.size(); i++) {
+        if(mask[i] == 0) {
+            continue;
+        }
+
+        const double *h = H.ptr<double>(0);
+        double x = src[i].x, y = src[i].y;
+        double w = h[6]*x + h[7]*y + h[8];
+        double dx = (h[0]*x + h[1]*y + h[2])/w - dst[i].x;
+        double dy = (h[3]*x + h[4]*y + h[5])/w - dst[i].y;
+
+        err += sqrt(dx*dx + dy*dy);
+
+        src2.push_back(src[i]);
+        dst2.push_back(dst[i]);
+
+        target.avg_optical_flow.x += dst[i].x - prev[i].x;
+        target.avg_optical_flow.y += dst[i].y - prev[i].y;
+    }
+
+    t2 = boost::posix_time::microsec_clock::local_time();
+    job.timing[ThreadJob::HOMOGRAPHY_TIME] += (t2-t1).total_microseconds()*0.001f;
+
+    if((int)src2.size() < m_min_flow_inliers) {
+        cout << "Flow: not enough inliers " << src2.size() << endl;
+        return false;
+    }
+
+    err /= src2.size();
+    target.avg_optical_flow.x /= src2.size();
+    target.avg_optical_flow.y /= src2.size();
+
+    if(err > m_max_flow_error) {
+        cout << "Flow: reprojection error " << err << endl;
+        return false;
+    }
+
+    H = cv::findHomography(src2, dst2, 0);
+
+    target.prev_optical_flow_pts = dst2;
+    target.prev_AR_object_pts = src2;
+    result.matches = dst2;
+
+    cout << "Flow: " << src2.size() << " inliers, error " << err << ", " << (t2-t1).total_milliseconds() << " ms" << endl;
+
+    return true;
 }
 
-NAR::StatusCode NAR::DetectionFailed()
+void NAR::UpdateFlowLock(ThreadJob &job)
 {
-    m_failed_frames++;
-    m_prev_optical_flow_pts.clear();
-    m_prev_AR_object_pts.clear();
+    // Locked when something was found and every target found has enough tracks for the next frame
+    bool locked = m_flow_tracking;
+    bool found = false;
+
+    for(size_t i=0; i < job.targets.size() && locked; i++) {
+        const TargetResult &result = job.targets[i];
+
+        if(result.status != GOOD) {
+            locked = false;
+            break;
+        }
+
+        found = true;
+
+        if((int)m_targets[result.target_id].prev_optical_flow_pts.size() < m_min_flow_inliers) {
+            locked = false;
+        }
+    }
+
+    boost::mutex::scoped_lock lock(m_flow_mutex);
+    m_flow_locked = locked && found;
+}
+
+NAR::StatusCode NAR::DetectionFailed(ARTarget &target)
+{
+    target.failed_frames++;
+    target.prev_optical_flow_pts.clear();
+    target.prev_AR_object_pts.clear();
 
     // For now we'll just return the same pose when the frame has failed to detect the model
     // Prediction doesn't work very well in the presence of motion blur
-    if(m_failed_frames < m_max_consecutive_fails) {
+    if(target.tracking && target.failed_frames < m_max_consecutive_fails) {
         /*
         double yaw, pitch, roll;
         double x, y, z;
 
-        m_tracker.GetCorrectedState(&x, &y, &z, &yaw, &pitch, &roll);
+        target.tracker.GetCorrectedState(&x, &y, &z, &yaw, &pitch, &roll);
 
-        m_AR_object_rotation = YPR(yaw, pitch, roll);
-        m_AR_object_translation.at<double>(0,0) = x;
-        m_AR_object_translation.at<double>(1,0) = y;
-        m_AR_object_translation.at<double>(2,0) = z;
+        target.rotation = YPR(yaw, pitch, roll);
+        target.translation.at<double>(0,0) = x;
+        target.translation.at<double>(1,0) = y;
+        target.translation.at<double>(2,0) = z;
         */
 
         return PREDICTION;
     }
 
-    // reset search regions
-    for(int i=0; i < KEYPOINT_LEVELS; i++) {
-        m_keypoint_thread[i].TurnOffSearchRegion();
-    }
-
-    m_tracker.Reset();
+    // Search regions are reset by UpdateSearchRegion
+    target.tracking = false;
+    target.use_search_region = false;
+    target.tracker.Reset();
 
     return BAD;
 }
 
-void NAR::PredictSearchRegion(cv::Point &ret_start, cv::Point &ret_end)
+void NAR::PredictSearchRegion(ARTarget &target, cv::Point &ret_start, cv::Point &ret_end)
 {
-    cv::Mat X = m_AR_object_rotation*m_AR_oject_worlds_pts; // 3x3 * 3x4
+    cv::Mat X = target.rotation*target.world_pts; // 3x3 * 3x4
 
     for(int i=0; i < X.cols; i++) {
-        X.at<double>(0,i) += m_AR_object_translation.at<double>(0,0);
-        X.at<double>(1,i) += m_AR_object_translation.at<double>(1,0);
-        X.at<double>(2,i) += m_AR_object_translation.at<double>(2,0);
+        X.at<double>(0,i) += target.translation.at<double>(0,0);
+        X.at<double>(1,i) += target.translation.at<double>(1,0);
+        X.at<double>(2,i) += target.translation.at<double>(2,0);
     }
 
     X = m_camera_intrinsics*X;
@@ -602,9 +1048,6 @@ void NAR::PredictSearchRegion(cv::Point &ret_start, cv::Point &ret_end)
 
     ret_end.x += m_search_region_padding;
     ret_end.y += m_search_region_padding;
-
-    m_region_start = ret_start;
-    m_region_end = ret_end;
 }
 
 bool NAR::FilterOrientation(vector <NAR_Sig> &input, vector <NAR_Sig> &output, int top)
@@ -726,11 +1169,11 @@ cv::Mat NAR::CorrectRotationForOpenGL(const cv::Mat &rotation)
     return MakeRotation3x3(yaw, -pitch, -roll);
 }
 
-void NAR::ProjectModel(double x, double y, double z, double yaw, double pitch, double roll, cv::Point2i ret_corners[4])
+void NAR::ProjectModel(const ARTarget &target, double x, double y, double z, double yaw, double pitch, double roll, cv::Point2i ret_corners[4])
 {
     cv::Mat rot = MakeRotation3x3(yaw, pitch, roll);
 
-    cv::Mat model_pts = rot*m_AR_oject_worlds_pts;
+    cv::Mat model_pts = rot*target.world_pts;
 
     for(int i=0; i < 4; i++) {
         model_pts.at<double>(0,i) += x;
@@ -772,6 +1215,17 @@ void NAR::SetSearchDepth(int num)
     m_search_depth = num;
 }
 
+void NAR::SetSearchBranching(int branching)
+{
+    m_search_branching = branching;
+}
+
+void NAR::SetSearchChecks(int checks)
+{
+    m_search_checks = checks;
+    m_ktree.SetMaxChecks(checks);
+}
+
 void NAR::SetRASNACThreshold(double threshold)
 {
     m_RANSAC_threshold = threshold;
@@ -804,14 +1258,24 @@ void NAR::SetMaxSigDist(int max_sig_dist)
     m_max_sig_dist = max_sig_dist;
 }
 
+void NAR::SetMatchRatio(float ratio)
+{
+    m_match_ratio = ratio;
+}
+
 void NAR::SetAlphaBeta(double alpha, double beta)
 {
-    m_tracker.SetAlphaBeta(alpha, beta);
+    m_alpha = alpha;
+    m_beta = beta;
+
+    for(size_t i=0; i < m_targets.size(); i++) {
+        m_targets[i].tracker.SetAlphaBeta(alpha, beta);
+    }
 }
 
 void NAR::SetMaxFailedFrames(int n)
 {
-    m_failed_frames = n;
+    m_max_consecutive_fails = n;
 }
 
 void NAR::SetMaxOpticalFlowTracks(int n)
@@ -819,6 +1283,13 @@ void NAR::SetMaxOpticalFlowTracks(int n)
     m_max_optical_flow_tracks = n;
 }
 
+void NAR::SetInputOverflowPolicy(OverflowPolicy policy)
+{
+    for(int i=0; i < KEYPOINT_LEVELS; i++) {
+        m_keypoint_thread[i].SetOverflowPolicy(policy);
+    }
+}
+
 void NAR::SetAngleStep(int angle_step)
 {
     m_angle_step = angle_step;
@@ -849,38 +1320,39 @@ void NAR::SetMaxFeatureLabels(int max_feature_labels)
     m_max_feature_labels = max_feature_labels;
 }
 
-int NAR::BitCount(unsigned int u)
+void NAR::SetFlowTracking(bool on)
 {
-    // http://tekpool.wordpress.com/2006/09/25/bit-count-parallel-counting-mit-hakmem/
-    unsigned int uCount = u - ((u >> 1) & 033333333333) - ((u >> 2) & 011111111111);
-    return((uCount + (uCount >> 3)) & 030707070707) % 63;
+    m_flow_tracking = on;
 }
 
-int NAR::HammingDistance(const unsigned char *a, const unsigned char *b)
+void NAR::SetRedetectInterval(int frames)
 {
-#ifdef USE_SSE4
-    uint64_t *aa = (uint64_t *)a;
-    uint64_t *bb = (uint64_t *)b;
-    //return  _mm_popcnt_u64((*aa) ^ (*bb));
-
-    uint64_t ret = 0;
+    m_redetect_interval = frames;
+}
 
-    for(unsigned int i=0; i < FEATURE_LENGTH/(sizeof(uint64_t)*8); i++) {
-        ret += _mm_popcnt_u64(aa[i] ^ bb[i]);
-    }
+void NAR::SetMaxFlowError(double error)
+{
+    m_max_flow_error = error;
+}
 
-    return (int)ret;
-#else
-    int dist = 0;
+void NAR::SetMinFlowInliers(int n)
+{
+    m_min_flow_inliers = n;
+}
 
-    int *aa = (int*)a;
-    int *bb = (int*)b;
+void NAR::SetDeterministic(bool on)
+{
+    m_deterministic = on;
+}
 
-    dist += BitCount(aa[0] ^ bb[0]);
-    dist += BitCount(aa[1] ^ bb[1]);
+void NAR::SetLearnThreads(int n)
+{
+    m_learn_threads = n;
+}
 
-    return dist;
-#endif
+void NAR::SetSigCacheDir(const std::string &dir)
+{
+    m_sig_cache_dir = dir;
 }
 
 void NAR::WarpImage(const cv::Mat &in, cv::Mat &out, float yaw, float pitch, float roll, cv::Mat &inv_affine)
@@ -917,42 +1389,183 @@ void NAR::WarpImage(const cv::Mat &in, cv::Mat &out, float yaw, float pitch, flo
     cv::warpAffine(in, out, affine, cv::Size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(128));
 }
 
-void NAR::LearnARObject(const cv::Mat &AR_object)
+// A keypoint found in one of the synthesised views, mapped back onto the AR object
+struct LearnedKeyPoint
 {
-    assert(AR_object.type() == CV_8U);
+    int grid_idx; // cell in the feature label grid
+    int num_sigs;
+    NAR_Sig sigs[2]; // one per orientation
+};
 
-    const int grid_size = 2;
+struct LearnPose
+{
+    int scale; // index into LearnContext::resized
+    int yaw, pitch;
+};
 
-    int total_poses = m_nscales * (m_yaw_end/m_angle_step+1) * (m_pitch_end/m_angle_step+1);
+// Shared by the LearnPoses workers, each takes the next pose until there are none left
+struct LearnContext
+{
+    cv::Size AR_object_size;
+    int off_x, off_y; // AR object position in the bordered image
+    int grid_size, grid_width;
+    vector <cv::Mat> resized; // bordered image at each scale
+    vector <float> scales;
+    vector <LearnPose> poses;
+    vector < vector<LearnedKeyPoint> > results; // per pose, merged in pose order afterwards
+
+    boost::mutex mutex;
+    size_t next_pose;
+    int poses_done;
+};
+
+SigDatabaseKey NAR::GetSigDatabaseKey(const cv::Mat &AR_object) const
+{
+    // Everything that changes the learnt sigs
+    int params[] = {m_angle_step, m_yaw_end, m_pitch_end, m_nscales, m_max_feature_labels,
+                    NAR_PATCH_SIZE, FEATURE_LENGTH, KEYPOINT_LEVELS};
+
+    SigDatabaseKey key = SigDatabaseHashImage(AR_object);
+    key = SigDatabaseHash(params, sizeof(params), key);
+    key = SigDatabaseHash(&m_scale_factor, sizeof(m_scale_factor), key);
 
+    return key;
+}
+
+void NAR::LearnPoses(LearnContext *ctx)
+{
     cv::Mat X(3,1,CV_32F);
     cv::Mat X2(2,1,CV_32F);
-    cv::Mat resized, warped, inv_affine;
+    cv::Mat warped, inv_affine;
     cv::Mat blurred;
     unsigned char patch[NAR_PATCH_SQ];
 
     X.at<float>(2,0) = 1.0f;
 
+    while(true) {
+        size_t p;
+
+        {
+            boost::mutex::scoped_lock lock(ctx->mutex);
+
+            if(ctx->next_pose >= ctx->poses.size()) {
+                break;
+            }
+
+            p = ctx->next_pose++;
+        }
+
+        const LearnPose &pose = ctx->poses[p];
+        float s = ctx->scales[pose.scale];
+        vector <LearnedKeyPoint> &result = ctx->results[p];
+
+        WarpImage(ctx->resized[pose.scale], warped, (float)pose.yaw, (float)pose.pitch, 0.0f, inv_affine);
+
+        vector <cv::Point2f> keypoints;
+        DoGKeyPointExtraction(warped, true, keypoints, blurred, false, cv::Point2i(), cv::Point2i());
+
+        for(size_t i=0; i < keypoints.size(); i++) {
+            // Do sub-pixel using cornerScore function somewhere here
+            float x = keypoints[i].x;
+            float y = keypoints[i].y;
+
+            X.at<float>(0,0) = x;
+            X.at<float>(1,0) = y;
+
+            X2 = inv_affine*X;
+
+            int orig_x = (int)(X2.at<float>(0,0)*s - ctx->off_x + 0.5f);
+            int orig_y = (int)(X2.at<float>(1,0)*s - ctx->off_y + 0.5f);
+
+            if(orig_x < 0 || orig_x >= ctx->AR_object_size.width || orig_y < 0 || orig_y >= ctx->AR_object_size.height) {
+                continue;
+            }
+
+            LearnedKeyPoint kp;
+
+            kp.grid_idx = (orig_y/ctx->grid_size)*ctx->grid_width + orig_x/ctx->grid_size;
+            kp.num_sigs = 0;
+
+            float orientation = ExtractFeatureThread::CalcOrientation(blurred, (int)(x+0.5f), (int)(y+0.5f));
+
+            // 2 possible orientation
+            for(int o=0; o < 2; o++) {
+                if(o == 1) {
+                    orientation += (float)M_PI;
+                }
+
+                if(orientation > 2.0*M_PI) {
+                    orientation -= (float)(2.0*M_PI);
+                }
+
+                if(!ExtractFeatureThread::GetRotatedPatch(blurred, (int)(x+0.5f), (int)(y+0.5f), orientation, patch)) {
+                    continue;
+                }
+
+                NAR_Sig &new_feature = kp.sigs[kp.num_sigs++];
+
+                new_feature = NAR_Sig(); // zero the unused fields, the sigs end up in the cache file
+                new_feature.x = (float)orig_x;
+                new_feature.y = (float)orig_y;
+                new_feature.orientation = orientation;
+                //memcpy(new_feature.patch, patch, NAR_PATCH_SQ);
+
+                ExtractFeatureThread::GetPatchFeatureDescriptor(patch, new_feature.feature);
+            }
+
+            result.push_back(kp);
+        }
+
+        {
+            boost::mutex::scoped_lock lock(ctx->mutex);
+
+            ctx->poses_done++;
+            cout << "Learning pose " << ctx->poses_done << "/" << ctx->poses.size() << endl;
+        }
+    }
+}
+
+void NAR::LearnARObject(const cv::Mat &AR_object, SigDatabaseKey key, vector <NAR_Sig> &sigs)
+{
+    assert(AR_object.type() == CV_8U);
+
+    boost::posix_time::ptime t1, t2;
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+
+    string cache_file;
+
+    if(!m_sig_cache_dir.empty()) {
+        cache_file = SigDatabaseFilename(m_sig_cache_dir, key);
+
+        if(LoadSigDatabase(cache_file, key, sigs)) {
+            t2 = boost::posix_time::microsec_clock::local_time();
+
+            cout << "Loaded AR object from " << cache_file << " in " << (t2-t1).total_milliseconds() << " ms, " << sigs.size() << " features" << endl;
+            return;
+        }
+    }
+
+    LearnContext ctx;
+
+    ctx.AR_object_size = AR_object.size();
+    ctx.grid_size = 2;
+    ctx.grid_width = AR_object.cols / ctx.grid_size;
+    ctx.next_pose = 0;
+    ctx.poses_done = 0;
+
+    int grid_height = AR_object.rows / ctx.grid_size;
+
     // Increase AR_object borders
     cv::Mat big = cv::Mat(AR_object.size()*2, CV_8U);
     cv::rectangle(big, cv::Point(0,0), cv::Point(big.cols-1, big.rows-1), CV_RGB(128,128,128), CV_FILLED);
 
-    int off_x = (big.cols - AR_object.cols) / 2;
-    int off_y = (big.rows - AR_object.rows) / 2;
+    ctx.off_x = (big.cols - AR_object.cols) / 2;
+    ctx.off_y = (big.rows - AR_object.rows) / 2;
 
-    cv::Mat sub = big(cv::Rect(off_x, off_y, AR_object.cols, AR_object.rows));
+    cv::Mat sub = big(cv::Rect(ctx.off_x, ctx.off_y, AR_object.cols, AR_object.rows));
     AR_object.copyTo(sub);
 
-    int grid_width = AR_object.cols / grid_size;
-    int grid_height = AR_object.rows / grid_size;
-
-    vector <int> feature_count(grid_width*grid_height, 0);
-    vector <int> feature_label(grid_width*grid_height, -1);
-    vector < vector<NAR_Sig> > label_features;
-
-    int current_feature_label = 0;
-    int pose_count = 0;
-
     cout << "Learning AR object ..." << endl;
 
     for(int scale=0; scale < m_nscales; scale++) {
@@ -963,78 +1576,69 @@ void NAR::LearnARObject(const cv::Mat &AR_object)
 
         cout << "Image size: " << w << "x" << h << endl;
 
-        cv::resize(big, resized, cv::Size(w,h));
+        ctx.scales.push_back(s);
+        ctx.resized.push_back(cv::Mat());
+        cv::resize(big, ctx.resized.back(), cv::Size(w,h));
 
         for(int yaw=0; yaw <= m_yaw_end; yaw += m_angle_step) {
             for(int pitch=0; pitch <= m_pitch_end; pitch += m_angle_step) {
-                pose_count++;
-                cout << "Learning pose " << pose_count << "/" << total_poses << endl;
-
-                WarpImage(resized, warped, (float)yaw, (float)pitch, 0.0f, inv_affine);
-
-                vector <cv::Point2f> keypoints;
-                DoGKeyPointExtraction(warped, true, keypoints, blurred, false, cv::Point2i(), cv::Point2i());
+                LearnPose pose;
 
-                for(size_t i=0; i < keypoints.size(); i++) {
-                    // Do sub-pixel using cornerScore function somewhere here
-                    float x = keypoints[i].x;
-                    float y = keypoints[i].y;
+                pose.scale = scale;
+                pose.yaw = yaw;
+                pose.pitch = pitch;
 
-                    X.at<float>(0,0) = x;
-                    X.at<float>(1,0) = y;
-
-                    X2 = inv_affine*X;
+                ctx.poses.push_back(pose);
+            }
+        }
+    }
 
-                    int orig_x = (int)(X2.at<float>(0,0)*s - off_x + 0.5f);
-                    int orig_y = (int)(X2.at<float>(1,0)*s - off_y + 0.5f);
+    ctx.results.resize(ctx.poses.size());
 
-                    if(orig_x < 0 || orig_x >= AR_object.cols || orig_y < 0 || orig_y >= AR_object.rows) {
-                        continue;
-                    }
+    // Warp the poses in parallel
+    int num_threads = m_learn_threads > 0 ? m_learn_threads : (int)boost::thread::hardware_concurrency();
 
-                    int idx = (orig_y/grid_size)*grid_width + orig_x/grid_size;
-                    int label = feature_label[idx];
+    num_threads = max(1, min(num_threads, (int)ctx.poses.size()));
 
-                    if(label == -1) {
-                        label = current_feature_label;
-                        feature_label[idx] = label;
+    if(num_threads == 1) {
+        LearnPoses(&ctx);
+    }
+    else {
+        boost::thread_group threads;
 
-                        current_feature_label++;
+        for(int i=0; i < num_threads; i++) {
+            threads.create_thread(boost::bind(&NAR::LearnPoses, this, &ctx));
+        }
 
-                        label_features.resize(current_feature_label);
-                    }
+        threads.join_all();
+    }
 
-                    feature_count[idx]++;
+    // Label the features in pose order, so the result doesn't depend on the number of threads
+    vector <int> feature_count(ctx.grid_width*grid_height, 0);
+    vector <int> feature_label(ctx.grid_width*grid_height, -1);
+    vector < vector<NAR_Sig> > label_features;
 
-                    float orientation = ExtractFeatureThread::CalcOrientation(blurred, (int)(x+0.5f), (int)(y+0.5f));
+    int current_feature_label = 0;
 
-                    // 2 possible orientation
-                    for(int o=0; o < 2; o++) {
-                        if(o == 1) {
-                            orientation += (float)M_PI;
-                        }
+    for(size_t p=0; p < ctx.results.size(); p++) {
+        const vector <LearnedKeyPoint> &result = ctx.results[p];
 
-                        if(orientation > 2.0*M_PI) {
-                            orientation -= (float)(2.0*M_PI);
-                        }
+        for(size_t i=0; i < result.size(); i++) {
+            int idx = result[i].grid_idx;
+            int label = feature_label[idx];
 
-                        if(!m_extract_feature_thread[0].GetRotatedPatch(blurred, (int)(x+0.5f), (int)(y+0.5f), orientation, patch)) {
-                            continue;
-                        }
+            if(label == -1) {
+                label = current_feature_label;
+                feature_label[idx] = label;
 
-                        NAR_Sig new_feature;
+                current_feature_label++;
 
-                        new_feature.x = (float)orig_x;
-                        new_feature.y = (float)orig_y;
-                        new_feature.orientation = orientation;
-                        //memcpy(new_feature.patch, patch, NAR_PATCH_SQ);
+                label_features.resize(current_feature_label);
+            }
 
-                        ExtractFeatureThread::GetPatchFeatureDescriptor(patch, new_feature.feature);
+            feature_count[idx]++;
 
-                        label_features[label].push_back(new_feature);
-                    }
-                }
-            }
+            label_features[label].insert(label_features[label].end(), result[i].sigs, result[i].sigs + result[i].num_sigs);
         }
     }
 
@@ -1050,21 +1654,31 @@ void NAR::LearnARObject(const cv::Mat &AR_object)
 
     sort(count_label.begin(), count_label.end(), greater <pair<int,int> >());
 
-    m_AR_object_sigs.clear();
+    sigs.clear();
     int i=0;
     for(i=0; i < m_max_feature_labels && i < (int)count_label.size(); i++) {
         int label = count_label[i].second;
 
         //cout << i << " features " << label << " " << " seen " << count_label[i].first << " times" << endl;
-        m_AR_object_sigs.insert(m_AR_object_sigs.end(), label_features[label].begin(), label_features[label].end());
+        sigs.insert(sigs.end(), label_features[label].begin(), label_features[label].end());
     }
 
     cout << "Total feature labels " << count_label.size() << endl;
     cout << "Keeping feature labels " << i << endl;
-    cout << "Total features kept " << m_AR_object_sigs.size() << endl;
+    cout << "Total features kept " << sigs.size() << endl;
 
-    // Build the KTree
-    m_ktree.Create(m_AR_object_sigs, m_search_depth);
+    t2 = boost::posix_time::microsec_clock::local_time();
+
+    cout << "Learning took " << (t2-t1).total_milliseconds() << " ms using " << num_threads << " threads" << endl;
+
+    if(!cache_file.empty()) {
+        if(SaveSigDatabase(cache_file, key, sigs)) {
+            cout << "Saved AR object to " << cache_file << endl;
+        }
+        else {
+            cerr << "Can't save AR object to " << cache_file << endl;
+        }
+    }
 }
 
 cv::Mat NAR::MakeRotation4x4(float x, float y, float z)
@@ -1105,6 +1719,8 @@ void NAR::AddNewJob(const cv::Mat &img)
 {
     static unsigned int group_id = 0;
 
+    FinishAddingObjects();
+
     cv::Mat grey;
 
     if(img.channels() == 3) {
@@ -1118,157 +1734,215 @@ void NAR::AddNewJob(const cv::Mat &img)
         exit(-1);
     }
 
-    ThreadJob new_job;
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
 
-    new_job.img = img;
-    new_job.group_id = group_id;
-    group_id++;
+    // While locked, frames skip the keypoint and feature stages and go straight to optical flow.
+    // Frames already in those stages arrive too late and are dropped, only happens when pipelined.
+    // A flow frame would overtake a redetection the same way, so none are sent until it's done.
+    bool flow_only = false;
+
+    {
+        boost::mutex::scoped_lock lock(m_flow_mutex);
+
+        if(m_flow_locked && !m_redetect_pending && m_frames_since_detection < m_redetect_interval) {
+            flow_only = true;
+            m_frames_since_detection++;
+        }
+        else if(!m_redetect_pending) {
+            m_frames_since_detection = 0;
+
+            if(m_flow_locked) {
+                m_redetect_pending = true;
+                m_redetect_group_id = group_id;
+            }
+        }
+    }
+
+    if(flow_only) {
+        ThreadJobPtr new_job = m_job_pool.Get();
+
+        new_job->img = img;
+        new_job->grey = grey;
+        new_job->group_id = group_id;
+        new_job->start_time = now;
+        new_job->flow_only = true;
+
+        AddJob(new_job);
+
+        group_id++;
+        return;
+    }
 
     for(int i=0; i < KEYPOINT_LEVELS; i++) {
+        ThreadJobPtr new_job = m_job_pool.Get();
         float scale = 1.0f;
 
+        new_job->img = img;
+        new_job->group_id = group_id;
+        new_job->start_time = now;
+
         if(i == 0) {
-            new_job.grey = grey;
-            new_job.sub_pixel = false;
+            new_job->grey = grey;
+            new_job->sub_pixel = false;
         }
         else {
             scale = pow(KEYPOINT_SCALE_FACTOR, (float)i);
-            cv::resize(grey, new_job.grey, cv::Size((int)(grey.rows*scale), (int)(grey.cols*scale)));
-            new_job.sub_pixel = true;
+            cv::resize(grey, new_job->grey, cv::Size((int)(grey.rows*scale), (int)(grey.cols*scale)));
+            new_job->sub_pixel = true;
         }
 
-        new_job.scale = scale;
+        new_job->scale = scale;
 
         m_keypoint_thread[i].AddJob(new_job);
     }
+
+    group_id++;
 }
 
-void NAR::DoWork()
+void NAR::DoWork(const ThreadJobPtr &job)
 {
     boost::posix_time::ptime t1, t2;
-    map<int, vector<ThreadJob> > buffer;
-    map<int, vector<ThreadJob> >::iterator iter;
 
-    unsigned int total_time = 0;
-    unsigned int frame_count = 0;
-    m_done = false;
+    // The keypoint/feature stages run in parallel so levels can arrive out of order.
+    // Anything from a frame older than the last one processed is too late to be useful.
+    if(m_group_processed && job->group_id <= m_last_group_id) {
+        return;
+    }
 
-    while(!m_done) {
-        boost::mutex::scoped_lock lock(m_base_mutex);
+    if(job->flow_only) {
+        DoFlowWork(job);
+        return;
+    }
 
-        while(!m_jobs.empty()) {
-            ThreadJob &job = m_jobs.front();
-            buffer[job.group_id].push_back(job);
-            m_jobs.pop_front();
+    vector <ThreadJobPtr> &jobs = m_group_buffer[job->group_id];
+
+    jobs.push_back(job);
+
+    // Wait for all the necessary jobs
+    if((int)jobs.size() < KEYPOINT_LEVELS) {
+        return;
+    }
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+
+    // The full size level carries the image and the full size blurred grey image,
+    // it becomes the final job with the sigs from the other levels appended
+    ThreadJobPtr job_done = jobs[0];
+
+    for(size_t i=1; i < jobs.size(); i++) {
+        if(jobs[i]->scale == 1.0f) {
+            job_done = jobs[i];
         }
+    }
+
+    for(size_t i=0; i < jobs.size(); i++) {
+        // Levels run side by side, the slowest one is the latency of the stage
+        job_done->timing[ThreadJob::KEYPOINT_TIME] = max(job_done->timing[ThreadJob::KEYPOINT_TIME], jobs[i]->timing[ThreadJob::KEYPOINT_TIME]);
+        job_done->timing[ThreadJob::EXTRACT_TIME] = max(job_done->timing[ThreadJob::EXTRACT_TIME], jobs[i]->timing[ThreadJob::EXTRACT_TIME]);
 
-        lock.unlock();
+        if(jobs[i] != job_done) {
+            job_done->sigs.insert(job_done->sigs.end(), jobs[i]->sigs.begin(), jobs[i]->sigs.end());
+        }
+    }
 
-        if(!buffer.empty()) {
-            vector <int> to_erase;
-            unsigned int current_group_id = 0;
-            bool group_id_processed = false;
+    if(m_deterministic) {
+        cv::theRNG() = cv::RNG(job_done->group_id + 1); // RANSAC, otherwise depends on which worker runs this
+    }
 
-            for(iter = buffer.begin(); iter != buffer.end(); ++iter) {
-                vector <ThreadJob> &jobs = iter->second;
+    // Find the object
+    {
+        boost::posix_time::ptime start, end;
+        start = boost::posix_time::microsec_clock::local_time();
 
-                // Got all the necessary jobs
-                if((int)jobs.size() == KEYPOINT_LEVELS) {
-                    t1 = boost::posix_time::microsec_clock::local_time();
+        job_done->status = FindARObject(*job_done);
 
-                    ThreadJob job_done;
+        end = boost::posix_time::microsec_clock::local_time();
+        job_done->timing[ThreadJob::FIND_AR_OBJECT_TIME] = (end-start).total_microseconds()*0.001f;
+        job_done->timing[ThreadJob::LATENCY_TIME] = (end-job_done->start_time).total_microseconds()*0.001f;
 
-                    job_done.img = jobs[0].img;
+        cout << "FindARObject: " << (end-start).total_milliseconds() << " ms" << endl;
+    }
 
-                    current_group_id = jobs[0].group_id;
-                    group_id_processed = true;
+    boost::mutex::scoped_lock lock2(m_job_mutex);
+    m_jobs_done.push_back(job_done);
+    lock2.unlock();
 
-                    for(size_t i=0; i < jobs.size(); i++) {
-                        job_done.sigs.insert(job_done.sigs.end(), jobs[i].sigs.begin(), jobs[i].sigs.end());
+    // Done with the redetection, or with a newer frame if it was dropped on the way
+    {
+        boost::mutex::scoped_lock lock3(m_flow_mutex);
 
-                        // Pass the full size blurred grey image
-                        if(jobs[i].blurred.size() == jobs[i].img.size()) {
-                            job_done.blurred = jobs[i].blurred;
-                        }
-                    }
+        if(m_redetect_pending && job_done->group_id >= m_redetect_group_id) {
+            m_redetect_pending = false;
+        }
+    }
 
-                    // Find the object
-                    {
-                        boost::posix_time::ptime start, end;
-                        start = boost::posix_time::microsec_clock::local_time();
+    t2 = boost::posix_time::microsec_clock::local_time();
 
-                        job_done.status = FindARObject(job_done);
+    UpdateFPS((unsigned int)((t2-t1).total_milliseconds()));
 
-                        end = boost::posix_time::microsec_clock::local_time();
+    m_last_group_id = job_done->group_id;
+    m_group_processed = true;
 
-                        cout << "FindARObject: " << (end-start).total_milliseconds() << " ms" << endl;
-                    }
+    // Delete this and older group_id, if any.
+    // Older ones can happen if the buffer is full in any of the stages.
+    // Resulting in *zombie* group_id that will never get prcoessed.
+    m_group_buffer.erase(m_group_buffer.begin(), m_group_buffer.upper_bound(m_last_group_id));
+}
 
-                    boost::mutex::scoped_lock lock2(m_job_mutex);
-                    m_jobs_done.push_back(job_done);
-                    lock2.unlock();
+void NAR::DoFlowWork(const ThreadJobPtr &job)
+{
+    boost::posix_time::ptime t1, t2;
 
-                    t2 = boost::posix_time::microsec_clock::local_time();
+    t1 = boost::posix_time::microsec_clock::local_time();
 
-                    total_time += (unsigned int)((t2-t1).total_milliseconds());
-                    frame_count++;
+    if(m_deterministic) {
+        cv::theRNG() = cv::RNG(job->group_id + 1);
+    }
 
-                    if(frame_count >= 8) {
-                        boost::mutex::scoped_lock lock3(m_fps_mutex);
-                        m_fps = frame_count*1000.0f / total_time;
+    job->status = TrackFlow(*job);
 
-                        // The effective fps is the fps of the slowest thread
-                        float min_fps = m_fps;
+    t2 = boost::posix_time::microsec_clock::local_time();
+    job->timing[ThreadJob::FIND_AR_OBJECT_TIME] = (t2-t1).total_microseconds()*0.001f;
+    job->timing[ThreadJob::LATENCY_TIME] = (t2-job->start_time).total_microseconds()*0.001f;
 
-                        for(int i=0; i < KEYPOINT_LEVELS; i++) {
-                            if(m_keypoint_thread[i].GetFPS() < min_fps) {
-                                min_fps = m_keypoint_thread[i].GetFPS();
-                            }
+    cout << "TrackFlow: " << (t2-t1).total_milliseconds() << " ms" << endl;
 
-                            if(m_extract_feature_thread[i].GetFPS() < min_fps) {
-                                min_fps = m_extract_feature_thread[i].GetFPS();
-                            }
-                        }
+    boost::mutex::scoped_lock lock2(m_job_mutex);
+    m_jobs_done.push_back(job);
+    lock2.unlock();
 
-                        m_fps = min_fps;
+    UpdateFPS((unsigned int)((t2-t1).total_milliseconds()));
 
-                        lock3.unlock();
-                        total_time = 0;
-                        frame_count = 0;
-                    }
+    m_last_group_id = job->group_id;
+    m_group_processed = true;
 
-                    to_erase.push_back(jobs[0].group_id);
-                }
-            }
+    // Levels of a frame sent for detection before this one can't be used any more
+    m_group_buffer.erase(m_group_buffer.begin(), m_group_buffer.upper_bound(m_last_group_id));
+}
 
-            // Delete older group_id than current, if any.
-            // This can happen if the buffer is full in any of the threads.
-            // Resulting in *zombie* group_id that will never get prcoessed.
-            if(group_id_processed) {
-                for(iter = buffer.begin(); iter != buffer.end(); ++iter) {
-                    unsigned int id = iter->first;
-                    if(id < current_group_id) {
-                       // cout << "ZOMBIE ID FOUND! " << id << endl;
-                        to_erase.push_back(id);
-                    }
-                }
-            }
+float NAR::GetFPS()
+{
+    // The effective fps is the fps of the slowest stage
+    float min_fps = BaseThread::GetFPS();
 
-            for(size_t i=0; i < to_erase.size(); i++) {
-                buffer.erase(to_erase[i]);
-            }
-        }
-        else {
-            boost::thread::yield();
-        }
+    for(int i=0; i < KEYPOINT_LEVELS; i++) {
+        min_fps = min(min_fps, m_keypoint_thread[i].GetFPS());
+        min_fps = min(min_fps, m_extract_feature_thread[i].GetFPS());
     }
+
+    return min_fps;
 }
 
-std::deque <ThreadJob>& NAR::GetJobsDone()
+std::deque <ThreadJobPtr>& NAR::GetJobsDone()
 {
     return m_jobs_done;
 }
 
+bool NAR::WaitIdle(int timeout_ms)
+{
+    return m_scheduler.WaitIdle(timeout_ms);
+}
+
 size_t NAR::GetARObjectSigSizeBytes()
 {
     return m_AR_object_sigs.size() * sizeof(NAR_Sig);
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <deque>
+#include <map>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <opencv2/features2d/features2d.hpp>
@@ -11,10 +12,16 @@
 #include "NAR_Config.h"
 #include "KTree.h"
 #include "AlphaBetaTracker.h"
-#include "KTree.h"
+#include "HammingMatcher.h"
 #include "ThreadJob.h"
 #include "KeyPointThread.h"
 #include "ExtractFeatureThread.h"
+#include "StageScheduler.h"
+#include "ThreadJobPool.h"
+#include "SigDatabase.h"
+#include "ARTarget.h"
+
+struct LearnContext;
 
 class NAR : public BaseThread
 {
@@ -25,23 +32,40 @@ public:
     ~NAR();
 
     // YOU MUST CALL THESE TWO FUNCTIONS
-    void SetARObject(const cv::Mat &AR_object); // You must call this once
+    void SetARObject(const cv::Mat &AR_object); // You must call this once, replaces any AR objects already added
     void SetCameraCentre(double cx, double cy);
 
+    // Tracking more than one AR object. All the objects share one K-Tree, so the cost of a frame
+    // depends on how many are visible, not how many were added. Add them before the first frame.
+    int AddARObject(const cv::Mat &AR_object); // returns the target id used in ThreadJob::targets
+    void FinishAddingObjects(); // builds the K-Tree, otherwise done by the first AddNewJob
+    int GetNumARObjects() const { return (int)m_targets.size(); }
+
     // These functions get called every video frame
     void AddNewJob(const cv::Mat &img); // avoid naming conflict from BaseThread::AddJob(...)
-    std::deque <ThreadJob>& GetJobsDone();
+    std::deque <ThreadJobPtr>& GetJobsDone();
+    bool WaitIdle(int timeout_ms); // waits until every frame sent has been processed or dropped, false on timeout
 
     // All settings below have default values
     void SetCameraFOV(double fov); // horizontal degrees
     void SetSearchDepth(int depth);
+    void SetSearchBranching(int branching); // K-Tree children per node, set before the first frame
+    void SetSearchChecks(int checks); // features compared per query before the K-Tree search stops backtracking
     void SetRASNACThreshold(double threshold);
     void SetMinInliers(int m);
     void SetSearchRegionPadding(int padding);
     void SetMaxSigDist(int max_sig_dist);
+    void SetMatchRatio(float ratio); // ratio test on the best two matches, 1 = off
     void SetAlphaBeta(double alpha, double beta);
     void SetMaxFailedFrames(int n);
     void SetMaxOpticalFlowTracks(int n);
+    void SetInputOverflowPolicy(OverflowPolicy policy); // what AddNewJob does when the pipeline is full, default DROP_OLDEST
+    void SetFlowTracking(bool on); // once locked on, track with optical flow alone and only run detection when the lock is lost, default off
+    void SetRedetectInterval(int frames); // flow tracking runs detection at least this often anyway, to find new targets, default 10
+    int GetRedetectInterval() const { return m_redetect_interval; }
+    void SetMaxFlowError(double error); // mean reprojection error in pixels that loses the flow lock, default 2
+    void SetMinFlowInliers(int n); // flow tracks needed to keep the lock, default 20
+    void SetDeterministic(bool on); // seeds RANSAC from the frame number so replaying the same frames gives the same poses, default off
 
     // Parameters used to learn the AR object
     void SetAngleStep(int angle_step);
@@ -50,8 +74,11 @@ public:
     void SetScaleFactor(float scale_factor);
     void SetNumScales(int nscales);
     void SetMaxFeatureLabels(int max_feature_labels);
+    void SetLearnThreads(int n); // threads warping the AR object, 0 = one per core (default)
+    void SetSigCacheDir(const std::string &dir); // learnt AR objects are cached here, empty disables caching (default)
 
     double GetOpenGLFOV() const; // For OpenGL, vertical fov, instead of horizontal
+    virtual float GetFPS(); // effective fps, the fps of the slowest stage
 
     static cv::Mat CorrectRotationForOpenGL(const cv::Mat &rot); // assumes x is right, y is up, +ve z is out of the screen,
     static void GetYPR(const cv::Mat &rotation, double &yaw, double &pitch, double &roll); // decomposes 3x3 rotation matrix
@@ -59,34 +86,43 @@ public:
     // Debug/visual feedback functions
     size_t GetARObjectSigSizeBytes(); // returns the size of AR object signature in bytes
     void DumpMatches(); // for debugging individual matches
-    std::vector <cv::Point2f>& GetOFTracks() { return m_prev_optical_flow_pts; }
+    std::vector <cv::Point2f>& GetOFTracks(int target_id = 0) { return m_targets[target_id].prev_optical_flow_pts; }
 
     boost::mutex m_job_mutex;
 
 private:
-    virtual void DoWork();
+    virtual void DoWork(const ThreadJobPtr &job);
+    void DoFlowWork(const ThreadJobPtr &job); // DoWork for frames that skipped detection
 
     // FindARObject processing pipeline
     int FindARObject(const cv::Mat &grey);
-    bool FeatureMatching(ThreadJob &job, std::vector <NAR_Sig> &matches);
+    bool FeatureMatching(ThreadJob &job, std::map <int, std::vector<NAR_Sig> > &matches); // matches per target id
+    void TrackTarget(ThreadJob &job, int target_id, std::vector <NAR_Sig> &matches); // rest of the pipeline for one target
     bool FilterOrientation(std::vector <NAR_Sig> &input, std::vector <NAR_Sig> &output, int top = 0); // filter inconsistent oriented sigs
-    bool Homography(ThreadJob &job, const std::vector <NAR_Sig> &matches, cv::Mat &H);
-    bool PoseEstimation(const cv::Mat &H);
-    void UpdateAlphaBetaTracker(ThreadJob &job);
-    void UpdateSearchRegion(ThreadJob &job);
-    void UpdateOpticalFlowTracks(ThreadJob &job, const cv::Mat &H, const cv::Mat &cur_grey);
-
-    void LearnARObject(const cv::Mat &AR_object);
+    bool Homography(ThreadJob &job, ARTarget &target, TargetResult &result, const std::vector <NAR_Sig> &matches, cv::Mat &H);
+    bool PoseEstimation(ThreadJob &job, ARTarget &target, const cv::Mat &H);
+    void UpdateAlphaBetaTracker(ARTarget &target, TargetResult &result);
+    void UpdateSearchRegion(ThreadJob &job); // union of the targets' regions
+    int SingleTargetResult(ThreadJob &job); // copies target 0's result to the single target fields, returns its status
+
+    // Flow tracking pipeline, replaces FindARObject while locked
+    int TrackFlow(ThreadJob &job);
+    void FlowTrackTarget(ThreadJob &job, int target_id);
+    bool FlowHomography(ThreadJob &job, ARTarget &target, TargetResult &result, cv::Mat &H); // homography from the tracks alone
+    void UpdateFlowLock(ThreadJob &job); // whether the next frame can skip detection
+    void UpdateOpticalFlowTracks(ARTarget &target, TargetResult &result, const cv::Mat &H, const cv::Mat &cur_grey);
+
+    void LearnARObject(const cv::Mat &AR_object, SigDatabaseKey key, std::vector <NAR_Sig> &sigs);
+    void BuildIndex(); // K-Tree over the sigs of all the targets
+    void LearnPoses(LearnContext *ctx); // worker for LearnARObject
+    SigDatabaseKey GetSigDatabaseKey(const cv::Mat &AR_object) const; // AR object + learning parameters
     void UpdateParameters(); // sets the 3x3 camera matrix
     int FindARObject(ThreadJob &job);
 
     float ShortestAngle(float a, float b); // shortest angle from a to be
-    void ProjectModel(double x, double y, double z, double yaw, double pitch, double roll, cv::Point2i ret_corners[4]);
-    StatusCode DetectionFailed(); // called when detection has failed
-    void PredictSearchRegion(cv::Point &ret_start, cv::Point &ret_end);
-
-    int BitCount(unsigned int u);
-    int HammingDistance(const unsigned char *a, const unsigned char *b);
+    void ProjectModel(const ARTarget &target, double x, double y, double z, double yaw, double pitch, double roll, cv::Point2i ret_corners[4]);
+    StatusCode DetectionFailed(ARTarget &target); // called when detection has failed
+    void PredictSearchRegion(ARTarget &target, cv::Point &ret_start, cv::Point &ret_end);
 
     static cv::Mat MakeRotation3x3(double yaw, double pitch, double roll); // compose yaw pitch roll to 3x3 rotation matrix
     static cv::Mat MakeRotation4x4(float x, float y, float z); // used by WarpImage()
@@ -98,9 +134,17 @@ private:
     double m_cx, m_cy; // camera optical centre
     double m_RANSAC_threshold;
     int m_search_depth;
+    int m_search_branching;
+    int m_search_checks;
     int m_min_inliers;
     int m_search_region_padding;
     int m_max_sig_dist;
+    float m_match_ratio;
+    bool m_deterministic;
+    bool m_flow_tracking;
+    int m_redetect_interval;
+    double m_max_flow_error;
+    int m_min_flow_inliers;
     // End parameters
 
     // Parameters used to learn the AR object
@@ -111,45 +155,49 @@ private:
     int m_nscales;
     int m_max_feature_labels;
     int m_max_optical_flow_tracks;
+    int m_learn_threads;
+    std::string m_sig_cache_dir;
     // End parameters
 
     // Opengl specific
     double m_focal; // calculated from m_fov and model size
     double m_vfov; // for OpenGL, vertical field of view in degrees
 
-    // Geometry specific to camera and AR object
-    int m_AR_object_width, m_AR_object_height;
+    // Geometry specific to camera
     cv::Mat m_camera_intrinsics; // 3x3 camera matrix
     cv::Mat m_inv_camera_intrinsics; // 3x3 camera matrix
-    cv::Mat m_AR_object_image_pts; // 4 corners, image points, never changes
-    cv::Mat m_AR_oject_worlds_pts; // 4 corners, world points, constantly changing
 
-    // From pose estimation
-    cv::Mat m_AR_object_rotation;
-    cv::Mat m_AR_object_translation;
+    // AR objects
+    std::vector <ARTarget> m_targets;
 
-    // Searching
+    // Searching, one index for all the targets
     KTree m_ktree;
+    HammingMatcher m_matcher;
     std::vector <NAR_Sig> m_AR_object_sigs;
-    cv::Point2i m_region_start, m_region_end; // limits the search space in the image
+    std::vector <int> m_sig_target; // target id of each of m_AR_object_sigs
+    SigDatabaseKey m_index_key; // all the targets' keys, for caching the combined index
+    bool m_index_built; // false until FinishAddingObjects after the last AddARObject
 
     // For smoothing out the pose estimation
-    AlphaBetaTracker m_tracker;
-    int m_failed_frames; // number of consecutive failed detection
+    double m_alpha, m_beta;
     int m_max_consecutive_fails;
 
     // Threading
-    std::deque <ThreadJob> m_jobs_done;
+    ThreadJobPool m_job_pool; // recycles the jobs passed down the pipeline
+    std::deque <ThreadJobPtr> m_jobs_done;
+    std::map <unsigned int, std::vector<ThreadJobPtr> > m_group_buffer; // jobs from each pyramid level, waiting for the rest
+    unsigned int m_last_group_id; // last frame passed to FindARObject
+    bool m_group_processed;
+    StageScheduler m_scheduler; // must outlive the stages below
     KeyPointThread m_keypoint_thread[KEYPOINT_LEVELS];
     ExtractFeatureThread m_extract_feature_thread[KEYPOINT_LEVELS];
 
-    // Optical flow assist
-    std::vector <cv::Point2f> m_prev_optical_flow_pts;
-    std::vector <cv::Point2f> m_prev_AR_object_pts;
-    int m_optical_flow_frame_count; // increments where this significant movement
-    cv::Point2f m_avg_optical_flow;
-    int m_last_optical_flow_size;
-    cv::Mat m_prev_grey;
+    // Flow tracking, set by the NAR stage and read by AddNewJob
+    boost::mutex m_flow_mutex;
+    bool m_flow_locked;
+    int m_frames_since_detection;
+    bool m_redetect_pending; // a detection frame sent while locked hasn't reached the NAR stage yet
+    unsigned int m_redetect_group_id;
 };
 
 #endif
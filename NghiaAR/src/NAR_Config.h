@@ -20,4 +20,21 @@ const int BORDER = NAR_PATCH_SIZE;
 #define TO_RAD(x) (x*0.0174532925199433)
 #define TO_DEG(x) (x*57.2957795130823)
 
+// SIMD code paths are compiled in when the compiler can, and picked at runtime using CpuID.h
+#if defined(__GNUC__)
+    #define NAR_TARGET(x) __attribute__((target(x)))
+    #define NAR_HAVE_SSSE3
+    #if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+        #define NAR_HAVE_AVX2
+    #endif
+#elif defined(_MSC_VER)
+    #define NAR_TARGET(x)
+    #define NAR_HAVE_SSSE3
+    #if _MSC_VER >= 1700 // VS2012
+        #define NAR_HAVE_AVX2
+    #endif
+#else
+    #define NAR_TARGET(x)
+#endif
+
 #endif
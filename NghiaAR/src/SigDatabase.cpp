@@ -0,0 +1,199 @@
+#include "SigDatabase.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace std;
+
+struct SigDatabaseHeader
+{
+    char magic[4]; // "NARS"
+    boost::uint32_t version;
+    SigDatabaseKey key;
+    boost::uint32_t sig_bytes; // sizeof(NAR_Sig)
+    boost::uint32_t feature_bytes;
+    boost::uint32_t num_sigs;
+    boost::uint32_t tree_bytes;
+};
+
+static const char SIG_DATABASE_MAGIC[4] = {'N','A','R','S'};
+
+SigDatabaseKey SigDatabaseHash(const void *data, size_t size, SigDatabaseKey seed)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    SigDatabaseKey h = seed;
+
+    for(size_t i=0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+SigDatabaseKey SigDatabaseHashImage(const cv::Mat &img, SigDatabaseKey seed)
+{
+    int header[3] = {img.cols, img.rows, img.type()};
+    SigDatabaseKey h = SigDatabaseHash(header, sizeof(header), seed);
+
+    // Row by row, img might be a sub-image
+    for(int y=0; y < img.rows; y++) {
+        h = SigDatabaseHash(img.ptr(y), img.cols*img.elemSize(), h);
+    }
+
+    return h;
+}
+
+string SigDatabaseFilename(const string &dir, SigDatabaseKey key)
+{
+    stringstream str;
+
+    str << dir;
+
+    if(!dir.empty() && dir[dir.size()-1] != '/' && dir[dir.size()-1] != '\\') {
+        str << "/";
+    }
+
+    str << "nar_" << hex << setw(16) << setfill('0') << key << ".sig";
+
+    return str.str();
+}
+
+static bool LoadSigDatabase(const string &filename, SigDatabaseKey key, vector <NAR_Sig> &sigs, KTree *tree)
+{
+    using namespace boost::interprocess;
+
+    try {
+        // Check it exists first, file_mapping throws otherwise
+        {
+            ifstream test(filename.c_str(), ios::binary);
+
+            if(!test) {
+                return false;
+            }
+        }
+
+        file_mapping file(filename.c_str(), read_only);
+        mapped_region region(file, read_only);
+
+        const unsigned char *data = (const unsigned char*)region.get_address();
+        size_t size = region.get_size();
+        SigDatabaseHeader header;
+
+        if(size < sizeof(header)) {
+            return false;
+        }
+
+        memcpy(&header, data, sizeof(header));
+
+        if(memcmp(header.magic, SIG_DATABASE_MAGIC, 4) != 0 ||
+           header.version != SIG_DATABASE_VERSION ||
+           header.key != key ||
+           header.sig_bytes != sizeof(NAR_Sig) ||
+           header.feature_bytes != FEATURE_BYTES) {
+            return false;
+        }
+
+        size_t sig_bytes = (size_t)header.num_sigs*sizeof(NAR_Sig);
+
+        if(size != sizeof(header) + sig_bytes + header.tree_bytes || header.num_sigs == 0) {
+            return false;
+        }
+
+        sigs.resize(header.num_sigs);
+        memcpy(&sigs[0], data + sizeof(header), sig_bytes);
+
+        if(tree && !tree->Load(sigs, data + sizeof(header) + sig_bytes, header.tree_bytes)) {
+            sigs.clear();
+            return false;
+        }
+    }
+    catch(interprocess_exception &e) {
+        cerr << "Can't map " << filename << ": " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool LoadSigDatabase(const string &filename, SigDatabaseKey key, vector <NAR_Sig> &sigs, KTree &tree)
+{
+    return LoadSigDatabase(filename, key, sigs, &tree);
+}
+
+bool LoadSigDatabase(const string &filename, SigDatabaseKey key, vector <NAR_Sig> &sigs)
+{
+    return LoadSigDatabase(filename, key, sigs, NULL);
+}
+
+static bool SaveSigDatabase(const string &filename, SigDatabaseKey key, const vector <NAR_Sig> &sigs, const KTree *tree)
+{
+    if(sigs.empty()) {
+        return false;
+    }
+
+    vector <unsigned char> tree_buf;
+
+    if(tree) {
+        tree->Save(tree_buf);
+    }
+
+    SigDatabaseHeader header;
+
+    memcpy(header.magic, SIG_DATABASE_MAGIC, 4);
+    header.version = SIG_DATABASE_VERSION;
+    header.key = key;
+    header.sig_bytes = sizeof(NAR_Sig);
+    header.feature_bytes = FEATURE_BYTES;
+    header.num_sigs = (boost::uint32_t)sigs.size();
+    header.tree_bytes = (boost::uint32_t)tree_buf.size();
+
+    // Write to a temporary file first so a reader never maps a half written file
+    string tmp = filename + ".tmp";
+
+    {
+        ofstream out(tmp.c_str(), ios::binary | ios::trunc);
+
+        if(!out) {
+            return false;
+        }
+
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)&sigs[0], sigs.size()*sizeof(NAR_Sig));
+
+        if(!tree_buf.empty()) {
+            out.write((const char*)&tree_buf[0], tree_buf.size());
+        }
+
+        if(!out) {
+            out.close();
+            remove(tmp.c_str());
+            return false;
+        }
+    }
+
+    remove(filename.c_str()); // rename won't overwrite on Windows
+
+    if(rename(tmp.c_str(), filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool SaveSigDatabase(const string &filename, SigDatabaseKey key, const vector <NAR_Sig> &sigs, const KTree &tree)
+{
+    return SaveSigDatabase(filename, key, sigs, &tree);
+}
+
+bool SaveSigDatabase(const string &filename, SigDatabaseKey key, const vector <NAR_Sig> &sigs)
+{
+    return SaveSigDatabase(filename, key, sigs, NULL);
+}
@@ -0,0 +1,42 @@
+#ifndef __SIG_DATABASE_H__
+#define __SIG_DATABASE_H__
+
+/*
+On-disk cache of a learnt AR object's NAR_Sig set, or of every target's sigs and the K-Tree over them.
+Learning an object warps it through every pose, which takes seconds, loading this file takes milliseconds.
+
+The file is a fixed header followed by the raw NAR_Sig array and the flat K-Tree (KTree::Save),
+so it is memory mapped and copied out as is. A single AR object's file has no tree part.
+It is only valid on the machine type that wrote it,
+the header records the struct sizes and anything that doesn't match is treated as a cache miss.
+
+The key is a hash of the AR object image and every parameter that changes the learnt result.
+Bump SIG_DATABASE_VERSION when the feature descriptor changes.
+*/
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <opencv2/core/core.hpp>
+
+#include "NAR_Sig.h"
+#include "KTree.h"
+
+typedef boost::uint64_t SigDatabaseKey;
+
+static const unsigned int SIG_DATABASE_VERSION = 2;
+
+// FNV-1a, chain calls by passing the last key as seed
+SigDatabaseKey SigDatabaseHash(const void *data, size_t size, SigDatabaseKey seed = 14695981039346656037ULL);
+SigDatabaseKey SigDatabaseHashImage(const cv::Mat &img, SigDatabaseKey seed = 14695981039346656037ULL);
+
+std::string SigDatabaseFilename(const std::string &dir, SigDatabaseKey key); // dir/nar_<key in hex>.sig
+
+bool LoadSigDatabase(const std::string &filename, SigDatabaseKey key, std::vector <NAR_Sig> &sigs, KTree &tree);
+bool SaveSigDatabase(const std::string &filename, SigDatabaseKey key, const std::vector <NAR_Sig> &sigs, const KTree &tree);
+
+// Sigs only, loading ignores any tree in the file
+bool LoadSigDatabase(const std::string &filename, SigDatabaseKey key, std::vector <NAR_Sig> &sigs);
+bool SaveSigDatabase(const std::string &filename, SigDatabaseKey key, const std::vector <NAR_Sig> &sigs);
+
+#endif
@@ -0,0 +1,230 @@
+#include "StageScheduler.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+StageScheduler::StageScheduler()
+{
+    m_stop = false;
+}
+
+StageScheduler::~StageScheduler()
+{
+    Stop();
+}
+
+void StageScheduler::Start(int num_workers)
+{
+    if(num_workers <= 0) {
+        num_workers = max(1, (int)boost::thread::hardware_concurrency());
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    m_stop = false;
+
+    for(int i=0; i < num_workers; i++) {
+        boost::thread *t = new boost::thread(boost::bind(&StageScheduler::WorkerLoop, this));
+
+        m_workers.push_back(t);
+        m_worker_ids.push_back(t->get_id());
+    }
+}
+
+void StageScheduler::Stop()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_work_cond.notify_all();
+    m_space_cond.notify_all();
+
+    for(size_t i=0; i < m_workers.size(); i++) {
+        m_workers[i]->join();
+        delete m_workers[i];
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    m_workers.clear();
+    m_worker_ids.clear();
+}
+
+void StageScheduler::Attach(BaseThread *stage)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    if(find(m_stages.begin(), m_stages.end(), stage) == m_stages.end()) {
+        m_stages.push_back(stage);
+    }
+
+    stage->m_attached = true;
+
+    // There might be jobs waiting from before the stage was attached
+    m_work_cond.notify_all();
+}
+
+void StageScheduler::Detach(BaseThread *stage)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    stage->m_attached = false;
+
+    while(stage->m_running > 0) {
+        m_space_cond.wait(lock);
+    }
+
+    m_stages.erase(remove(m_stages.begin(), m_stages.end(), stage), m_stages.end());
+
+    // Anyone blocked on this stage's buffer would wait forever
+    m_space_cond.notify_all();
+}
+
+void StageScheduler::Push(BaseThread *stage, const ThreadJobPtr &job)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    while(stage->m_jobs.size() >= stage->m_buffer_limit) {
+        if(stage->m_overflow_policy == BaseThread::DROP_NEWEST) {
+            cout << stage->m_name << ": buffer full, dropping newest job" << endl;
+            return;
+        }
+        else if(stage->m_overflow_policy == BaseThread::DROP_OLDEST) {
+            cout << stage->m_name << ": buffer full, dropping oldest job" << endl;
+            stage->m_jobs.pop_front();
+        }
+        else {
+            if(m_stop || !stage->m_attached) {
+                return;
+            }
+
+            // A worker waiting on a full stage could end up waiting on itself,
+            // so it helps out by running the stage's job instead.
+            if(IsWorker() && Runnable(stage)) {
+                RunJob(stage, lock);
+            }
+            else {
+                m_space_cond.wait(lock);
+            }
+        }
+    }
+
+    stage->m_jobs.push_back(job);
+
+    m_work_cond.notify_one();
+}
+
+bool StageScheduler::WaitIdle(int timeout_ms)
+{
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout_ms);
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    // A stage passes its job on from inside DoWork, so there is no moment where a job is in neither place
+    while(!Idle()) {
+        if(!m_space_cond.timed_wait(lock, deadline)) {
+            return Idle();
+        }
+    }
+
+    return true;
+}
+
+void StageScheduler::WorkerLoop()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    while(!m_stop) {
+        BaseThread *stage = NextStage();
+
+        if(stage) {
+            RunJob(stage, lock);
+        }
+        else {
+            m_work_cond.wait(lock);
+        }
+    }
+}
+
+bool StageScheduler::IsWorker() const
+{
+    return find(m_worker_ids.begin(), m_worker_ids.end(), boost::this_thread::get_id()) != m_worker_ids.end();
+}
+
+bool StageScheduler::Runnable(const BaseThread *stage) const
+{
+    if(!stage->m_attached || stage->m_jobs.empty()) {
+        return false;
+    }
+
+    if(stage->m_serial && stage->m_running > 0) {
+        return false;
+    }
+
+    return true;
+}
+
+bool StageScheduler::Idle() const
+{
+    for(size_t i=0; i < m_stages.size(); i++) {
+        if(!m_stages[i]->m_jobs.empty() || m_stages[i]->m_running > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+BaseThread* StageScheduler::NextStage() const
+{
+    BaseThread *best = NULL;
+
+    // Oldest frame first, keeps latency down and work moves to the stages that fell behind.
+    // Ties go to the stage with the longest buffer.
+    for(size_t i=0; i < m_stages.size(); i++) {
+        BaseThread *stage = m_stages[i];
+
+        if(!Runnable(stage)) {
+            continue;
+        }
+
+        if(best == NULL) {
+            best = stage;
+            continue;
+        }
+
+        unsigned int id = stage->m_jobs.front()->group_id;
+        unsigned int best_id = best->m_jobs.front()->group_id;
+
+        if(id < best_id || (id == best_id && stage->m_jobs.size() > best->m_jobs.size())) {
+            best = stage;
+        }
+    }
+
+    return best;
+}
+
+void StageScheduler::RunJob(BaseThread *stage, boost::mutex::scoped_lock &lock)
+{
+    ThreadJobPtr job = stage->m_jobs.front();
+    stage->m_jobs.pop_front();
+    stage->m_running++;
+
+    m_space_cond.notify_all();
+
+    lock.unlock();
+    stage->DoWork(job);
+    job = ThreadJobPtr(); // recycling the job can free memory, do it unlocked
+    lock.lock();
+
+    stage->m_running--;
+
+    m_space_cond.notify_all();
+
+    // A serial stage might have more jobs waiting
+    if(stage->m_serial && !stage->m_jobs.empty()) {
+        m_work_cond.notify_one();
+    }
+}
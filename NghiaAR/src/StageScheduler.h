@@ -0,0 +1,53 @@
+#ifndef __STAGE_SCHEDULER_H__
+#define __STAGE_SCHEDULER_H__
+
+/*
+Runs the jobs of a set of pipeline stages (BaseThread) on a shared pool of worker threads.
+
+Idle workers sleep on a condition variable instead of spinning.
+Any worker can pick up any stage's job, the one belonging to the oldest frame (group_id) is picked first.
+This lets the workers move to whichever pyramid level is behind, instead of having one thread pinned per level.
+*/
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "BaseThread.h"
+
+class StageScheduler
+{
+public:
+    StageScheduler();
+    ~StageScheduler();
+
+    void Start(int num_workers = 0); // 0 = one worker per hardware thread
+    void Stop(); // waits for the workers to finish their current job
+
+    void Attach(BaseThread *stage);
+    void Detach(BaseThread *stage);
+    void Push(BaseThread *stage, const ThreadJobPtr &job);
+    bool WaitIdle(int timeout_ms); // waits until no stage has a job queued or running, false on timeout
+
+    int GetNumWorkers() const { return (int)m_worker_ids.size(); }
+
+private:
+    void WorkerLoop();
+    bool IsWorker() const;
+    bool Runnable(const BaseThread *stage) const;
+    bool Idle() const; // requires m_mutex
+    BaseThread* NextStage() const; // requires m_mutex
+    void RunJob(BaseThread *stage, boost::mutex::scoped_lock &lock); // unlocks m_mutex while the job runs
+
+private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_work_cond; // a job can be run
+    boost::condition_variable m_space_cond; // a job left a stage buffer or finished running
+    std::vector <boost::thread*> m_workers;
+    std::vector <boost::thread::id> m_worker_ids;
+    std::vector <BaseThread*> m_stages;
+    bool m_stop;
+};
+
+#endif
@@ -2,9 +2,27 @@
 #define __THREAD_JOB_H__
 
 #include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <opencv2/core/core.hpp>
 #include "NAR_Sig.h"
 
+struct ThreadJobPoolStorage;
+
+// Result for one AR object, see NAR::AddARObject
+struct TargetResult
+{
+    int target_id;
+    int status; // NAR::StatusCode
+    cv::Mat rotation, translation;
+    cv::Point2i corners[4]; // 4 corners of the AR object
+    std::vector <cv::Point2f> matches;
+    std::vector <cv::Point2f> optical_flow_tracks;
+};
+
+// Jobs are passed along the pipeline by handle (ThreadJobPtr) and never copied
 struct ThreadJob
 {
     // These variables processed along the threading pipeline
@@ -16,8 +34,12 @@ struct ThreadJob
     float scale;
     unsigned int group_id;
     bool sub_pixel;
+    bool flow_only; // tracked by optical flow alone, skips the keypoint and feature stages
 
-    // Everything below here is final result of the AR process, used for display
+    // Everything below here is final result of the AR process, used for display.
+    // targets has every AR object found or predicted in this frame, in target id order.
+    // The single target fields after it are a copy of target 0's result.
+    std::vector <TargetResult> targets;
     int status; // return status of the AR process
     cv::Mat rotation, translation;
     std::vector <cv::Point2f> matches;
@@ -25,6 +47,55 @@ struct ThreadJob
     cv::Point2i search_region_start, search_region_end;
     cv::Point2i corners[4]; // 4 corners of the AR object
     std::vector <cv::Point2f> optical_flow_tracks;
+
+    // Profiling, milliseconds spent in each stage. Stages that didn't run are 0.
+    enum Timing {KEYPOINT_TIME=0, EXTRACT_TIME, MATCHING_TIME, HOMOGRAPHY_TIME, POSE_TIME, FIND_AR_OBJECT_TIME, LATENCY_TIME, NUM_TIMINGS};
+    float timing[NUM_TIMINGS]; // LATENCY_TIME is from AddNewJob to the result
+    boost::posix_time::ptime start_time; // when AddNewJob was called
+
+    // Handle bookkeeping, see ThreadJobPool
+    boost::detail::atomic_count ref_count;
+    boost::shared_ptr <ThreadJobPoolStorage> pool; // where to go when the last handle is released, NULL = delete
+
+    ThreadJob() : ref_count(0) { Clear(); }
+
+    // Get ready for re-use, vectors keep their capacity. The Mats are released rather than
+    // reused, the tracker may still share the last grey image as its prev_grey
+    void Clear()
+    {
+        img.release();
+        grey.release();
+        blurred.release();
+        keypoints.clear();
+        sigs.clear();
+        scale = 1.0f;
+        group_id = 0;
+        sub_pixel = false;
+        flow_only = false;
+
+        targets.clear();
+        status = 0;
+        rotation.release();
+        translation.release();
+        matches.clear();
+        use_search_region = false;
+        optical_flow_tracks.clear();
+
+        for(int i=0; i < NUM_TIMINGS; i++) {
+            timing[i] = 0.0f;
+        }
+
+        start_time = boost::posix_time::ptime();
+    }
+
+private:
+    ThreadJob(const ThreadJob&);
+    ThreadJob& operator=(const ThreadJob&);
 };
 
+void intrusive_ptr_add_ref(ThreadJob *job);
+void intrusive_ptr_release(ThreadJob *job);
+
+typedef boost::intrusive_ptr <ThreadJob> ThreadJobPtr;
+
 #endif
@@ -0,0 +1,90 @@
+#include "ThreadJobPool.h"
+
+using namespace std;
+
+ThreadJobPool::ThreadJobPool(unsigned int max_free)
+{
+    m_storage.reset(new ThreadJobPoolStorage());
+    m_storage->max_free = max_free;
+    m_storage->allocated = 0;
+    m_storage->closed = false;
+}
+
+ThreadJobPool::~ThreadJobPool()
+{
+    vector <ThreadJob*> free_jobs;
+
+    {
+        boost::mutex::scoped_lock lock(m_storage->mutex);
+        m_storage->closed = true;
+        free_jobs.swap(m_storage->free_jobs);
+    }
+
+    // Jobs still in use delete themselves when released
+    for(size_t i=0; i < free_jobs.size(); i++) {
+        delete free_jobs[i];
+    }
+}
+
+ThreadJobPtr ThreadJobPool::Get()
+{
+    ThreadJob *job = NULL;
+
+    {
+        boost::mutex::scoped_lock lock(m_storage->mutex);
+
+        if(!m_storage->free_jobs.empty()) {
+            job = m_storage->free_jobs.back();
+            m_storage->free_jobs.pop_back();
+        }
+        else {
+            m_storage->allocated++;
+        }
+    }
+
+    if(!job) {
+        job = new ThreadJob();
+        job->pool = m_storage;
+    }
+
+    return ThreadJobPtr(job);
+}
+
+unsigned int ThreadJobPool::GetNumAllocated() const
+{
+    boost::mutex::scoped_lock lock(m_storage->mutex);
+    return m_storage->allocated;
+}
+
+void intrusive_ptr_add_ref(ThreadJob *job)
+{
+    ++job->ref_count;
+}
+
+void intrusive_ptr_release(ThreadJob *job)
+{
+    if(--job->ref_count != 0) {
+        return;
+    }
+
+    if(!job->pool) {
+        delete job;
+        return;
+    }
+
+    // Drop the image references outside the lock, might free memory
+    job->Clear();
+
+    ThreadJobPoolStorage &storage = *job->pool;
+    boost::mutex::scoped_lock lock(storage.mutex);
+
+    if(!storage.closed && storage.free_jobs.size() < storage.max_free) {
+        storage.free_jobs.push_back(job);
+        return;
+    }
+
+    storage.allocated--;
+    lock.unlock();
+
+    delete job; // might be the last reference to the storage
+}
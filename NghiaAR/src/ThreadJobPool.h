@@ -0,0 +1,39 @@
+#ifndef __THREAD_JOB_POOL_H__
+#define __THREAD_JOB_POOL_H__
+
+/*
+Recycles ThreadJob objects so the keypoint and sig vectors keep their capacity from frame to frame.
+The img, grey and blurred Mats are still allocated every frame, Clear() has to release them
+because tracking keeps a reference to the previous grey image.
+Handles can safely outlive the pool.
+*/
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "ThreadJob.h"
+
+struct ThreadJobPoolStorage
+{
+    boost::mutex mutex;
+    std::vector <ThreadJob*> free_jobs;
+    unsigned int max_free;
+    unsigned int allocated;
+    bool closed; // pool has been destroyed, released jobs are deleted
+};
+
+class ThreadJobPool
+{
+public:
+    ThreadJobPool(unsigned int max_free = 64);
+    ~ThreadJobPool();
+
+    ThreadJobPtr Get(); // a cleared job, recycled if possible
+    unsigned int GetNumAllocated() const; // jobs alive, stops growing at steady state
+
+private:
+    boost::shared_ptr <ThreadJobPoolStorage> m_storage;
+};
+
+#endif
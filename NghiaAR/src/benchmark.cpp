@@ -0,0 +1,637 @@
+/*
+Headless benchmark and replay harness for NAR.
+
+Replays recorded frames through the full pipeline without a camera or a window and
+reports the time spent in each stage, the detection rate and, given ground truth, the pose error.
+Frames are fed one at a time and the result waited for, so every run of the same frames is
+comparable (--pipelined feeds them as fast as the pipeline takes them, for throughput).
+
+Usage: NghiaAR_Benchmark <AR object image> <frames> [options]
+
+<frames> is a directory of images (read in filename order), a video file, or with --raw WxH
+a file of 8 bit grey frames stored back to back.
+
+Ground truth file, one line per frame, angles in degrees, # starts a comment:
+    frame x y z yaw pitch roll
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "NAR.h"
+
+#ifdef _WIN32
+	#ifdef _DEBUG
+	#pragma comment(lib, "opencv_calib3d233d.lib")
+	#pragma comment(lib, "opencv_core233d.lib")
+	#pragma comment(lib, "opencv_features2d233d.lib")
+	#pragma comment(lib, "opencv_highgui233d.lib")
+	#pragma comment(lib, "opencv_imgproc233d.lib")
+	#pragma comment(lib, "opencv_ml233d.lib")
+	#pragma comment(lib, "opencv_video233d.lib")
+#else
+	#pragma comment(lib, "opencv_calib3d233.lib")
+	#pragma comment(lib, "opencv_core233.lib")
+	#pragma comment(lib, "opencv_features2d233.lib")
+	#pragma comment(lib, "opencv_highgui233.lib")
+	#pragma comment(lib, "opencv_imgproc233.lib")
+	#pragma comment(lib, "opencv_ml233.lib")
+	#pragma comment(lib, "opencv_video233.lib")
+	#endif
+#endif
+
+using namespace std;
+
+static const char *TIMING_NAMES[ThreadJob::NUM_TIMINGS] = {"Keypoints", "Extract features", "Matching", "Homography", "Pose", "FindARObject", "Latency"};
+static const int RESULT_TIMEOUT = 10000; // ms to wait for a frame in lock-step mode, or for the pipeline to drain
+
+// Swallows NAR's per-frame console output
+class NullBuffer : public streambuf
+{
+protected:
+    virtual int overflow(int c) { return c; }
+};
+
+struct Pose
+{
+    double x, y, z;
+    double yaw, pitch, roll; // degrees
+};
+
+struct FrameResult
+{
+    bool done;
+    bool flow_only;
+    int status;
+    Pose pose;
+    float timing[ThreadJob::NUM_TIMINGS];
+};
+
+// Reads frames from a directory, a video or a raw grey file
+class FrameSource
+{
+public:
+    FrameSource()
+    {
+        m_raw_width = m_raw_height = 0;
+        m_next = 0;
+    }
+
+    bool Open(const string &path, int raw_width, int raw_height)
+    {
+        m_raw_width = raw_width;
+        m_raw_height = raw_height;
+
+        if(raw_width > 0) {
+            m_raw.open(path.c_str(), ios::binary);
+            return m_raw.good();
+        }
+
+        if(boost::filesystem::is_directory(path)) {
+            boost::filesystem::directory_iterator end;
+
+            for(boost::filesystem::directory_iterator it(path); it != end; ++it) {
+                string file = it->path().string();
+                string ext = file.substr(min(file.size(), file.rfind('.')));
+                transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+                if(ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".pgm" || ext == ".ppm" || ext == ".tif") {
+                    m_files.push_back(it->path().string());
+                }
+            }
+
+            sort(m_files.begin(), m_files.end());
+
+            return !m_files.empty();
+        }
+
+        return m_video.open(path) && m_video.isOpened();
+    }
+
+    bool Next(cv::Mat &frame)
+    {
+        if(m_raw_width > 0) {
+            frame.create(m_raw_height, m_raw_width, CV_8U);
+            m_raw.read((char*)frame.data, m_raw_width*m_raw_height);
+
+            return m_raw.gcount() == m_raw_width*m_raw_height;
+        }
+
+        if(!m_files.empty()) {
+            if(m_next >= m_files.size()) {
+                return false;
+            }
+
+            frame = cv::imread(m_files[m_next++]);
+
+            if(!frame.data) {
+                cerr << "Can't read " << m_files[m_next-1] << endl;
+                return false;
+            }
+
+            return true;
+        }
+
+        cv::Mat tmp;
+
+        if(!m_video.read(tmp) || tmp.empty()) {
+            return false;
+        }
+
+        frame = tmp.clone(); // the capture reuses its buffer, the pipeline still holds the last frame
+
+        return true;
+    }
+
+private:
+    int m_raw_width, m_raw_height;
+    ifstream m_raw;
+    vector <string> m_files;
+    size_t m_next;
+    cv::VideoCapture m_video;
+};
+
+static void Usage()
+{
+    cerr << "Usage: NghiaAR_Benchmark <AR object image> <frames> [options]" << endl;
+    cerr << endl;
+    cerr << "<frames> is a directory of images, a video file, or a raw file with --raw" << endl;
+    cerr << endl;
+    cerr << "Options" << endl;
+    cerr << "    --raw WxH               frames are 8 bit grey, back to back" << endl;
+    cerr << "    --max-frames n          stop after n frames" << endl;
+    cerr << "    --fov degrees           horizontal field of view" << endl;
+    cerr << "    --search-depth n" << endl;
+    cerr << "    --search-branching n" << endl;
+    cerr << "    --search-checks n" << endl;
+    cerr << "    --max-sig-dist n" << endl;
+    cerr << "    --match-ratio r" << endl;
+    cerr << "    --min-inliers n" << endl;
+    cerr << "    --sig-cache dir         cache the learnt AR object in dir" << endl;
+    cerr << "    --flow-tracking         track with optical flow alone once locked" << endl;
+    cerr << "    --redetect-interval n   with --flow-tracking, detect at least every n frames" << endl;
+    cerr << "    --max-flow-error px     with --flow-tracking, reprojection error that loses the lock" << endl;
+    cerr << "    --pipelined             feed frames as fast as possible, measures throughput" << endl;
+    cerr << "    --ground-truth file     lines of: frame x y z yaw pitch roll" << endl;
+    cerr << "    --save-poses file       same format as --ground-truth, for recording a reference run" << endl;
+    cerr << "    --verbose               keep NAR's console output" << endl;
+}
+
+static bool LoadGroundTruth(const string &filename, map <int, Pose> &gt)
+{
+    ifstream in(filename.c_str());
+
+    if(!in) {
+        return false;
+    }
+
+    string line;
+
+    while(getline(in, line)) {
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        stringstream str(line);
+        int frame;
+        Pose p;
+
+        if(str >> frame >> p.x >> p.y >> p.z >> p.yaw >> p.pitch >> p.roll) {
+            gt[frame] = p;
+        }
+    }
+
+    return true;
+}
+
+static double AngleDiff(double a, double b) // degrees
+{
+    double d = fmod(fabs(a - b), 360.0);
+
+    return d > 180.0 ? 360.0 - d : d;
+}
+
+static double TranslationError(const Pose &a, const Pose &b)
+{
+    return sqrt((a.x-b.x)*(a.x-b.x) + (a.y-b.y)*(a.y-b.y) + (a.z-b.z)*(a.z-b.z));
+}
+
+static double RotationError(const Pose &a, const Pose &b)
+{
+    return max(AngleDiff(a.yaw, b.yaw), max(AngleDiff(a.pitch, b.pitch), AngleDiff(a.roll, b.roll)));
+}
+
+static float Percentile(vector <float> v, float p) // v is sorted on a copy
+{
+    if(v.empty()) {
+        return 0.0f;
+    }
+
+    sort(v.begin(), v.end());
+
+    size_t idx = (size_t)(p*(v.size() - 1) + 0.5f);
+
+    return v[min(idx, v.size() - 1)];
+}
+
+static void GetResult(const ThreadJobPtr &job, FrameResult &r)
+{
+    r.done = true;
+    r.flow_only = job->flow_only;
+    r.status = job->status;
+
+    for(int i=0; i < ThreadJob::NUM_TIMINGS; i++) {
+        r.timing[i] = job->timing[i];
+    }
+
+    if(job->status != NAR::BAD && !job->translation.empty() && !job->rotation.empty()) {
+        double yaw, pitch, roll;
+
+        NAR::GetYPR(job->rotation, yaw, pitch, roll);
+
+        r.pose.x = job->translation.at<double>(0,0);
+        r.pose.y = job->translation.at<double>(1,0);
+        r.pose.z = job->translation.at<double>(2,0);
+        r.pose.yaw = TO_DEG(yaw);
+        r.pose.pitch = TO_DEG(pitch);
+        r.pose.roll = TO_DEG(roll);
+    }
+}
+
+// Moves finished jobs into results, returns how many were collected.
+// last_result is set to the time of the call if there were any.
+static int CollectResults(NAR &nar, unsigned int first_group_id, vector <FrameResult> &results, boost::posix_time::ptime &last_result)
+{
+    int n = 0;
+
+    boost::mutex::scoped_lock lock(nar.m_job_mutex);
+
+    while(!nar.GetJobsDone().empty()) {
+        ThreadJobPtr job = nar.GetJobsDone().front();
+        nar.GetJobsDone().pop_front();
+
+        unsigned int idx = job->group_id - first_group_id;
+
+        if(idx < results.size()) {
+            GetResult(job, results[idx]);
+            n++;
+        }
+    }
+
+    if(n) {
+        last_result = boost::posix_time::microsec_clock::local_time();
+    }
+
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3) {
+        Usage();
+        return -1;
+    }
+
+    string AR_object_file = argv[1];
+    string frames_path = argv[2];
+    string ground_truth_file, save_poses_file;
+    int raw_width = 0, raw_height = 0;
+    int max_frames = -1;
+    bool pipelined = false;
+    bool verbose = false;
+
+    NAR *nar = new NAR();
+
+    nar->SetDeterministic(true);
+
+    for(int i=3; i < argc; i++) {
+        string opt = argv[i];
+        bool has_arg = i+1 < argc;
+
+        if(opt == "--pipelined") {
+            pipelined = true;
+        }
+        else if(opt == "--verbose") {
+            verbose = true;
+        }
+        else if(opt == "--flow-tracking") {
+            nar->SetFlowTracking(true);
+        }
+        else if(!has_arg) {
+            cerr << "Missing value for " << opt << endl;
+            Usage();
+            return -1;
+        }
+        else if(opt == "--raw") {
+            if(sscanf(argv[++i], "%dx%d", &raw_width, &raw_height) != 2 || raw_width <= 0 || raw_height <= 0) {
+                cerr << "Invalid --raw size: " << argv[i] << endl;
+                return -1;
+            }
+        }
+        else if(opt == "--max-frames") { max_frames = atoi(argv[++i]); }
+        else if(opt == "--fov") { nar->SetCameraFOV(atof(argv[++i])); }
+        else if(opt == "--search-depth") { nar->SetSearchDepth(atoi(argv[++i])); }
+        else if(opt == "--search-branching") { nar->SetSearchBranching(atoi(argv[++i])); }
+        else if(opt == "--search-checks") { nar->SetSearchChecks(atoi(argv[++i])); }
+        else if(opt == "--max-sig-dist") { nar->SetMaxSigDist(atoi(argv[++i])); }
+        else if(opt == "--match-ratio") { nar->SetMatchRatio((float)atof(argv[++i])); }
+        else if(opt == "--min-inliers") { nar->SetMinInliers(atoi(argv[++i])); }
+        else if(opt == "--sig-cache") { nar->SetSigCacheDir(argv[++i]); }
+        else if(opt == "--redetect-interval") { nar->SetRedetectInterval(atoi(argv[++i])); }
+        else if(opt == "--max-flow-error") { nar->SetMaxFlowError(atof(argv[++i])); }
+        else if(opt == "--ground-truth") { ground_truth_file = argv[++i]; }
+        else if(opt == "--save-poses") { save_poses_file = argv[++i]; }
+        else {
+            cerr << "Unknown option: " << opt << endl;
+            Usage();
+            return -1;
+        }
+    }
+
+    map <int, Pose> ground_truth;
+
+    if(!ground_truth_file.empty() && !LoadGroundTruth(ground_truth_file, ground_truth)) {
+        cerr << "Can't read " << ground_truth_file << endl;
+        return -1;
+    }
+
+    // Read all the frames up front so disk and decoding don't show up in the timings
+    vector <cv::Mat> frames;
+    {
+        FrameSource source;
+
+        if(!source.Open(frames_path, raw_width, raw_height)) {
+            cerr << "Can't open " << frames_path << endl;
+            return -1;
+        }
+
+        cv::Mat frame;
+
+        while((max_frames < 0 || (int)frames.size() < max_frames) && source.Next(frame)) {
+            frames.push_back(frame);
+            frame = cv::Mat();
+        }
+    }
+
+    if(frames.empty()) {
+        cerr << "No frames in " << frames_path << endl;
+        return -1;
+    }
+
+    cv::Mat AR_object = cv::imread(AR_object_file);
+
+    if(!AR_object.data) {
+        cerr << AR_object_file << " not found" << endl;
+        return -1;
+    }
+
+    NullBuffer null_buffer;
+    streambuf *cout_buffer = cout.rdbuf();
+
+    if(!verbose) {
+        cout.rdbuf(&null_buffer);
+    }
+
+    boost::posix_time::ptime t1, t2;
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+    nar->SetARObject(AR_object);
+    nar->FinishAddingObjects(); // keep building the K-Tree out of the first frame's time
+    t2 = boost::posix_time::microsec_clock::local_time();
+
+    float learn_time = (t2-t1).total_microseconds()*0.001f;
+
+    nar->SetCameraCentre(frames[0].cols/2, frames[0].rows/2);
+
+    if(pipelined) {
+        nar->SetInputOverflowPolicy(BaseThread::BLOCK); // measure throughput, not how many frames get dropped
+    }
+
+    nar->Run();
+
+    vector <FrameResult> results(frames.size());
+    unsigned int first_group_id = 0; // NAR numbers frames from 0, one NAR per process
+    size_t collected = 0;
+
+    for(size_t i=0; i < results.size(); i++) {
+        results[i].done = false;
+        results[i].flow_only = false;
+        results[i].status = NAR::BAD;
+    }
+
+    t1 = boost::posix_time::microsec_clock::local_time();
+
+    boost::posix_time::ptime last_result = t1;
+
+    for(size_t i=0; i < frames.size(); i++) {
+        nar->AddNewJob(frames[i]);
+
+        if(pipelined) {
+            collected += CollectResults(*nar, first_group_id, results, last_result);
+            continue;
+        }
+
+        // Lock-step, wait for this frame before sending the next
+        boost::posix_time::ptime wait_start = boost::posix_time::microsec_clock::local_time();
+
+        while(!results[i].done) {
+            collected += CollectResults(*nar, first_group_id, results, last_result);
+
+            if(results[i].done) {
+                break;
+            }
+
+            if((boost::posix_time::microsec_clock::local_time() - wait_start).total_milliseconds() > RESULT_TIMEOUT) {
+                cerr << "Frame " << i << " timed out" << endl;
+                break;
+            }
+
+            boost::this_thread::sleep(boost::posix_time::microseconds(200));
+        }
+    }
+
+    // Drain the pipeline. A frame the pipeline dropped never turns up, so wait for it to go idle
+    // instead of for the last frame. The clock stops at the last result, not when the wait ends.
+    if(pipelined) {
+        if(!nar->WaitIdle(RESULT_TIMEOUT)) {
+            cerr << "Pipeline still busy after " << RESULT_TIMEOUT << " ms" << endl;
+        }
+
+        collected += CollectResults(*nar, first_group_id, results, last_result);
+    }
+
+    t2 = last_result;
+
+    float total_time = (t2-t1).total_microseconds()*0.001f;
+    int redetect_interval = nar->GetRedetectInterval();
+
+    delete nar; // stops the pipeline, before restoring cout
+
+    cout.rdbuf(cout_buffer);
+
+    // Report
+    vector <float> timings[ThreadJob::NUM_TIMINGS];
+    int status_count[3] = {0, 0, 0};
+    int dropped = 0;
+    int flow_frames = 0;
+    int redetections = 0; // detection results delivered straight after a flow frame
+    int flow_run = 0, longest_flow_run = 0;
+    vector <double> trans_errors, rot_errors;
+    double jitter_sum = 0.0;
+    int jitter_count = 0;
+    const FrameResult *prev = NULL;
+    double prev_trans_error = 0.0;
+
+    for(size_t i=0; i < results.size(); i++) {
+        const FrameResult &r = results[i];
+
+        if(!r.done) {
+            dropped++;
+            prev = NULL;
+            continue;
+        }
+
+        status_count[r.status]++;
+
+        // Dropped frames are skipped, a redetection that never arrives shows up as a flow run longer than the interval
+        if(r.flow_only) {
+            flow_frames++;
+            flow_run++;
+            longest_flow_run = max(longest_flow_run, flow_run);
+        }
+        else {
+            if(flow_run) {
+                redetections++;
+            }
+
+            flow_run = 0;
+        }
+
+        for(int j=0; j < ThreadJob::NUM_TIMINGS; j++) {
+            if(r.timing[j] > 0.0f) {
+                timings[j].push_back(r.timing[j]);
+            }
+        }
+
+        if(r.status == NAR::BAD) {
+            prev = NULL;
+            continue;
+        }
+
+        map <int, Pose>::const_iterator gt = ground_truth.find((int)i);
+        double trans_error = 0.0;
+
+        if(gt != ground_truth.end()) {
+            trans_error = TranslationError(r.pose, gt->second);
+            trans_errors.push_back(trans_error);
+            rot_errors.push_back(RotationError(r.pose, gt->second));
+        }
+
+        // Jitter, frame to frame change in the error if there's ground truth, else in the pose itself
+        if(prev) {
+            double d;
+
+            if(gt != ground_truth.end()) {
+                d = trans_error - prev_trans_error;
+            }
+            else {
+                d = TranslationError(r.pose, prev->pose);
+            }
+
+            jitter_sum += d*d;
+            jitter_count++;
+        }
+
+        prev = &r;
+        prev_trans_error = trans_error;
+    }
+
+    cout << fixed << setprecision(2);
+    cout << "Frames: " << frames.size() << " (" << frames[0].cols << "x" << frames[0].rows << ")";
+    cout << (pipelined ? ", pipelined" : ", lock-step") << endl;
+    cout << "Learn AR object: " << learn_time << " ms" << endl;
+    cout << endl;
+
+    cout << left << setw(20) << "Stage (ms)" << right << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << endl;
+
+    for(int i=0; i < ThreadJob::NUM_TIMINGS; i++) {
+        const vector <float> &t = timings[i];
+
+        cout << left << setw(20) << TIMING_NAMES[i] << right;
+        cout << setw(10) << Percentile(t, 0.5f);
+        cout << setw(10) << Percentile(t, 0.9f);
+        cout << setw(10) << Percentile(t, 0.99f);
+        cout << setw(10) << (t.empty() ? 0.0f : *max_element(t.begin(), t.end())) << endl;
+    }
+
+    cout << endl;
+    cout << "Detected: " << status_count[NAR::GOOD] << " (" << 100.0*status_count[NAR::GOOD]/frames.size() << "%)" << endl;
+    cout << "Predicted: " << status_count[NAR::PREDICTION] << " (" << 100.0*status_count[NAR::PREDICTION]/frames.size() << "%)" << endl;
+    cout << "Lost: " << status_count[NAR::BAD] << " (" << 100.0*status_count[NAR::BAD]/frames.size() << "%)" << endl;
+    cout << "Dropped: " << dropped << endl;
+    cout << "Optical flow only: " << flow_frames << " (" << 100.0*flow_frames/frames.size() << "%)" << endl;
+
+    if(flow_frames) {
+        cout << "Redetections: " << redetections << ", longest optical flow run " << longest_flow_run << " frames" << endl;
+    }
+
+    cout << "Throughput: " << (total_time > 0.0f ? collected*1000.0f/total_time : 0.0f) << " fps" << endl;
+
+    if(!trans_errors.empty()) {
+        double t_sum = 0.0, r_sum = 0.0;
+
+        for(size_t i=0; i < trans_errors.size(); i++) {
+            t_sum += trans_errors[i];
+            r_sum += rot_errors[i];
+        }
+
+        cout << "Translation error: mean " << t_sum/trans_errors.size() << ", max " << *max_element(trans_errors.begin(), trans_errors.end()) << endl;
+        cout << "Rotation error (degrees): mean " << r_sum/rot_errors.size() << ", max " << *max_element(rot_errors.begin(), rot_errors.end()) << endl;
+    }
+
+    if(jitter_count) {
+        cout << "Jitter (RMS translation change): " << sqrt(jitter_sum/jitter_count) << endl;
+    }
+
+    bool redetect_failed = longest_flow_run > redetect_interval;
+
+    if(redetect_failed) {
+        cerr << "Optical flow ran " << longest_flow_run << " frames without a redetection, the interval is " << redetect_interval << endl;
+    }
+
+    if(!save_poses_file.empty()) {
+        ofstream out(save_poses_file.c_str());
+
+        if(!out) {
+            cerr << "Can't write " << save_poses_file << endl;
+            return -1;
+        }
+
+        out << "# frame x y z yaw pitch roll" << endl;
+        out << setprecision(6);
+
+        for(size_t i=0; i < results.size(); i++) {
+            const FrameResult &r = results[i];
+
+            if(r.done && r.status != NAR::BAD) {
+                out << i << " " << r.pose.x << " " << r.pose.y << " " << r.pose.z << " " << r.pose.yaw << " " << r.pose.pitch << " " << r.pose.roll << endl;
+            }
+        }
+    }
+
+    return redetect_failed ? 1 : 0;
+}
@@ -114,6 +114,7 @@ int main()
         }
 
         // Give the process thread access to the video thread
+        video_thread.GetNAR().SetSigCacheDir("../media"); // skips learning after the first run
         video_thread.GetNAR().SetARObject(ARObject);
         video_thread.Run();
     }
@@ -216,7 +217,7 @@ int main()
         person->addChild(light);
     }
 
-    ThreadJob last_job;
+    ThreadJobPtr last_job;
     bool job_init = false;
 
     while(device->run() && g_running) {
@@ -234,11 +235,11 @@ int main()
 
             // Image
             unsigned char *tex_buf = (unsigned char*)tex->lock();
-            unsigned char *frame_buf = last_job.img.data;
+            unsigned char *frame_buf = last_job->img.data;
 
             // Convert from RGB to RGBA
-            for(int y=0; y < last_job.img.rows; y++) {
-                for(int x=0; x < last_job.img.cols; x++) {
+            for(int y=0; y < last_job->img.rows; y++) {
+                for(int x=0; x < last_job->img.cols; x++) {
                     *(tex_buf++) = *(frame_buf++);
                     *(tex_buf++) = *(frame_buf++);
                     *(tex_buf++) = *(frame_buf++);
@@ -255,9 +256,9 @@ int main()
         driver->draw2DImage(tex, core::rect<s32>(0,0,VIDEO_WIDTH,VIDEO_HEIGHT), core::rect<s32>(0,0,VIDEO_WIDTH,VIDEO_HEIGHT));
 
         if(job_init) {
-            if(last_job.status == NAR::GOOD) {
-                cv::Mat t = last_job.translation;
-                cv::Mat R = last_job.rotation;
+            if(last_job->status == NAR::GOOD) {
+                cv::Mat t = last_job->translation;
+                cv::Mat R = last_job->rotation;
 
                 float tx = (float)t.at<double>(0,0);
                 float ty = (float)-t.at<double>(1,0);
@@ -280,17 +281,17 @@ int main()
                 person->setVisible(true);
                 y_axis->setVisible(true);
             }
-            else if(last_job.status == NAR::BAD) {
+            else if(last_job->status == NAR::BAD) {
                 person->setVisible(false);
                 y_axis->setVisible(false);
             }
 
-            if(last_job.status != NAR::BAD) {
+            if(last_job->status != NAR::BAD) {
                 // Draw the features matched
-                for(size_t i=0; i < last_job.matches.size(); i++) {
-                    int x = (int)(last_job.matches[i].x + 0.5f);
-                    int y = (int)(last_job.matches[i].y + 0.5f);
-                    //float scale = last_job.matches[i].scale;
+                for(size_t i=0; i < last_job->matches.size(); i++) {
+                    int x = (int)(last_job->matches[i].x + 0.5f);
+                    int y = (int)(last_job->matches[i].y + 0.5f);
+                    //float scale = last_job->matches[i].scale;
                    // float radius = (NAR_PATCH_SIZE/2) / scale;
 
                     driver->draw2DPolygon(core::position2d<s32>(x,y), 8, SColor(100, 255, 0, 0), 32);
@@ -298,22 +299,22 @@ int main()
 
                 // Draw the countour
                 for(int i=0; i < 4; i++) {
-                    cv::Point2i &pt1 = last_job.corners[i];
-                    cv::Point2i &pt2 = last_job.corners[(i+1)%4];
+                    cv::Point2i &pt1 = last_job->corners[i];
+                    cv::Point2i &pt2 = last_job->corners[(i+1)%4];
                     driver->draw2DLine(core::position2d<s32>(pt1.x, pt1.y), core::position2d<s32>(pt2.x, pt2.y), SColor(255,255,0,0));
                 }
                 /*
                 // Draw the search region
-                if(last_job.use_search_region) {
-                    cv::Point2i &pt1 =  last_job.search_region_start;
-                    cv::Point2i &pt2 =  last_job.search_region_end;
+                if(last_job->use_search_region) {
+                    cv::Point2i &pt1 =  last_job->search_region_start;
+                    cv::Point2i &pt2 =  last_job->search_region_end;
 
                     driver->draw2DRectangleOutline(core::recti(pt1.x, pt1.y, pt2.x, pt2.y), SColor(255,0,255,0));
                 }
                 */
 
-                for(size_t i=0; i < last_job.optical_flow_tracks.size(); i++) {
-                    cv::Point2f &pt = last_job.optical_flow_tracks[i];
+                for(size_t i=0; i < last_job->optical_flow_tracks.size(); i++) {
+                    cv::Point2f &pt = last_job->optical_flow_tracks[i];
 					int x = (int)(pt.x + 0.5f);
 					int y = (int)(pt.y + 0.5f);
                     driver->draw2DPolygon(core::position2d<s32>(x,y), 3, SColor(100, 0, 255, 0), 32);
@@ -345,10 +346,10 @@ int main()
             text.str("");
             text << fixed << setprecision(2) << "Status: ";
 
-            if(last_job.status == NAR::GOOD) {
+            if(job_init && last_job->status == NAR::GOOD) {
                 text << "Detected";
             }
-            else if(last_job.status == NAR::PREDICTION) {
+            else if(job_init && last_job->status == NAR::PREDICTION) {
                 text << "Prediction";
             }
             else {
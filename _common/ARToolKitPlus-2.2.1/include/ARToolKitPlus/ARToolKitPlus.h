@@ -62,7 +62,9 @@ enum MARKER_MODE {
 enum POSE_ESTIMATOR {
     POSE_ESTIMATOR_ORIGINAL, // original "normal" pose estimator
     POSE_ESTIMATOR_ORIGINAL_CONT, // original "cont" pose estimator
-    POSE_ESTIMATOR_RPP // new "Robust Planar Pose" estimator
+    POSE_ESTIMATOR_RPP, // new "Robust Planar Pose" estimator
+    POSE_ESTIMATOR_IPPE, // closed form "Infinitesimal Plane-based Pose Estimation"
+    POSE_ESTIMATOR_IPPE_REFINED // IPPE followed by one Gauss-Newton step
 };
 
 struct CornerPoint {
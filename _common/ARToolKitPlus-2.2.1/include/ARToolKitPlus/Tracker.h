@@ -77,6 +77,7 @@ public:
      *  can take quite a while. Consequently caching will speedup the start phase.
      *  If set to true and no cache file could be found a new one will be created.
      *  The cache file will get the same name as the camera file with the added extension '.LUT'
+     *  A cache file written for another image size or camera file is ignored and replaced.
      */
     virtual void setLoadUndistLUT(bool nSet) {
         loadCachedUndist = nSet;
@@ -103,6 +104,10 @@ public:
     virtual ARFloat rppMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num, ARMultiMarkerInfoT *config);
     virtual ARFloat rppGetTransMat(ARMarkerInfo *marker_info, ARFloat center[2], ARFloat width, ARFloat conv[3][4]);
 
+    /// closed form planar pose, see IPPE.h; multi marker configurations that are not planar go to RPP
+    virtual ARFloat ippeMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num, ARMultiMarkerInfoT *config);
+    virtual ARFloat ippeGetTransMat(ARMarkerInfo *marker_info, ARFloat center[2], ARFloat width, ARFloat conv[3][4]);
+
     /// loads a pattern from a file
     virtual int arLoadPatt(char *filename);
 
@@ -161,6 +166,9 @@ public:
      * Changes the undistortion mode
      * Default value is UNDIST_STD which means that
      * artoolkit's standard undistortion method is used.
+     * UNDIST_LUT samples the standard method on a grid of every 4th to 16th pixel
+     * and interpolates in between, the grid is built when the mode is set.
+
      */
     virtual void setUndistortionMode(UNDIST_MODE nMode);
 
@@ -169,6 +177,9 @@ public:
      * POSE_ESTIMATOR_ORIGINAL (default): arGetTransMat()
      * POSE_ESTIMATOR_CONT: original pose estimator with "Cont"
      * POSE_ESTIMATOR_RPP: "Robust Pose Estimation from a Planar Target"
+     * POSE_ESTIMATOR_IPPE: "Infinitesimal Plane-based Pose Estimation", non-iterative
+     *   and several times cheaper than RPP, less robust against noisy corners
+     * POSE_ESTIMATOR_IPPE_REFINED: IPPE plus one Gauss-Newton step on the reprojection error
      */
     virtual bool setPoseEstimator(POSE_ESTIMATOR nMethod);
 
@@ -232,6 +243,40 @@ public:
         autoThreshold.numRandomRetries = nNumRetries >= 1 ? nNumRetries : 1;
     }
 
+    /**
+     * Turns the adaptive (local) threshold on/off
+     *  Instead of one threshold for the whole image every pixel is compared against the
+     *  mean of the nWindowSize x nWindowSize pixels around it: it is black if it is not brighter
+     *  than nPercentage percent of that mean. This copes with spot lights and shadows in a
+     *  single pass, so the autothreshold retries are skipped while it is active.
+     *  nWindowSize is in pixels of the processed image (see setImageProcessingMode()), 0 picks
+     *  an eighth of its width. It should be about twice the width of a marker border.
+     *  ID markers are decoded with the threshold halfway between the darkest and brightest
+     *  pixel of each marker, the global threshold is only used for markers without contrast.
+     */
+    virtual void activateAdaptiveThreshold(bool nEnable, int nWindowSize = 0, int nPercentage = 85);
+
+    /// Returns true if the adaptive threshold is enabled
+    virtual bool isAdaptiveThresholdActivated() const {
+        return adaptiveThreshold.enabled;
+    }
+
+    /**
+     * Turns the temporal region of interest tracking on/off
+     *  Once markers have been found only the area around them is converted, labeled and
+     *  traced in the next frame: the bounding box of every marker grown by nMargin times
+     *  its size on each side. The whole image is scanned again every nRescanInterval frames,
+     *  whenever fewer markers are found than in the frame before and while no marker is
+     *  found at all, so markers entering the image show up at the next rescan.
+     *  It has no effect while the adaptive threshold is active, which needs the whole image.
+     */
+    virtual void activateROITracking(bool nEnable, int nRescanInterval = 10, ARFloat nMargin = 0.5f);
+
+    /// Returns true if the region of interest tracking is enabled
+    virtual bool isROITrackingActivated() const {
+        return roiTracking.enabled;
+    }
+
     /**
      * Sets an image processing mode (half or full resolution)
      *  Half resolution is faster but less accurate. When using
@@ -242,6 +287,23 @@ public:
         arImageProcMode = (nMode == IMAGE_HALF_RES ? AR_IMAGE_PROC_IN_HALF : AR_IMAGE_PROC_IN_FULL);
     }
 
+    /**
+     * Sets the number of threads used for marker detection (Default: 1)
+     *  With more than one thread the image is labeled in horizontal stripes, one per
+     *  thread, and the marker candidates are traced and decoded in parallel. The detected
+     *  markers are exactly the same as with a single thread. 0 uses one thread per core.
+     *  Only has an effect if ARToolKitPlus was built with OpenMP. Inside calcBatch() the
+     *  threads are busy with the other cameras, there every tracker uses a single one.
+     */
+    virtual void setNumThreads(int nNumThreads) {
+        numThreads = nNumThreads >= 0 ? nNumThreads : 1;
+    }
+
+    /// Returns the number of threads set with setNumThreads()
+    virtual int getNumThreads() const {
+        return numThreads;
+    }
+
     /// Returns an opengl-style modelview transformation matrix
     virtual const ARFloat* getModelViewMatrix() const {
         return gl_para;
@@ -313,12 +375,21 @@ protected:
     const int PATTERN_SAMPLE_NUM;
     const int MAX_LOAD_PATTERNS;
     const int MAX_IMAGE_PATTERNS;
-    const int WORK_SIZE;
 
     bool checkPixelFormat();
 
     void checkImageBuffer();
 
+    // number of threads detection really runs on, 1 without OpenMP
+    int getDetectionThreads() const;
+
+    // number of horizontal stripes numRows rows are split into for the detection threads,
+    // a stripe should have enough rows to be worth a thread
+    int getDetectionStripes(int numRows) const;
+
+    // number of threads the calcBatch() of the subclasses spreads nNumTrackers trackers over
+    static int getBatchThreads(int nNumThreads, int nNumTrackers);
+
     // converts an ARToolKit transformation matrix for usage with OpenGL
     void convertTransformationMatrixToOpenGLStyle(ARFloat para[3][4], ARFloat gl_para[16]);
 
@@ -327,10 +398,10 @@ protected:
     static bool convertProjectionMatrixToOpenGLStyle2(ARFloat cparam[3][4], int width, int height, ARFloat gnear,
             ARFloat gfar, ARFloat m[16]);
 
-    ARMarkerInfo2* arDetectMarker2(int16_t *limage, int label_num, int *label_ref, int *warea, ARFloat *wpos,
+    ARMarkerInfo2* arDetectMarker2(int16_t *limage, int label_num, int *wstart, int *warea, ARFloat *wpos,
             int *wclip, int area_max, int area_min, ARFloat factor, int *marker_num);
 
-    int arGetContour(int16_t *limage, int *label_ref, int label, int clip[4], ARMarkerInfo2 *marker_infoTWO);
+    int arGetContour(int16_t *limage, int start, int clip[4], ARMarkerInfo2 *marker_infoTWO);
 
     int check_square(int area, ARMarkerInfo2 *marker_infoTWO, ARFloat factor);
 
@@ -377,19 +448,29 @@ protected:
     ARFloat arGetTransMatContSub(ARMarkerInfo *marker_info, ARFloat prev_conv[3][4], ARFloat center[2], ARFloat width,
             ARFloat conv[3][4]);
 
-    int16_t* arLabeling(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
+    // thresholds the luminance plane against the mean of the window around every pixel, returns
+    // a plane that is 0 where the pixel is black and 255 elsewhere, see activateAdaptiveThreshold()
+    uint8_t* arAdaptiveThreshold(uint8_t *lumImage);
+
+    // converts the camera image to the 8 bit plane arLabeling() thresholds: one byte per pixel
+    // at the labeling resolution with the vignetting compensation applied. valid until the
+    // next call, for PIXEL_FORMAT_LUM without half mode or vignetting this is the image itself
+    uint8_t* arGetLuminance(uint8_t *image);
+
+    // thresholds the luminance plane and labels its 8-connected black components, returns the binary image.
+    // start is the x of each label's leftmost pixel on its top row, where arGetContour() begins
+    // numStripes horizontal stripes are labeled in parallel, then joined by mergeLabelStripes()
+    int16_t* arLabeling(uint8_t *lumImage, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
+            int **start);
+
+    int mergeLabelStripes(int numStripes);
+
+    // picks the rectangles arGetLuminance() and arLabeling() work on, the regions of interest
+    // of the last frame or the whole image, and splits them into stripes for the threads
+    void setLabelRects(bool useROIs);
 
-    int16_t* arLabeling_ABGR(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
-    int16_t* arLabeling_BGR(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
-    int16_t* arLabeling_RGB(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
-    int16_t* arLabeling_RGB565(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
-    int16_t* arLabeling_LUM(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-            int **label_ref);
+    // predicts the regions of interest of the next frame from the markers just found
+    void updateLabelROIs(const ARMarkerInfo *markers, int num);
 
     int arActivatePatt(int patno);
 
@@ -421,6 +502,9 @@ protected:
 
     int arCameraObserv2Ideal_LUT(Camera* pCam, ARFloat ox, ARFloat oy, ARFloat *ix, ARFloat *iy);
 
+    /// undistorts num contour points into (x, y) pairs with the current undistortion mode
+    void arCameraObserv2IdealBatch(const int *x_coord, const int *y_coord, int num, ARFloat *ideal);
+
     int arCameraObserv2Ideal_std(Camera* pCam, ARFloat ox, ARFloat oy, ARFloat *ix, ARFloat *iy);
     int arCameraIdeal2Observ_std(Camera* pCam, ARFloat ix, ARFloat iy, ARFloat *ox, ARFloat *oy);
 
@@ -501,8 +585,9 @@ protected:
     ARMarkerInfo2 *marker_infoTWO; // CAUTION: this member has to be manually allocated!
     //          see TrackerSingleMarker for more info on this.
 
-    int arGetContour_wx[AR_CHAIN_MAX];
-    int arGetContour_wy[AR_CHAIN_MAX];
+    std::vector<int> candidateLabels;
+    std::vector<ARMarkerInfo2> candidateInfo; // one per candidate traced in parallel
+    std::vector<int> candidateValid;
 
     // arGetCode.cpp
     int pattern_num;
@@ -530,14 +615,65 @@ protected:
     ARFloat pos2d[P_MAX][2];
     ARFloat pos3d[P_MAX][3];
 
+    // arLuminance.cpp
+    //
+    std::vector<uint8_t> lumImageL;
+    std::vector<uint16_t> lumSumsL; // one row per stripe
+    std::vector<int16_t> lumCorrL; // one row per stripe
+    std::vector<uint32_t> lumIntegralL; // lysize x (lxsize+1), row r sums the rows 1 to r-1
+
+    std::vector<uint8_t> adaptImageL;
+
     // arLabeling.cpp
     //
     int16_t *l_imageL; //[HARDCODED_BUFFER_WIDTH*HARDCODED_BUFFER_HEIGHT];		// dyna
     int16_t *l_imageR;
     int l_imageL_size;
 
-    int *workL; //[WORK_SIZE];											// dyna
-    int *work2L; //[WORK_SIZE*7];											// dyna
+    // horizontal run of black pixels and the union-find node of its component
+    struct LabelRun {
+        int x0, x1, node;
+    };
+
+    // one per run that starts a new component, merged components point to the older one
+    struct LabelNode {
+        int parent;
+        int area;
+        double sumX, sumY;
+        int clip[4];
+        int start;
+    };
+
+    // runs and nodes of a horizontal stripe of the image, node ids are local to the stripe
+    struct LabelStripe {
+        std::vector<LabelRun> runs[2]; // previous and current row
+        std::vector<LabelRun> firstRow;
+        int lastRow; // which of runs holds the last row
+        std::vector<LabelNode> nodes;
+        int nodeOffset; // of the first node in labelNodesL
+
+        int x0, x1; // columns, including the white frame of the rectangle
+        int jBegin, jEnd; // rows
+        bool joinAbove; // false for the first stripe of a rectangle
+    };
+
+    // part of the processed image that is labeled, inclusive. its outermost rows and columns
+    // are kept white in the binary image so no label can leave it
+    struct LabelRect {
+        int x0, y0, x1, y1;
+    };
+
+    // root of a node, halving the path on the way
+    static int findLabel(LabelNode *nodes, int node);
+
+    // joins the components of two nodes, the older root stays the root so labels come out in raster order
+    static int joinLabels(LabelNode *nodes, int a, int b);
+
+    std::vector<LabelRect> labelRectsL; // of this frame
+    std::vector<LabelStripe> labelStripesL;
+    int numLabelStripesL;
+    std::vector<LabelNode> labelNodesL; // all stripes, in raster order
+    std::vector<double> labelSumsL;
 
     int *workR;
     int *work2R;
@@ -547,9 +683,11 @@ protected:
 
     int wlabel_numL;
     int wlabel_numR;
-    int *wareaL; //[WORK_SIZE];	dyna
-    int *wclipL; //[WORK_SIZE*4]; dyna
-    ARFloat *wposL; //[WORK_SIZE*2];dyna
+    std::vector<int> wareaL;
+    std::vector<int> wclipL;
+    std::vector<ARFloat> wposL;
+    std::vector<int> wstartL;
+
 
     int arFittingMode;
     int arImageProcMode;
@@ -568,7 +706,9 @@ protected:
 
     // camera distortion addon by Daniel
     UNDIST_MODE undistMode;
-    unsigned int *undistO2ITable;
+    int16_t *undistO2ITable;
+    int undistGridShift, undistGridWidth;
+
 
     // used for Hull Tracking
     MarkerPoint hullInPoints[MAX_HULL_POINTS];
@@ -587,6 +727,7 @@ protected:
 
     static int screenWidth;
 	static int screenHeight;
+    int imageWidth, imageHeight; // of this tracker, the static ones are the last set for calcCameraMatrix()
     int thresh;
 
     ARFloat gl_para[16];
@@ -599,9 +740,27 @@ protected:
         int corners, leftright, bottomtop;
     } vignetting;
 
+    struct {
+        bool enabled;
+        int windowSize, percentage;
+    } adaptiveThreshold;
+
+    struct {
+        bool enabled;
+        int rescanInterval;
+        ARFloat margin;
+        int framesSinceRescan;
+        int numMarkers; // the rectangles were predicted from
+        std::vector<LabelRect> rects; // for the next frame
+    } roiTracking;
+
     unsigned short *DIV_TABLE;
 
     BCH *bchProcessor;
+    std::vector<BCH> bchThreadProcessors; // BCH keeps decoding state, one per detection thread
+
+    int numThreads;
+
 };
 
 } // namespace ARToolKitPlus
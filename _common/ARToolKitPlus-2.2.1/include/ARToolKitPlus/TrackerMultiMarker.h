@@ -74,6 +74,17 @@ public:
      */
     virtual int calc(const unsigned char* nImage);
 
+    /**
+     * calc() for the frames of several cameras at once
+     *  Every camera needs a tracker of its own, nTrackers[i] processes nImages[i] and
+     *  nNumDetected[i] receives what its calc() returns. The trackers are spread over
+     *  nNumThreads threads (0 uses one thread per core), their poses are read from
+     *  the trackers afterwards as usual.
+     *  Only runs the cameras in parallel if ARToolKitPlus was built with OpenMP.
+     */
+    static void calcBatch(TrackerMultiMarker** nTrackers, const unsigned char** nImages, int nNumTrackers,
+            int* nNumDetected, int nNumThreads = 0);
+
     /*
      * Returns the number of detected markers used for multi-marker tracking
      */
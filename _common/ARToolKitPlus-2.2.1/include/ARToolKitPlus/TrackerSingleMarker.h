@@ -89,6 +89,17 @@ public:
      */
     virtual int selectBestMarkerByCf();
 
+    /**
+     * calc() and selectBestMarkerByCf() for the frames of several cameras at once
+     *  Every camera needs a tracker of its own, nTrackers[i] processes nImages[i] and
+     *  nBestMarkers[i] receives the id of its best marker or -1. The trackers are spread
+     *  over nNumThreads threads (0 uses one thread per core), their poses are read from
+     *  the trackers afterwards as usual.
+     *  Only runs the cameras in parallel if ARToolKitPlus was built with OpenMP.
+     */
+    static void calcBatch(TrackerSingleMarker** nTrackers, const uint8_t** nImages, int nNumTrackers,
+            int* nBestMarkers, int nNumThreads = 0);
+
     /**
      * Sets the width and height of the patterns in OpenGL units
      * defaults to 2.0, so the unity cube fits the marker surface
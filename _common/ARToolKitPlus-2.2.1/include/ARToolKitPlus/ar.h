@@ -24,7 +24,11 @@
 #include <stdlib.h>
 
 #include <ARToolKitPlus/config.h>
-#include "../../../stdint.h"
+#if defined(_MSC_VER) && _MSC_VER < 1600
+#include "../../../stdint.h"    // Visual Studio before 2010 has no stdint.h
+#else
+#include <stdint.h>
+#endif
 
 #define arMalloc(V,T,S)  \
 { if( ((V) = (T *)malloc( sizeof(T) * (S) )) == 0 ) \
@@ -0,0 +1,392 @@
+/**
+ * Copyright (C) 2010  ARToolkitPlus Authors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ARTOOLKITPLUS_IPPE_HEADERFILE__
+#define __ARTOOLKITPLUS_IPPE_HEADERFILE__
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace ARToolKitPlus {
+
+// Closed-form pose of a planar target after Collins and Bartoli, "Infinitesimal Plane-based
+// Pose Estimation" (IJCV 2014): the homography from the target plane to the normalised image
+// is estimated linearly, its Jacobian at the target centre allows exactly two rotations, the
+// one that reprojects better is taken. No iterations, so the cost is a few small linear
+// systems no matter how many points there are.
+namespace ippe {
+
+// solves a x = b for a n x n row major matrix by Gaussian elimination with partial pivoting,
+// a and b are destroyed, the solution is left in b. false if a is singular
+template<typename T>
+bool solve(T *a, T *b, int n) {
+    for (int k = 0; k < n; k++) {
+        int pivot = k;
+        for (int i = k + 1; i < n; i++)
+            if (std::fabs(a[i * n + k]) > std::fabs(a[pivot * n + k]))
+                pivot = i;
+
+        if (std::fabs(a[pivot * n + k]) < T(1e-12))
+            return false;
+
+        if (pivot != k) {
+            for (int j = 0; j < n; j++)
+                std::swap(a[k * n + j], a[pivot * n + j]);
+            std::swap(b[k], b[pivot]);
+        }
+
+        for (int i = k + 1; i < n; i++) {
+            T f = a[i * n + k] / a[k * n + k];
+            for (int j = k; j < n; j++)
+                a[i * n + j] -= f * a[k * n + j];
+            b[i] -= f * b[k];
+        }
+    }
+
+    for (int k = n - 1; k >= 0; k--) {
+        for (int j = k + 1; j < n; j++)
+            b[k] -= a[k * n + j] * b[j];
+        b[k] /= a[k * n + k];
+    }
+    return true;
+}
+
+// least squares translation for a known rotation, linear in the image space error
+template<typename T>
+bool translation(const T R[3][3], const T (*model)[2], const T (*image)[2], int n, T t[3]) {
+    T ata[9] = { 0 }, atb[3] = { 0 };
+
+    for (int i = 0; i < n; i++) {
+        const T u = image[i][0], v = image[i][1];
+        const T px = R[0][0] * model[i][0] + R[0][1] * model[i][1];
+        const T py = R[1][0] * model[i][0] + R[1][1] * model[i][1];
+        const T pz = R[2][0] * model[i][0] + R[2][1] * model[i][1];
+        const T bu = u * pz - px, bv = v * pz - py;
+
+        // rows (1, 0, -u) and (0, 1, -v)
+        ata[0] += 1;
+        ata[2] -= u;
+        ata[4] += 1;
+        ata[5] -= v;
+        ata[8] += u * u + v * v;
+        atb[0] += bu;
+        atb[1] += bv;
+        atb[2] -= u * bu + v * bv;
+    }
+    ata[6] = ata[2];
+    ata[7] = ata[5];
+
+    if (!solve(ata, atb, 3))
+        return false;
+
+    t[0] = atb[0];
+    t[1] = atb[1];
+    t[2] = atb[2];
+    return true;
+}
+
+// sum of the squared reprojection errors in pixels, infinite if a point is behind the camera
+template<typename T>
+T reprojectionError(const T R[3][3], const T t[3], const T (*model)[2], const T (*image)[2], int n, const T fc[2]) {
+    T err = 0;
+
+    for (int i = 0; i < n; i++) {
+        const T x = R[0][0] * model[i][0] + R[0][1] * model[i][1] + t[0];
+        const T y = R[1][0] * model[i][0] + R[1][1] * model[i][1] + t[1];
+        const T z = R[2][0] * model[i][0] + R[2][1] * model[i][1] + t[2];
+
+        if (z <= 0)
+            return T(1e+20);
+
+        const T du = fc[0] * (x / z - image[i][0]), dv = fc[1] * (y / z - image[i][1]);
+        err += du * du + dv * dv;
+    }
+    return err;
+}
+
+// one Gauss-Newton step on the reprojection error, rotation updates are applied on the left
+template<typename T>
+bool refine(T R[3][3], T t[3], const T (*model)[2], const T (*image)[2], int n, const T fc[2]) {
+    T jtj[36] = { 0 }, jtr[6] = { 0 };
+    int i, j, k;
+
+    for (i = 0; i < n; i++) {
+        const T rx = R[0][0] * model[i][0] + R[0][1] * model[i][1];
+        const T ry = R[1][0] * model[i][0] + R[1][1] * model[i][1];
+        const T rz = R[2][0] * model[i][0] + R[2][1] * model[i][1];
+        const T x = rx + t[0], y = ry + t[1], z = rz + t[2];
+
+        if (z <= 0)
+            return false;
+
+        const T iz = 1 / z;
+        const T res[2] = { fc[0] * (x * iz - image[i][0]), fc[1] * (y * iz - image[i][1]) };
+
+        // d(projection)/d(point) times d(point)/d(omega, t), d(point)/d(omega) = -[R m]x
+        const T dp[2][3] = { { fc[0] * iz, 0, -fc[0] * x * iz * iz }, { 0, fc[1] * iz, -fc[1] * y * iz * iz } };
+        T jac[2][6];
+
+        for (k = 0; k < 2; k++) {
+            jac[k][0] = dp[k][2] * ry - dp[k][1] * rz;
+            jac[k][1] = dp[k][0] * rz - dp[k][2] * rx;
+            jac[k][2] = dp[k][1] * rx - dp[k][0] * ry;
+
+            jac[k][3] = dp[k][0];
+            jac[k][4] = dp[k][1];
+            jac[k][5] = dp[k][2];
+        }
+
+        for (k = 0; k < 2; k++)
+            for (j = 0; j < 6; j++) {
+                jtr[j] -= jac[k][j] * res[k];
+                for (int l = j; l < 6; l++)
+                    jtj[j * 6 + l] += jac[k][j] * jac[k][l];
+            }
+    }
+
+    for (j = 0; j < 6; j++)
+        for (k = 0; k < j; k++)
+            jtj[j * 6 + k] = jtj[k * 6 + j];
+
+    if (!solve(jtj, jtr, 6))
+        return false;
+
+    // Rodrigues of the rotation update
+    const T theta = std::sqrt(jtr[0] * jtr[0] + jtr[1] * jtr[1] + jtr[2] * jtr[2]);
+    T dR[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+
+    if (theta > T(1e-12)) {
+        const T kx = jtr[0] / theta, ky = jtr[1] / theta, kz = jtr[2] / theta;
+        const T s = std::sin(theta), c = 1 - std::cos(theta);
+        const T K[3][3] = { { 0, -kz, ky }, { kz, 0, -kx }, { -ky, kx, 0 } };
+
+        for (i = 0; i < 3; i++)
+            for (j = 0; j < 3; j++) {
+                T k2 = K[i][0] * K[0][j] + K[i][1] * K[1][j] + K[i][2] * K[2][j];
+                dR[i][j] += s * K[i][j] + c * k2;
+            }
+    }
+
+    T nR[3][3];
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+            nR[i][j] = dR[i][0] * R[0][j] + dR[i][1] * R[1][j] + dR[i][2] * R[2][j];
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++)
+            R[i][j] = nR[i][j];
+        t[i] += jtr[3 + i];
+    }
+    return true;
+}
+
+// true if a target coordinate lies on the z = 0 plane the closed form assumes
+template<typename T>
+inline bool onPlane(T z) {
+    return std::fabs(z) <= T(1e-4);
+}
+
+} // namespace ippe
+
+/**
+ * Pose of n >= 4 points on the z = 0 plane of the target
+ *  model holds their x and y on the target, image their undistorted pixel positions,
+ *  fc and cc are the focal lengths and the principal point. With refine set one Gauss-Newton
+ *  step on the reprojection error follows, it is kept only if it lowers the error.
+ *  R and t receive the target to camera transformation. Returns the mean squared
+ *  reprojection error in pixels, or -1 if the points do not determine a pose.
+ */
+template<typename T>
+T planarPose(const T (*model)[2], const T (*image)[2], int n, const T fc[2], const T cc[2], bool refine, T R[3][3],
+        T t[3]) {
+    int i, j, k;
+
+    if (n < 4)
+        return -1;
+
+    // the rotations are taken at the centre of the target, so the model is centred,
+    // for the homography it is scaled to about unit size too
+    T cx = 0, cy = 0, scale = 0;
+    for (i = 0; i < n; i++) {
+        cx += model[i][0];
+        cy += model[i][1];
+    }
+    cx /= n;
+    cy /= n;
+
+    std::vector<T> centred(n * 2), normalised(n * 2);
+    for (i = 0; i < n; i++) {
+        centred[i * 2 + 0] = model[i][0] - cx;
+        centred[i * 2 + 1] = model[i][1] - cy;
+        scale += std::sqrt(centred[i * 2 + 0] * centred[i * 2 + 0] + centred[i * 2 + 1] * centred[i * 2 + 1]);
+        normalised[i * 2 + 0] = (image[i][0] - cc[0]) / fc[0];
+        normalised[i * 2 + 1] = (image[i][1] - cc[1]) / fc[1];
+    }
+    if (scale <= 0)
+        return -1;
+    scale = n / scale;
+
+    const T (*m)[2] = reinterpret_cast<const T (*)[2]> (&centred[0]);
+    const T (*q)[2] = reinterpret_cast<const T (*)[2]> (&normalised[0]);
+
+    // homography with h[8] = 1 from the normal equations of the DLT
+    T ata[64] = { 0 }, h[9];
+    for (j = 0; j < 8; j++)
+        h[j] = 0;
+
+    for (i = 0; i < n; i++) {
+        const T x = m[i][0] * scale, y = m[i][1] * scale, u = q[i][0], v = q[i][1];
+        const T rows[2][8] = { { x, y, 1, 0, 0, 0, -u * x, -u * y }, { 0, 0, 0, x, y, 1, -v * x, -v * y } };
+        const T rhs[2] = { u, v };
+
+        for (k = 0; k < 2; k++)
+            for (j = 0; j < 8; j++) {
+                h[j] += rows[k][j] * rhs[k];
+                for (int l = 0; l < 8; l++)
+                    ata[j * 8 + l] += rows[k][j] * rows[k][l];
+            }
+    }
+
+    if (!ippe::solve(ata, h, 8))
+        return -1;
+    h[8] = 1;
+
+    // back to the unscaled centred model
+    h[0] *= scale;
+    h[1] *= scale;
+    h[3] *= scale;
+    h[4] *= scale;
+    h[6] *= scale;
+    h[7] *= scale;
+
+    // the centre of the target in the image and the Jacobian of the homography there
+    const T v[2] = { h[2], h[5] };
+    const T J[2][2] = { { h[0] - h[6] * v[0], h[1] - h[7] * v[0] }, { h[3] - h[6] * v[1], h[4] - h[7] * v[1] } };
+
+    // rotation that turns the optical axis onto the ray through v
+    T Rv[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    const T vn = std::sqrt(v[0] * v[0] + v[1] * v[1]);
+
+    if (vn > T(1e-12)) {
+        const T s = std::sqrt(vn * vn + 1);
+        const T cosTh = 1 / s, sinTh = std::sqrt(1 - 1 / (s * s));
+        const T K[3][3] = { { 0, 0, v[0] / vn }, { 0, 0, v[1] / vn }, { -v[0] / vn, -v[1] / vn, 0 } };
+
+        for (i = 0; i < 3; i++)
+            for (j = 0; j < 3; j++) {
+                T k2 = K[i][0] * K[0][j] + K[i][1] * K[1][j] + K[i][2] * K[2][j];
+                Rv[i][j] += sinTh * K[i][j] + (1 - cosTh) * k2;
+            }
+    }
+
+    // A = B^-1 J with B = [I, -v] Rv(:, 0:1)
+    const T B[2][2] = { { Rv[0][0] - v[0] * Rv[2][0], Rv[0][1] - v[0] * Rv[2][1] },
+            { Rv[1][0] - v[1] * Rv[2][0], Rv[1][1] - v[1] * Rv[2][1] } };
+    const T detB = B[0][0] * B[1][1] - B[0][1] * B[1][0];
+
+    if (std::fabs(detB) < T(1e-12))
+        return -1;
+
+    const T Binv[2][2] = { { B[1][1] / detB, -B[0][1] / detB }, { -B[1][0] / detB, B[0][0] / detB } };
+    const T A[2][2] = { { Binv[0][0] * J[0][0] + Binv[0][1] * J[1][0], Binv[0][0] * J[0][1] + Binv[0][1] * J[1][1] },
+            { Binv[1][0] * J[0][0] + Binv[1][1] * J[1][0], Binv[1][0] * J[0][1] + Binv[1][1] * J[1][1] } };
+
+    // the largest singular value of A scales it to the upper left of a rotation
+    const T aat00 = A[0][0] * A[0][0] + A[0][1] * A[0][1], aat11 = A[1][0] * A[1][0] + A[1][1] * A[1][1];
+    const T aat01 = A[0][0] * A[1][0] + A[0][1] * A[1][1];
+    const T gamma = std::sqrt(
+            T(0.5) * (aat00 + aat11 + std::sqrt((aat00 - aat11) * (aat00 - aat11) + 4 * aat01 * aat01)));
+
+    if (gamma < T(1e-12))
+        return -1;
+
+    const T R22[2][2] = { { A[0][0] / gamma, A[0][1] / gamma }, { A[1][0] / gamma, A[1][1] / gamma } };
+    const T h00 = 1 - R22[0][0] * R22[0][0] - R22[1][0] * R22[1][0];
+    const T h11 = 1 - R22[0][1] * R22[0][1] - R22[1][1] * R22[1][1];
+    const T h01 = -R22[0][0] * R22[0][1] - R22[1][0] * R22[1][1];
+    T b[2] = { std::sqrt(h00 > 0 ? h00 : 0), std::sqrt(h11 > 0 ? h11 : 0) };
+    if (h01 < 0)
+        b[1] = -b[1];
+
+    // the third column completes the rotation, the two solutions differ in the sign of c and b
+    const T c[2] = { R22[1][0] * b[1] - b[0] * R22[1][1], b[0] * R22[0][1] - R22[0][0] * b[1] };
+    const T a = R22[0][0] * R22[1][1] - R22[1][0] * R22[0][1];
+
+    T bestErr = -1;
+
+    for (int sol = 0; sol < 2; sol++) {
+        const T sign = sol == 0 ? T(1) : T(-1);
+        const T S[3][3] = { { R22[0][0], R22[0][1], sign * c[0] }, { R22[1][0], R22[1][1], sign * c[1] },
+                { sign * b[0], sign * b[1], a } };
+        T Rs[3][3], ts[3];
+
+        for (i = 0; i < 3; i++)
+            for (j = 0; j < 3; j++)
+                Rs[i][j] = Rv[i][0] * S[0][j] + Rv[i][1] * S[1][j] + Rv[i][2] * S[2][j];
+
+        if (!ippe::translation(Rs, m, q, n, ts))
+            continue;
+
+        T err = ippe::reprojectionError(Rs, ts, m, q, n, fc);
+        if (bestErr >= 0 && err >= bestErr)
+            continue;
+
+        bestErr = err;
+        for (i = 0; i < 3; i++) {
+            t[i] = ts[i];
+            for (j = 0; j < 3; j++)
+                R[i][j] = Rs[i][j];
+        }
+    }
+
+    if (bestErr < 0 || bestErr >= T(1e+20))
+        return -1;
+
+    if (refine) {
+        T Rr[3][3], tr[3];
+
+        for (i = 0; i < 3; i++) {
+            tr[i] = t[i];
+            for (j = 0; j < 3; j++)
+                Rr[i][j] = R[i][j];
+        }
+
+        if (ippe::refine(Rr, tr, m, q, n, fc)) {
+            T err = ippe::reprojectionError(Rr, tr, m, q, n, fc);
+
+            if (err < bestErr) {
+                bestErr = err;
+                for (i = 0; i < 3; i++) {
+                    t[i] = tr[i];
+                    for (j = 0; j < 3; j++)
+                        R[i][j] = Rr[i][j];
+                }
+            }
+        }
+    }
+
+    // from the centred model back to the target's origin
+    for (i = 0; i < 3; i++)
+        t[i] -= R[i][0] * cx + R[i][1] * cy;
+
+    return bestErr / n;
+}
+
+} // namespace ARToolKitPlus
+
+#endif //__ARTOOLKITPLUS_IPPE_HEADERFILE__
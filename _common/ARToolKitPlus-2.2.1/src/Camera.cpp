@@ -71,6 +71,7 @@ bool Camera::loadFromFile(const char* filename) {
     mat[1][2] = cc[1]; // cc_y
     mat[2][2] = 1.0;
 
+    fileName = filename;
     return true;
 }
 
@@ -140,6 +141,7 @@ Camera* Camera::clone() {
     for (i = 0; i < 6; i++)
         pCam->kc[i] = kc[i];
     pCam->undist_iterations = undist_iterations;
+    pCam->fileName = fileName;
     return ((Camera*) pCam);
 }
 
@@ -22,6 +22,11 @@
 #include <ARToolKitPlus/Tracker.h>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using std::cerr;
 using std::endl;
@@ -38,15 +43,14 @@ Tracker::Tracker(int imWidth, int imHeight, int maxImagePatterns, int pattWidth,
 		PATTERN_SAMPLE_NUM(pattSamples),
 		MAX_LOAD_PATTERNS(maxLoadPatterns),
 		MAX_IMAGE_PATTERNS(maxImagePatterns),
-		WORK_SIZE(1024*MAX_IMAGE_PATTERNS),
 		sprev_info(2, vector<arPrevInfo>(MAX_IMAGE_PATTERNS)),
 		pat(MAX_LOAD_PATTERNS, vector<vector<int> >(4, vector<int>(PATTERN_HEIGHT*PATTERN_WIDTH*3))),
 		patBW(MAX_LOAD_PATTERNS, vector<vector<int> >(4, vector<int>(PATTERN_HEIGHT*PATTERN_WIDTH*3))),
 		evec(EVEC_MAX, vector<ARFloat>(PATTERN_HEIGHT*PATTERN_WIDTH*3)),
 		evecBW(EVEC_MAX, vector<ARFloat>(PATTERN_HEIGHT*PATTERN_WIDTH*3))
  {
-    screenWidth = imWidth;
-    screenHeight = imHeight;
+    screenWidth = imageWidth = imWidth;
+    screenHeight = imageHeight = imHeight;
 
     int i;
 
@@ -87,12 +91,8 @@ Tracker::Tracker(int imWidth, int imHeight, int maxImagePatterns, int pattWidth,
     //
     l_imageL = NULL;
     l_imageL_size = 0;
-
-    workL = new int[WORK_SIZE];
-    work2L = new int[WORK_SIZE * 7];
-    wareaL = new int[WORK_SIZE];
-    wclipL = new int[WORK_SIZE * 4];
-    wposL = new ARFloat[WORK_SIZE * 2];
+    wlabel_numL = 0;
+    numLabelStripesL = 0;
 
     // set all right side structures to NULL
     l_imageR = NULL;
@@ -124,12 +124,25 @@ Tracker::Tracker(int imWidth, int imHeight, int maxImagePatterns, int pattWidth,
 
     undistMode = UNDIST_STD;
     undistO2ITable = NULL;
+    undistGridShift = undistGridWidth = 0;
+
     arCameraObserv2Ideal_func = &Tracker::arCameraObserv2Ideal_std;
 
     vignetting.enabled = false;
     vignetting.corners = vignetting.leftright = vignetting.bottomtop = 0;
 
+    adaptiveThreshold.enabled = false;
+    adaptiveThreshold.windowSize = 0;
+    adaptiveThreshold.percentage = 85;
+
+    roiTracking.enabled = false;
+    roiTracking.rescanInterval = 10;
+    roiTracking.margin = 0.5f;
+    roiTracking.framesSinceRescan = 0;
+    roiTracking.numMarkers = 0;
+
     bchProcessor = NULL;
+    numThreads = 1;
 
     poseEstimator = POSE_ESTIMATOR_RPP;
     hullTrackingMode = HULL_FOUR;
@@ -156,25 +169,6 @@ Tracker::~Tracker() {
         delete[] l_imageL;
     l_imageL = NULL;
 
-    if (workL)
-        delete[] workL;
-    workL = NULL;
-
-    if (work2L)
-        delete[] work2L;
-    work2L = NULL;
-
-    if (wareaL)
-        delete[] wareaL;
-    wareaL = NULL;
-
-    if (wclipL)
-        delete[] wclipL;
-    wclipL = NULL;
-
-    if (wposL)
-        delete[] wposL;
-    wposL = NULL;
 
     if (RGB565_to_LUM8_LUT)
         delete RGB565_to_LUM8_LUT;
@@ -224,7 +218,7 @@ void Tracker::checkImageBuffer() {
     // (usually this image buffer should only be built once - unless we change camera resolution)
     //
 
-    int newSize = screenWidth * screenHeight;
+    int newSize = imageWidth * imageHeight;
 
     if (newSize == l_imageL_size)
         return;
@@ -237,7 +231,41 @@ void Tracker::checkImageBuffer() {
     l_imageL = new int16_t[newSize];
 }
 
+int Tracker::getDetectionThreads() const {
+#ifdef _OPENMP
+    // a nested parallel region would only get one thread anyway
+    if (omp_in_parallel() && !omp_get_nested())
+        return 1;
+    return numThreads > 0 ? numThreads : omp_get_num_procs();
+#else
+    return 1;
+#endif
+}
+
+int Tracker::getBatchThreads(int nNumThreads, int nNumTrackers) {
+#ifdef _OPENMP
+    int numThreads = nNumThreads > 0 ? nNumThreads : omp_get_num_procs();
+
+    return std::max(1, std::min(numThreads, nNumTrackers));
+#else
+    return 1;
+#endif
+}
+
+int Tracker::getDetectionStripes(int numRows) const {
+    int numStripes = getDetectionThreads();
+
+    if (numStripes > numRows / 32)
+        numStripes = numRows / 32;
+    if (numStripes < 1)
+        numStripes = 1;
+
+    return numStripes;
+}
+
 bool Tracker::checkPixelFormat() {
+
+
     switch (pixelFormat) {
     case PIXEL_FORMAT_LUM:
         return pixelSize == 1;
@@ -279,7 +307,7 @@ bool Tracker::loadCameraFile(const char* nCamParamFile, ARFloat nNearClip, ARFlo
 void Tracker::setCamera(Camera* nCamera) {
     arCamera = nCamera;
 
-    arCamera->changeFrameSize(screenWidth, screenHeight);
+    arCamera->changeFrameSize(imageWidth, imageHeight);
     arInitCparam(arCamera);
 
     // Comment out if you want to get the matrix for camera calibration
@@ -288,7 +316,13 @@ void Tracker::setCamera(Camera* nCamera) {
     // printf("%f %f %f;\n",arCamera->mat[1][0],arCamera->mat[1][1],arCamera->mat[1][2]);
     // printf("%f %f %f ]\n",arCamera->mat[2][0],arCamera->mat[2][1],arCamera->mat[2][2]);
 
-    buildUndistO2ITable(arCamera);
+    // the table belongs to the old camera, only UNDIST_LUT needs a new one
+    if (undistO2ITable) {
+        delete[] undistO2ITable;
+        undistO2ITable = NULL;
+    }
+    if (undistMode == UNDIST_LUT)
+        buildUndistO2ITable(arCamera);
 }
 
 void Tracker::setCamera(Camera* nCamera, ARFloat nNearClip, ARFloat nFarClip) {
@@ -402,8 +436,8 @@ bool Tracker::calcCameraMatrix(const char* nCamParamFile, ARFloat nNear, ARFloat
 }
 
 void Tracker::changeCameraSize(int nWidth, int nHeight) {
-    screenWidth = nWidth;
-    screenHeight = nHeight;
+    screenWidth = imageWidth = nWidth;
+    screenHeight = imageHeight = nHeight;
 
     arCamera->changeFrameSize(nWidth, nHeight);
     arInitCparam(arCamera);
@@ -422,6 +456,8 @@ void Tracker::setUndistortionMode(UNDIST_MODE nMode) {
 
     case UNDIST_LUT:
         arCameraObserv2Ideal_func = &Tracker::arCameraObserv2Ideal_LUT;
+        if (arCamera && !undistO2ITable)
+            buildUndistO2ITable(arCamera);
         break;
     }
 }
@@ -443,6 +479,10 @@ ARFloat Tracker::executeSingleMarkerPoseEstimator(ARMarkerInfo *marker_info, ARF
 
     case POSE_ESTIMATOR_RPP:
         return rppGetTransMat(marker_info, center, width, conv);
+
+    case POSE_ESTIMATOR_IPPE:
+    case POSE_ESTIMATOR_IPPE_REFINED:
+        return ippeGetTransMat(marker_info, center, width, conv);
     }
 
     return -1.0f;
@@ -462,6 +502,10 @@ ARFloat Tracker::executeMultiMarkerPoseEstimator(ARMarkerInfo *marker_info, int
 
     case POSE_ESTIMATOR_RPP:
         return rppMultiGetTransMat(marker_info, marker_num, config);
+
+    case POSE_ESTIMATOR_IPPE:
+    case POSE_ESTIMATOR_IPPE_REFINED:
+        return ippeMultiGetTransMat(marker_info, marker_num, config);
     }
 
     return -1.0f;
@@ -474,6 +518,21 @@ void Tracker::activateVignettingCompensation(bool nEnable, int nCorners, int nLe
     vignetting.bottomtop = nTopBottom;
 }
 
+void Tracker::activateAdaptiveThreshold(bool nEnable, int nWindowSize, int nPercentage) {
+    adaptiveThreshold.enabled = nEnable;
+    adaptiveThreshold.windowSize = nWindowSize >= 0 ? nWindowSize : 0;
+    adaptiveThreshold.percentage = nPercentage >= 1 ? nPercentage : 1;
+}
+
+void Tracker::activateROITracking(bool nEnable, int nRescanInterval, ARFloat nMargin) {
+    roiTracking.enabled = nEnable;
+    roiTracking.rescanInterval = nRescanInterval >= 1 ? nRescanInterval : 1;
+    roiTracking.margin = nMargin >= 0 ? nMargin : 0;
+    roiTracking.framesSinceRescan = 0;
+    roiTracking.numMarkers = 0;
+    roiTracking.rects.clear();
+}
+
 void Tracker::setMarkerMode(MARKER_MODE nMarkerMode) {
     markerMode = nMarkerMode;
 }
@@ -93,6 +93,17 @@ int TrackerMultiMarker::calc(const unsigned char* nImage) {
 	return numDetected;
 }
 
+void TrackerMultiMarker::calcBatch(TrackerMultiMarker** nTrackers, const unsigned char** nImages, int nNumTrackers,
+		int* nNumDetected, int nNumThreads) {
+	int numThreads = getBatchThreads(nNumThreads, nNumTrackers);
+	int i;
+
+	// the trackers share nothing, one camera per iteration
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic) if(numThreads > 1)
+	for (i = 0; i < nNumTrackers; i++)
+		nNumDetected[i] = nTrackers[i]->calc(nImages[i]);
+}
+
 void TrackerMultiMarker::getDetectedMarkers(int*& nMarkerIDs) {
 	nMarkerIDs = detectedMarkerIDs;
 }
@@ -108,6 +108,21 @@ int TrackerSingleMarker::selectBestMarkerByCf() {
     return best;
 }
 
+void TrackerSingleMarker::calcBatch(TrackerSingleMarker** nTrackers, const uint8_t** nImages, int nNumTrackers,
+        int* nBestMarkers, int nNumThreads) {
+    int numThreads = getBatchThreads(nNumThreads, nNumTrackers);
+    int i;
+
+    // the trackers share nothing, one camera per iteration
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic) if(numThreads > 1)
+    for (i = 0; i < nNumTrackers; i++) {
+        if (nTrackers[i]->calc(nImages[i]).empty())
+            nBestMarkers[i] = -1;
+        else
+            nBestMarkers[i] = nTrackers[i]->selectBestMarkerByCf();
+    }
+}
+
 void TrackerSingleMarker::selectDetectedMarker(const int id) {
     for (int i = 0; i < marker_num; i++) {
         if (marker_info[i].id == id) {
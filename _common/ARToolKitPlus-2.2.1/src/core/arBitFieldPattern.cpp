@@ -23,6 +23,10 @@
 
 #include <cassert>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace ARToolKitPlus {
 
 static void applyMaskSimple(IDPATTERN& nPattern) {
@@ -371,23 +375,34 @@ int Tracker::bitfield_check_BCH(uint8_t *data, int *code, int *dir, ARFloat *cf,
     int id0 = -1, id90 = -1, id180 = -1, id270 = -1;
     float prop0 = 0.0f, prop90 = 0.0f, prop180 = 0.0f, prop270 = 0.0f;
 
-    if (bchProcessor == NULL)
-        bchProcessor = new BCH;
+    // BCH decoding keeps state, parallel detection gives each thread its own processor
+    BCH *processor;
+#ifdef _OPENMP
+    if (getDetectionThreads() > 1)
+        processor = &bchThreadProcessors[omp_get_thread_num()];
+    else
+#endif
+    {
+        if (bchProcessor == NULL)
+            bchProcessor = new BCH;
+        processor = bchProcessor;
+    }
 
     pat0 = pat;
-    checkPatternBCH(pat0, id0, prop0, bchProcessor);
+    checkPatternBCH(pat0, id0, prop0, processor);
 
     pat90 = pat0;
     rotate90CW(pat90);
-    checkPatternBCH(pat90, id90, prop90, bchProcessor);
+    checkPatternBCH(pat90, id90, prop90, processor);
 
     pat180 = pat90;
     rotate90CW(pat180);
-    checkPatternBCH(pat180, id180, prop180, bchProcessor);
+    checkPatternBCH(pat180, id180, prop180, processor);
 
     pat270 = pat180;
     rotate90CW(pat270);
-    checkPatternBCH(pat270, id270, prop270, bchProcessor);
+    checkPatternBCH(pat270, id270, prop270, processor);
+
 
     if (prop0 >= prop90 && prop0 >= prop180 && prop0 >= prop270) // is prop0 maximum?
     {
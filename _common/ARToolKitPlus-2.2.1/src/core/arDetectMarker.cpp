@@ -35,7 +35,7 @@ Tracker::arDetectMarker(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker_inf
 {
     int16_t                *limage=NULL;
     int                    label_num;
-    int                    *area, *clip, *label_ref;
+    int                    *area, *clip, *start;
     ARFloat                 *pos;
     ARFloat                 rarea, rlen, rlenmin;
     ARFloat                 diff, diffmin;
@@ -43,7 +43,6 @@ Tracker::arDetectMarker(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker_inf
     int                    i, j, k;
     
     trackedCorners.clear();
-	autoThreshold.reset();
 	checkImageBuffer();
 
 //	FILE* fp = fopen("imgdump.raw", "wb");
@@ -52,33 +51,64 @@ Tracker::arDetectMarker(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker_inf
 
     *marker_num = 0;
 
-	for(int numTries = 0;;)
+	uint8_t *lumImage;
+	bool useROIs = roiTracking.enabled && !adaptiveThreshold.enabled && roiTracking.numMarkers > 0 &&
+		roiTracking.framesSinceRescan < roiTracking.rescanInterval;
+
+	// the regions of interest of the last frame first, the whole image if they lose a marker
+	for(;;)
 	{
-		limage = arLabeling(dataPtr, _thresh, &label_num, &area, &pos, &clip, &label_ref);
-		if(limage)
+		autoThreshold.reset();
+		setLabelRects(useROIs);
+
+		lumImage = arGetLuminance(dataPtr);
+		if(adaptiveThreshold.enabled)
+			lumImage = arAdaptiveThreshold(lumImage);
+
+		for(int numTries = 0;;)
 		{
-			marker_info2 = arDetectMarker2(limage, label_num, label_ref, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
-			assert(wmarker_num <= MAX_IMAGE_PATTERNS);
-			if(marker_info2)
+			limage = arLabeling(lumImage, adaptiveThreshold.enabled ? 127 : _thresh, &label_num, &area, &pos, &clip, &start);
+			if(limage)
 			{
-				wmarker_info = arGetMarkerInfo(dataPtr, marker_info2, &wmarker_num, _thresh);
+				marker_info2 = arDetectMarker2(limage, label_num, start, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
 				assert(wmarker_num <= MAX_IMAGE_PATTERNS);
-				if(wmarker_info && wmarker_num>0)
+				if(marker_info2)
+				{
+					wmarker_info = arGetMarkerInfo(dataPtr, marker_info2, &wmarker_num, _thresh);
+					assert(wmarker_num <= MAX_IMAGE_PATTERNS);
+					if(wmarker_info && wmarker_num>0)
+						break;
+				}
+			}
+
+			if(!autoThreshold.enable || adaptiveThreshold.enabled || useROIs)
+				break;
+			else
+			{
+				_thresh = thresh = (rand() % 230) + 10;
+				if(++numTries>autoThreshold.numRandomRetries)
 					break;
 			}
+
 		}
 
-		if(!autoThreshold.enable)
+		if(!useROIs)
 			break;
-		else
+
+		int numFound = 0;
+		if(limage && marker_info2 && wmarker_info)
 		{
-			_thresh = thresh = (rand() % 230) + 10;
-			if(++numTries>autoThreshold.numRandomRetries)
-				break;
+			for( i = 0; i < wmarker_num; i++ )
+				if( wmarker_info[i].id >= 0 && wmarker_info[i].cf >= 0.5 )
+					numFound++;
 		}
-
+		if(numFound >= roiTracking.numMarkers)
+			break;
+		useROIs = false;
 	}
 
+	roiTracking.framesSinceRescan = useROIs ? roiTracking.framesSinceRescan + 1 : 0;
+
 	if(!limage || !marker_info2 || !wmarker_info)
 		return -1;
 
@@ -123,6 +153,8 @@ Tracker::arDetectMarker(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker_inf
         if( wmarker_info[i].cf < 0.5 ) wmarker_info[i].id = -1;
    }
 
+    if( roiTracking.enabled )
+        updateLabelROIs(wmarker_info, wmarker_num);
 
 /*------------------------------------------------------------*/
 
@@ -189,50 +221,81 @@ Tracker::arDetectMarkerLite(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker
 {
     int16_t                *limage = NULL;
     int                    label_num;
-    int                    *area, *clip, *label_ref;
+    int                    *area, *clip, *start;
     ARFloat                 *pos;
     int                    i;
-
+
     trackedCorners.clear();
 
-	autoThreshold.reset();
 	checkImageBuffer();
 
     *marker_num = 0;
 
-	for(int numTries = 0;;)
+	uint8_t *lumImage;
+	bool useROIs = roiTracking.enabled && !adaptiveThreshold.enabled && roiTracking.numMarkers > 0 &&
+		roiTracking.framesSinceRescan < roiTracking.rescanInterval;
+
+	// the regions of interest of the last frame first, the whole image if they lose a marker
+	for(;;)
 	{
-		limage = arLabeling(dataPtr, _thresh, &label_num, &area, &pos, &clip, &label_ref);
-		if(limage)
+		autoThreshold.reset();
+		setLabelRects(useROIs);
+
+		lumImage = arGetLuminance(dataPtr);
+		if(adaptiveThreshold.enabled)
+			lumImage = arAdaptiveThreshold(lumImage);
+
+		for(int numTries = 0;;)
 		{
-			marker_info2 = arDetectMarker2(limage, label_num, label_ref, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
-			if(marker_info2)
+			limage = arLabeling(lumImage, adaptiveThreshold.enabled ? 127 : _thresh, &label_num, &area, &pos, &clip, &start);
+			if(limage)
+			{
+				marker_info2 = arDetectMarker2(limage, label_num, start, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
+				if(marker_info2)
+				{
+					wmarker_info = arGetMarkerInfo(dataPtr, marker_info2, &wmarker_num, _thresh);
+					if(wmarker_info && wmarker_num>0)
+						break;
+				}
+			}
+
+			if(!autoThreshold.enable || adaptiveThreshold.enabled || useROIs)
+				break;
+			else
 			{
-				wmarker_info = arGetMarkerInfo(dataPtr, marker_info2, &wmarker_num, _thresh);
-				if(wmarker_info && wmarker_num>0)
+				_thresh = thresh = (rand() % 230) + 10;
+				if(++numTries>autoThreshold.numRandomRetries)
 					break;
 			}
+
 		}
 
-		if(!autoThreshold.enable)
+		if(!useROIs)
 			break;
-		else
+
+		int numFound = 0;
+		if(limage && marker_info2 && wmarker_info)
 		{
-			_thresh = thresh = (rand() % 230) + 10;
-			if(++numTries>autoThreshold.numRandomRetries)
-				break;
+			for( i = 0; i < wmarker_num; i++ )
+				if( wmarker_info[i].id >= 0 && wmarker_info[i].cf >= 0.5 )
+					numFound++;
 		}
-
+		if(numFound >= roiTracking.numMarkers)
+			break;
+		useROIs = false;
 	}
 
+	roiTracking.framesSinceRescan = useROIs ? roiTracking.framesSinceRescan + 1 : 0;
+
 	if(!limage || !marker_info2 || !wmarker_info)
 		return -1;
 
 
-    limage = arLabeling(dataPtr, _thresh, &label_num, &area, &pos, &clip, &label_ref);
+    limage = arLabeling(lumImage, adaptiveThreshold.enabled ? 127 : _thresh, &label_num, &area, &pos, &clip, &start);
     if( limage == 0 )    return -1;
 
-    marker_info2 = arDetectMarker2(limage, label_num, label_ref, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
+
+    marker_info2 = arDetectMarker2(limage, label_num, start, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN, 1.0, &wmarker_num);
     if( marker_info2 == 0 ) return -1;
 
     wmarker_info = arGetMarkerInfo(dataPtr, marker_info2, &wmarker_num, _thresh);
@@ -242,6 +305,8 @@ Tracker::arDetectMarkerLite(uint8_t *dataPtr, int _thresh, ARMarkerInfo **marker
         if( wmarker_info[i].cf < 0.5 )
 			wmarker_info[i].id = -1;
 
+    if( roiTracking.enabled )
+        updateLabelROIs(wmarker_info, wmarker_num);
 
     *marker_num  = wmarker_num;
     *marker_info = wmarker_info;
@@ -22,6 +22,7 @@
 
 #include <ARToolKitPlus/Tracker.h>
 #include <cstdio>
+#include <algorithm>
 
 
 namespace ARToolKitPlus {
@@ -31,14 +32,14 @@ static int get_vertex( int x_coord[], int y_coord[], int st,  int ed,
 
 
  ARMarkerInfo2*
-Tracker::arDetectMarker2(int16_t *limage, int label_num, int *label_ref,
+Tracker::arDetectMarker2(int16_t *limage, int label_num, int *wstart,
                     int *warea, ARFloat *wpos, int *wclip,
                     int area_max, int area_min, ARFloat factor, int *marker_num)
 {
     ARMarkerInfo2     *pm;
     int               xsize, ysize;
     int               marker_num2;
-    int               i, j, ret;
+    int               i, j, k, ret;
     ARFloat            d;
 
     if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
@@ -51,25 +52,67 @@ Tracker::arDetectMarker2(int16_t *limage, int label_num, int *label_ref,
         xsize = arImXsize;
         ysize = arImYsize;
     }
-    marker_num2 = 0;
+    candidateLabels.clear();
     for(i=0; i<label_num; i++ ) {
         if( warea[i] < area_min || warea[i] > area_max ) continue;
         if( wclip[i*4+0] == 1 || wclip[i*4+1] == xsize-2 ) continue;
         if( wclip[i*4+2] == 1 || wclip[i*4+3] == ysize-2 ) continue;
+        candidateLabels.push_back(i);
+    }
+
+    marker_num2 = 0;
 
-        ret = arGetContour( limage, label_ref, i+1,
-                            &(wclip[i*4]), &(marker_infoTWO[marker_num2]));
-        if( ret < 0 ) continue;
+    if( getDetectionThreads() == 1 ) {
+        for(k=0; k<(int)candidateLabels.size(); k++ ) {
+            i = candidateLabels[k];
 
-        ret = check_square( warea[i], &(marker_infoTWO[marker_num2]), factor );
-        if( ret < 0 ) continue;
+            ret = arGetContour( limage, wstart[i],
+                                &(wclip[i*4]), &(marker_infoTWO[marker_num2]));
+            if( ret < 0 ) continue;
 
-        marker_infoTWO[marker_num2].area   = warea[i];
-        marker_infoTWO[marker_num2].pos[0] = wpos[i*2+0];
-        marker_infoTWO[marker_num2].pos[1] = wpos[i*2+1];
-        marker_num2++;
-        if(marker_num2==MAX_IMAGE_PATTERNS)
-			break;
+            ret = check_square( warea[i], &(marker_infoTWO[marker_num2]), factor );
+            if( ret < 0 ) continue;
+
+            marker_infoTWO[marker_num2].area   = warea[i];
+            marker_infoTWO[marker_num2].pos[0] = wpos[i*2+0];
+            marker_infoTWO[marker_num2].pos[1] = wpos[i*2+1];
+            marker_num2++;
+            if(marker_num2==MAX_IMAGE_PATTERNS)
+                break;
+        }
+    }
+    else {
+        // trace a batch of candidates in parallel, then keep the good ones in label
+        // order until MAX_IMAGE_PATTERNS is reached, just like the loop above
+        int numThreads = getDetectionThreads();
+        int batch = numThreads * 2;
+
+        if( (int)candidateInfo.size() < batch ) candidateInfo.resize(batch);
+        if( (int)candidateValid.size() < batch ) candidateValid.resize(batch);
+
+        for(k=0; k<(int)candidateLabels.size() && marker_num2<MAX_IMAGE_PATTERNS; k+=batch ) {
+            int num = std::min(batch, (int)candidateLabels.size()-k);
+            int c;
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+            for(c=0; c<num; c++ ) {
+                int l = candidateLabels[k+c];
+
+                candidateValid[c] = arGetContour( limage, wstart[l], &(wclip[l*4]), &(candidateInfo[c])) >= 0
+                                 && check_square( warea[l], &(candidateInfo[c]), factor ) >= 0;
+            }
+
+            for(c=0; c<num && marker_num2<MAX_IMAGE_PATTERNS; c++ ) {
+                if( !candidateValid[c] ) continue;
+
+                i = candidateLabels[k+c];
+                marker_infoTWO[marker_num2] = candidateInfo[c];
+                marker_infoTWO[marker_num2].area   = warea[i];
+                marker_infoTWO[marker_num2].pos[0] = wpos[i*2+0];
+                marker_infoTWO[marker_num2].pos[1] = wpos[i*2+1];
+                marker_num2++;
+            }
+        }
     }
 
     for( i=0; i < marker_num2; i++ ) {
@@ -119,7 +162,7 @@ Tracker::arDetectMarker2(int16_t *limage, int label_num, int *label_ref,
 
 
  int
-Tracker::arGetContour(int16_t *limage, int *label_ref, int label, int clip[4], ARMarkerInfo2 *marker_infoTWO)
+Tracker::arGetContour(int16_t *limage, int start, int clip[4], ARMarkerInfo2 *marker_infoTWO)
 {
     static const int      xdir[8] = { 0, 1, 1, 1, 0,-1,-1,-1};
     static const int      ydir[8] = {-1,-1, 0, 1, 1, 1, 0,-1};
@@ -129,7 +172,7 @@ Tracker::arGetContour(int16_t *limage, int *label_ref, int label, int clip[4], A
     int             xsize, ysize;
     int             sx, sy, dir;
     int             dmax, d, v1 = 0;
-    int             i, j;
+    int             i;
 
     if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
         xsize = arImXsize / 2;
@@ -139,17 +182,13 @@ Tracker::arGetContour(int16_t *limage, int *label_ref, int label, int clip[4], A
         xsize = arImXsize;
         ysize = arImYsize;
     }
-    j = clip[2];
-    p1 = &(limage[j*xsize+clip[0]]);
-    for( i = clip[0]; i <= clip[1]; i++, p1++ ) {
-        if( *p1 > 0 && label_ref[(*p1)-1] == label ) {
-            sx = i; sy = j; break;
-        }
-    }
-    if( i > clip[1] ) {
+    // the labeling already knows the top-left pixel, the trace only needs the binary image
+    sx = start; sy = clip[2];
+    if( sx < clip[0] || sx > clip[1] || limage[sy*xsize+sx] <= 0 ) {
         printf("??? 1\n"); return(-1);
     }
 
+
     marker_infoTWO->coord_num = 1;
     marker_infoTWO->x_coord[0] = sx;
     marker_infoTWO->y_coord[0] = sy;
@@ -187,18 +226,10 @@ Tracker::arGetContour(int16_t *limage, int *label_ref, int label, int clip[4], A
         }
     }
 
-    for(i=0;i<v1;i++) {
-        arGetContour_wx[i] = marker_infoTWO->x_coord[i];
-        arGetContour_wy[i] = marker_infoTWO->y_coord[i];
-    }
-    for(i=v1;i<marker_infoTWO->coord_num;i++) {
-        marker_infoTWO->x_coord[i-v1] = marker_infoTWO->x_coord[i];
-        marker_infoTWO->y_coord[i-v1] = marker_infoTWO->y_coord[i];
-    }
-    for(i=0;i<v1;i++) {
-        marker_infoTWO->x_coord[i-v1+marker_infoTWO->coord_num] = arGetContour_wx[i];
-        marker_infoTWO->y_coord[i-v1+marker_infoTWO->coord_num] = arGetContour_wy[i];
-    }
+    // start the contour at v1, in place so that candidates can be traced in parallel
+    std::rotate(marker_infoTWO->x_coord, marker_infoTWO->x_coord+v1, marker_infoTWO->x_coord+marker_infoTWO->coord_num);
+    std::rotate(marker_infoTWO->y_coord, marker_infoTWO->y_coord+v1, marker_infoTWO->y_coord+marker_infoTWO->coord_num);
+
     marker_infoTWO->x_coord[marker_infoTWO->coord_num] = marker_infoTWO->x_coord[0];
     marker_infoTWO->y_coord[marker_infoTWO->coord_num] = marker_infoTWO->y_coord[0];
     marker_infoTWO->coord_num++;
@@ -154,6 +154,8 @@ int Tracker::arGetCode(uint8_t *image, int *x_coord, int *y_coord, int *vertex,
 	if (autoThreshold.enable) {
 		int x, y;
 
+		// markers may be decoded in parallel, min and max don't depend on the order
+#pragma omp critical(ARToolKitPlus_autoThreshold)
 		for (y = 0; y < PATTERN_HEIGHT; y++)
 			for (x = 0; x < PATTERN_WIDTH; x++)
 				autoThreshold.addValue(
@@ -162,8 +164,29 @@ int Tracker::arGetCode(uint8_t *image, int *x_coord, int *y_coord, int *vertex,
 					_M(ext_pat,y,x,2),
 					pixelFormat);
 	}
+
+	if (adaptiveThreshold.enabled && markerMode != MARKER_TEMPLATE) {
+		// the lighting differs across the image, decode against the marker's own contrast
+		const int minContrast = 32;
+		AutoThreshold local;
+		int x, y;
+
+		local.reset();
+		for (y = 0; y < PATTERN_HEIGHT; y++)
+			for (x = 0; x < PATTERN_WIDTH; x++)
+				local.addValue(
+					_M(ext_pat,y,x,0),
+					_M(ext_pat,y,x,1),
+					_M(ext_pat,y,x,2),
+					pixelFormat);
+
+		if (local.maxLum - local.minLum >= minContrast)
+			thresh = local.calc();
+	}
+
 	#undef _M
 
+
 	//	FILE* fp = fopen("dump.raw", "wb");
 	//	fwrite(ext_pat, PATTERN_HEIGHT*PATTERN_WIDTH*3, 1, fp);
 	//	fclose(fp);
@@ -32,28 +32,72 @@ Tracker::arGetMarkerInfo(uint8_t *image, ARMarkerInfo2 *marker_info2, int *marke
     int            id, dir;
     ARFloat         cf;
     int            i, j;
+    int            numThreads = getDetectionThreads();
 
-    for( i = j = 0; i < *marker_num; i++ ) {
-        marker_infoL[j].area   = marker_info2[i].area;
-        marker_infoL[j].pos[0] = marker_info2[i].pos[0];
-        marker_infoL[j].pos[1] = marker_info2[i].pos[1];
+    if( numThreads == 1 ) {
+        for( i = j = 0; i < *marker_num; i++ ) {
+            marker_infoL[j].area   = marker_info2[i].area;
+            marker_infoL[j].pos[0] = marker_info2[i].pos[0];
+            marker_infoL[j].pos[1] = marker_info2[i].pos[1];
+
+            if (arGetLine(marker_info2[i].x_coord, marker_info2[i].y_coord, marker_info2[i].vertex, marker_infoL[j].line,
+                    marker_infoL[j].vertex) < 0)
+                continue;
+
+            arGetCode( image,
+                       marker_info2[i].x_coord, marker_info2[i].y_coord,
+                       marker_info2[i].vertex, &id, &dir, &cf, thresh);
+
+            marker_infoL[j].id  = id;
+            marker_infoL[j].dir = dir;
+            marker_infoL[j].cf  = cf;
+
+            j++;
+        }
+        *marker_num = j;
+
+        return( marker_infoL );
+    }
 
-        if (arGetLine(marker_info2[i].x_coord, marker_info2[i].y_coord, marker_info2[i].vertex, marker_infoL[j].line,
-                marker_infoL[j].vertex) < 0)
-            continue;
+    // everything that is built lazily has to exist before the threads start
+    if( undistMode == UNDIST_LUT && !undistO2ITable )
+        buildUndistO2ITable(arCamera);
+    if( markerMode == MARKER_ID_BCH && (int)bchThreadProcessors.size() < numThreads )
+        bchThreadProcessors.resize(numThreads);
+    if( (int)candidateValid.size() < *marker_num )
+        candidateValid.resize(*marker_num);
+
+    // decode every marker into its own slot, then close the gaps of the failed ones
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+    for( i = 0; i < *marker_num; i++ ) {
+        int     id, dir;
+        ARFloat  cf;
+
+        marker_infoL[i].area   = marker_info2[i].area;
+        marker_infoL[i].pos[0] = marker_info2[i].pos[0];
+        marker_infoL[i].pos[1] = marker_info2[i].pos[1];
+
+        candidateValid[i] = arGetLine(marker_info2[i].x_coord, marker_info2[i].y_coord, marker_info2[i].vertex,
+                marker_infoL[i].line, marker_infoL[i].vertex) >= 0;
+        if( !candidateValid[i] ) continue;
 
         arGetCode( image,
                    marker_info2[i].x_coord, marker_info2[i].y_coord,
                    marker_info2[i].vertex, &id, &dir, &cf, thresh);
 
-        marker_infoL[j].id  = id;
-        marker_infoL[j].dir = dir;
-        marker_infoL[j].cf  = cf;
+        marker_infoL[i].id  = id;
+        marker_infoL[i].dir = dir;
+        marker_infoL[i].cf  = cf;
+    }
 
+    for( i = j = 0; i < *marker_num; i++ ) {
+        if( !candidateValid[i] ) continue;
+        if( j != i ) marker_infoL[j] = marker_infoL[i];
         j++;
     }
     *marker_num = j;
 
+
     return( marker_infoL );
 }
 
@@ -20,8 +20,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
+#include <cassert>
 #include <ARToolKitPlus/Tracker.h>
 
+
 namespace ARToolKitPlus {
 
 void put_zero(uint8_t *p, int size) {
@@ -29,64 +32,421 @@ void put_zero(uint8_t *p, int size) {
         *(p++) = 0;
 }
 
-// in order to get no speed loss we use the preprocessor
-// to create 5 different versions of labeling2, for the
-// five different major pixel formats
-#define _DEF_PIXEL_FORMAT_ABGR
-#define LABEL_FUNC_NAME arLabeling_ABGR
-#include "arLabelingImpl.h"
-#undef _DEF_PIXEL_FORMAT_ABGR
-
-#define _DEF_PIXEL_FORMAT_BGR
-#define LABEL_FUNC_NAME arLabeling_BGR
-#include "arLabelingImpl.h"
-#undef _DEF_PIXEL_FORMAT_BGR
-
-#define _DEF_PIXEL_FORMAT_RGB
-#define LABEL_FUNC_NAME arLabeling_RGB
-#include "arLabelingImpl.h"
-#undef _DEF_PIXEL_FORMAT_RGB
-
-#define _DEF_PIXEL_FORMAT_RGB565
-#define LABEL_FUNC_NAME arLabeling_RGB565
-#include "arLabelingImpl.h"
-#undef _DEF_PIXEL_FORMAT_RGB565
-
-#define _DEF_PIXEL_FORMAT_LUM
-#define LABEL_FUNC_NAME arLabeling_LUM
-#include "arLabelingImpl.h"
-#undef _DEF_PIXEL_FORMAT_LUM
+int Tracker::findLabel(LabelNode *nodes, int node) {
+    while (nodes[node].parent != node) {
+        nodes[node].parent = nodes[nodes[node].parent].parent;
+        node = nodes[node].parent;
+    }
+    return node;
+}
+
+int Tracker::joinLabels(LabelNode *nodes, int a, int b) {
+    a = findLabel(nodes, a);
+    b = findLabel(nodes, b);
+
+    if (a < b) {
+        nodes[b].parent = a;
+        return a;
+    }
+    nodes[a].parent = b;
+    return b;
+}
 
+// Run length labeling: every row is thresholded into runs of black pixels in the
+// same pass that writes the binary image, the runs are then joined to the
+// 8-connected runs of the previous row with a union-find over one node per new
+// component. Area, centroid sums, clip and start are kept per node and folded
+// into the final labels at the end, so the only limit is memory.
+// Only the rectangles picked by setLabelRects() are labeled, each one is split into
+// stripes the detection threads label on their own, mergeLabelStripes() joins the
+// runs that meet at the stripe seams.
 int16_t*
-Tracker::arLabeling(uint8_t *image, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
-        int **label_ref) {
-    int16_t* ret = NULL;
+Tracker::arLabeling(uint8_t *lumImage, int thresh, int *label_num, int **area, ARFloat **pos, int **clip,
+        int **start) {
+    int16_t *pnt1, *pnt2;
+    int i, r, s;
+    int lxsize;
+    int16_t *l_image;
+
+    assert(l_imageL && "checkImageBuffer() must be called before labeling2(). this should happen automatically in arDetectMarker() & arDetectMarkerLite()");
+
+    l_image = &l_imageL[0];
+
+    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = arImXsize / 2;
+    } else {
+        lxsize = arImXsize;
+    }
+
+    // the frames keep the labels apart from whatever is left of older frames around them
+    for (r = 0; r < (int) labelRectsL.size(); r++) {
+        const LabelRect &rect = labelRectsL[r];
+
+        pnt1 = &l_image[rect.y0 * lxsize + rect.x0];
+        pnt2 = &l_image[rect.y1 * lxsize + rect.x0];
+        for (i = rect.x0; i <= rect.x1; i++) {
+            *(pnt1++) = *(pnt2++) = 0;
+        }
+
+        pnt1 = &l_image[rect.y0 * lxsize + rect.x0];
+        pnt2 = &l_image[rect.y0 * lxsize + rect.x1];
+        for (i = rect.y0; i <= rect.y1; i++) {
+            *pnt1 = *pnt2 = 0;
+            pnt1 += lxsize;
+            pnt2 += lxsize;
+        }
+    }
+
+    int numStripes = numLabelStripesL;
+    int numThreads = std::min(numStripes, getDetectionThreads());
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic) if(numThreads > 1)
+    for (s = 0; s < numStripes; s++) {
+        LabelStripe &stripe = labelStripesL[s];
+        std::vector<LabelRun> *prevRuns = &stripe.runs[0];
+        std::vector<LabelRun> *curRuns = &stripe.runs[1];
+        std::vector<LabelNode> &nodes = stripe.nodes;
+        int iBegin = stripe.x0 + 1;
+        int iEnd = stripe.x1;
+        int i, j, k;
+        int runStart;
+
+        prevRuns->clear();
+        nodes.clear();
+
+        for (j = stripe.jBegin; j < stripe.jEnd; j++) {
+            const uint8_t *pnt = &lumImage[j * lxsize];
+            int16_t *pnt2 = &l_image[j * lxsize];
+
+            // threshold the row into the binary image and collect its runs
+            curRuns->clear();
+            runStart = -1;
+
+            for (i = iBegin; i < iEnd; i++) {
+                bool isBlack = (pnt[i] <= thresh);
+
+                pnt2[i] = isBlack;
+
+                if (isBlack) {
+                    if (runStart < 0)
+                        runStart = i;
+                } else if (runStart >= 0) {
+                    LabelRun run = { runStart, i - 1, 0 };
+                    curRuns->push_back(run);
+                    runStart = -1;
+                }
+            }
+
+            if (runStart >= 0) {
+                LabelRun run = { runStart, iEnd - 1, 0 };
+                curRuns->push_back(run);
+            }
+
+            // join the runs to the 8-connected runs of the previous row
+            LabelRun *prev = prevRuns->empty() ? NULL : &(*prevRuns)[0];
+            LabelRun *prevEnd = prev + prevRuns->size();
+
+            for (k = 0; k < (int) curRuns->size(); k++) {
+                LabelRun &run = (*curRuns)[k];
+                int node = -1;
+
+                while (prev < prevEnd && prev->x1 < run.x0 - 1)
+                    prev++;
+
+                for (LabelRun *p = prev; p < prevEnd && p->x0 <= run.x1 + 1; p++)
+                    node = node < 0 ? findLabel(&nodes[0], p->node) : joinLabels(&nodes[0], node, p->node);
+
+                if (node < 0) {
+                    LabelNode n;
+                    n.parent = node = (int) nodes.size();
+                    n.area = 0;
+                    n.sumX = n.sumY = 0;
+                    n.clip[0] = run.x0;
+                    n.clip[1] = run.x1;
+                    n.clip[2] = j;
+                    n.clip[3] = j;
+                    n.start = run.x0;
+                    nodes.push_back(n);
+                }
+
+                int len = run.x1 - run.x0 + 1;
+                LabelNode &n = nodes[node];
+                n.area += len;
+                n.sumX += (run.x0 + run.x1) * len / 2;
+                n.sumY += (double) j * len;
+                if (n.clip[0] > run.x0)
+                    n.clip[0] = run.x0;
+                if (n.clip[1] < run.x1)
+                    n.clip[1] = run.x1;
+                n.clip[3] = j;
+
+                run.node = node;
+            }
+
+            if (j == stripe.jBegin)
+                stripe.firstRow = *curRuns;
+
+            std::swap(prevRuns, curRuns);
+        }
+
+        stripe.lastRow = (prevRuns == &stripe.runs[0]) ? 0 : 1;
+    }
+
+    *label_num = wlabel_numL = mergeLabelStripes(numStripes);
+    if (*label_num == 0) {
+        return (l_image);
+    }
+
+    *start = &wstartL[0];
+    *area = &wareaL[0];
+    *pos = &wposL[0];
+    *clip = &wclipL[0];
+    return (l_image);
+}
+
+int Tracker::mergeLabelStripes(int numStripes) {
+    int i, r, s;
+
+    // renumber the nodes of all stripes into one list, the stripes come in raster
+    // order so every root still is the oldest node of its component
+    labelNodesL.swap(labelStripesL[0].nodes);
+    labelStripesL[0].nodeOffset = 0;
+
+    for (s = 1; s < numStripes; s++) {
+        const std::vector<LabelNode> &nodes = labelStripesL[s].nodes;
+        int offset = labelStripesL[s].nodeOffset = (int) labelNodesL.size();
+
+        for (i = 0; i < (int) nodes.size(); i++) {
+            labelNodesL.push_back(nodes[i]);
+            labelNodesL.back().parent += offset;
+        }
+    }
+
+    int numNodes = (int) labelNodesL.size();
+    if (numNodes == 0)
+        return 0;
+
+    LabelNode *nodes = &labelNodesL[0];
 
-    switch (pixelFormat) {
-    case PIXEL_FORMAT_ABGR:
-        ret = arLabeling_ABGR(image, thresh, label_num, area, pos, clip, label_ref);
-        break;
+    // join the runs that touch across each seam inside a rectangle, the same way as two rows of a stripe
+    for (s = 1; s < numStripes; s++) {
+        const LabelStripe &above = labelStripesL[s - 1], &below = labelStripesL[s];
+        const std::vector<LabelRun> &prevRuns = above.runs[above.lastRow];
+        size_t p = 0;
 
-    case PIXEL_FORMAT_BGRA:
-    case PIXEL_FORMAT_BGR:
-        ret = arLabeling_BGR(image, thresh, label_num, area, pos, clip, label_ref);
-        break;
+        if (!below.joinAbove)
+            continue;
 
-    case PIXEL_FORMAT_RGBA:
-    case PIXEL_FORMAT_RGB:
-        ret = arLabeling_RGB(image, thresh, label_num, area, pos, clip, label_ref);
-        break;
+        for (i = 0; i < (int) below.firstRow.size(); i++) {
+            const LabelRun &run = below.firstRow[i];
 
-    case PIXEL_FORMAT_RGB565:
-        ret = arLabeling_RGB565(image, thresh, label_num, area, pos, clip, label_ref);
-        break;
+            while (p < prevRuns.size() && prevRuns[p].x1 < run.x0 - 1)
+                p++;
 
-    case PIXEL_FORMAT_LUM:
-        ret = arLabeling_LUM(image, thresh, label_num, area, pos, clip, label_ref);
-        break;
+            for (size_t q = p; q < prevRuns.size() && prevRuns[q].x0 <= run.x1 + 1; q++)
+                joinLabels(nodes, prevRuns[q].node + above.nodeOffset, run.node + below.nodeOffset);
+        }
     }
 
-    return ret;
+    // a root is always older than its children, so one pass in node order
+    // numbers the roots and replaces every parent by -(label+1)
+    int numLabels = 0;
+
+    for (i = 0; i < numNodes; i++) {
+        int parent = nodes[i].parent;
+        nodes[i].parent = (parent == i) ? -(++numLabels) : nodes[parent].parent;
+    }
+
+    wareaL.assign(numLabels, 0);
+    wposL.resize(numLabels * 2);
+    wclipL.resize(numLabels * 4);
+    wstartL.resize(numLabels);
+    labelSumsL.assign(numLabels * 2, 0.0);
+
+    // the root is the first node of each label, it holds the top row and start
+    for (i = 0; i < numNodes; i++) {
+        const LabelNode &n = nodes[i];
+        int l = -n.parent - 1;
+        int *c = &wclipL[l * 4];
+
+        if (wareaL[l] == 0) {
+            c[0] = n.clip[0];
+            c[1] = n.clip[1];
+            c[2] = n.clip[2];
+            c[3] = n.clip[3];
+            wstartL[l] = n.start;
+        } else {
+            if (c[0] > n.clip[0])
+                c[0] = n.clip[0];
+            if (c[1] < n.clip[1])
+                c[1] = n.clip[1];
+            if (c[3] < n.clip[3])
+                c[3] = n.clip[3];
+        }
+
+        wareaL[l] += n.area;
+        labelSumsL[l * 2 + 0] += n.sumX;
+        labelSumsL[l * 2 + 1] += n.sumY;
+    }
+
+    // a label that touches the frame of its rectangle may go on outside of it, it is
+    // dropped like the ones at the image border used to be in arDetectMarker2()
+    int num = 0;
+
+    for (i = 0; i < numLabels; i++) {
+        const int *c = &wclipL[i * 4];
+
+        for (r = 0; r < (int) labelRectsL.size(); r++) {
+            const LabelRect &rect = labelRectsL[r];
+
+            if (c[0] > rect.x0 && c[1] < rect.x1 && c[2] > rect.y0 && c[3] < rect.y1)
+                break;
+        }
+        if (c[0] == labelRectsL[r].x0 + 1 || c[1] == labelRectsL[r].x1 - 1)
+            continue;
+        if (c[2] == labelRectsL[r].y0 + 1 || c[3] == labelRectsL[r].y1 - 1)
+            continue;
+
+        wareaL[num] = wareaL[i];
+        wposL[num * 2 + 0] = (ARFloat) (labelSumsL[i * 2 + 0] / wareaL[i]);
+        wposL[num * 2 + 1] = (ARFloat) (labelSumsL[i * 2 + 1] / wareaL[i]);
+        wclipL[num * 4 + 0] = c[0];
+        wclipL[num * 4 + 1] = c[1];
+        wclipL[num * 4 + 2] = c[2];
+        wclipL[num * 4 + 3] = c[3];
+        wstartL[num] = wstartL[i];
+        num++;
+    }
+
+    return num;
+}
+
+void Tracker::setLabelRects(bool useROIs) {
+    int lxsize, lysize;
+    int r, k;
+
+    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = arImXsize / 2;
+        lysize = arImYsize / 2;
+    } else {
+        lxsize = arImXsize;
+        lysize = arImYsize;
+    }
+
+    labelRectsL.clear();
+    if (useROIs) {
+        // rectangles of an other image size or processing mode are of no use
+        for (r = 0; r < (int) roiTracking.rects.size(); r++) {
+            if (roiTracking.rects[r].x1 >= lxsize || roiTracking.rects[r].y1 >= lysize)
+                break;
+        }
+        if (r == (int) roiTracking.rects.size())
+            labelRectsL = roiTracking.rects;
+    }
+    if (labelRectsL.empty()) {
+        LabelRect full = { 0, 0, lxsize - 1, lysize - 1 };
+        labelRectsL.push_back(full);
+    }
+
+    numLabelStripesL = 0;
+    for (r = 0; r < (int) labelRectsL.size(); r++) {
+        const LabelRect &rect = labelRectsL[r];
+        int numRows = rect.y1 - rect.y0 - 1;
+        int numStripes = getDetectionStripes(numRows);
+
+        if ((int) labelStripesL.size() < numLabelStripesL + numStripes)
+            labelStripesL.resize(numLabelStripesL + numStripes);
+
+        for (k = 0; k < numStripes; k++) {
+            LabelStripe &stripe = labelStripesL[numLabelStripesL++];
+
+            stripe.x0 = rect.x0;
+            stripe.x1 = rect.x1;
+            stripe.jBegin = rect.y0 + 1 + numRows * k / numStripes;
+            stripe.jEnd = rect.y0 + 1 + numRows * (k + 1) / numStripes;
+            stripe.joinAbove = (k > 0);
+        }
+    }
+}
+
+void Tracker::updateLabelROIs(const ARMarkerInfo *markers, int num) {
+    int lxsize, lysize, shift;
+    int i, k, r;
+
+    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = arImXsize / 2;
+        lysize = arImYsize / 2;
+        shift = 1;
+    } else {
+        lxsize = arImXsize;
+        lysize = arImYsize;
+        shift = 0;
+    }
+
+    roiTracking.rects.clear();
+    roiTracking.numMarkers = 0;
+
+    for (i = 0; i < num; i++) {
+        if (markers[i].id < 0)
+            continue;
+
+        // the vertices are undistorted but the labeling works on the camera image, so
+        // their box is moved onto the centre of the label, the margin covers the rest
+        ARFloat minX = markers[i].vertex[0][0], maxX = minX, minY = markers[i].vertex[0][1], maxY = minY;
+        ARFloat centerX = 0, centerY = 0;
+
+        for (k = 0; k < 4; k++) {
+            minX = std::min(minX, markers[i].vertex[k][0]);
+            maxX = std::max(maxX, markers[i].vertex[k][0]);
+            minY = std::min(minY, markers[i].vertex[k][1]);
+            maxY = std::max(maxY, markers[i].vertex[k][1]);
+            centerX += markers[i].vertex[k][0] / 4;
+            centerY += markers[i].vertex[k][1] / 4;
+        }
+
+        minX += markers[i].pos[0] - centerX;
+        maxX += markers[i].pos[0] - centerX;
+        minY += markers[i].pos[1] - centerY;
+        maxY += markers[i].pos[1] - centerY;
+
+
+        ARFloat marginX = (maxX - minX) * roiTracking.margin, marginY = (maxY - minY) * roiTracking.margin;
+        LabelRect rect;
+
+        rect.x0 = std::max(0, ((int) (minX - marginX) >> shift) - 1);
+        rect.y0 = std::max(0, ((int) (minY - marginY) >> shift) - 1);
+        rect.x1 = std::min(lxsize - 1, ((int) (maxX + marginX) >> shift) + 1);
+        rect.y1 = std::min(lysize - 1, ((int) (maxY + marginY) >> shift) + 1);
+        if (rect.x1 - rect.x0 < 2 || rect.y1 - rect.y0 < 2)
+            continue;
+
+        // rectangles must not share pixels, the frame of one would cut through the other
+        for (r = 0; r < (int) roiTracking.rects.size();) {
+            const LabelRect &other = roiTracking.rects[r];
+
+            if (other.x0 > rect.x1 || other.x1 < rect.x0 || other.y0 > rect.y1 || other.y1 < rect.y0) {
+                r++;
+                continue;
+            }
+
+            rect.x0 = std::min(rect.x0, other.x0);
+            rect.y0 = std::min(rect.y0, other.y0);
+            rect.x1 = std::max(rect.x1, other.x1);
+            rect.y1 = std::max(rect.y1, other.y1);
+            roiTracking.rects.erase(roiTracking.rects.begin() + r);
+            r = 0;
+        }
+
+        roiTracking.rects.push_back(rect);
+        roiTracking.numMarkers++;
+    }
+
+    // top to bottom, so the labels come out in about the same order as from the whole image
+
+    for (i = 1; i < (int) roiTracking.rects.size(); i++) {
+        for (k = i; k > 0 && roiTracking.rects[k].y0 < roiTracking.rects[k - 1].y0; k--)
+            std::swap(roiTracking.rects[k], roiTracking.rects[k - 1]);
+    }
 }
 
 } // namespace ARToolKitPlus
@@ -0,0 +1,492 @@
+/**
+ * Copyright (C) 2010  ARToolkitPlus Authors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *  Daniel Wagner
+ */
+
+#include <algorithm>
+#include <ARToolKitPlus/Tracker.h>
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AR_LUMINANCE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define AR_LUMINANCE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ARToolKitPlus {
+
+// The labeling front end: whatever the pixel format, the image is reduced once per
+// frame to one byte per pixel at the labeling resolution, so arLabeling() compares
+// bytes against the threshold and the autoThreshold retries reuse the plane.
+//
+// Every row is done in two passes over a row buffer. The first sums the colour
+// channels (or converts RGB565, or widens LUM) of every step'th pixel, the second
+// subtracts the vignetting ramp and scales down to a byte. Colour pixels used to be
+// black when r+g+b <= 3*thresh + ramp, so the plane holds ceil((r+g+b - ramp) / 3),
+// which is <= thresh exactly then. The binary image does not change, except that
+// values above 255 are clamped, which only matters for thresh 255 with a negative ramp.
+
+static void sumRow32(const uint8_t *src, bool alphaFirst, int step, int width, uint16_t *dst) {
+    int i = 0;
+    const int c = alphaFirst ? 1 : 0;
+
+#if defined(AR_LUMINANCE_SSE2)
+    // the even bytes of a pixel are channels 0 and 2, the odd ones 1 and 3,
+    // one madd per half sums the three colour channels into 32 bits
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    const __m128i weightEven = _mm_set1_epi32(alphaFirst ? 0x00010000 : 0x00010001);
+    const __m128i weightOdd = _mm_set1_epi32(alphaFirst ? 0x00010001 : 0x00000001);
+
+    for (; i + 8 <= width; i += 8) {
+        const uint8_t *p = src + i * step * 4;
+        __m128i a, b;
+
+        if (step == 1) {
+            a = _mm_loadu_si128((const __m128i*) p);
+            b = _mm_loadu_si128((const __m128i*) (p + 16));
+        } else {
+            a = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(_mm_loadu_si128((const __m128i*) p)),
+                    _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (p + 16))), _MM_SHUFFLE(2, 0, 2, 0)));
+            b = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (p + 32))),
+                    _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (p + 48))), _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+
+        a = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(a, lowBytes), weightEven),
+                _mm_madd_epi16(_mm_srli_epi16(a, 8), weightOdd));
+        b = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(b, lowBytes), weightEven),
+                _mm_madd_epi16(_mm_srli_epi16(b, 8), weightOdd));
+
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(AR_LUMINANCE_NEON)
+    for (; i + 16 <= width; i += 16) {
+        const uint8_t *p = src + i * step * 4;
+        uint8x16_t c0, c1, c2;
+
+        if (step == 1) {
+            uint8x16x4_t a = vld4q_u8(p);
+            c0 = a.val[c];
+            c1 = a.val[c + 1];
+            c2 = a.val[c + 2];
+        } else {
+            uint8x16x4_t a = vld4q_u8(p), b = vld4q_u8(p + 64);
+            c0 = vuzpq_u8(a.val[c], b.val[c]).val[0];
+            c1 = vuzpq_u8(a.val[c + 1], b.val[c + 1]).val[0];
+            c2 = vuzpq_u8(a.val[c + 2], b.val[c + 2]).val[0];
+        }
+
+        vst1q_u16(dst + i, vaddw_u8(vaddl_u8(vget_low_u8(c0), vget_low_u8(c1)), vget_low_u8(c2)));
+        vst1q_u16(dst + i + 8, vaddw_u8(vaddl_u8(vget_high_u8(c0), vget_high_u8(c1)), vget_high_u8(c2)));
+    }
+#endif
+
+    for (; i < width; i++) {
+        const uint8_t *p = src + i * step * 4 + c;
+        dst[i] = (uint16_t) (p[0] + p[1] + p[2]);
+    }
+}
+
+static void sumRow24(const uint8_t *src, int step, int width, uint16_t *dst) {
+    int i = 0;
+
+#if defined(AR_LUMINANCE_NEON)
+    for (; i + 16 <= width; i += 16) {
+        const uint8_t *p = src + i * step * 3;
+        uint8x16_t c0, c1, c2;
+
+        if (step == 1) {
+            uint8x16x3_t a = vld3q_u8(p);
+            c0 = a.val[0];
+            c1 = a.val[1];
+            c2 = a.val[2];
+        } else {
+            uint8x16x3_t a = vld3q_u8(p), b = vld3q_u8(p + 48);
+            c0 = vuzpq_u8(a.val[0], b.val[0]).val[0];
+            c1 = vuzpq_u8(a.val[1], b.val[1]).val[0];
+            c2 = vuzpq_u8(a.val[2], b.val[2]).val[0];
+        }
+
+        vst1q_u16(dst + i, vaddw_u8(vaddl_u8(vget_low_u8(c0), vget_low_u8(c1)), vget_low_u8(c2)));
+        vst1q_u16(dst + i + 8, vaddw_u8(vaddl_u8(vget_high_u8(c0), vget_high_u8(c1)), vget_high_u8(c2)));
+    }
+#endif
+
+    // SSE2 has no byte shuffle to split 3 byte pixels, this stays scalar there
+    for (; i < width; i++) {
+        const uint8_t *p = src + i * step * 3;
+        dst[i] = (uint16_t) (p[0] + p[1] + p[2]);
+    }
+}
+
+// same as RGB565_to_LUM8_LUT, ((r<<1) + (g<<2) + g + b) >> 3 of the 8 bit channels
+static void sumRow565(const uint8_t *src, int step, int width, uint16_t *dst,
+        const unsigned char *RGB565_to_LUM8_LUT) {
+    const unsigned short *src16 = (const unsigned short*) src;
+    int i = 0;
+
+#if defined(AR_LUMINANCE_SSE2)
+#ifdef SMALL_LUM8_TABLE
+    const __m128i tableMask = _mm_set1_epi16((short) 0xFFC0);
+#else
+    const __m128i tableMask = _mm_set1_epi16((short) 0xFFFF);
+#endif
+    const __m128i redMask = _mm_set1_epi16((short) 0xF800), greenMask = _mm_set1_epi16(0x07E0),
+            blueMask = _mm_set1_epi16(0x001F), five = _mm_set1_epi16(5);
+
+    for (; i + 8 <= width; i += 8) {
+        const unsigned short *p = src16 + i * step;
+        __m128i v;
+
+        if (step == 1)
+            v = _mm_loadu_si128((const __m128i*) p);
+        else {
+            // keep the low half of every 32 bits, sign extended so the saturating pack keeps the bits
+            __m128i a = _mm_loadu_si128((const __m128i*) p), b = _mm_loadu_si128((const __m128i*) (p + 8));
+            v = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        }
+
+        v = _mm_and_si128(v, tableMask);
+
+        __m128i red = _mm_srli_epi16(_mm_and_si128(v, redMask), 8);
+        __m128i green = _mm_srli_epi16(_mm_and_si128(v, greenMask), 3);
+        __m128i blue = _mm_slli_epi16(_mm_and_si128(v, blueMask), 3);
+
+        v = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(red, 1), _mm_mullo_epi16(green, five)), blue);
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_srli_epi16(v, 3));
+    }
+#elif defined(AR_LUMINANCE_NEON)
+#ifdef SMALL_LUM8_TABLE
+    const uint16x8_t tableMask = vdupq_n_u16(0xFFC0);
+#else
+    const uint16x8_t tableMask = vdupq_n_u16(0xFFFF);
+#endif
+
+    for (; i + 8 <= width; i += 8) {
+        const unsigned short *p = src16 + i * step;
+        uint16x8_t v = (step == 1) ? vld1q_u16(p) : vld2q_u16(p).val[0];
+
+        v = vandq_u16(v, tableMask);
+
+        uint16x8_t red = vshrq_n_u16(vandq_u16(v, vdupq_n_u16(0xF800)), 8);
+        uint16x8_t green = vshrq_n_u16(vandq_u16(v, vdupq_n_u16(0x07E0)), 3);
+        uint16x8_t blue = vshlq_n_u16(vandq_u16(v, vdupq_n_u16(0x001F)), 3);
+
+        v = vaddq_u16(vaddq_u16(vshlq_n_u16(red, 1), vmulq_n_u16(green, 5)), blue);
+        vst1q_u16(dst + i, vshrq_n_u16(v, 3));
+    }
+#endif
+
+    for (; i < width; i++) {
+        const unsigned short *p = src16 + i * step;
+        dst[i] = getLUM8_from_RGB565(p);
+    }
+}
+
+static void sumRow8(const uint8_t *src, int step, int width, uint16_t *dst) {
+    int i = 0;
+
+#if defined(AR_LUMINANCE_SSE2)
+    const __m128i zero = _mm_setzero_si128(), lowBytes = _mm_set1_epi16(0x00FF);
+
+    for (; i + 16 <= width; i += 16) {
+        const uint8_t *p = src + i * step;
+
+        if (step == 1) {
+            __m128i v = _mm_loadu_si128((const __m128i*) p);
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i*) (dst + i + 8), _mm_unpackhi_epi8(v, zero));
+        } else {
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_and_si128(_mm_loadu_si128((const __m128i*) p), lowBytes));
+            _mm_storeu_si128((__m128i*) (dst + i + 8), _mm_and_si128(_mm_loadu_si128((const __m128i*) (p + 16)),
+                    lowBytes));
+        }
+    }
+#elif defined(AR_LUMINANCE_NEON)
+    for (; i + 16 <= width; i += 16) {
+        const uint8_t *p = src + i * step;
+        uint8x16_t v = (step == 1) ? vld1q_u8(p) : vld2q_u8(p).val[0];
+
+        vst1q_u16(dst + i, vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(dst + i + 8, vmovl_u8(vget_high_u8(v)));
+    }
+#endif
+
+    for (; i < width; i++)
+        dst[i] = src[i * step];
+}
+
+// dst = clamp(ceil((sum - corr) / (div3 ? 3 : 1))), corr may be NULL
+static void finishRow(const uint16_t *sum, const int16_t *corr, bool div3, int width, uint8_t *dst) {
+    int i = 0;
+
+    // x/3 == (x*21846)>>16 for x < 32768, ceil(x/3) == (x+2)/3
+#if defined(AR_LUMINANCE_SSE2)
+    const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2), third = _mm_set1_epi16(21846);
+
+    for (; i + 16 <= width; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (sum + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (sum + i + 8));
+
+        if (corr) {
+            a = _mm_max_epi16(_mm_sub_epi16(a, _mm_loadu_si128((const __m128i*) (corr + i))), zero);
+            b = _mm_max_epi16(_mm_sub_epi16(b, _mm_loadu_si128((const __m128i*) (corr + i + 8))), zero);
+        }
+        if (div3) {
+            a = _mm_mulhi_epu16(_mm_add_epi16(a, two), third);
+            b = _mm_mulhi_epu16(_mm_add_epi16(b, two), third);
+        }
+
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+    }
+#elif defined(AR_LUMINANCE_NEON)
+    for (; i + 8 <= width; i += 8) {
+        int16x8_t v = vreinterpretq_s16_u16(vld1q_u16(sum + i));
+
+        if (corr)
+            v = vmaxq_s16(vsubq_s16(v, vld1q_s16(corr + i)), vdupq_n_s16(0));
+        if (div3) {
+            uint16x8_t x = vaddq_u16(vreinterpretq_u16_s16(v), vdupq_n_u16(2));
+            uint16x4_t lo = vshrn_n_u32(vmull_n_u16(vget_low_u16(x), 21846), 16);
+            uint16x4_t hi = vshrn_n_u32(vmull_n_u16(vget_high_u16(x), 21846), 16);
+            v = vreinterpretq_s16_u16(vcombine_u16(lo, hi));
+        }
+
+        vst1_u8(dst + i, vqmovun_s16(v));
+    }
+#endif
+
+    for (; i < width; i++) {
+        int x = sum[i];
+
+        if (corr) {
+            x -= corr[i];
+            if (x < 0)
+                x = 0;
+        }
+        if (div3)
+            x = (x + 2) / 3;
+
+        dst[i] = (uint8_t) (x > 255 ? 255 : x);
+    }
+}
+
+uint8_t* Tracker::arGetLuminance(uint8_t *image) {
+    int s;
+    int lxsize, lysize, step;
+
+    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = arImXsize / 2;
+        lysize = arImYsize / 2;
+        step = 2;
+    } else {
+        lxsize = arImXsize;
+        lysize = arImYsize;
+        step = 1;
+    }
+
+    // arGetCode() still reads RGB565 through the table
+    if (pixelFormat == PIXEL_FORMAT_RGB565)
+        checkRGB565LUT();
+
+    if (pixelFormat == PIXEL_FORMAT_LUM && step == 1 && !vignetting.enabled)
+        return image;
+
+    // only the stripes of setLabelRects() are labeled, the frames of the rectangles stay white
+    int numStripes = numLabelStripesL;
+    int numThreads = std::min(numStripes, getDetectionThreads());
+
+    lumImageL.resize(lxsize * lysize);
+    if ((int) lumSumsL.size() < numStripes * lxsize) {
+        lumSumsL.resize(numStripes * lxsize);
+        lumCorrL.resize(numStripes * lxsize);
+    }
+
+    const bool div3 = (pixelFormat != PIXEL_FORMAT_RGB565 && pixelFormat != PIXEL_FORMAT_LUM);
+    const int srcRowSize = arImXsize * pixelSize * step;
+
+    // the vignetting ramps are the ones the labeling used to add to the threshold
+    // pixel by pixel, in closed form so that every row can start on its own
+    const int shiftBits = 10;
+    const int iHalf = lxsize / 2, jHalf = lysize / 2;
+    const int threshFact = div3 ? 3 : 1;
+
+    const int corrLeftY0 = (vignetting.corners * threshFact) << shiftBits,
+            dCorrLeftY0 = vignetting.enabled ? ((vignetting.leftright - vignetting.corners * threshFact) << shiftBits) / jHalf : 0,
+            corrCenterY0 = (vignetting.bottomtop * threshFact) << shiftBits,
+            dCorrCenterY0 = vignetting.enabled ? -corrCenterY0 / jHalf : 0;
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic) if(numThreads > 1)
+    for (s = 0; s < numStripes; s++) {
+        const LabelStripe &stripe = labelStripesL[s];
+        uint16_t *sum = &lumSumsL[s * lxsize];
+        int16_t *corr = vignetting.enabled ? &lumCorrL[s * lxsize] : NULL;
+        const int x0 = stripe.x0, width = stripe.x1 - stripe.x0 + 1;
+        int i, j;
+
+        for (j = stripe.jBegin; j < stripe.jEnd; j++) {
+            const uint8_t *src = image + j * srcRowSize + x0 * step * pixelSize;
+
+            switch (pixelFormat) {
+            case PIXEL_FORMAT_ABGR:
+                sumRow32(src, true, step, width, sum);
+                break;
+
+            case PIXEL_FORMAT_BGRA:
+            case PIXEL_FORMAT_RGBA:
+                sumRow32(src, false, step, width, sum);
+                break;
+
+            case PIXEL_FORMAT_BGR:
+            case PIXEL_FORMAT_RGB:
+                sumRow24(src, step, width, sum);
+                break;
+
+            case PIXEL_FORMAT_RGB565:
+                sumRow565(src, step, width, sum, RGB565_to_LUM8_LUT);
+                break;
+
+            case PIXEL_FORMAT_LUM:
+                sumRow8(src, step, width, sum);
+                break;
+            }
+
+            if (corr) {
+                // the ramps step once per row before it and turn around at jHalf,
+                // along the row they step once per pixel and turn around at iHalf
+                int rowsFirstHalf = j - 1 < jHalf - 1 ? j - 1 : jHalf - 1;
+                int rowsSecondHalf = j - 1 - rowsFirstHalf;
+                int corrLeftY = corrLeftY0 + dCorrLeftY0 * (rowsFirstHalf - rowsSecondHalf);
+                int corrCenterY = corrCenterY0 + dCorrCenterY0 * (rowsFirstHalf - rowsSecondHalf);
+                int dCorrX = (corrCenterY - corrLeftY) / iHalf;
+
+                for (i = x0; i < iHalf && i < x0 + width; i++)
+                    corr[i - x0] = (int16_t) ((corrLeftY + dCorrX * i) >> shiftBits);
+                for (; i < x0 + width; i++)
+                    corr[i - x0] = (int16_t) ((corrLeftY + dCorrX * (2 * iHalf - 2 - i)) >> shiftBits);
+            }
+
+            finishRow(sum, corr, div3, width, &lumImageL[j * lxsize + x0]);
+
+        }
+    }
+
+    return &lumImageL[0];
+}
+
+// Bradley and Roth's integral image threshold, as cinder's ip::adaptiveThreshold. The integral
+// image only covers the inner rows because the front end leaves the border rows untouched.
+uint8_t* Tracker::arAdaptiveThreshold(uint8_t *lumImage) {
+    int s, i, j;
+    int lxsize, lysize;
+
+    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = arImXsize / 2;
+        lysize = arImYsize / 2;
+    } else {
+        lxsize = arImXsize;
+        lysize = arImYsize;
+    }
+
+    const int stride = lxsize + 1;
+    int numStripes = getDetectionStripes(lysize - 2);
+
+    lumIntegralL.resize(lysize * stride);
+    adaptImageL.resize(lxsize * lysize);
+
+    uint32_t *integral = &lumIntegralL[0];
+    for (i = 0; i < stride * 2; i++)
+        integral[i] = 0;
+
+    // row sums first, they are independent, then every row adds the one above
+#pragma omp parallel for num_threads(numStripes) schedule(static, 1) if(numStripes > 1)
+    for (s = 0; s < numStripes; s++) {
+        int jBegin = 1 + (lysize - 2) * s / numStripes;
+        int jEnd = 1 + (lysize - 2) * (s + 1) / numStripes;
+        int i, j;
+
+        for (j = jBegin; j < jEnd; j++) {
+            const uint8_t *lum = &lumImage[j * lxsize];
+            uint32_t *row = &integral[(j + 1) * stride];
+            uint32_t sum = 0;
+
+            row[0] = 0;
+            for (i = 0; i < lxsize; i++)
+                row[i + 1] = sum += lum[i];
+        }
+    }
+
+    for (j = 3; j < lysize; j++) {
+        uint32_t *row = &integral[j * stride];
+        const uint32_t *above = row - stride;
+
+        for (i = 0; i <= lxsize; i++)
+            row[i] += above[i];
+    }
+
+    const int halfWindow = (adaptiveThreshold.windowSize > 0 ? adaptiveThreshold.windowSize : lxsize / 8) / 2;
+    const float percentage = (float) adaptiveThreshold.percentage;
+
+#pragma omp parallel for num_threads(numStripes) schedule(static, 1) if(numStripes > 1)
+    for (s = 0; s < numStripes; s++) {
+        int jBegin = 1 + (lysize - 2) * s / numStripes;
+        int jEnd = 1 + (lysize - 2) * (s + 1) / numStripes;
+        int i, j;
+
+        for (j = jBegin; j < jEnd; j++) {
+            int y1 = j - halfWindow > 1 ? j - halfWindow : 1;
+            int y2 = j + halfWindow + 1 < lysize - 1 ? j + halfWindow + 1 : lysize - 1;
+            const uint32_t *top = &integral[y1 * stride], *bottom = &integral[y2 * stride];
+            const uint8_t *lum = &lumImage[j * lxsize];
+            uint8_t *dst = &adaptImageL[j * lxsize];
+            const float rowScale = 100.0f * (y2 - y1) / percentage;
+
+            // black if lum * count * 100 <= sum * percentage, the window is only clipped
+            // next to the left and right border so the middle part has a constant count
+            int iMid = halfWindow + 1 < lxsize - 1 ? halfWindow + 1 : lxsize - 1;
+            int iRight = lxsize - 1 - halfWindow > iMid ? lxsize - 1 - halfWindow : iMid;
+
+            for (i = 1; i < lxsize - 1; i++) {
+                if (i == iMid) {
+                    const float scale = (2 * halfWindow + 1) * rowScale;
+                    const uint32_t *top1 = top - halfWindow, *bottom1 = bottom - halfWindow;
+                    const uint32_t *top2 = top + halfWindow + 1, *bottom2 = bottom + halfWindow + 1;
+
+                    for (; i < iRight; i++) {
+                        uint32_t sum = (bottom2[i] - top2[i]) - (bottom1[i] - top1[i]);
+                        dst[i] = (lum[i] * scale <= (float) sum) ? 0 : 255;
+                    }
+                    if (i >= lxsize - 1)
+                        break;
+                }
+
+                int x1 = i - halfWindow > 0 ? i - halfWindow : 0;
+                int x2 = i + halfWindow + 1 < lxsize ? i + halfWindow + 1 : lxsize;
+                uint32_t sum = (bottom[x2] - top[x2]) - (bottom[x1] - top[x1]);
+
+                dst[i] = (lum[i] * (x2 - x1) * rowScale <= (float) sum) ? 0 : 255;
+            }
+        }
+    }
+
+    return &adaptImageL[0];
+}
+
+} // namespace ARToolKitPlus
+
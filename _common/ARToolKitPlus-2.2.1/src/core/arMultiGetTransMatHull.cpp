@@ -23,6 +23,7 @@
 #include <ARToolKitPlus/extra/Hull.h>
 #include <ARToolKitPlus/Tracker.h>
 #include <ARToolKitPlus/arGetInitRot2Sub.h>
+#include <ARToolKitPlus/extra/IPPE.h>
 
 
 namespace ARToolKitPlus {
@@ -45,6 +46,7 @@ Tracker::arMultiGetTransMatHull(ARMarkerInfo *marker_info, int marker_num, ARMul
 	int indices[maxHullPoints];
 	rpp_vec ppos2d[maxHullPoints];
 	rpp_vec ppos3d[maxHullPoints];
+	bool hullPlanar = true;
 
 
 	// create an array of 2D points and keep references
@@ -156,6 +158,9 @@ Tracker::arMultiGetTransMatHull(ARMarkerInfo *marker_info, int marker_num, ARMul
 		ppos3d[i][0] = markerInfo.pos3d[cornerIdx][0];
 		ppos3d[i][1] = markerInfo.pos3d[cornerIdx][1];
 		ppos3d[i][2] = 0;
+
+		if(!ippe::onPlane(markerInfo.pos3d[cornerIdx][2]))
+			hullPlanar = false;
 	}
 
 	trackedCenterX /= 4;
@@ -170,7 +175,10 @@ Tracker::arMultiGetTransMatHull(ARMarkerInfo *marker_info, int marker_num, ARMul
 	rpp_mat R, R_init;
 	rpp_vec t;
 
-	if(poseEstimator==POSE_ESTIMATOR_RPP)
+	// IPPE only handles flat configurations, others are left to RPP like in ippeMultiGetTransMat()
+	const bool ippeMode = poseEstimator==POSE_ESTIMATOR_IPPE || poseEstimator==POSE_ESTIMATOR_IPPE_REFINED;
+
+	if(poseEstimator==POSE_ESTIMATOR_RPP || (ippeMode && !hullPlanar))
 	{
 		robustPlanarPose(err,R,t,cc,fc,ppos3d,ppos2d,numHullPoints,R_init, true,0,0,0);
 		if(err>1e+10)
@@ -183,6 +191,32 @@ Tracker::arMultiGetTransMatHull(ARMarkerInfo *marker_info, int marker_num, ARMul
 				config->trans[k][j] = (ARFloat)R[k][j];
 		}
 	}
+	else if(ippeMode)
+	{
+		ARFloat tmp_pos2d[maxHullPoints][2], tmp_pos3d[maxHullPoints][2], rot[3][3], trans[3];
+
+		for(int i=0; i<numHullPoints; i++)
+		{
+			tmp_pos2d[i][0] = (ARFloat)ppos2d[i][0];
+			tmp_pos2d[i][1] = (ARFloat)ppos2d[i][1];
+			tmp_pos3d[i][0] = (ARFloat)ppos3d[i][0];
+			tmp_pos3d[i][1] = (ARFloat)ppos3d[i][1];
+		}
+
+		const ARFloat fcf[2] = {arCamera->mat[0][0],arCamera->mat[1][1]};
+		const ARFloat ccf[2] = {arCamera->mat[0][2],arCamera->mat[1][2]};
+
+		err = planarPose<ARFloat>(tmp_pos3d,tmp_pos2d,numHullPoints,fcf,ccf,poseEstimator==POSE_ESTIMATOR_IPPE_REFINED,rot,trans);
+		if(err<0)
+			return(-1);
+
+		for(int k=0; k<3; k++)
+		{
+			config->trans[k][3] = trans[k];
+			for(int j=0; j<3; j++)
+				config->trans[k][j] = rot[k][j];
+		}
+	}
 	else
 	{
 		ARFloat rot[3][3];
@@ -45,7 +45,7 @@ int Tracker::arGetLine(int x_coord[], int y_coord[], int vertex[], ARFloat line[
     ARVec *ev, *mean;
     ARFloat w1;
     int st, ed, n;
-    int i, j;
+    int i;
 
     ev = Vector::alloc(2);
     mean = Vector::alloc(2);
@@ -56,12 +56,7 @@ int Tracker::arGetLine(int x_coord[], int y_coord[], int vertex[], ARFloat line[
         ed = (int) (vertex[i + 1] - w1);
         n = ed - st + 1;
         input = Matrix::alloc(n, 2);
-        for (j = 0; j < n; j++) {
-            ARFloat x, y;
-            (this->*arCameraObserv2Ideal_func)(arCamera, (ARFloat) x_coord[st + j], (ARFloat) y_coord[st + j], &x, &y);
-            input->m[j * 2 + 0] = x;
-            input->m[j * 2 + 1] = y;
-        }
+        arCameraObserv2IdealBatch(x_coord + st, y_coord + st, n, input->m);
         if (arMatrixPCA(input, evec, ev, mean) < 0) {
             Matrix::free(input);
             Matrix::free(evec);
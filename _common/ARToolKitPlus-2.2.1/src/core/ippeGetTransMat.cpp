@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2010  ARToolkitPlus Authors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ARToolKitPlus/Tracker.h>
+#include <ARToolKitPlus/extra/IPPE.h>
+
+namespace ARToolKitPlus {
+
+ARFloat Tracker::ippeGetTransMat(ARMarkerInfo *marker_info, ARFloat center[2], ARFloat width, ARFloat conv[3][4]) {
+    const int dir = marker_info->dir;
+    const ARFloat hw = width * (ARFloat) 0.5;
+    ARFloat pos2d[4][2], pos3d[4][2];
+
+    for (int i = 0; i < 4; i++) {
+        pos2d[i][0] = marker_info->vertex[(4 + i - dir) % 4][0];
+        pos2d[i][1] = marker_info->vertex[(4 + i - dir) % 4][1];
+    }
+
+    // same corner order as rppGetTransMat()
+    pos3d[0][0] = center[0] - hw;
+    pos3d[0][1] = center[1] + hw;
+    pos3d[1][0] = center[0] + hw;
+    pos3d[1][1] = center[1] + hw;
+    pos3d[2][0] = center[0] + hw;
+    pos3d[2][1] = center[1] - hw;
+    pos3d[3][0] = center[0] - hw;
+    pos3d[3][1] = center[1] - hw;
+
+    const ARFloat cc[2] = { arCamera->mat[0][2], arCamera->mat[1][2] };
+    const ARFloat fc[2] = { arCamera->mat[0][0], arCamera->mat[1][1] };
+    ARFloat R[3][3], t[3];
+
+    ARFloat err = planarPose<ARFloat> (pos3d, pos2d, 4, fc, cc, poseEstimator == POSE_ESTIMATOR_IPPE_REFINED, R, t);
+    if (err < 0)
+        return -1;
+
+    for (int i = 0; i < 3; i++) {
+        conv[i][3] = t[i];
+        for (int j = 0; j < 3; j++)
+            conv[i][j] = R[i][j];
+    }
+
+    return err; // NOTE: mean squared reprojection error in pixels
+}
+
+} // namespace ARToolKitPlus
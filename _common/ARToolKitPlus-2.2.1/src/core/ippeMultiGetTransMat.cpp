@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2010  ARToolkitPlus Authors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <vector>
+#include <ARToolKitPlus/Tracker.h>
+#include <ARToolKitPlus/extra/IPPE.h>
+
+namespace ARToolKitPlus {
+
+ARFloat Tracker::ippeMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num, ARMultiMarkerInfoT *config) {
+    int i, j;
+
+    // the closed form needs all markers on one plane, anything else is left to RPP
+    for (j = 0; j < config->marker_num; j++)
+        for (i = 0; i < 4; i++)
+            if (!ippe::onPlane(config->marker[j].pos3d[i][2]))
+                return rppMultiGetTransMat(marker_info, marker_num, config);
+
+    // markers seen more than once are ambiguous and ignored, like in rppMultiGetTransMat()
+    std::map<int, int> marker_id_freq;
+    for (i = 0; i < marker_num; i++)
+        if (marker_info[i].id >= 0)
+            marker_id_freq[marker_info[i].id]++;
+
+    std::vector<bool> config_used(config->marker_num, false);
+    std::vector<ARFloat> pos2d, pos3d;
+
+    for (i = 0; i < marker_num; i++) {
+        if (marker_info[i].id < 0 || marker_id_freq[marker_info[i].id] > 1)
+            continue;
+
+        for (j = 0; j < config->marker_num; j++)
+            if (!config_used[j] && config->marker[j].patt_id == marker_info[i].id)
+                break;
+        if (j == config->marker_num)
+            continue;
+        config_used[j] = true;
+
+        const int dir = marker_info[i].dir;
+        for (int k = 0; k < 4; k++) {
+            pos2d.push_back(marker_info[i].vertex[(4 + k - dir) % 4][0]);
+            pos2d.push_back(marker_info[i].vertex[(4 + k - dir) % 4][1]);
+            pos3d.push_back(config->marker[j].pos3d[k][0]);
+            pos3d.push_back(config->marker[j].pos3d[k][1]);
+        }
+    }
+
+    const int n_pts = (int) pos2d.size() / 2;
+    if (n_pts == 0)
+        return (-1);
+
+    const ARFloat cc[2] = { arCamera->mat[0][2], arCamera->mat[1][2] };
+    const ARFloat fc[2] = { arCamera->mat[0][0], arCamera->mat[1][1] };
+    ARFloat R[3][3], t[3];
+
+    ARFloat err = planarPose<ARFloat> (reinterpret_cast<const ARFloat(*)[2]> (&pos3d[0]),
+            reinterpret_cast<const ARFloat(*)[2]> (&pos2d[0]), n_pts, fc, cc,
+            poseEstimator == POSE_ESTIMATOR_IPPE_REFINED, R, t);
+    if (err < 0)
+        return (-1);
+
+    for (int k = 0; k < 3; k++) {
+        config->trans[k][3] = t[k];
+        for (j = 0; j < 3; j++)
+            config->trans[k][j] = R[k][j];
+    }
+
+    return err; // NOTE: mean squared reprojection error in pixels
+}
+
+} // namespace ARToolKitPlus
@@ -26,6 +26,11 @@
 #include <ARToolKitPlus/Camera.h>
 #include <ARToolKitPlus/Camera.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AR_UNDIST_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace ARToolKitPlus {
 
 int Tracker::arCameraObserv2Ideal_std(Camera* pCam, ARFloat ox, ARFloat oy, ARFloat *ix, ARFloat *iy) {
@@ -45,55 +50,126 @@ int Tracker::arCameraObserv2Ideal_none(Camera* pCam, ARFloat ox, ARFloat oy, ARF
 }
 
 //
-//  these functions store 2 values (x & y) in a single 32-bit unsigned integer
-//  each value is stored as 11.5 fixed point
+//  UNDIST_LUT keeps the undistortion on a coarse grid: a node every 4 to 16 pixels holds
+//  the offset from the observed to the ideal position as two 11.5 fixed point shorts,
+//  positions in between are interpolated bilinearly. The grid gets coarser with the image
+//  size, which keeps the interpolation error around 1/20 pixel for a given lens, while
+//  the table is 16 to 256 times smaller and quicker to build than one entry per pixel.
 //
 
-inline
-void floatToFixed(ARFloat nX, ARFloat nY, unsigned int &nFixed) {
-    short sx = (short) (nX * 32);
-    short sy = (short) (nY * 32);
-
-    unsigned short *ux = (unsigned short*) &sx;
-    unsigned short *uy = (unsigned short*) &sy;
+static const int undistFixedShift = 5;
 
-    nFixed = (*ux << 16) | *uy;
+static int undistGridShiftFor(int xsize) {
+    int shift = 2;
+    while (shift < 4 && (xsize >> (shift + 1)) >= 160)
+        shift++;
+    return shift;
 }
 
-inline
-void fixedToFloat(unsigned int nFixed, ARFloat& nX, ARFloat& nY) {
-    unsigned short ux = (nFixed >> 16);
-    unsigned short uy = (nFixed & 0xffff);
+// cache file layout, the undistorted corners and centre tell a changed camera file apart
+struct UndistCacheHeader {
+    char magic[8];
+    int xsize, ysize, gridShift;
+    float check[5][2];
+};
+
+static const char undistCacheMagic[8] = { 'A', 'R', 'T', 'K', 'L', 'U', 'T', '2' };
 
-    short *sx = (short*) &ux;
-    short *sy = (short*) &uy;
+static void undistCheckPoints(Camera* pCam, int xsize, int ysize, float check[5][2]) {
+    const ARFloat pts[5][2] = { { 0, 0 }, { ARFloat(xsize - 1), 0 }, { 0, ARFloat(ysize - 1) },
+            { ARFloat(xsize - 1), ARFloat(ysize - 1) }, { ARFloat(xsize / 2), ARFloat(ysize / 2) } };
+
+    for (int i = 0; i < 5; i++) {
+        ARFloat ix, iy;
+        pCam->observ2Ideal(pts[i][0], pts[i][1], &ix, &iy);
+        check[i][0] = (float) ix;
+        check[i][1] = (float) iy;
+    }
+}
 
-    nX = (*sx) / 32.0f;
-    nY = (*sy) / 32.0f;
+inline int16_t toFixedOffset(ARFloat nOffset) {
+    ARFloat f = std::floor(nOffset * (1 << undistFixedShift) + (ARFloat) 0.5);
+    return (int16_t) (f < -32768 ? -32768 : (f > 32767 ? 32767 : f));
 }
 
 int Tracker::arCameraObserv2Ideal_LUT(Camera* pCam, ARFloat ox, ARFloat oy, ARFloat *ix, ARFloat *iy) {
     if (!undistO2ITable)
         buildUndistO2ITable(pCam);
 
-    int x = (int) ox, y = (int) oy;
+    const ARFloat step = ARFloat(1 << undistGridShift);
+    ARFloat gx = (ox < 0 ? 0 : (ox > arImXsize - 1 ? arImXsize - 1 : ox)) / step;
+    ARFloat gy = (oy < 0 ? 0 : (oy > arImYsize - 1 ? arImYsize - 1 : oy)) / step;
+    int x = (int) gx, y = (int) gy;
+    ARFloat fx = gx - x, fy = gy - y;
 
-    fixedToFloat(undistO2ITable[x + y * arImXsize], *ix, *iy);
+    const int16_t *p = undistO2ITable + (y * undistGridWidth + x) * 2;
+    const int16_t *q = p + undistGridWidth * 2;
+    const ARFloat scale = ARFloat(1) / (1 << undistFixedShift);
+
+    *ix = ox + ((p[0] * (1 - fx) + p[2] * fx) * (1 - fy) + (q[0] * (1 - fx) + q[2] * fx) * fy) * scale;
+    *iy = oy + ((p[1] * (1 - fx) + p[3] * fx) * (1 - fy) + (q[1] * (1 - fx) + q[3] * fx) * fy) * scale;
     return 0;
 }
 
+void Tracker::arCameraObserv2IdealBatch(const int *x_coord, const int *y_coord, int num, ARFloat *ideal) {
+    int i;
+
+    if (undistMode != UNDIST_LUT) {
+        for (i = 0; i < num; i++)
+            (this->*arCameraObserv2Ideal_func)(arCamera, (ARFloat) x_coord[i], (ARFloat) y_coord[i], &ideal[i * 2],
+                    &ideal[i * 2 + 1]);
+        return;
+    }
+
+    if (!undistO2ITable)
+        buildUndistO2ITable(arCamera);
+
+    // contour points are whole pixels, so the bilinear weights are integers that sum up to
+    // step^2 <= 256 and the whole interpolation stays in 32 bit fixed point
+    const int step = 1 << undistGridShift, gridMask = step - 1;
+    const ARFloat scale = ARFloat(1) / (1 << (undistFixedShift + 2 * undistGridShift));
+
+    for (i = 0; i < num; i++) {
+        int x = x_coord[i], y = y_coord[i];
+        x = x < 0 ? 0 : (x >= arImXsize ? arImXsize - 1 : x);
+        y = y < 0 ? 0 : (y >= arImYsize ? arImYsize - 1 : y);
+
+        const int fx = x & gridMask, fy = y & gridMask;
+        const int w00 = (step - fx) * (step - fy), w10 = fx * (step - fy);
+        const int w01 = (step - fx) * fy, w11 = fx * fy;
+        const int16_t *p = undistO2ITable + ((y >> undistGridShift) * undistGridWidth + (x >> undistGridShift)) * 2;
+        const int16_t *q = p + undistGridWidth * 2;
+        int dx, dy;
+
+#if defined(AR_UNDIST_SSE2)
+        // the four nodes as (dx, dx', dy, dy') pairs, one madd interpolates along x for both rows
+        __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) p), _mm_loadl_epi64((const __m128i*) q));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i s = _mm_madd_epi16(v, _mm_set_epi16((short) w11, (short) w01, (short) w11, (short) w01,
+                (short) w10, (short) w00, (short) w10, (short) w00));
+        s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+        dx = _mm_cvtsi128_si32(s);
+        dy = _mm_cvtsi128_si32(_mm_srli_si128(s, 4));
+#else
+        dx = p[0] * w00 + p[2] * w10 + q[0] * w01 + q[2] * w11;
+        dy = p[1] * w00 + p[3] * w10 + q[1] * w01 + q[3] * w11;
+#endif
+
+        ideal[i * 2 + 0] = x + dx * scale;
+        ideal[i * 2 + 1] = y + dy * scale;
+    }
+}
+
 void Tracker::buildUndistO2ITable(Camera* pCam) {
     int x, y;
-    ARFloat cx, cy, ox, oy;
-    unsigned int fixed;
-    char* cachename = NULL;
+    ARFloat cx, cy;
+    std::string cachename;
+    UndistCacheHeader header;
     bool loaded = false;
 
     if (loadCachedUndist) {
         assert(pCam->getFileName() != "");
-        cachename = new char[strlen(pCam->getFileName().c_str()) + 5];
-        strcpy(cachename, pCam->getFileName().c_str());
-        strcat(cachename, ".LUT");
+        cachename = pCam->getFileName() + ".LUT";
     }
 
     // we have to take care here when using a memory manager that can not free memory
@@ -102,36 +178,59 @@ void Tracker::buildUndistO2ITable(Camera* pCam) {
     if (undistO2ITable)
         delete[] undistO2ITable;
 
-    undistO2ITable = new unsigned int[arImXsize * arImYsize];
+    // one node past the last pixel in both directions, so every pixel has four neighbours
+    undistGridShift = undistGridShiftFor(arImXsize);
+    undistGridWidth = (arImXsize >> undistGridShift) + 2;
+    const int gridHeight = (arImYsize >> undistGridShift) + 2;
+    const size_t numShorts = (size_t) undistGridWidth * gridHeight * 2;
+
+    undistO2ITable = new int16_t[numShorts];
+
+    memcpy(header.magic, undistCacheMagic, sizeof(header.magic));
+    header.xsize = arImXsize;
+    header.ysize = arImYsize;
+    header.gridShift = undistGridShift;
+    undistCheckPoints(pCam, arImXsize, arImYsize, header.check);
 
     if (loadCachedUndist) {
-        if (FILE* fp = fopen(cachename, "rb")) {
-            size_t numBytes = fread(undistO2ITable, 1, arImXsize * arImYsize * sizeof(unsigned int), fp);
-            fclose(fp);
+        if (FILE* fp = fopen(cachename.c_str(), "rb")) {
+            UndistCacheHeader cached;
 
-            if (numBytes == arImXsize * arImYsize * sizeof(unsigned int))
+            if (fread(&cached, sizeof(cached), 1, fp) == 1 && !memcmp(cached.magic, header.magic, sizeof(header.magic))
+                    && cached.xsize == header.xsize && cached.ysize == header.ysize && cached.gridShift
+                    == header.gridShift) {
                 loaded = true;
+                for (int i = 0; i < 5; i++)
+                    if (std::fabs(cached.check[i][0] - header.check[i][0]) > 1e-3f || std::fabs(cached.check[i][1]
+                            - header.check[i][1]) > 1e-3f)
+                        loaded = false;
+
+                if (loaded)
+                    loaded = fread(undistO2ITable, sizeof(int16_t), numShorts, fp) == numShorts;
+            }
+            fclose(fp);
         }
     }
 
     if (!loaded) {
-        for (x = 0; x < arImXsize; x++) {
-            for (y = 0; y < arImYsize; y++) {
-                arCameraObserv2Ideal_std(pCam, (ARFloat) x, (ARFloat) y, &cx, &cy);
-                floatToFixed(cx, cy, fixed);
-                fixedToFloat(fixed, ox, oy);
-                undistO2ITable[x + y * arImXsize] = fixed;
+        for (y = 0; y < gridHeight; y++) {
+            for (x = 0; x < undistGridWidth; x++) {
+                const ARFloat ox = (ARFloat) (x << undistGridShift), oy = (ARFloat) (y << undistGridShift);
+                int16_t *node = undistO2ITable + (y * undistGridWidth + x) * 2;
+
+                arCameraObserv2Ideal_std(pCam, ox, oy, &cx, &cy);
+                node[0] = toFixedOffset(cx - ox);
+                node[1] = toFixedOffset(cy - oy);
             }
         }
 
         if (loadCachedUndist)
-            if (FILE* fp = fopen(cachename, "wb")) {
-                fwrite(undistO2ITable, 1, arImXsize * arImYsize * sizeof(unsigned int), fp);
+            if (FILE* fp = fopen(cachename.c_str(), "wb")) {
+                fwrite(&header, sizeof(header), 1, fp);
+                fwrite(undistO2ITable, sizeof(int16_t), numShorts, fp);
                 fclose(fp);
             }
     }
-
-    delete cachename;
 }
 
 int Tracker::arCameraObserv2Ideal(Camera *pCam, ARFloat ox, ARFloat oy, ARFloat *ix, ARFloat *iy) {
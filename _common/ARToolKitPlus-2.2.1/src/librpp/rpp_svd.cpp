@@ -33,9 +33,6 @@ namespace rpp {
 typedef double SVD_FLOAT;
 
 
-static SVD_FLOAT at,bt,ct;
-static SVD_FLOAT maxarg1,maxarg2;
-
 #define PYTHAG(a,b) ((at=fabs(a)) > (bt=fabs(b)) ? \
     (ct=bt/at,at*sqrt(SVD_FLOAT(1.0f)+ct*ct)) : (bt ? (ct=at/bt,bt*sqrt(SVD_FLOAT(1.0f)+ct*ct)): SVD_FLOAT(0.0)))
 
@@ -49,6 +46,7 @@ int svdcmp( double **a, int m,int n, double *w,double **v)
     int flag,i,its,j,jj,k,ii=0,nm=0;
     SVD_FLOAT c,f,h,s,x,y,z;
     SVD_FLOAT anorm=0.0,g=0.0,scale=0.0;
+    SVD_FLOAT at,bt,ct,maxarg1,maxarg2;  // for PYTHAG and MAX, no statics so that trackers can run in parallel
 
     if (m < n) return -1;	// must augment A with extra zero rows
 
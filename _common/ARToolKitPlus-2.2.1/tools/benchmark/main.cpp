@@ -0,0 +1,266 @@
+/**
+ * Copyright (C) 2010  ARToolkitPlus Authors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replays the sample images at several scales and reports the time of every
+ * detection stage, then the throughput of several cameras run with calcBatch().
+ * Run it from the sample directory like the test program:
+ *   benchmark [numFrames]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <ARToolKitPlus/TrackerSingleMarker.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using ARToolKitPlus::ARMarkerInfo;
+using ARToolKitPlus::ARMarkerInfo2;
+using ARToolKitPlus::TrackerSingleMarker;
+
+struct SampleImage {
+    const char *fileName;
+    bool bch;
+    ARFloat borderWidth;
+    int thresh;
+};
+
+const SampleImage sampleImages[] = {
+    { "data/image_320_240_8_marker_id_simple_nr031.raw", false, 0.25f, 150 },
+    { "data/image_320_240_8_marker_id_bch_nr0100.raw", true, 0.125f, 100 },
+    { "data/image_320_240_8_marker_id_simple_nr321.raw", false, 0.25f, 100 },
+    { "data/markerboard_480-499.raw", false, 0.125f, 160 }
+};
+const int numSampleImages = sizeof(sampleImages) / sizeof(sampleImages[0]);
+const int sampleWidth = 320, sampleHeight = 240;
+
+static double now() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return double(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+static int numCores() {
+#ifdef _OPENMP
+    return omp_get_num_procs();
+#else
+    return 1;
+#endif
+}
+
+// bilinear upscale of an 8 bit image, scale 1 is a copy
+static void scaleImage(const std::vector<uint8_t>& src, int scale, std::vector<uint8_t>& dst) {
+    const int width = sampleWidth * scale, height = sampleHeight * scale;
+
+    dst.resize(width * height);
+    for (int y = 0; y < height; y++) {
+        float sy = (y + 0.5f) / scale - 0.5f;
+        int y0 = sy < 0 ? 0 : (int) sy;
+        int y1 = y0 + 1 < sampleHeight ? y0 + 1 : y0;
+        float fy = sy < 0 ? 0 : sy - y0;
+
+        for (int x = 0; x < width; x++) {
+            float sx = (x + 0.5f) / scale - 0.5f;
+            int x0 = sx < 0 ? 0 : (int) sx;
+            int x1 = x0 + 1 < sampleWidth ? x0 + 1 : x0;
+            float fx = sx < 0 ? 0 : sx - x0;
+            float top = src[y0 * sampleWidth + x0] * (1 - fx) + src[y0 * sampleWidth + x1] * fx;
+            float bottom = src[y1 * sampleWidth + x0] * (1 - fx) + src[y1 * sampleWidth + x1] * fx;
+
+            dst[y * width + x] = (uint8_t) (top * (1 - fy) + bottom * fy + 0.5f);
+        }
+    }
+}
+
+static void setupTracker(TrackerSingleMarker& tracker, const SampleImage& image) {
+    tracker.setPixelFormat(ARToolKitPlus::PIXEL_FORMAT_LUM);
+    tracker.init("data/PGR_M12x0.5_2.5mm.cal", 1.0f, 1000.0f);
+    tracker.setUndistortionMode(ARToolKitPlus::UNDIST_LUT);
+    tracker.setMarkerMode(image.bch ? ARToolKitPlus::MARKER_ID_BCH : ARToolKitPlus::MARKER_ID_SIMPLE);
+    tracker.setBorderWidth(image.borderWidth);
+    tracker.setThreshold(image.thresh);
+}
+
+enum Stage {
+    STAGE_LUMINANCE, STAGE_LABELING, STAGE_CONTOUR, STAGE_CODE, STAGE_POSE_ORIGINAL, STAGE_POSE_RPP, STAGE_POSE_IPPE,
+    NUM_STAGES
+
+};
+
+const char *stageNames[NUM_STAGES] = { "lum", "label", "contour", "code", "arGetTM", "rppGetTM", "ippeGetTM" };
+
+// runs the stages of arDetectMarkerLite() one by one so they can be timed
+class StageTracker: public TrackerSingleMarker {
+public:
+    StageTracker(int width, int height) :
+        TrackerSingleMarker(width, height, 32) {
+    }
+
+    int run(uint8_t* image, double times[NUM_STAGES]) {
+        int16_t *limage;
+        int label_num, marker_num;
+        int *area, *clip, *start;
+        ARFloat *pos;
+        ARFloat center[2] = { 0, 0 }, conv[3][4];
+        int i, numFound = 0;
+
+        checkImageBuffer();
+        setLabelRects(false);
+
+        double t0 = now();
+        uint8_t *lumImage = arGetLuminance(image);
+        double t1 = now();
+        limage = arLabeling(lumImage, thresh, &label_num, &area, &pos, &clip, &start);
+        double t2 = now();
+        ARMarkerInfo2 *info2 = arDetectMarker2(limage, label_num, start, area, pos, clip, AR_AREA_MAX, AR_AREA_MIN,
+                1.0, &marker_num);
+        double t3 = now();
+        ARMarkerInfo *info = arGetMarkerInfo(image, info2, &marker_num, thresh);
+        double t4 = now();
+
+        for (i = 0; i < marker_num; i++)
+            if (info[i].id >= 0 && info[i].cf >= 0.5) {
+                arGetTransMat(&info[i], center, 80.0, conv);
+                numFound++;
+            }
+        double t5 = now();
+
+        for (i = 0; i < marker_num; i++)
+            if (info[i].id >= 0 && info[i].cf >= 0.5)
+                rppGetTransMat(&info[i], center, 80.0, conv);
+        double t6 = now();
+
+        for (i = 0; i < marker_num; i++)
+            if (info[i].id >= 0 && info[i].cf >= 0.5)
+                ippeGetTransMat(&info[i], center, 80.0, conv);
+        double t7 = now();
+
+        times[STAGE_LUMINANCE] += t1 - t0;
+        times[STAGE_LABELING] += t2 - t1;
+        times[STAGE_CONTOUR] += t3 - t2;
+        times[STAGE_CODE] += t4 - t3;
+        times[STAGE_POSE_ORIGINAL] += t5 - t4;
+        times[STAGE_POSE_RPP] += t6 - t5;
+        times[STAGE_POSE_IPPE] += t7 - t6;
+
+        return numFound;
+    }
+};
+
+int main(int argc, char** argv) {
+    const int numFrames = argc > 1 ? atoi(argv[1]) : 100;
+    const int scales[] = { 1, 2, 3, 4 };
+    const int numScales = sizeof(scales) / sizeof(scales[0]);
+    std::vector<std::vector<uint8_t> > images(numSampleImages);
+    int i, s, k;
+
+    for (i = 0; i < numSampleImages; i++) {
+        images[i].resize(sampleWidth * sampleHeight);
+
+        FILE* fp = fopen(sampleImages[i].fileName, "rb");
+        if (!fp || fread(&images[i][0], 1, images[i].size(), fp) != images[i].size()) {
+            printf("Failed to read %s\n", sampleImages[i].fileName);
+            return -1;
+        }
+        fclose(fp);
+    }
+
+    // single thread, stage by stage
+    printf("%-48s %9s %7s", "image", "size", "markers");
+    for (k = 0; k < NUM_STAGES; k++)
+        printf(" %9s", stageNames[k]);
+    printf("   (ms per frame)\n");
+
+    for (s = 0; s < numScales; s++) {
+        const int width = sampleWidth * scales[s], height = sampleHeight * scales[s];
+
+        for (i = 0; i < numSampleImages; i++) {
+            std::vector<uint8_t> frame;
+            double times[NUM_STAGES] = { 0 };
+            int numFound = 0;
+
+            scaleImage(images[i], scales[s], frame);
+
+            StageTracker tracker(width, height);
+            setupTracker(tracker, sampleImages[i]);
+
+            // the first frame builds the undistortion table
+            double warmUp[NUM_STAGES] = { 0 };
+            tracker.run(&frame[0], warmUp);
+
+            for (k = 0; k < numFrames; k++)
+                numFound = tracker.run(&frame[0], times);
+
+            printf("%-48s %4dx%-4d %7d", sampleImages[i].fileName, width, height, numFound);
+            for (k = 0; k < NUM_STAGES; k++)
+                printf(" %9.3f", times[k] * 1000 / numFrames);
+            printf("\n");
+        }
+    }
+
+    // several cameras, every one with its own tracker replaying one of the images
+    const int cameraCounts[] = { 1, 2, 4 };
+    const int numCameraCounts = sizeof(cameraCounts) / sizeof(cameraCounts[0]);
+
+    printf("\n%9s %7s %7s %12s %16s   (calcBatch, %d cores)\n", "size", "cameras", "threads", "frames/s",
+            "frames/s/thread", numCores());
+
+    for (s = 0; s < numScales; s++) {
+        const int width = sampleWidth * scales[s], height = sampleHeight * scales[s];
+        std::vector<std::vector<uint8_t> > frames(numSampleImages);
+
+        for (i = 0; i < numSampleImages; i++)
+            scaleImage(images[i], scales[s], frames[i]);
+
+        for (int c = 0; c < numCameraCounts; c++) {
+            const int numCameras = cameraCounts[c];
+
+            for (int numThreads = 1; numThreads <= numCameras; numThreads *= 2) {
+                std::vector<TrackerSingleMarker*> trackers(numCameras);
+                std::vector<const uint8_t*> cameraFrames(numCameras);
+                std::vector<int> best(numCameras);
+
+                for (k = 0; k < numCameras; k++) {
+                    trackers[k] = new TrackerSingleMarker(width, height, 32);
+                    setupTracker(*trackers[k], sampleImages[k % numSampleImages]);
+                    cameraFrames[k] = &frames[k % numSampleImages][0];
+                }
+
+                // the first frame builds the undistortion tables
+                TrackerSingleMarker::calcBatch(&trackers[0], &cameraFrames[0], numCameras, &best[0], numThreads);
+
+                double t0 = now();
+                for (k = 0; k < numFrames; k++)
+                    TrackerSingleMarker::calcBatch(&trackers[0], &cameraFrames[0], numCameras, &best[0], numThreads);
+                double fps = numFrames * numCameras / (now() - t0);
+
+                printf("%4dx%-4d %7d %7d %12.1f %16.1f\n", width, height, numCameras, numThreads, fps, fps / numThreads);
+
+                for (k = 0; k < numCameras; k++)
+                    delete trackers[k];
+            }
+        }
+    }
+
+    return 0;
+}
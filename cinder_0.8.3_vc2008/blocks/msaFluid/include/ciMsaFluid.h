@@ -35,3 +35,4 @@
 #include "ciMsaFluidDrawer.h"
 
 #include "ciMsaFluidParticleUpdater.h"
+#include "ciMsaFluidParticleSystem.h"
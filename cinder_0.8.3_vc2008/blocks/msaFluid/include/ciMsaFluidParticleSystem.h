@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2010, The Barbarian Group
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include "ciMsaFluidSolver.h"
+
+#include <vector>
+
+// do not change these values, you can override them using the particle system methods
+#define		FLUID_DEFAULT_MAX_PARTICLES			500000
+#define		FLUID_DEFAULT_PARTICLE_MOMENTUM		0.5f
+#define		FLUID_DEFAULT_PARTICLE_FORCE		0.6f
+#define		FLUID_DEFAULT_PARTICLE_FADESPEED	0.001f
+#define		FLUID_DEFAULT_PARTICLE_MIN_ALPHA	0.01f
+
+// Moves large numbers of particles along a fluid. The particles are kept as arrays of each of their values, packed at the
+// start of a pool set aside by setup(), and the whole pool is moved in one pass spread over threads - the fluid's velocity
+// is sampled for blocks of particles with ciMsaFluidSolver::getVelocityAtPositions() rather than one particle at a time.
+// Particles are added and killed through queues which update() applies, the ones which fade out are killed by update() too.
+class ciMsaFluidParticleSystem {
+  public:
+	ciMsaFluidParticleSystem();
+	
+	// set aside room for maxParticles, removing any particles
+	ciMsaFluidParticleSystem& setup( int maxParticles = FLUID_DEFAULT_MAX_PARTICLES );
+	
+	ciMsaFluidParticleSystem& setFluidSolver( const ciMsaFluidSolver *solver );
+	
+	// the particles move around (0..size.x), (0..size.y), with the fluid stretched over it. Defaults to (1, 1)
+	ciMsaFluidParticleSystem& setWorldSize( const ci::Vec2f &size );
+	
+	// each update, vel = fluid velocity * mass * force * world size + vel * momentum
+	ciMsaFluidParticleSystem& setMomentum( float momentum = FLUID_DEFAULT_PARTICLE_MOMENTUM );
+	ciMsaFluidParticleSystem& setFluidForce( float force = FLUID_DEFAULT_PARTICLE_FORCE );
+	
+	// each update the alpha of a particle is multiplied by 1 - fadeSpeed, and the particle killed once it is below minAlpha
+	ciMsaFluidParticleSystem& setFadeSpeed( float fadeSpeed = FLUID_DEFAULT_PARTICLE_FADESPEED, float minAlpha = FLUID_DEFAULT_PARTICLE_MIN_ALPHA );
+	
+	// queue a particle to be added by the next update(). returns false if there isn't room left in the pool for it
+	bool addParticle( const ci::Vec2f &pos, const ci::Vec2f &vel = ci::Vec2f::zero(), float mass = 1, float alpha = 1 );
+	
+	// queue up to count particles at random points radius away from pos, with random masses and alphas as in the
+	// msaFluidParticles sample. returns how many there was room for
+	int addParticles( const ci::Vec2f &pos, int count, float radius );
+	
+	// queue the particle at index, 0..getNumParticles()-1, to be killed by the next update()
+	void killParticle( int index );
+	
+	// kill the queued particles, add the queued new ones, move every particle along the fluid and kill the ones faded out
+	void update();
+	
+	int getNumParticles() const		{ return mNumParticles; }
+	int getMaxParticles() const		{ return (int)mPosX.size(); }
+	
+	// the values of the particles, getNumParticles() of each. update() moves particles around as it kills others
+	const float* getPositionsX() const	{ return mPosX.empty() ? NULL : &mPosX[0]; }
+	const float* getPositionsY() const	{ return mPosY.empty() ? NULL : &mPosY[0]; }
+	const float* getVelocitiesX() const	{ return mVelX.empty() ? NULL : &mVelX[0]; }
+	const float* getVelocitiesY() const	{ return mVelY.empty() ? NULL : &mVelY[0]; }
+	const float* getMasses() const		{ return mMass.empty() ? NULL : &mMass[0]; }
+	const float* getAlphas() const		{ return mAlpha.empty() ? NULL : &mAlpha[0]; }
+	
+  protected:
+	struct NewParticle {
+		float	x, y, velX, velY, mass, alpha;
+	};
+	
+	const ciMsaFluidSolver	*mSolver;
+	ci::Vec2f				mWorldSize;
+	float					mMomentum, mFluidForce, mFadeSpeed, mMinAlpha;
+	
+	// the pool, the live particles are the first mNumParticles of each
+	std::vector<float>		mPosX, mPosY, mVelX, mVelY, mMass, mAlpha;
+	int						mNumParticles;
+	
+	std::vector<NewParticle>	mNewParticles;		// queued by addParticle(), never more than the room left in the pool
+	std::vector<int>			mKillList;			// queued by killParticle()
+	
+	void	removeParticle( int index );
+};
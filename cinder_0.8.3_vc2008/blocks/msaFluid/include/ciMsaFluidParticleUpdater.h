@@ -40,6 +40,7 @@
 #include "ciMsaFluid.h"
 
 
+// updates one particle at a time, ciMsaFluidParticleSystem moves large numbers of particles in one pass
 class ciMsaFluidParticleUpdater : public ciMsaParticleUpdater {
 public:
     float strength;
@@ -7,34 +7,31 @@
  */
 #pragma once
 
-#include "Particle.h"
+#include "ciMsaFluidParticleSystem.h"
 #include "cinder/Vector.h"
 
-#define MAX_PARTICLES		50000
+#include <vector>
 
+#define MAX_PARTICLES		FLUID_DEFAULT_MAX_PARTICLES
 
+
+// Draws the particles of a ciMsaFluidParticleSystem as lines from where they were to where they are
 class ParticleSystem {
 public:	
 	
-    float posArray[MAX_PARTICLES * 2 * 2];
-    float colArray[MAX_PARTICLES * 3 * 2];
+	std::vector<float>	posArray;
+	std::vector<float>	colArray;
 	ci::Vec2i	windowSize;
 	ci::Vec2f	invWindowSize;
-	const ciMsaFluidSolver	*solver;
-	
-    int curIndex;
 	
-    Particle particles[MAX_PARTICLES];
+	ciMsaFluidParticleSystem	particles;
 	
 	ParticleSystem();
-	void setFluidSolver( const ciMsaFluidSolver *aSolver ) { solver = aSolver; }
+	void setFluidSolver( const ciMsaFluidSolver *aSolver ) { particles.setFluidSolver( aSolver ); }
 	
-    void updateAndDraw( bool drawingFluid );
+	void update();
+	void draw( bool drawingFluid );
 	void addParticles( const ci::Vec2f &pos, int count );
-	void addParticle( const ci::Vec2f &pos );
+	void fill();	// as many particles as there is room for, all over the window
 	void setWindowSize( ci::Vec2i winSize );
 };
-
-
-
-
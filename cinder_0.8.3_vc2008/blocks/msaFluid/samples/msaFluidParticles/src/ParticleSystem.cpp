@@ -9,13 +9,16 @@
 #include "ParticleSystem.h"
 #include "cinder/gl/gl.h"
 #include "cinder/Rand.h"
-#include "cinder/app/App.h"
+#include "cinder/CinderMath.h"
+#include "cinder/Color.h"
 
 using namespace ci;
 
 ParticleSystem::ParticleSystem() 
 {
-	curIndex = 0;
+	particles.setup( MAX_PARTICLES );
+	posArray.resize( MAX_PARTICLES * 2 * 2 );
+	colArray.resize( MAX_PARTICLES * 3 * 2 );
 	setWindowSize( Vec2i( 1, 1 ) );
 }
 
@@ -23,27 +26,65 @@ void ParticleSystem::setWindowSize( Vec2i winSize )
 {
 	windowSize = winSize;
 	invWindowSize = Vec2f( 1.0f / winSize.x, 1.0f / winSize.y );
+	particles.setWorldSize( Vec2f( winSize ) );
 }
 
-void ParticleSystem::updateAndDraw( bool drawingFluid ){
+void ParticleSystem::update()
+{
+	particles.update();
+}
+
+void ParticleSystem::draw( bool drawingFluid ){
+	const int count = particles.getNumParticles();
+	if( count == 0 )
+		return;
+	
+	const float *px = particles.getPositionsX(), *py = particles.getPositionsY();
+	const float *vx = particles.getVelocitiesX(), *vy = particles.getVelocitiesY();
+	const float *mass = particles.getMasses(), *alpha = particles.getAlphas();
+	
+	for(int i=0; i<count; i++) {
+		int vi = i * 4;
+		posArray[vi++] = px[i] - vx[i];
+		posArray[vi++] = py[i] - vy[i];
+		posArray[vi++] = px[i];
+		posArray[vi++] = py[i];
+		
+		int ci = i * 6;
+		if( drawingFluid ) {
+			// if drawing fluid, draw lines as black & white
+			for( int k = 0; k < 6; k++ )
+				colArray[ci++] = alpha[i];
+		} else {
+			// otherwise, use color
+			float vxNorm = vx[i] * invWindowSize.x;
+			float vyNorm = vy[i] * invWindowSize.y;
+			float v2 = vxNorm * vxNorm + vyNorm * vyNorm;
+#define VMAX 0.013f
+			if(v2>VMAX*VMAX) v2 = VMAX*VMAX;
+			Color color( CM_HSV, 0, v2 / ( VMAX * VMAX ), lerp( 0.5f, 1.0f, mass[i] ) * alpha[i] );
+			
+			colArray[ci++] = color.r;
+			colArray[ci++] = color.g;
+			colArray[ci++] = color.b;
+			colArray[ci++] = color.r;
+			colArray[ci++] = color.g;
+			colArray[ci++] = color.b;
+		}
+	}
+	
 	glEnable(GL_BLEND);
 	glDisable( GL_TEXTURE_2D );
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_LINE_SMOOTH);       
 	
-	for(int i=0; i<MAX_PARTICLES; i++) {
-		if(particles[i].alpha > 0) {
-			particles[i].update( *solver, windowSize, invWindowSize );
-			particles[i].updateVertexArrays( drawingFluid, invWindowSize, i, posArray, colArray);
-		}
-	}    
 	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 0, posArray);
+	glVertexPointer(2, GL_FLOAT, 0, &posArray[0]);
 	
 	glEnableClientState(GL_COLOR_ARRAY);
-	glColorPointer(3, GL_FLOAT, 0, colArray);
+	glColorPointer(3, GL_FLOAT, 0, &colArray[0]);
 	
-	glDrawArrays(GL_LINES, 0, MAX_PARTICLES * 2);
+	glDrawArrays(GL_LINES, 0, count * 2);
 
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_COLOR_ARRAY);
@@ -53,13 +94,11 @@ void ParticleSystem::updateAndDraw( bool drawingFluid ){
 
 
 void ParticleSystem::addParticles( const Vec2f &pos, int count ){
-	for(int i=0; i<count; i++)
-		addParticle( pos + Rand::randVec2f() * 15 );
+	particles.addParticles( pos, count, 15 );
 }
 
 
-void ParticleSystem::addParticle( const Vec2f &pos ) {
-	particles[curIndex].init( pos.x, pos.y );
-	curIndex++;
-	if(curIndex >= MAX_PARTICLES) curIndex = 0;
+void ParticleSystem::fill() {
+	while( particles.addParticle( Vec2f( Rand::randFloat( (float)windowSize.x ), Rand::randFloat( (float)windowSize.y ) ), Vec2f::zero(), Rand::randFloat( 0.1f, 1 ), Rand::randFloat( 0.3f, 1 ) ) )
+		;
 }
@@ -3,7 +3,6 @@
 #include "ciMsaFluidSolver.h"
 #include "ciMsaFluidDrawerGl.h"
 
-#include "Particle.h"
 #include "ParticleSystem.h"
 
 using namespace ci;
@@ -103,6 +102,9 @@ void msaFluidParticlesApp::update()
 	}
 	
 	fluidSolver.update();
+	
+	if( drawParticles )
+		particleSystem.update();
 }
 
 void msaFluidParticlesApp::draw()
@@ -112,7 +114,7 @@ void msaFluidParticlesApp::draw()
 		fluidDrawer.draw(0, 0, getWindowWidth(), getWindowHeight());
 	}
 	if( drawParticles )
-		particleSystem.updateAndDraw( drawFluid );
+		particleSystem.draw( drawFluid );
 }
 
 
@@ -134,6 +136,9 @@ void msaFluidParticlesApp::keyDown( KeyEvent event )
 		case 'p':
 			drawParticles = ! drawParticles;
 		break;
+		case 'n':
+			particleSystem.fill();
+		break;
 		case 'b': {
 			Timer timer;
 			timer.start();
@@ -142,6 +147,13 @@ void msaFluidParticlesApp::keyDown( KeyEvent event )
 				fluidSolver.update();
 			timer.stop();
 			console() << ITERS << " iterations took " << timer.getSeconds() << " seconds." << std::endl;
+			
+			const int PARTICLE_ITERS = 100;
+			timer.start();
+			for( int i = 0; i < PARTICLE_ITERS; ++i )
+				particleSystem.update();
+			timer.stop();
+			console() << PARTICLE_ITERS << " updates of " << particleSystem.particles.getNumParticles() << " particles took " << timer.getSeconds() << " seconds." << std::endl;
 		}
 		break;
     }
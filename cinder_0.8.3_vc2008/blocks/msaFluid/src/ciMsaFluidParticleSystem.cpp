@@ -0,0 +1,252 @@
+/*
+ Copyright (c) 2010, The Barbarian Group
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "ciMsaFluidParticleSystem.h"
+#include "cinder/Rand.h"
+#include "cinder/ip/Parallel.h"
+
+#include <algorithm>
+
+namespace {
+
+// particles whose fluid velocity is sampled in one go, few enough for the scratch of a block to sit on the stack
+const int PARTICLE_BLOCK_SIZE = 256;
+
+// Moves the particles [first, last) along the fluid, bouncing them off the edges of the world, and fades them.
+// A particle faded below minAlpha is given an alpha of 0 for update() to kill
+struct ParticleBand {
+	const ciMsaFluidSolver	*solver;
+	float		*posX, *posY, *velX, *velY;
+	const float	*mass;
+	float		*alpha;
+	float		worldX, worldY, invWorldX, invWorldY;
+	float		momentum, fluidForce, holdAmount, minAlpha;
+
+	void operator()( int32_t first, int32_t last ) const
+	{
+		float normX[PARTICLE_BLOCK_SIZE], normY[PARTICLE_BLOCK_SIZE];
+		float fluidX[PARTICLE_BLOCK_SIZE], fluidY[PARTICLE_BLOCK_SIZE];
+		for( int32_t block = first; block < last; block += PARTICLE_BLOCK_SIZE ) {
+			const int count = std::min<int32_t>( PARTICLE_BLOCK_SIZE, last - block );
+			for( int k = 0; k < count; ++k ) {
+				normX[k] = posX[block + k] * invWorldX;
+				normY[k] = posY[block + k] * invWorldY;
+			}
+			solver->getVelocityAtPositions( normX, normY, count, fluidX, fluidY );
+			move( block, count, fluidX, fluidY );
+		}
+	}
+
+	void move( int first, int count, const float *fluidX, const float *fluidY ) const
+	{
+		int k = 0;
+#if defined( CINDER_IP_SSE2 )
+		if( ci::ip::useSse2() ) {
+			const __m128 zero = _mm_setzero_ps(), sign = _mm_set1_ps( -0.0f );
+			const __m128 worldXV = _mm_set1_ps( worldX ), worldYV = _mm_set1_ps( worldY );
+			const __m128 momentumV = _mm_set1_ps( momentum ), forceV = _mm_set1_ps( fluidForce );
+			const __m128 holdV = _mm_set1_ps( holdAmount ), minAlphaV = _mm_set1_ps( minAlpha );
+			for( ; k + 4 <= count; k += 4 ) {
+				const int i = first + k;
+				const __m128 m = _mm_mul_ps( _mm_loadu_ps( mass + i ), forceV );
+				__m128 vx = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( _mm_loadu_ps( fluidX + k ), m ), worldXV ), _mm_mul_ps( _mm_loadu_ps( velX + i ), momentumV ) );
+				__m128 vy = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( _mm_loadu_ps( fluidY + k ), m ), worldYV ), _mm_mul_ps( _mm_loadu_ps( velY + i ), momentumV ) );
+				__m128 px = _mm_add_ps( _mm_loadu_ps( posX + i ), vx );
+				__m128 py = _mm_add_ps( _mm_loadu_ps( posY + i ), vy );
+				
+				// the particles past an edge have their velocity flipped and are put back on the edge
+				vx = _mm_xor_ps( vx, _mm_and_ps( sign, _mm_or_ps( _mm_cmplt_ps( px, zero ), _mm_cmpgt_ps( px, worldXV ) ) ) );
+				vy = _mm_xor_ps( vy, _mm_and_ps( sign, _mm_or_ps( _mm_cmplt_ps( py, zero ), _mm_cmpgt_ps( py, worldYV ) ) ) );
+				px = _mm_min_ps( _mm_max_ps( px, zero ), worldXV );
+				py = _mm_min_ps( _mm_max_ps( py, zero ), worldYV );
+				
+				const __m128 a = _mm_mul_ps( _mm_loadu_ps( alpha + i ), holdV );
+				_mm_storeu_ps( alpha + i, _mm_and_ps( _mm_cmpnlt_ps( a, minAlphaV ), a ) );
+				_mm_storeu_ps( posX + i, px );
+				_mm_storeu_ps( posY + i, py );
+				_mm_storeu_ps( velX + i, vx );
+				_mm_storeu_ps( velY + i, vy );
+			}
+		}
+#endif
+		for( ; k < count; ++k ) {
+			const int i = first + k;
+			float vx = fluidX[k] * ( mass[i] * fluidForce ) * worldX + velX[i] * momentum;
+			float vy = fluidY[k] * ( mass[i] * fluidForce ) * worldY + velY[i] * momentum;
+			float px = posX[i] + vx;
+			float py = posY[i] + vy;
+			
+			// bounce of edges
+			if( px < 0 ) {
+				px = 0;
+				vx = -vx;
+			}
+			else if( px > worldX ) {
+				px = worldX;
+				vx = -vx;
+			}
+			
+			if( py < 0 ) {
+				py = 0;
+				vy = -vy;
+			}
+			else if( py > worldY ) {
+				py = worldY;
+				vy = -vy;
+			}
+			
+			float a = alpha[i] * holdAmount;
+			if( a < minAlpha )
+				a = 0;
+			alpha[i] = a;
+			posX[i] = px;
+			posY[i] = py;
+			velX[i] = vx;
+			velY[i] = vy;
+		}
+	}
+};
+
+} // anonymous namespace
+
+ciMsaFluidParticleSystem::ciMsaFluidParticleSystem()
+	: mSolver( NULL ), mWorldSize( 1, 1 ), mNumParticles( 0 )
+{
+	setMomentum();
+	setFluidForce();
+	setFadeSpeed();
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setup( int maxParticles )
+{
+	std::vector<float> *arrays[] = { &mPosX, &mPosY, &mVelX, &mVelY, &mMass, &mAlpha };
+	for( int k = 0; k < 6; ++k )
+		arrays[k]->assign( maxParticles, 0.0f );
+	mNumParticles = 0;
+	
+	mNewParticles.clear();
+	mNewParticles.reserve( maxParticles );
+	mKillList.clear();
+	return *this;
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setFluidSolver( const ciMsaFluidSolver *solver )
+{
+	mSolver = solver;
+	return *this;
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setWorldSize( const ci::Vec2f &size )
+{
+	mWorldSize = size;
+	return *this;
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setMomentum( float momentum )
+{
+	mMomentum = momentum;
+	return *this;
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setFluidForce( float force )
+{
+	mFluidForce = force;
+	return *this;
+}
+
+ciMsaFluidParticleSystem& ciMsaFluidParticleSystem::setFadeSpeed( float fadeSpeed, float minAlpha )
+{
+	mFadeSpeed = fadeSpeed;
+	mMinAlpha = minAlpha;
+	return *this;
+}
+
+bool ciMsaFluidParticleSystem::addParticle( const ci::Vec2f &pos, const ci::Vec2f &vel, float mass, float alpha )
+{
+	if( mNumParticles + (int)mNewParticles.size() >= getMaxParticles() )
+		return false;
+	
+	NewParticle p = { pos.x, pos.y, vel.x, vel.y, mass, alpha };
+	mNewParticles.push_back( p );
+	return true;
+}
+
+int ciMsaFluidParticleSystem::addParticles( const ci::Vec2f &pos, int count, float radius )
+{
+	int added = 0;
+	while( added < count && addParticle( pos + ci::Rand::randVec2f() * radius, ci::Vec2f::zero(), ci::Rand::randFloat( 0.1f, 1 ), ci::Rand::randFloat( 0.3f, 1 ) ) )
+		++added;
+	return added;
+}
+
+void ciMsaFluidParticleSystem::killParticle( int index )
+{
+	if( index >= 0 && index < mNumParticles )
+		mKillList.push_back( index );
+}
+
+// the last particle takes the place of the one at index
+void ciMsaFluidParticleSystem::removeParticle( int index )
+{
+	const int last = --mNumParticles;
+	mPosX[index] = mPosX[last];
+	mPosY[index] = mPosY[last];
+	mVelX[index] = mVelX[last];
+	mVelY[index] = mVelY[last];
+	mMass[index] = mMass[last];
+	mAlpha[index] = mAlpha[last];
+}
+
+void ciMsaFluidParticleSystem::update()
+{
+	// the killed particles are faded out straight away, the sweep at the end removes them with the rest
+	for( size_t k = 0; k < mKillList.size(); ++k )
+		mAlpha[mKillList[k]] = 0;
+	mKillList.clear();
+	
+	for( size_t k = 0; k < mNewParticles.size(); ++k ) {
+		const NewParticle &p = mNewParticles[k];
+		const int i = mNumParticles++;
+		mPosX[i] = p.x;
+		mPosY[i] = p.y;
+		mVelX[i] = p.velX;
+		mVelY[i] = p.velY;
+		mMass[i] = p.mass;
+		mAlpha[i] = p.alpha;
+	}
+	mNewParticles.clear();
+	
+	if( mSolver && mSolver->isInited() && mNumParticles > 0 ) {
+		const ParticleBand band = { mSolver, &mPosX[0], &mPosY[0], &mVelX[0], &mVelY[0], &mMass[0], &mAlpha[0],
+									mWorldSize.x, mWorldSize.y, 1.0f / mWorldSize.x, 1.0f / mWorldSize.y,
+									mMomentum, mFluidForce, 1 - mFadeSpeed, mMinAlpha };
+		// every particle is a row one wide
+		ci::ip::parallelRows( 0, mNumParticles, 1, band );
+	}
+	
+	// from the back, so the particle moved into a dead one's place has been looked at already
+	for( int i = mNumParticles - 1; i >= 0; --i ) {
+		if( ! ( mAlpha[i] > 0 ) )
+			removeParticle( i );
+	}
+}
@@ -46,6 +46,459 @@
 
 #include "ciMsaFluidSolver.h"
 #include "cinder/Rand.h"
+#include "cinder/ip/Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Relaxes the cells of one colour of a red-black ordering in the rows [y1, y2): x = ( ( left + right + up + down ) * a + x0 ) * c.
+// The cells of the other colour are only read, so the rows can be done in any order and on any thread. A NULL x0 is all zeros.
+struct RedBlackBand {
+	float		*x[3];
+	const float	*x0[3];
+	int			numFields;
+	int			rowStride;		// floats from one row to the next
+	int			NX;
+	int			colour;			// 0 relaxes the cells where i + j is even, 1 those where it is odd
+	float		a, c;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		for( int32_t j = y1; j < y2; ++j ) {
+			// the cell k of the row is i = k + 1, which is relaxed when k + parity is even
+			const int parity = ( 1 + j + colour ) & 1;
+			for( int field = 0; field < numFields; ++field ) {
+				float *row = x[field] + j * rowStride + 1;
+				const float *row0 = x0[field] ? x0[field] + j * rowStride + 1 : NULL;
+				int k = 0;
+#if defined( CINDER_IP_SSE2 )
+				if( ci::ip::useSse2() ) {
+					// every lane is computed and the ones of the other colour are written back unchanged
+					const __m128 mask = _mm_castsi128_ps( parity ? _mm_set_epi32( -1, 0, -1, 0 ) : _mm_set_epi32( 0, -1, 0, -1 ) );
+					const __m128 av = _mm_set1_ps( a ), cv = _mm_set1_ps( c );
+					// the left and right neighbours are shuffled out of the vectors either side rather than loaded,
+					// a load straddling the store just made can't be forwarded and stalls
+					__m128 prev = _mm_loadu_ps( row - 4 ), cur = _mm_loadu_ps( row );
+					for( ; k + 4 <= NX; k += 4 ) {
+						const __m128 next = _mm_loadu_ps( row + k + 4 );
+						const __m128 left = _mm_shuffle_ps( _mm_shuffle_ps( prev, cur, _MM_SHUFFLE( 0, 0, 3, 3 ) ), cur, _MM_SHUFFLE( 2, 1, 2, 0 ) );
+						const __m128 right = _mm_shuffle_ps( cur, _mm_shuffle_ps( cur, next, _MM_SHUFFLE( 0, 0, 3, 3 ) ), _MM_SHUFFLE( 2, 0, 2, 1 ) );
+						__m128 sum = _mm_add_ps( left, right );
+						sum = _mm_add_ps( _mm_add_ps( sum, _mm_loadu_ps( row + k - rowStride ) ), _mm_loadu_ps( row + k + rowStride ) );
+						const __m128 v = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( sum, av ), row0 ? _mm_loadu_ps( row0 + k ) : _mm_setzero_ps() ), cv );
+						prev = _mm_or_ps( _mm_and_ps( mask, v ), _mm_andnot_ps( mask, cur ) );
+						_mm_storeu_ps( row + k, prev );
+						cur = next;
+					}
+				}
+#endif
+				for( k += ( k + parity ) & 1; k < NX; k += 2 )
+					row[k] = ( ( row[k - 1] + row[k + 1] + row[k - rowStride] + row[k + rowStride] ) * a + ( row0 ? row0[k] : 0.0f ) ) * c;
+			}
+		}
+	}
+};
+
+// x += dt * x0 for the cells of the rows [y1, y2) of up to three fields, boundary cells included
+struct AddSourceBand {
+	float		*x[3];
+	const float	*x0[3];
+	int			numFields;
+	int			rowStride;
+	float		dt;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int first = y1 * rowStride, last = y2 * rowStride;
+		for( int field = 0; field < numFields; ++field ) {
+			float *dst = x[field];
+			const float *src = x0[field];
+			int i = first;
+#if defined( CINDER_IP_SSE2 )
+			if( ci::ip::useSse2() ) {
+				const __m128 dtv = _mm_set1_ps( dt );
+				for( ; i + 4 <= last; i += 4 )
+					_mm_storeu_ps( dst + i, _mm_add_ps( _mm_loadu_ps( dst + i ), _mm_mul_ps( dtv, _mm_loadu_ps( src + i ) ) ) );
+			}
+#endif
+			for( ; i < last; ++i )
+				dst[i] += dt * src[i];
+		}
+	}
+};
+
+// Finds the cells around the point (x, y) of the grid, clamped to half a cell inside the boundary, as the top left of
+// the 2x2 cells to sample there and the bilinear weights of the columns (s) and rows (t)
+inline void locateCells( float x, float y, int NX, int NY, int &src, float &s0, float &s1, float &t0, float &t1 )
+{
+	if (x > NX + 0.5) x = NX + 0.5f;
+	if (x < 0.5)     x = 0.5f;
+	
+	const int i0 = (int) x;
+	
+	if (y > NY + 0.5) y = NY + 0.5f;
+	if (y < 0.5)     y = 0.5f;
+	
+	const int j0 = (int) y;
+	
+	s1 = x - i0;
+	s0 = 1 - s1;
+	t1 = y - j0;
+	t0 = 1 - t1;
+	src = i0 + ( NX + 2 ) * j0;
+}
+
+#if defined( CINDER_IP_SSE2 )
+// four points at once, with the same arithmetic
+inline void locateCells( __m128 x, __m128 y, int NX, int NY, int src[4], __m128 &s0, __m128 &s1, __m128 &t0, __m128 &t1 )
+{
+	const __m128 one = _mm_set1_ps( 1.0f ), half = _mm_set1_ps( 0.5f );
+	x = _mm_max_ps( _mm_min_ps( x, _mm_set1_ps( NX + 0.5f ) ), half );
+	y = _mm_max_ps( _mm_min_ps( y, _mm_set1_ps( NY + 0.5f ) ), half );
+	
+	// x and y are positive, so truncating is rounding down
+	const __m128i i0 = _mm_cvttps_epi32( x ), j0 = _mm_cvttps_epi32( y );
+	s1 = _mm_sub_ps( x, _mm_cvtepi32_ps( i0 ) );
+	s0 = _mm_sub_ps( one, s1 );
+	t1 = _mm_sub_ps( y, _mm_cvtepi32_ps( j0 ) );
+	t0 = _mm_sub_ps( one, t1 );
+	
+	// SSE2 has no 32 bit multiply, so the cell indices are worked out one at a time
+	int col[4], row[4];
+	_mm_storeu_si128( (__m128i*)col, i0 );
+	_mm_storeu_si128( (__m128i*)row, j0 );
+	for( int k = 0; k < 4; ++k )
+		src[k] = col[k] + ( NX + 2 ) * row[k];
+}
+#endif
+
+// Backtraces cells along the velocity (du, dv) by dt0 and locates the cells they land among
+struct Backtrace {
+	const float	*du, *dv;
+	int			NX, NY;
+	float		dt0x, dt0y;		// negated to trace forward along the velocity
+
+	void operator()( int i, int j, int &src, float &s0, float &s1, float &t0, float &t1 ) const
+	{
+		const int index = i + ( NX + 2 ) * j;
+		locateCells( i - dt0x * du[index], j - dt0y * dv[index], NX, NY, src, s0, s1, t0, t1 );
+	}
+
+#if defined( CINDER_IP_SSE2 )
+	// the cells i .. i + 3 of row j at once
+	void operator()( int i, int j, int src[4], __m128 &s0, __m128 &s1, __m128 &t0, __m128 &t1 ) const
+	{
+		const int index = i + ( NX + 2 ) * j;
+		const __m128 xi = _mm_cvtepi32_ps( _mm_add_epi32( _mm_set1_epi32( i ), _mm_set_epi32( 3, 2, 1, 0 ) ) );
+		const __m128 x = _mm_sub_ps( xi, _mm_mul_ps( _mm_set1_ps( dt0x ), _mm_loadu_ps( du + index ) ) );
+		const __m128 y = _mm_sub_ps( _mm_set1_ps( (float)j ), _mm_mul_ps( _mm_set1_ps( dt0y ), _mm_loadu_ps( dv + index ) ) );
+		locateCells( x, y, NX, NY, src, s0, s1, t0, t1 );
+	}
+#endif
+};
+
+// the 2x2 cells of d0 with the top left one at src, and their bilinear blend
+inline void gatherCells( const float *d0, int src, int step, float &tl, float &tr, float &bl, float &br )
+{
+	tl = d0[src];	tr = d0[src + 1];
+	bl = d0[src + step];	br = d0[src + step + 1];
+}
+
+inline float blendCells( float tl, float tr, float bl, float br, float s0, float s1, float t0, float t1 )
+{
+	return s0 * ( t0 * tl + t1 * bl ) + s1 * ( t0 * tr + t1 * br );
+}
+
+#if defined( CINDER_IP_SSE2 )
+// the 2x2 cells of four samples, each pair of neighbours in a row is loaded as one 8 byte value and the pairs are transposed
+inline void gatherCells( const float *d0, const int src[4], int step, __m128 &tl, __m128 &tr, __m128 &bl, __m128 &br )
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top01 = _mm_loadh_pi( _mm_loadl_pi( zero, (const __m64*)( d0 + src[0] ) ), (const __m64*)( d0 + src[1] ) );
+	const __m128 top23 = _mm_loadh_pi( _mm_loadl_pi( zero, (const __m64*)( d0 + src[2] ) ), (const __m64*)( d0 + src[3] ) );
+	const __m128 bottom01 = _mm_loadh_pi( _mm_loadl_pi( zero, (const __m64*)( d0 + src[0] + step ) ), (const __m64*)( d0 + src[1] + step ) );
+	const __m128 bottom23 = _mm_loadh_pi( _mm_loadl_pi( zero, (const __m64*)( d0 + src[2] + step ) ), (const __m64*)( d0 + src[3] + step ) );
+	tl = _mm_shuffle_ps( top01, top23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	tr = _mm_shuffle_ps( top01, top23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	bl = _mm_shuffle_ps( bottom01, bottom23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	br = _mm_shuffle_ps( bottom01, bottom23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+}
+
+inline __m128 blendCells( __m128 tl, __m128 tr, __m128 bl, __m128 br, __m128 s0, __m128 s1, __m128 t0, __m128 t1 )
+{
+	return _mm_add_ps( _mm_mul_ps( s0, _mm_add_ps( _mm_mul_ps( t0, tl ), _mm_mul_ps( t1, bl ) ) ),
+					   _mm_mul_ps( s1, _mm_add_ps( _mm_mul_ps( t0, tr ), _mm_mul_ps( t1, br ) ) ) );
+}
+#endif
+
+// Semi-Lagrangian advection of up to three fields d0 into d along one velocity, for the interior cells of the rows [y1, y2).
+// Each row only reads d0, so the rows can be done in any order and on any thread
+struct AdvectBand {
+	Backtrace	trace;
+	float		*d[3];
+	const float	*d0[3];
+	int			numFields;
+
+	// advects the interior cells of row j, writing them to row dstRow
+	void advectRow( int j, int dstRow ) const
+	{
+		const int step = trace.NX + 2, offset = step * ( dstRow - j );
+		int i = 1;
+		int src;
+		float s0, s1, t0, t1, tl, tr, bl, br;
+#if defined( CINDER_IP_SSE2 )
+		if( ci::ip::useSse2() ) {
+			int src4[4];
+			__m128 s04, s14, t04, t14, tl4, tr4, bl4, br4;
+			for( ; i + 4 <= trace.NX + 1; i += 4 ) {
+				trace( i, j, src4, s04, s14, t04, t14 );
+				for( int field = 0; field < numFields; ++field ) {
+					gatherCells( d0[field], src4, step, tl4, tr4, bl4, br4 );
+					_mm_storeu_ps( d[field] + i + step * j + offset, blendCells( tl4, tr4, bl4, br4, s04, s14, t04, t14 ) );
+				}
+			}
+		}
+#endif
+		for( ; i <= trace.NX; ++i ) {
+			trace( i, j, src, s0, s1, t0, t1 );
+			for( int field = 0; field < numFields; ++field ) {
+				gatherCells( d0[field], src, step, tl, tr, bl, br );
+				d[field][i + step * j + offset] = blendCells( tl, tr, bl, br, s0, s1, t0, t1 );
+			}
+		}
+	}
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		for( int32_t j = y1; j < y2; ++j )
+			advectRow( j, j );
+	}
+};
+
+// The MacCormack correction of the interior cells of the rows [y1, y2): d holds d0 advected forward and dBack d advected
+// back again, half the round trip's error is taken off d and the result clamped to the 2x2 cells of d0 it was sampled from
+struct MacCormackBand {
+	Backtrace	trace;
+	float		*d[3];
+	const float	*d0[3];
+	const float	*dBack[3];
+	int			numFields;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int step = trace.NX + 2;
+		for( int32_t j = y1; j < y2; ++j ) {
+			int i = 1;
+			int src;
+			float s0, s1, t0, t1, tl, tr, bl, br;
+#if defined( CINDER_IP_SSE2 )
+			if( ci::ip::useSse2() ) {
+				const __m128 half = _mm_set1_ps( 0.5f );
+				int src4[4];
+				__m128 s04, s14, t04, t14, tl4, tr4, bl4, br4;
+				for( ; i + 4 <= trace.NX + 1; i += 4 ) {
+					trace( i, j, src4, s04, s14, t04, t14 );
+					const int index = i + step * j;
+					for( int field = 0; field < numFields; ++field ) {
+						gatherCells( d0[field], src4, step, tl4, tr4, bl4, br4 );
+						const __m128 lo = _mm_min_ps( _mm_min_ps( tl4, tr4 ), _mm_min_ps( bl4, br4 ) );
+						const __m128 hi = _mm_max_ps( _mm_max_ps( tl4, tr4 ), _mm_max_ps( bl4, br4 ) );
+						const __m128 error = _mm_sub_ps( _mm_loadu_ps( d0[field] + index ), _mm_loadu_ps( dBack[field] + index ) );
+						const __m128 corrected = _mm_add_ps( _mm_loadu_ps( d[field] + index ), _mm_mul_ps( half, error ) );
+						_mm_storeu_ps( d[field] + index, _mm_max_ps( _mm_min_ps( corrected, hi ), lo ) );
+					}
+				}
+			}
+#endif
+			for( ; i <= trace.NX; ++i ) {
+				trace( i, j, src, s0, s1, t0, t1 );
+				const int index = i + step * j;
+				for( int field = 0; field < numFields; ++field ) {
+					gatherCells( d0[field], src, step, tl, tr, bl, br );
+					const float lo = std::min( std::min( tl, tr ), std::min( bl, br ) );
+					const float hi = std::max( std::max( tl, tr ), std::max( bl, br ) );
+					const float corrected = d[field][index] + 0.5f * ( d0[field][index] - dBack[field][index] );
+					d[field][index] = std::max( std::min( corrected, hi ), lo );
+				}
+			}
+		}
+	}
+};
+
+// parallelRows() only hands out bands of at least 32K cells. The fused advect and fade passes advect this many rows
+// across the threads at a time and fade them while they are still in cache
+int advectFadeChunkRows( int NX )
+{
+	return std::max( 1, ci::ip::getNumRowBandThreads() * 32 * 1024 / NX );
+}
+
+// the fields are planes of one block: r, rOld, g, gOld, b, bOld, u, uOld, v, vOld and curl
+const int NUM_PLANES = 11;
+
+// The cells of a multigrid level are whole cells of the level but for the last column and row, which are short when the finer
+// level has an odd number of them. The pressure equation of a cell is the flow through its faces, the weight of a neighbour
+// being the length of the face they share over the distance between their centres. Returns the weighted sum of the neighbours
+// of cell (i, j) and their total weight in diagonal, on whole cells the four neighbours and 4
+inline float neighbourSum( const float *p, int index, int rowStride, const float *wx, const float *wy, int i, int j, float &diagonal )
+{
+	const float left = 2 * wy[j] / ( wx[i - 1] + wx[i] ), right = 2 * wy[j] / ( wx[i] + wx[i + 1] );
+	const float down = 2 * wx[i] / ( wy[j - 1] + wy[j] ), up = 2 * wx[i] / ( wy[j] + wy[j + 1] );
+	diagonal = left + right + down + up;
+	return left * p[index - 1] + right * p[index + 1] + down * p[index - rowStride] + up * p[index + rowStride];
+}
+
+// r = f - ( 4 * p - left - right - up - down ) for the interior cells of the rows [y1, y2) of a multigrid level,
+// weighted by neighbourSum() when the level has short cells
+struct ResidualBand {
+	const float	*p, *f;
+	float		*r;
+	int			nx;
+	const float	*wx, *wy;		// the cell sizes of the level, NULL when all of its cells are whole
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int rowStride = nx + 2;
+		for( int32_t j = y1; j < y2; ++j ) {
+			const int row = j * rowStride + 1;
+			int i = 0;
+			if( wx ) {
+				float diagonal;
+				for( ; i < nx; ++i ) {
+					const int index = row + i;
+					const float sum = neighbourSum( p, index, rowStride, wx, wy, i + 1, j, diagonal );
+					r[index] = f[index] - ( diagonal * p[index] - sum );
+				}
+			}
+#if defined( CINDER_IP_SSE2 )
+			if( ci::ip::useSse2() ) {
+				const __m128 four = _mm_set1_ps( 4.0f );
+				for( ; i + 4 <= nx; i += 4 ) {
+					const float *pc = p + row + i;
+					__m128 sum = _mm_add_ps( _mm_loadu_ps( pc - 1 ), _mm_loadu_ps( pc + 1 ) );
+					sum = _mm_add_ps( _mm_add_ps( sum, _mm_loadu_ps( pc - rowStride ) ), _mm_loadu_ps( pc + rowStride ) );
+					const __m128 ap = _mm_sub_ps( _mm_mul_ps( four, _mm_loadu_ps( pc ) ), sum );
+					_mm_storeu_ps( r + row + i, _mm_sub_ps( _mm_loadu_ps( f + row + i ), ap ) );
+				}
+			}
+#endif
+			for( ; i < nx; ++i ) {
+				const int index = row + i;
+				r[index] = f[index] - ( 4 * p[index] - ( p[index - 1] + p[index + 1] + p[index - rowStride] + p[index + rowStride] ) );
+			}
+		}
+	}
+};
+
+// one red-black Gauss-Seidel sweep of the colour of the rows [y1, y2) of a multigrid level with short cells
+struct ShortCellRelaxBand {
+	float		*p;
+	const float	*f;
+	const float	*wx, *wy;
+	int			nx;
+	int			colour;			// 0 relaxes the cells where i + j is even, 1 those where it is odd
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int rowStride = nx + 2;
+		float diagonal;
+		for( int32_t j = y1; j < y2; ++j )
+			for( int i = 2 - ( ( j + colour ) & 1 ); i <= nx; i += 2 ) {
+				const int index = i + j * rowStride;
+				const float sum = neighbourSum( p, index, rowStride, wx, wy, i, j, diagonal );
+				p[index] = ( sum + f[index] ) / diagonal;
+			}
+	}
+};
+
+// the right hand side of the coarse rows [y1, y2): the sum of the residuals of the (up to) 2x2 fine cells a coarse cell covers,
+// the flow through a coarse cell being that through the fine cells in it
+struct RestrictBand {
+	const float	*fineR;
+	float		*coarseF;
+	int			fineNX, fineNY, coarseNX;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int fineStride = fineNX + 2, coarseStride = coarseNX + 2;
+		for( int32_t J = y1; J < y2; ++J ) {
+			const int j0 = 2 * J - 1, j1 = std::min( 2 * J, fineNY );
+			for( int I = 1; I <= coarseNX; ++I ) {
+				const int i0 = 2 * I - 1, i1 = std::min( 2 * I, fineNX );
+				float sum = 0;
+				for( int j = j0; j <= j1; ++j )
+					for( int i = i0; i <= i1; ++i )
+						sum += fineR[i + j * fineStride];
+				coarseF[I + J * coarseStride] = sum;
+			}
+		}
+	}
+};
+
+// The fine cell i lies in the coarse cell I = ( i + 1 ) / 2. Sets I2 to the neighbour of I on the side of the centre of i and
+// t to the weight i takes from it. Between whole cells the centre of i is a quarter of a coarse cell from that of I and t is 1/4,
+// a coarse cell holding just the last fine cell shares its centre and t is 0
+inline void prolongationWeight( const float *fineW, const float *coarseW, int i, int &I2, float &t )
+{
+	const int I = ( i + 1 ) / 2;
+	const float offset = ( ( i & 1 ) ? 0.25f * fineW[i] : 0.5f * fineW[i - 1] + 0.25f * fineW[i] ) - 0.5f * coarseW[I];
+	I2 = ( offset < 0 ) ? I - 1 : I + 1;
+	t = 2 * std::abs( offset ) / ( coarseW[I] + coarseW[I2] );
+}
+
+// adds the bilinear interpolation of the coarse correction to the fine rows [y1, y2)
+struct ProlongBand {
+	const float	*coarseP;
+	float		*fineP;
+	int			fineNX, coarseNX;
+	const float	*fineWX, *fineWY, *coarseWX, *coarseWY;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int fineStride = fineNX + 2, coarseStride = coarseNX + 2;
+		for( int32_t j = y1; j < y2; ++j ) {
+			int J2, I2;
+			float tj, ti;
+			prolongationWeight( fineWY, coarseWY, j, J2, tj );
+			const float *rowA = coarseP + ( j + 1 ) / 2 * coarseStride, *rowB = coarseP + J2 * coarseStride;
+			float *dst = fineP + j * fineStride;
+			for( int i = 1; i <= fineNX; ++i ) {
+				const int I = ( i + 1 ) / 2;
+				prolongationWeight( fineWX, coarseWX, i, I2, ti );
+				dst[i] += ( 1 - tj ) * ( ( 1 - ti ) * rowA[I] + ti * rowA[I2] ) + tj * ( ( 1 - ti ) * rowB[I] + ti * rowB[I2] );
+			}
+		}
+	}
+};
+
+// the sizes of the cells of the level coarsened from cells of sizes fineW, ghosts left for setGhostWidths()
+std::vector<float> coarsenWidths( const std::vector<float> &fineW, int coarseN )
+{
+	const int fineN = (int)fineW.size() - 2;
+	std::vector<float> w( coarseN + 2, 1.0f );
+	for( int I = 1; I <= coarseN; ++I )
+		w[I] = 0.5f * ( fineW[2 * I - 1] + ( 2 * I <= fineN ? fineW[2 * I] : 0.0f ) );
+	return w;
+}
+
+// the ghost cells take the size of the cell setBoundaryLevel() copies into them
+void setGhostWidths( std::vector<float> &w, bool wrap )
+{
+	const int n = (int)w.size() - 2;
+	w[0] = w[wrap ? n : 1];
+	w[n + 1] = w[wrap ? 1 : n];
+}
+
+// sweeps a multigrid level gets before and after the coarser levels correct it, and the fewest sweeps on the coarsest level.
+// A sweep carries a correction about one cell, so a coarsest level n cells long, as a thin fluid leaves it, gets n * n
+const int MULTIGRID_SMOOTHING_SWEEPS = 2;
+const int MULTIGRID_COARSEST_SWEEPS = 40;
+// a level of at most this many cells across is not coarsened further
+const int MULTIGRID_COARSEST_SIZE = 4;
+
+} // anonymous namespace
 
 ciMsaFluidSolver::ciMsaFluidSolver()
 :r(NULL)
@@ -54,9 +507,12 @@ ciMsaFluidSolver::ciMsaFluidSolver()
 ,gOld(NULL)
 ,b(NULL)
 ,bOld(NULL)
-,uv(NULL)
-,uvOld(NULL)
+,u(NULL)
+,uOld(NULL)
+,v(NULL)
+,vOld(NULL)
 ,curl(NULL)
+,_planes(NULL)
 ,_isInited(false)
 {
 }
@@ -87,6 +543,10 @@ ciMsaFluidSolver& ciMsaFluidSolver::setup(int NX, int NY)
 	setFadeSpeed();
 	setSolverIterations();
 	enableVorticityConfinement(false);
+	enableRedBlack(false);
+	enableMultigrid(false);
+	setMultigridCycles();
+	enableMacCormack(false);
 	setWrap( false, false );
 	
 	//maa
@@ -127,6 +587,38 @@ bool ciMsaFluidSolver::getVorticityConfinement() {
 	return doVorticityConfinement;
 }
 
+ciMsaFluidSolver&  ciMsaFluidSolver::enableRedBlack(bool b) {
+	doRedBlack = b;
+	return *this;
+}
+
+bool ciMsaFluidSolver::getRedBlack() {
+	return doRedBlack;
+}
+
+ciMsaFluidSolver&  ciMsaFluidSolver::enableMultigrid(bool b) {
+	doMultigrid = b;
+	return *this;
+}
+
+bool ciMsaFluidSolver::getMultigrid() {
+	return doMultigrid;
+}
+
+ciMsaFluidSolver&  ciMsaFluidSolver::setMultigridCycles(int cycles) {
+	multigridCycles = cycles;
+	return *this;
+}
+
+ciMsaFluidSolver&  ciMsaFluidSolver::enableMacCormack(bool b) {
+	doMacCormack = b;
+	return *this;
+}
+
+bool ciMsaFluidSolver::getMacCormack() {
+	return doMacCormack;
+}
+
 ciMsaFluidSolver& ciMsaFluidSolver::setWrap( bool bx, bool by ) {
 	wrap_x = bx;
 	wrap_y = by;
@@ -144,18 +636,14 @@ ciMsaFluidSolver::~ciMsaFluidSolver() {
 void ciMsaFluidSolver::destroy() {
 	_isInited = false;
 	
-	if(r)		delete []r;
-	if(rOld)	delete []rOld;
-	
-	if(g)		delete []g;
-	if(gOld)	delete []gOld;
+	if(_planes)	delete []_planes;
+	_planes = NULL;
 	
-	if(b)		delete []b;
-	if(bOld)	delete []bOld;
+	r = rOld = g = gOld = b = bOld = NULL;
+	u = uOld = v = vOld = curl = NULL;
 	
-	if(uv)		delete []uv;
-	if(uvOld)	delete []uvOld;
-	if(curl)       delete []curl;
+	multigridLevels.clear();
+	macCormackPlanes.clear();
 }
 
 
@@ -163,25 +651,16 @@ void ciMsaFluidSolver::reset() {
 	destroy();
 	_isInited = true;
 	
-	r    = new float[_numCells];
-	rOld = new float[_numCells];
-	
-	g    = new float[_numCells];
-	gOld = new float[_numCells];
-	
-	b    = new float[_numCells];
-	bOld = new float[_numCells];
-	
-	uv    = new ci::Vec2f[_numCells];
-	uvOld = new ci::Vec2f[_numCells];
-	curl = new float[_numCells];
+	// every field is a plane of one block. The planes start on cache lines and are a cache line further apart than they
+	// need to be, so the same cell of different fields doesn't land in the same cache set when _numCells is a power of two
+	const int planeStride = ( ( _numCells + 15 ) & ~15 ) + 16;
+	_planes = new float[NUM_PLANES * planeStride + 16];
+	float *plane = reinterpret_cast<float*>( ( reinterpret_cast<size_t>( _planes ) + 63 ) & ~(size_t)63 );
+	float **fields[NUM_PLANES] = { &r, &rOld, &g, &gOld, &b, &bOld, &u, &uOld, &v, &vOld, &curl };
+	for( int k = 0; k < NUM_PLANES; ++k )
+		*fields[k] = plane + k * planeStride;
 	
-	for ( int i = _numCells-1; i>=0; --i )
-	{
-		uv[i] = uvOld[i] = ci::Vec2f::zero();
-		curl[i] = 0.0f;
-		r[i] = rOld[i] = g[i] = gOld[i] = b[i] = bOld[i] = 0;
-	}
+	memset( plane, 0, NUM_PLANES * planeStride * sizeof(float) );
 }
 
 // return total number of cells (_NX+2) * (_NY+2)
@@ -234,6 +713,40 @@ float ciMsaFluidSolver::getAvgSpeed() const {
 	return _avgSpeed;
 }
 
+void ciMsaFluidSolver::getVelocityAtPositions( const float *x, const float *y, int count, float *velX, float *velY ) const {
+	// the cell getVelocityAtPos() reads, p * (N + 2) rounded down and clamped to the grid. clamping before the
+	// conversion picks the same cell and keeps positions far outside the grid from overflowing the int
+	const float scaleX = (float)( _NX + 2 ), scaleY = (float)( _NY + 2 );
+	const float maxX = (float)( _NX + 1 ), maxY = (float)( _NY + 1 );
+	const int step = _NX + 2;
+	int k = 0;
+#if defined( CINDER_IP_SSE2 )
+	if( ci::ip::useSse2() ) {
+		const __m128 scaleXV = _mm_set1_ps( scaleX ), scaleYV = _mm_set1_ps( scaleY );
+		const __m128 maxXV = _mm_set1_ps( maxX ), maxYV = _mm_set1_ps( maxY ), zero = _mm_setzero_ps();
+		int col[4], row[4];
+		for( ; k + 4 <= count; k += 4 ) {
+			_mm_storeu_si128( (__m128i*)col, _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( x + k ), scaleXV ), zero ), maxXV ) ) );
+			_mm_storeu_si128( (__m128i*)row, _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( y + k ), scaleYV ), zero ), maxYV ) ) );
+			
+			// SSE2 has no 32 bit multiply or gather, so the cells are read one at a time
+			const int o0 = col[0] + step * row[0], o1 = col[1] + step * row[1];
+			const int o2 = col[2] + step * row[2], o3 = col[3] + step * row[3];
+			_mm_storeu_ps( velX + k, _mm_setr_ps( u[o0], u[o1], u[o2], u[o3] ) );
+			_mm_storeu_ps( velY + k, _mm_setr_ps( v[o0], v[o1], v[o2], v[o3] ) );
+		}
+	}
+#endif
+	for( ; k < count; ++k ) {
+		float fx = x[k] * scaleX, fy = y[k] * scaleY;
+		fx = fx < 0 ? 0 : ( fx > maxX ? maxX : fx );
+		fy = fy < 0 ? 0 : ( fy > maxY ? maxY : fy );
+		const int o = (int)fx + step * (int)fy;
+		velX[k] = u[o];
+		velY[k] = v[o];
+	}
+}
+
 #ifndef	SWAP
 template<class T> void SWAP( T& a, T& b)
 {
@@ -249,20 +762,23 @@ void ciMsaFluidSolver::swapRGB(){
 	SWAP( g, gOld );
 	SWAP( b, bOld );
 }
-void ciMsaFluidSolver::swapUV()	{	SWAP( uv, uvOld ); }
+void ciMsaFluidSolver::swapUV()	{
+	SWAP( u, uOld );
+	SWAP( v, vOld );
+}
 
 // Curl and vorticityConfinement based on code by Alexander McKenzie
 float ciMsaFluidSolver::calcCurl( int i, int j)
 {
-	float du_dy = uv[FLUID_IX(i, j + 1)].x - uv[FLUID_IX(i, j - 1)].x;
-	float dv_dx = uv[FLUID_IX(i + 1, j)].y - uv[FLUID_IX(i - 1, j)].y;
+	float du_dy = u[FLUID_IX(i, j + 1)] - u[FLUID_IX(i, j - 1)];
+	float dv_dx = v[FLUID_IX(i + 1, j)] - v[FLUID_IX(i - 1, j)];
 	return (du_dy - dv_dx) * 0.5f;	// for optimization should be moved to later and done with another operation
 }
 
-void ciMsaFluidSolver::vorticityConfinement(ci::Vec2f* Fvc_xy) {
+void ciMsaFluidSolver::vorticityConfinement(float* Fvc_x, float* Fvc_y) {
 	float dw_dx, dw_dy;
 	float length;
-	float v;
+	float w;
 	
 	// Calculate magnitude of calcCurl(u,v) for each cell. (|w|)
 	for (int j = _NY; j > 0; --j )
@@ -290,11 +806,11 @@ void ciMsaFluidSolver::vorticityConfinement(ci::Vec2f* Fvc_xy) {
 			dw_dx *= length;
 			dw_dy *= length;
 			
-			v = calcCurl(i, j);
+			w = calcCurl(i, j);
 			
 			// N x w
-			Fvc_xy[FLUID_IX(i, j)].x = dw_dy * -v;
-			Fvc_xy[FLUID_IX(i, j)].y = dw_dx *  v;
+			Fvc_x[FLUID_IX(i, j)] = dw_dy * -w;
+			Fvc_y[FLUID_IX(i, j)] = dw_dx *  w;
 		}
 	}
 }
@@ -304,7 +820,7 @@ void ciMsaFluidSolver::update() {
 	
 	if( doVorticityConfinement )
 	{
-		vorticityConfinement(uvOld);
+		vorticityConfinement(uOld, vOld);
 		addSourceUV();
 	}
 	
@@ -312,13 +828,13 @@ void ciMsaFluidSolver::update() {
 	
 	diffuseUV( viscocity );
 	
-	project(uv, uvOld);
+	project(u, v, uOld, vOld);
 	
 	swapUV();
 	
-	advect2d(uv, uvOld);
+	advect2d(u, v, uOld, vOld);
 	
-	project(uv, uvOld);
+	project(u, v, uOld, vOld);
 	
 	if(doRGB)
 	{
@@ -331,8 +847,7 @@ void ciMsaFluidSolver::update() {
 			swapRGB();
 		}
 		
-		advectRGB(0, uv);
-		fadeRGB();
+		advectFadeRGB(u, v);
 	} 
 	else
 	{
@@ -345,99 +860,48 @@ void ciMsaFluidSolver::update() {
 			swapRGB();
 		}
 		
-		advect(0, r, rOld, uv);	
-		fadeR();
+		advectFadeR(u, v);
 	}
 }
 
 #define ZERO_THRESH		1e-9			// if value falls under this, set to zero (to avoid denormal slowdown)
 #define CHECK_ZERO(p)	if(fabsf(p)<ZERO_THRESH) p = 0
 
-void ciMsaFluidSolver::fadeR() {
-	// I want the fluid to gradually fade out so the screen doesn't fill. the amount it fades out depends on how full it is, and how uniform (i.e. boring) the fluid is...
-	//		float holdAmount = 1 - _avgDensity * _avgDensity * fadeSpeed;	// this is how fast the density will decay depending on how full the screen currently is
-	float holdAmount = 1 - fadeSpeed;
-	
-	_avgDensity = 0;
-	_avgSpeed = 0;
-	
-	float totalDeviations = 0;
-	float currentDeviation;
-	float tmp_r;
-	//	float uniformityMult = uniformity * 0.05f;
-	
-	_avgSpeed = 0;
-	for (int i = _numCells-1; i >=0; --i) {
-		// clear old values
-		uvOld[i] = ci::Vec2f::zero(); 
-		rOld[i] = 0;
-		//		gOld[i] = bOld[i] = 0;
-		
-		// calc avg speed
-		_avgSpeed += uv[i].x * uv[i].x + uv[i].y * uv[i].y;
-		
+namespace {
+
+// fades the cells [first, last] of a monochrome fluid from the last to the first, adding them to the running totals of fadeR()
+void fadeCellsR( float *r, int first, int last, float holdAmount, float &avgDensity, float &totalDeviations )
+{
+	for (int i = last; i >= first; --i) {
 		// calc avg density
-		tmp_r = ci::math<float>::min( 1.0f, r[i] );
-		
-		//		g[i] = MIN(1.0f, g[i]);
-		//		b[i] = MIN(1.0f, b[i]);
-		//		float density = MAX(r[i], MAX(g[i], b[i]));
-		_avgDensity += tmp_r;	// add it up
+		float tmp_r = ci::math<float>::min( 1.0f, r[i] );
+		avgDensity += tmp_r;	// add it up
 		
 		// calc deviation (for uniformity)
-		currentDeviation = tmp_r - _avgDensity;
+		float currentDeviation = tmp_r - avgDensity;
 		totalDeviations += currentDeviation * currentDeviation;
 		
 		// fade out old
 		r[i] = tmp_r * holdAmount;
 		
 		CHECK_ZERO(r[i]);
-		CHECK_ZERO(uv[i].x);
-		CHECK_ZERO(uv[i].y);
-		if(doVorticityConfinement) CHECK_ZERO(curl[i]);
-		
 	}
-	_avgDensity *= _invNumCells;
-	//	_avgSpeed *= _invNumCells;
-	
-	//	println("%.3f\n", _avgSpeed);
-	_uniformity = 1.0f / (1 + totalDeviations * _invNumCells);		// 0: very wide distribution, 1: very uniform
 }
 
-
-void ciMsaFluidSolver::fadeRGB() {
-	// I want the fluid to gradually fade out so the screen doesn't fill. the amount it fades out depends on how full it is, and how uniform (i.e. boring) the fluid is...
-	//		float holdAmount = 1 - _avgDensity * _avgDensity * fadeSpeed;	// this is how fast the density will decay depending on how full the screen currently is
-	float holdAmount = 1 - fadeSpeed;
-	
-	_avgDensity = 0;
-	_avgSpeed = 0;
-	
-	float totalDeviations = 0;
-	float currentDeviation;
-	//	float uniformityMult = _uniformity * 0.05f;
-	float tmp_r, tmp_g, tmp_b;
-	_avgSpeed = 0;
-	for (int i = _numCells-1; i >=0; --i)
-	{
-		// clear old values
-		uvOld[i] = ci::Vec2f::zero();
-		rOld[i] = 0;
-		gOld[i] = bOld[i] = 0;
-		
-		// calc avg speed
-		_avgSpeed += uv[i].x * uv[i].x + uv[i].y * uv[i].y;
-		
+// fades the cells [first, last] of an RGB fluid from the last to the first, adding them to the running totals of fadeRGB()
+void fadeCellsRGB( float *r, float *g, float *b, int first, int last, float holdAmount, float &avgDensity, float &totalDeviations )
+{
+	for (int i = last; i >= first; --i) {
 		// calc avg density
-		tmp_r = ci::math<float>::min( 1.0f, r[i] );
-		tmp_g = ci::math<float>::min( 1.0f, g[i] );
-		tmp_b = ci::math<float>::min( 1.0f, b[i] );
+		float tmp_r = ci::math<float>::min( 1.0f, r[i] );
+		float tmp_g = ci::math<float>::min( 1.0f, g[i] );
+		float tmp_b = ci::math<float>::min( 1.0f, b[i] );
 
 		float density = ci::math<float>::max( tmp_r, ci::math<float>::max( tmp_g, tmp_b ) );
-		_avgDensity += density;	// add it up
+		avgDensity += density;	// add it up
 		
 		// calc deviation (for _uniformity)
-		currentDeviation = density - _avgDensity;
+		float currentDeviation = density - avgDensity;
 		totalDeviations += currentDeviation * currentDeviation;
 		
 		// fade out old
@@ -448,171 +912,233 @@ void ciMsaFluidSolver::fadeRGB() {
 		CHECK_ZERO(r[i]);
 		CHECK_ZERO(g[i]);
 		CHECK_ZERO(b[i]);
-		CHECK_ZERO(uv[i].x);
-		CHECK_ZERO(uv[i].y);
+	}
+}
+
+} // anonymous namespace
+
+// clears the velocity sources, adds up the squared speeds into _avgSpeed and zeroes velocities (and curls) too small to matter
+void ciMsaFluidSolver::fadeUV() {
+	_avgSpeed = 0;
+	for (int i = _numCells-1; i >=0; --i) {
+		// clear old values
+		uOld[i] = vOld[i] = 0;
+		
+		// calc avg speed
+		_avgSpeed += u[i] * u[i] + v[i] * v[i];
+		
+		CHECK_ZERO(u[i]);
+		CHECK_ZERO(v[i]);
 		if(doVorticityConfinement) CHECK_ZERO(curl[i]);
 	}
+}
+
+void ciMsaFluidSolver::fadeR() {
+	// I want the fluid to gradually fade out so the screen doesn't fill. the amount it fades out depends on how full it is, and how uniform (i.e. boring) the fluid is...
+	//		float holdAmount = 1 - _avgDensity * _avgDensity * fadeSpeed;	// this is how fast the density will decay depending on how full the screen currently is
+	float holdAmount = 1 - fadeSpeed;
+	
+	fadeUV();
+	memset( rOld, 0, _numCells * sizeof(float) );
+	
+	_avgDensity = 0;
+	float totalDeviations = 0;
+	fadeCellsR( r, 0, _numCells - 1, holdAmount, _avgDensity, totalDeviations );
 	_avgDensity *= _invNumCells;
-	_avgSpeed *= _invNumCells;
+	//	_avgSpeed *= _invNumCells;
 	
-	//println("%.3f\n", _avgDensity);
 	_uniformity = 1.0f / (1 + totalDeviations * _invNumCells);		// 0: very wide distribution, 1: very uniform
 }
 
 
-void ciMsaFluidSolver::addSourceUV()
-{
-	for (int i = _numCells-1; i >=0; --i)
-	{
-		uv[i].x += _dt * uvOld[i].x;
-		uv[i].y += _dt * uvOld[i].y;
-	}
+void ciMsaFluidSolver::fadeRGB() {
+	// I want the fluid to gradually fade out so the screen doesn't fill. the amount it fades out depends on how full it is, and how uniform (i.e. boring) the fluid is...
+	//		float holdAmount = 1 - _avgDensity * _avgDensity * fadeSpeed;	// this is how fast the density will decay depending on how full the screen currently is
+	float holdAmount = 1 - fadeSpeed;
+	
+	fadeUV();
+	memset( rOld, 0, _numCells * sizeof(float) );
+	memset( gOld, 0, _numCells * sizeof(float) );
+	memset( bOld, 0, _numCells * sizeof(float) );
+	
+	_avgDensity = 0;
+	float totalDeviations = 0;
+	fadeCellsRGB( r, g, b, 0, _numCells - 1, holdAmount, _avgDensity, totalDeviations );
+	_avgDensity *= _invNumCells;
+	_avgSpeed *= _invNumCells;
+	
+	_uniformity = 1.0f / (1 + totalDeviations * _invNumCells);		// 0: very wide distribution, 1: very uniform
 }
 
-void ciMsaFluidSolver::addSourceRGB()
-{
-	for (int i = _numCells-1; i >=0; --i)
-	{
-		r[i] += _dt * rOld[i];
-		g[i] += _dt * gOld[i];
-		b[i] += _dt * bOld[i];		
+// advect(0, r, rOld, du, dv) followed by fadeR() in one pass over the colour. Rows are faded as soon as they have been
+// advected and had their boundary set, from the last cell to the first as fadeR() does, so the boundary row on top is
+// advected first and the corners are worked out from cells before they are faded. The MacCormack correction needs all
+// of the colour advected before it, so with it on the two are done one after the other
+void ciMsaFluidSolver::advectFadeR(const float* du, const float* dv) {
+	if( doMacCormack ) {
+		advect( 0, r, rOld, du, dv );
+		fadeR();
+		return;
 	}
-}
-
-void ciMsaFluidSolver::addSource(float* x, float* x0) {
-	for (int i = _numCells-1; i >=0; --i)
+	
+	const float holdAmount = 1 - fadeSpeed;
+	const AdvectBand band = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { r }, { rOld }, 1 };
+	const int chunkRows = advectFadeChunkRows( _NX );
+	
+	_avgDensity = 0;
+	float totalDeviations = 0;
+	float left1 = 0, right1 = 0;
+	for (int top = _NY; top > 0; top -= chunkRows)
 	{
-		x[i] += _dt * x0[i];
+		const int bottom = std::max( 1, top - chunkRows + 1 );
+		ci::ip::parallelRows( bottom, top + 1, _NX, band );
+		for (int j = top; j >= bottom; --j)
+		{
+			r[FLUID_IX(0, j)] = r[FLUID_IX(wrap_x ? _NX : 1, j)];
+			r[FLUID_IX(_NX+1, j)] = r[FLUID_IX(wrap_x ? 1 : _NX, j)];
+			if( j == _NY ) {
+				band.advectRow( wrap_y ? 1 : _NY, _NY+1 );
+				r[FLUID_IX(  0, _NY+1)] = 0.5f * (r[FLUID_IX(1, _NY+1)] + r[FLUID_IX(  0, _NY)]);
+				r[FLUID_IX(_NX+1, _NY+1)] = 0.5f * (r[FLUID_IX(_NX, _NY+1)] + r[FLUID_IX(_NX+1, _NY)]);
+				fadeCellsR( r, FLUID_IX(0, _NY+1), FLUID_IX(_NX+1, _NY+1), holdAmount, _avgDensity, totalDeviations );
+			}
+			if( j == 1 ) {
+				left1 = r[FLUID_IX(0, 1)];
+				right1 = r[FLUID_IX(_NX+1, 1)];
+			}
+			fadeCellsR( r, FLUID_IX(0, j), FLUID_IX(_NX+1, j), holdAmount, _avgDensity, totalDeviations );
+		}
 	}
+	band.advectRow( wrap_y ? _NY : 1, 0 );
+	r[FLUID_IX(  0,   0)] = 0.5f * (r[FLUID_IX(1, 0  )] + left1);
+	r[FLUID_IX(_NX+1,   0)] = 0.5f * (r[FLUID_IX(_NX, 0  )] + right1);
+	fadeCellsR( r, FLUID_IX(0, 0), FLUID_IX(_NX+1, 0), holdAmount, _avgDensity, totalDeviations );
+	_avgDensity *= _invNumCells;
+	
+	fadeUV();
+	memset( rOld, 0, _numCells * sizeof(float) );
+	
+	_uniformity = 1.0f / (1 + totalDeviations * _invNumCells);
 }
 
-void ciMsaFluidSolver::advect( int bound, float* d, const float* d0, const ci::Vec2f* duv) {
-	int i0, j0, i1, j1;
-	float x, y, s0, t0, s1, t1;
-	int	index;
+// advectRGB(0, du, dv) followed by fadeRGB() in one pass over the colour, the same way as advectFadeR().
+// setBoundaryRGB() leaves the corners alone, so they are only faded
+void ciMsaFluidSolver::advectFadeRGB(const float* du, const float* dv) {
+	if( doMacCormack ) {
+		advectRGB( 0, du, dv );
+		fadeRGB();
+		return;
+	}
 	
-	const float dt0x = _dt * _NX;
-	const float dt0y = _dt * _NY;
+	const float holdAmount = 1 - fadeSpeed;
+	const AdvectBand band = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { r, g, b }, { rOld, gOld, bOld }, 3 };
+	const int chunkRows = advectFadeChunkRows( _NX );
 	
-	for (int j = _NY; j > 0; --j)
+	_avgDensity = 0;
+	float totalDeviations = 0;
+	band.advectRow( wrap_y ? 1 : _NY, _NY+1 );
+	fadeCellsRGB( r, g, b, FLUID_IX(0, _NY+1), FLUID_IX(_NX+1, _NY+1), holdAmount, _avgDensity, totalDeviations );
+	for (int top = _NY; top > 0; top -= chunkRows)
 	{
-		for (int i = _NX; i > 0; --i)
+		const int bottom = std::max( 1, top - chunkRows + 1 );
+		ci::ip::parallelRows( bottom, top + 1, _NX, band );
+		for (int j = top; j >= bottom; --j)
 		{
-			index = FLUID_IX(i, j);
-			x = i - dt0x * duv[index].x;
-			y = j - dt0y * duv[index].y;
-			
-			if (x > _NX + 0.5) x = _NX + 0.5f;
-			if (x < 0.5)     x = 0.5f;
-			
-			i0 = (int) x;
-			i1 = i0 + 1;
-			
-			if (y > _NY + 0.5) y = _NY + 0.5f;
-			if (y < 0.5)     y = 0.5f;
-			
-			j0 = (int) y;
-			j1 = j0 + 1;
-			
-			s1 = x - i0;
-			s0 = 1 - s1;
-			t1 = y - j0;
-			t0 = 1 - t1;
-			
-			d[index] = s0 * (t0 * d0[FLUID_IX(i0, j0)] + t1 * d0[FLUID_IX(i0, j1)])
-						+ s1 * (t0 * d0[FLUID_IX(i1, j0)] + t1 * d0[FLUID_IX(i1, j1)]);
-			
+			const int left = FLUID_IX(0, j), leftSrc = FLUID_IX(wrap_x ? _NX : 1, j);
+			const int right = FLUID_IX(_NX+1, j), rightSrc = FLUID_IX(wrap_x ? 1 : _NX, j);
+			r[left] = r[leftSrc];	g[left] = g[leftSrc];	b[left] = b[leftSrc];
+			r[right] = r[rightSrc];	g[right] = g[rightSrc];	b[right] = b[rightSrc];
+			fadeCellsRGB( r, g, b, left, right, holdAmount, _avgDensity, totalDeviations );
 		}
 	}
+	band.advectRow( wrap_y ? _NY : 1, 0 );
+	fadeCellsRGB( r, g, b, FLUID_IX(0, 0), FLUID_IX(_NX+1, 0), holdAmount, _avgDensity, totalDeviations );
+	_avgDensity *= _invNumCells;
+	
+	fadeUV();
+	memset( rOld, 0, _numCells * sizeof(float) );
+	memset( gOld, 0, _numCells * sizeof(float) );
+	memset( bOld, 0, _numCells * sizeof(float) );
+	_avgSpeed *= _invNumCells;
+	
+	_uniformity = 1.0f / (1 + totalDeviations * _invNumCells);
+}
+
+
+void ciMsaFluidSolver::addSourceUV()
+{
+	AddSourceBand band = { { u, v }, { uOld, vOld }, 2, _NX + 2, _dt };
+	ci::ip::parallelRows( 0, _NY + 2, _NX + 2, band );
+}
+
+void ciMsaFluidSolver::addSourceRGB()
+{
+	AddSourceBand band = { { r, g, b }, { rOld, gOld, bOld }, 3, _NX + 2, _dt };
+	ci::ip::parallelRows( 0, _NY + 2, _NX + 2, band );
+}
+
+void ciMsaFluidSolver::addSource(float* x, float* x0) {
+	AddSourceBand band = { { x }, { x0 }, 1, _NX + 2, _dt };
+	ci::ip::parallelRows( 0, _NY + 2, _NX + 2, band );
+}
+
+void ciMsaFluidSolver::advect( int bound, float* d, const float* d0, const float* du, const float* dv) {
+	const AdvectBand band = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { d }, { d0 }, 1 };
+	ci::ip::parallelRows( 1, _NY + 1, _NX, band );
 	setBoundary(bound, d);
+	
+	if( doMacCormack ) {
+		macCormackCorrect( band.d, band.d0, band.numFields, du, dv );
+		setBoundary(bound, d);
+	}
 }
 
 //          d    d0    du    dv
 // advect(1, u, uOld, uOld, vOld);
 // advect(2, v, vOld, uOld, vOld);
-void ciMsaFluidSolver::advect2d( ci::Vec2f *uv, const ci::Vec2f *duv ) {
-	int i0, j0, i1, j1;
-	float s0, t0, s1, t1;
-	int	index;
+void ciMsaFluidSolver::advect2d( float *x, float *y, const float *du, const float *dv ) {
+	const AdvectBand band = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { x, y }, { du, dv }, 2 };
+	ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+	setBoundary2d(1, x, y);
+	setBoundary2d(2, x, y);	
 	
-	const float dt0x = _dt * _NX;
-	const float dt0y = _dt * _NY;
-	
-	for (int j = _NY; j > 0; --j)
-	{
-		for (int i = _NX; i > 0; --i)
-		{
-			index = FLUID_IX(i, j);
-			float x = i - dt0x * duv[index].x;
-			float y = j - dt0y * duv[index].y;
-			
-			if (x > _NX + 0.5) x = _NX + 0.5f;
-			if (x < 0.5)     x = 0.5f;
-			
-			i0 = (int) x;
-			i1 = i0 + 1;
-			
-			if (y > _NY + 0.5) y = _NY + 0.5f;
-			if (y < 0.5)     y = 0.5f;
-			
-			j0 = (int) y;
-			j1 = j0 + 1;
-			
-			s1 = x - i0;
-			s0 = 1 - s1;
-			t1 = y - j0;
-			t0 = 1 - t1;
-			
-			uv[index].x = s0 * (t0 * duv[FLUID_IX(i0, j0)].x + t1 * duv[FLUID_IX(i0, j1)].x)
-						+ s1 * (t0 * duv[FLUID_IX(i1, j0)].x + t1 * duv[FLUID_IX(i1, j1)].x);
-			uv[index].y = s0 * (t0 * duv[FLUID_IX(i0, j0)].y + t1 * duv[FLUID_IX(i0, j1)].y)
-						+ s1 * (t0 * duv[FLUID_IX(i1, j0)].y + t1 * duv[FLUID_IX(i1, j1)].y);
-			
-		}
+	if( doMacCormack ) {
+		macCormackCorrect( band.d, band.d0, band.numFields, du, dv );
+		setBoundary2d(1, x, y);
+		setBoundary2d(2, x, y);
 	}
-	setBoundary2d(1, uv);
-	setBoundary2d(2, uv);	
 }
 
-void ciMsaFluidSolver::advectRGB(int bound, const ci::Vec2f* duv) {
-	int i0, j0;
-	float x, y, s0, t0, s1, t1, dt0x, dt0y;
-	int	index;
+void ciMsaFluidSolver::advectRGB(int bound, const float* du, const float* dv) {
+	const AdvectBand band = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { r, g, b }, { rOld, gOld, bOld }, 3 };
+	ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+	setBoundaryRGB();
 	
-	dt0x = _dt * _NX;
-	dt0y = _dt * _NY;
+	if( doMacCormack ) {
+		macCormackCorrect( band.d, band.d0, band.numFields, du, dv );
+		setBoundaryRGB();
+	}
+}
+
+// d has just been advected forward from d0 and had its boundary set. It is advected back to where it started - the same
+// backtrace with the velocity reversed - into planes of its own, and corrected by MacCormackBand
+void ciMsaFluidSolver::macCormackCorrect( float *const d[3], const float *const d0[3], int numFields, const float *du, const float *dv )
+{
+	macCormackPlanes.resize( numFields * _numCells );
+	AdvectBand back = { { du, dv, _NX, _NY, -_dt * _NX, -_dt * _NY }, { NULL }, { NULL }, numFields };
+	for( int field = 0; field < numFields; ++field ) {
+		back.d[field] = &macCormackPlanes[field * _numCells];
+		back.d0[field] = d[field];
+	}
+	ci::ip::parallelRows( 1, _NY + 1, _NX, back );
 	
-	for (int j = _NY; j > 0; --j)
-	{
-		for (int i = _NX; i > 0; --i)
-		{
-			index = FLUID_IX(i, j);
-			x = i - dt0x * duv[index].x;
-			y = j - dt0y * duv[index].y;
-			
-			if (x > _NX + 0.5) x = _NX + 0.5f;
-			if (x < 0.5)     x = 0.5f;
-			
-			i0 = (int) x;
-			
-			if (y > _NY + 0.5) y = _NY + 0.5f;
-			if (y < 0.5)     y = 0.5f;
-			
-			j0 = (int) y;
-			
-			s1 = x - i0;
-			s0 = 1 - s1;
-			t1 = y - j0;
-			t0 = 1 - t1;
-			
-			i0 = FLUID_IX(i0, j0);	//we don't need col/row index any more but index in 1 dimension
-			j0 = i0 + (_NX + 2);
-			r[index] = s0 * ( t0 * rOld[i0] + t1 * rOld[j0] ) + s1 * ( t0 * rOld[i0+1] + t1 * rOld[j0+1] );
-			g[index] = s0 * ( t0 * gOld[i0] + t1 * gOld[j0] ) + s1 * ( t0 * gOld[i0+1] + t1 * gOld[j0+1] );                  
-			b[index] = s0 * ( t0 * bOld[i0] + t1 * bOld[j0] ) + s1 * ( t0 * bOld[i0+1] + t1 * bOld[j0+1] );                          
-		}
+	MacCormackBand correct = { { du, dv, _NX, _NY, _dt * _NX, _dt * _NY }, { NULL }, { NULL }, { NULL }, numFields };
+	for( int field = 0; field < numFields; ++field ) {
+		correct.d[field] = d[field];
+		correct.d0[field] = d0[field];
+		correct.dBack[field] = back.d[field];
 	}
-	setBoundaryRGB();
+	ci::ip::parallelRows( 1, _NY + 1, _NX, correct );
 }
 
 void ciMsaFluidSolver::diffuse( int bound, float* c, float* c0, float diff )
@@ -633,28 +1159,36 @@ void ciMsaFluidSolver::diffuseUV( float diff )
 	linearSolverUV( a, 1.0 + 4 * a );
 }
 
-void ciMsaFluidSolver::project(ci::Vec2f* xy, ci::Vec2f* pDiv) 
+void ciMsaFluidSolver::project(float* x, float* y, float* p, float* q) 
 {
-	float	h;
+	float	hx, hy;
 	int		index;
 	int		step_x = _NX + 2;
 	
-	h = - 0.5f / _NX;
+	// scaled like the velocity corrections below, or on a grid of fewer columns than rows they over-correct v and a solve that
+	// converges far enough (multigrid) makes the fluid blow up
+	hx = - 0.5f / _NX;
+	hy = - 0.5f / _NY;
 	for (int j = _NY; j > 0; --j)
 	{
 		index = FLUID_IX(_NX, j);
 		for (int i = _NX; i > 0; --i)
 		{
-			pDiv[index].x = h * ( xy[index+1].x - xy[index-1].x + xy[index+step_x].y - xy[index-step_x].y );
-			pDiv[index].y = 0;
+			p[index] = hx * ( x[index+1] - x[index-1] ) + hy * ( y[index+step_x] - y[index-step_x] );
 			--index;
 		}
 	}
 	
-	setBoundary02d( reinterpret_cast<ci::Vec2f*>( &pDiv[0].x ));
-	setBoundary02d( reinterpret_cast<ci::Vec2f*>( &pDiv[0].y ));
+	setBoundary( 0, p );
 	
-	linearSolverProject( pDiv );
+	// setBoundary2d() never writes the side columns of y, after swapUV() these are the ones the velocity gets
+	for (int j = _NY; j > 0; --j)
+		q[FLUID_IX(0, j)] = q[FLUID_IX(_NX+1, j)] = 0;
+	
+	if( doMultigrid )
+		multigridProject( p );
+	else
+		linearSolverProject( p );
 	
 	float fx = 0.5f * _NX;
 	float fy = 0.5f * _NY;	//maa	change it from _NX to _NY
@@ -663,14 +1197,14 @@ void ciMsaFluidSolver::project(ci::Vec2f* xy, ci::Vec2f* pDiv)
 		index = FLUID_IX(_NX, j);
 		for (int i = _NX; i > 0; --i)
 		{
-			xy[index].x -= fx * (pDiv[index+1].x - pDiv[index-1].x);
-			xy[index].y -= fy * (pDiv[index+step_x].x - pDiv[index-step_x].x);
+			x[index] -= fx * (p[index+1] - p[index-1]);
+			y[index] -= fy * (p[index+step_x] - p[index-step_x]);
 			--index;
 		}
 	}
 	
-	setBoundary2d(1, xy);
-	setBoundary2d(2, xy);
+	setBoundary2d(1, x, y);
+	setBoundary2d(2, x, y);
 }
 
 
@@ -680,6 +1214,17 @@ void ciMsaFluidSolver::linearSolver( int bound, float* __restrict x, const float
 	int	step_x = _NX + 2;
 	int index;
 	c = 1. / c;
+	if( doRedBlack )
+	{
+		RedBlackBand band = { { x }, { x0 }, 1, step_x, _NX, 0, a, c };
+		for (int k = solverIterations; k > 0; --k)
+		{
+			for( band.colour = 0; band.colour < 2; ++band.colour )
+				ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+			setBoundary( bound, x );
+		}
+		return;
+	}
 	for (int k = solverIterations; k > 0; --k)	// MEMO 
 	{
 		for (int j = _NY; j > 0 ; --j)
@@ -695,22 +1240,32 @@ void ciMsaFluidSolver::linearSolver( int bound, float* __restrict x, const float
 	}
 }
 
-void ciMsaFluidSolver::linearSolverProject( ci::Vec2f* __restrict pdiv )
+void ciMsaFluidSolver::linearSolverProject( float* __restrict p )
 {
 	int	step_x = _NX + 2;
 	int index;
+	if( doRedBlack )
+	{
+		RedBlackBand band = { { p }, { NULL }, 1, step_x, _NX, 0, 1.0f, .25f };
+		for (int k = solverIterations; k > 0; --k) {
+			for( band.colour = 0; band.colour < 2; ++band.colour )
+				ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+			setBoundary( 0, p );
+		}
+		return;
+	}
 	for (int k = solverIterations; k > 0; --k) {
 		for (int j = _NY; j > 0 ; --j) {
 			index = FLUID_IX(_NX, j );
-			float prev = pdiv[index+1].x;
+			float prev = p[index+1];
 			for (int i = _NX; i > 0 ; --i)
 			{
-				prev = ( pdiv[index-1].x + prev + pdiv[index - step_x].x + pdiv[index + step_x].x + pdiv[index].y ) * .25;
-				pdiv[index].x = prev;
+				prev = ( p[index-1] + prev + p[index - step_x] + p[index + step_x] ) * .25;
+				p[index] = prev;
 				--index;				
 			}
 		}
-		setBoundary02d( reinterpret_cast<ci::Vec2f*>( &pdiv[0].x ) );
+		setBoundary( 0, p );
 	}
 }
 
@@ -719,6 +1274,17 @@ void ciMsaFluidSolver::linearSolverRGB( float a, float c )
 	int index3, index4, index;
 	int	step_x = _NX + 2;
 	c = 1. / c;
+	if( doRedBlack )
+	{
+		RedBlackBand band = { { r, g, b }, { rOld, gOld, bOld }, 3, step_x, _NX, 0, a, c };
+		for ( int k = solverIterations; k > 0; --k )
+		{
+			for( band.colour = 0; band.colour < 2; ++band.colour )
+				ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+			setBoundaryRGB();
+		}
+		return;
+	}
 	for ( int k = solverIterations; k > 0; --k )	// MEMO
 	{           
 		for (int j = _NY; j > 0 ; --j)
@@ -748,27 +1314,157 @@ void ciMsaFluidSolver::linearSolverUV( float a, float c )
 	int index;
 	int	step_x = _NX + 2;
 	c = 1. / c;
-	ci::Vec2f* __restrict localUV = uv;
-	const ci::Vec2f* __restrict localOldUV = uvOld;
-
+	float* __restrict localU = u;
+	float* __restrict localV = v;
+	const float* __restrict localOldU = uOld;
+	const float* __restrict localOldV = vOld;
+	if( doRedBlack )
+	{
+		RedBlackBand band = { { u, v }, { uOld, vOld }, 2, step_x, _NX, 0, a, c };
+		for (int k = solverIterations; k > 0; --k)
+		{
+			for( band.colour = 0; band.colour < 2; ++band.colour )
+				ci::ip::parallelRows( 1, _NY + 1, _NX, band );
+			setBoundary2d( 1, u, v );
+		}
+		return;
+	}
 	for (int k = solverIterations; k > 0; --k)	// MEMO
 	{           
 		for (int j = _NY; j > 0 ; --j)
 		{
 			index = FLUID_IX(_NX, j );
-			float prevU = localUV[index+1].x;
-			float prevV = localUV[index+1].y;
+			float prevU = localU[index+1];
+			float prevV = localV[index+1];
 			for (int i = _NX; i > 0 ; --i)
 			{
-				prevU = ( ( localUV[index-1].x + prevU + localUV[index - step_x].x + localUV[index + step_x].x ) * a  + localOldUV[index].x ) * c;
-				prevV = ( ( localUV[index-1].y + prevV + localUV[index - step_x].y + localUV[index + step_x].y ) * a  + localOldUV[index].y ) * c;
-				localUV[index].x = prevU;
-				localUV[index].y = prevV;
+				prevU = ( ( localU[index-1] + prevU + localU[index - step_x] + localU[index + step_x] ) * a  + localOldU[index] ) * c;
+				prevV = ( ( localV[index-1] + prevV + localV[index - step_x] + localV[index + step_x] ) * a  + localOldV[index] ) * c;
+				localU[index] = prevU;
+				localV[index] = prevV;
 				--index;
 			}
 		}
-		setBoundary2d( 1, uv );
+		setBoundary2d( 1, u, v );
+	}
+}
+
+// Solves 4 * p - ( left + right + up + down ) = div for the pressure p, with the divergence project() leaves in p,
+// and stores the pressure in p. Each V-cycle smooths the error on the fluid grid, solves for what is left of it on grids of half the
+// size down to a few cells across and interpolates that back, so a couple of cycles reduce the error far more than the same
+// work spent in relaxation sweeps.
+void ciMsaFluidSolver::multigridProject( float *p )
+{
+	if( multigridLevels.empty() || multigridLevels[0].nx != _NX || multigridLevels[0].ny != _NY ) {
+		multigridLevels.clear();
+		int nx = _NX, ny = _NY;
+		while( true ) {
+			MultigridLevel level;
+			level.nx = nx;
+			level.ny = ny;
+			level.p.resize( ( nx + 2 ) * ( ny + 2 ) );
+			level.f.resize( ( nx + 2 ) * ( ny + 2 ) );
+			level.r.resize( ( nx + 2 ) * ( ny + 2 ) );
+			if( multigridLevels.empty() ) {
+				level.wx.assign( nx + 2, 1.0f );
+				level.wy.assign( ny + 2, 1.0f );
+			}
+			else {
+				level.wx = coarsenWidths( multigridLevels.back().wx, nx );
+				level.wy = coarsenWidths( multigridLevels.back().wy, ny );
+			}
+			level.uniform = std::count( level.wx.begin(), level.wx.end(), 1.0f ) == nx + 2
+							&& std::count( level.wy.begin(), level.wy.end(), 1.0f ) == ny + 2;
+			multigridLevels.push_back( level );
+			if( std::min( nx, ny ) <= MULTIGRID_COARSEST_SIZE )
+				break;
+			nx = ( nx + 1 ) / 2;
+			ny = ( ny + 1 ) / 2;
+		}
+	}
+	
+	for( size_t l = 1; l < multigridLevels.size(); ++l ) {
+		setGhostWidths( multigridLevels[l].wx, wrap_x );
+		setGhostWidths( multigridLevels[l].wy, wrap_y );
+	}
+	
+	MultigridLevel &fine = multigridLevels[0];
+	for (int i = _numCells-1; i >=0; --i) {
+		fine.f[i] = p[i];
+		fine.p[i] = 0;
+	}
+	
+	for (int k = multigridCycles; k > 0; --k)
+		multigridVCycle( 0 );
+	
+	for (int i = _numCells-1; i >=0; --i)
+		p[i] = fine.p[i];
+}
+
+void ciMsaFluidSolver::multigridVCycle( int l )
+{
+	MultigridLevel &level = multigridLevels[l];
+	if( l + 1 == (int)multigridLevels.size() ) {
+		const int longestSide = std::max( level.nx, level.ny );
+		for (int k = std::max( MULTIGRID_COARSEST_SWEEPS, longestSide * longestSide ); k > 0; --k)
+			multigridRelax( level );
+		return;
 	}
+	
+	for (int k = MULTIGRID_SMOOTHING_SWEEPS; k > 0; --k)
+		multigridRelax( level );
+	
+	MultigridLevel &coarse = multigridLevels[l + 1];
+	ResidualBand residual = { &level.p[0], &level.f[0], &level.r[0], level.nx, level.uniform ? NULL : &level.wx[0], &level.wy[0] };
+	ci::ip::parallelRows( 1, level.ny + 1, level.nx, residual );
+	RestrictBand restriction = { &level.r[0], &coarse.f[0], level.nx, level.ny, coarse.nx };
+	ci::ip::parallelRows( 1, coarse.ny + 1, coarse.nx, restriction );
+	std::fill( coarse.p.begin(), coarse.p.end(), 0.0f );
+	
+	multigridVCycle( l + 1 );
+	
+	ProlongBand prolongation = { &coarse.p[0], &level.p[0], level.nx, coarse.nx, &level.wx[0], &level.wy[0], &coarse.wx[0], &coarse.wy[0] };
+	ci::ip::parallelRows( 1, level.ny + 1, level.nx, prolongation );
+	setBoundaryLevel( &level.p[0], level.nx, level.ny );
+	
+	for (int k = MULTIGRID_SMOOTHING_SWEEPS; k > 0; --k)
+		multigridRelax( level );
+}
+
+// one red-black Gauss-Seidel sweep of p = ( left + right + up + down + f ) * .25, weighted by neighbourSum() on a level with short cells
+void ciMsaFluidSolver::multigridRelax( MultigridLevel &level )
+{
+	if( level.uniform ) {
+		RedBlackBand band = { { &level.p[0] }, { &level.f[0] }, 1, level.nx + 2, level.nx, 0, 1.0f, .25f };
+		for( band.colour = 0; band.colour < 2; ++band.colour )
+			ci::ip::parallelRows( 1, level.ny + 1, level.nx, band );
+	}
+	else {
+		ShortCellRelaxBand band = { &level.p[0], &level.f[0], &level.wx[0], &level.wy[0], level.nx, 0 };
+		for( band.colour = 0; band.colour < 2; ++band.colour )
+			ci::ip::parallelRows( 1, level.ny + 1, level.nx, band );
+	}
+	setBoundaryLevel( &level.p[0], level.nx, level.ny );
+}
+
+// setBoundary( 0, x ) for a grid of nx * ny cells
+void ciMsaFluidSolver::setBoundaryLevel( float *x, int nx, int ny )
+{
+	const int step = nx + 2;
+	for (int j = ny; j > 0; --j )
+	{
+		x[j * step] = x[j * step + ( wrap_x ? nx : 1 )];
+		x[j * step + nx + 1] = x[j * step + ( wrap_x ? 1 : nx )];
+	}
+	for (int i = nx; i > 0; --i )
+	{
+		x[i] = x[i + ( wrap_y ? ny : 1 ) * step];
+		x[i + ( ny + 1 ) * step] = x[i + ( wrap_y ? 1 : ny ) * step];
+	}
+	x[0] = 0.5f * ( x[1] + x[step] );
+	x[( ny + 1 ) * step] = 0.5f * ( x[( ny + 1 ) * step + 1] + x[ny * step] );
+	x[nx + 1] = 0.5f * ( x[nx] + x[step + nx + 1] );
+	x[( ny + 1 ) * step + nx + 1] = 0.5f * ( x[( ny + 1 ) * step + nx] + x[ny * step + nx + 1] );
 }
 
 // specifies simple boundry conditions.
@@ -821,46 +1517,10 @@ void ciMsaFluidSolver::setBoundary(int bound, float* x)
 	x[FLUID_IX(_NX+1, _NY+1)] = 0.5f * (x[FLUID_IX(_NX, _NY+1)] + x[FLUID_IX(_NX+1, _NY)]);
 }
 
-void ciMsaFluidSolver::setBoundary02d(ci::Vec2f* x)
+void ciMsaFluidSolver::setBoundary2d( int bound, float *x, float *y )
 {
 	int dst1, dst2, src1, src2;
 	int step = FLUID_IX(0, 1) - FLUID_IX(0, 0);
-
-	dst1 = FLUID_IX(0, 1);
-	src1 = FLUID_IX(1, 1);
-	dst2 = FLUID_IX(_NX+1, 1 );
-	src2 = FLUID_IX(_NX, 1);
-	if( wrap_x )
-		SWAP( src1, src2 );
-	for (int i = _NY; i > 0; --i )
-	{
-		x[dst1].x = x[src1].x;	dst1 += step;	src1 += step;	
-		x[dst2].x = x[src2].x;	dst2 += step;	src2 += step;	
-	}
-
-	dst1 = FLUID_IX(1, 0);
-	src1 = FLUID_IX(1, 1);
-	dst2 = FLUID_IX(1, _NY+1);
-	src2 = FLUID_IX(1, _NY);
-	if( wrap_y )
-		SWAP( src1, src2 );
-	for (int i = _NX; i > 0; --i )
-	{
-		x[dst1++] = x[src1++];
-		x[dst2++] = x[src2++];	
-	}
-	
-	x[FLUID_IX(  0,   0)].x = 0.5f * (x[FLUID_IX(1, 0  )].x + x[FLUID_IX(  0, 1)].x);
-	x[FLUID_IX(  0, _NY+1)].x = 0.5f * (x[FLUID_IX(1, _NY+1)].x + x[FLUID_IX(  0, _NY)].x);
-	x[FLUID_IX(_NX+1,   0)].x = 0.5f * (x[FLUID_IX(_NX, 0  )].x + x[FLUID_IX(_NX+1, 1)].x);
-	x[FLUID_IX(_NX+1, _NY+1)].x = 0.5f * (x[FLUID_IX(_NX, _NY+1)].x + x[FLUID_IX(_NX+1, _NY)].x);
-}
-
-void ciMsaFluidSolver::setBoundary2d( int bound, ci::Vec2f *xy )
-{
-	int dst1, dst2, src1, src2;
-	int step = FLUID_IX(0, 1) - FLUID_IX(0, 0);
-
 	dst1 = FLUID_IX(0, 1);
 	src1 = FLUID_IX(1, 1);
 	dst2 = FLUID_IX(_NX+1, 1 );
@@ -870,16 +1530,15 @@ void ciMsaFluidSolver::setBoundary2d( int bound, ci::Vec2f *xy )
 	if( bound == 1 && !wrap_x )
 		for (int i = _NY; i > 0; --i )
 		{
-			xy[dst1].x = -xy[src1].x;	dst1 += step;	src1 += step;	
-			xy[dst2].x = -xy[src2].x;	dst2 += step;	src2 += step;	
+			x[dst1] = -x[src1];	dst1 += step;	src1 += step;	
+			x[dst2] = -x[src2];	dst2 += step;	src2 += step;	
 		}
 	else
 		for (int i = _NY; i > 0; --i )
 		{
-			xy[dst1].x = xy[src1].x;	dst1 += step;	src1 += step;	
-			xy[dst2].x = xy[src2].x;	dst2 += step;	src2 += step;	
+			x[dst1] = x[src1];	dst1 += step;	src1 += step;	
+			x[dst2] = x[src2];	dst2 += step;	src2 += step;	
 		}
-
 	dst1 = FLUID_IX(1, 0);
 	src1 = FLUID_IX(1, 1);
 	dst2 = FLUID_IX(1, _NY+1);
@@ -889,20 +1548,21 @@ void ciMsaFluidSolver::setBoundary2d( int bound, ci::Vec2f *xy )
 	if( bound == 2 && !wrap_y )
 		for (int i = _NX; i > 0; --i )
 		{
-			xy[dst1++].y = -xy[src1++].y;	
-			xy[dst2++].y = -xy[src2++].y;	
+			y[dst1++] = -y[src1++];	
+			y[dst2++] = -y[src2++];	
 		}
 	else
 		for (int i = _NX; i > 0; --i )
 		{
-			xy[dst1++].y = xy[src1++].y;
-			xy[dst2++].y = xy[src2++].y;	
+			y[dst1++] = y[src1++];
+			y[dst2++] = y[src2++];	
 		}
 	
-	xy[FLUID_IX(  0,   0)][bound-1] = 0.5f * (xy[FLUID_IX(1, 0  )][bound-1] + xy[FLUID_IX(  0, 1)][bound-1]);
-	xy[FLUID_IX(  0, _NY+1)][bound-1] = 0.5f * (xy[FLUID_IX(1, _NY+1)][bound-1] + xy[FLUID_IX(  0, _NY)][bound-1]);
-	xy[FLUID_IX(_NX+1,   0)][bound-1] = 0.5f * (xy[FLUID_IX(_NX, 0  )][bound-1] + xy[FLUID_IX(_NX+1, 1)][bound-1]);
-	xy[FLUID_IX(_NX+1, _NY+1)][bound-1] = 0.5f * (xy[FLUID_IX(_NX, _NY+1)][bound-1] + xy[FLUID_IX(_NX+1, _NY)][bound-1]);
+	float *c = ( bound == 1 ) ? x : y;
+	c[FLUID_IX(  0,   0)] = 0.5f * (c[FLUID_IX(1, 0  )] + c[FLUID_IX(  0, 1)]);
+	c[FLUID_IX(  0, _NY+1)] = 0.5f * (c[FLUID_IX(1, _NY+1)] + c[FLUID_IX(  0, _NY)]);
+	c[FLUID_IX(_NX+1,   0)] = 0.5f * (c[FLUID_IX(_NX, 0  )] + c[FLUID_IX(_NX+1, 1)]);
+	c[FLUID_IX(_NX+1, _NY+1)] = 0.5f * (c[FLUID_IX(_NX, _NY+1)] + c[FLUID_IX(_NX+1, _NY)]);
 }
 
 #define CPY_RGB( d, s )		{	r[d] = r[s];	g[d] = g[s];	b[d] = b[s]; }
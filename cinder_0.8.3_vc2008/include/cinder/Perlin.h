@@ -24,6 +24,7 @@
 
 #include "cinder/Cinder.h"
 #include "cinder/Vector.h"
+#include "cinder/Channel.h"
 
 namespace cinder {
 
@@ -51,6 +52,17 @@ class Perlin
 	Vec3f	dfBm( const Vec3f &v ) const;
 	Vec3f	dfBm( float x, float y, float z ) const { return dfBm( Vec3f( x, y, z ) ); }
 
+	/// Fills \a channel with fBm() of \a offset + ( x, y ) * \a scale for each of its pixels ( x, y ), 4 pixels at a time and spread over threads. Matches calling fBm() per pixel
+	void	fBm( Channel32f *channel, const Vec2f &offset, const Vec2f &scale = Vec2f::one() ) const;
+	/// Fills \a channel with a slice of 3D fBm() through z = \a offset.z, as above
+	void	fBm( Channel32f *channel, const Vec3f &offset, const Vec2f &scale = Vec2f::one() ) const;
+	/// Writes fBm() of each of the \a count \a positions to \a results, 4 positions at a time and spread over threads
+	void	fBm( const Vec2f *positions, size_t count, float *results ) const;
+	void	fBm( const Vec3f *positions, size_t count, float *results ) const;
+	/// Writes dfBm() of each of the \a count \a positions to \a results, 4 positions at a time and spread over threads
+	void	dfBm( const Vec2f *positions, size_t count, Vec2f *results ) const;
+	void	dfBm( const Vec3f *positions, size_t count, Vec3f *results ) const;
+
 	/// Calculates a single octave of noise
 	float	noise( float x ) const;
 	float	noise( float x, float y ) const;
@@ -61,6 +73,18 @@ class Perlin
 	Vec2f	dnoise( float x, float y ) const;
 	Vec3f	dnoise( float x, float y, float z ) const;
 
+	/// Calculates a single octave of simplex noise, roughly -1..1. Uses the same permutation table as noise(), so it changes with the seed the same way
+	float	simplex( float x, float y ) const;
+	float	simplex( float x, float y, float z ) const;
+
+	/// Fractal Brownian motion of 'mOctaves' worth of simplex noise, and its batch versions as for fBm()
+	float	simplexfBm( const Vec2f &v ) const;
+	float	simplexfBm( const Vec3f &v ) const;
+	void	simplexfBm( Channel32f *channel, const Vec2f &offset, const Vec2f &scale = Vec2f::one() ) const;
+	void	simplexfBm( Channel32f *channel, const Vec3f &offset, const Vec2f &scale = Vec2f::one() ) const;
+	void	simplexfBm( const Vec2f *positions, size_t count, float *results ) const;
+	void	simplexfBm( const Vec3f *positions, size_t count, float *results ) const;
+
  private:
 	void	initPermutationTable();
 
@@ -0,0 +1,89 @@
+/*
+ Copyright (c) 2010, The Barbarian Group
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "cinder/Cinder.h"
+
+#if defined( CINDER_MSW ) || defined( CINDER_MAC ) || defined( __SSE2__ )
+	#define CINDER_IP_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace cinder { namespace ip {
+
+//! A piece of work handed to parallelRows(). Processes the rows [\a y1, \a y2) and may be called from several threads at once with disjoint ranges.
+class RowBandTask {
+  public:
+	virtual ~RowBandTask() {}
+	virtual void operator()( int32_t y1, int32_t y2 ) const = 0;
+};
+
+//! Splits the rows [\a y1, \a y2) of an image \a width pixels wide into bands and runs \a task on each of them. Large images are spread over a pool with a thread per core, small ones run on the calling thread. Returns once every band is done.
+void runRowBands( int32_t y1, int32_t y2, int32_t width, const RowBandTask &task );
+
+template<typename FN>
+class RowBandFn : public RowBandTask {
+  public:
+	RowBandFn( const FN &fn ) : mFn( fn ) {}
+	virtual void operator()( int32_t y1, int32_t y2 ) const { mFn( y1, y2 ); }
+
+  private:
+	const FN	&mFn;
+};
+
+//! Runs \a fn( bandY1, bandY2 ) over bands of the rows [\a y1, \a y2) as runRowBands() does. \a fn needs a const operator()( int32_t, int32_t ).
+template<typename FN>
+void parallelRows( int32_t y1, int32_t y2, int32_t width, const FN &fn )
+{
+	runRowBands( y1, y2, width, RowBandFn<FN>( fn ) );
+}
+
+//! Returns the number of threads parallelRows() spreads large images over, including the calling thread.
+int32_t getNumRowBandThreads();
+
+//! Returns whether the SSE2 paths of the ip functions can run on this machine. Always true on x64, checked with System::hasSse2() otherwise.
+bool useSse2();
+
+#if defined( CINDER_IP_SSE2 )
+//! Divides the 16 bit lanes of \a x by 255, rounding down like integer division. Exact for values up to 255 * 255.
+inline __m128i div255_epi16( __m128i x )
+{
+	return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( x, _mm_set1_epi16( 1 ) ), _mm_srli_epi16( x, 8 ) ), 8 );
+}
+
+//! Returns the byte at \a byteOffset of every 32 bit lane of \a x copied into all four bytes of the lane
+inline __m128i broadcastByte_epi32( __m128i x, uint8_t byteOffset )
+{
+	__m128i b = _mm_and_si128( _mm_srl_epi32( x, _mm_cvtsi32_si128( byteOffset * 8 ) ), _mm_set1_epi32( 0xFF ) );
+	b = _mm_or_si128( b, _mm_slli_epi32( b, 8 ) );
+	return _mm_or_si128( b, _mm_slli_epi32( b, 16 ) );
+}
+
+//! Returns \a a where \a mask is set and \a b elsewhere
+inline __m128i select_si128( __m128i mask, __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+#endif
+
+} } // namespace cinder::ip
@@ -49,6 +49,8 @@
 #include "cinder/Vector.h"
 #include "cinder/Color.h"
 
+#include <vector>
+
 // do not change these values, you can override them using the solver methods
 #define		FLUID_DEFAULT_NX					100
 #define		FLUID_DEFAULT_NY					100
@@ -57,6 +59,7 @@
 #define     FLUID_DEFAULT_COLOR_DIFFUSION	0
 #define     FLUID_DEFAULT_FADESPEED         .03
 #define		FLUID_DEFAULT_SOLVER_ITERATIONS		10
+#define		FLUID_DEFAULT_MULTIGRID_CYCLES		2
 
 #define		FLUID_IX(i, j)		((i) + (_NX + 2)  *(j))
 
@@ -90,6 +93,10 @@ public:
 	
 	inline ci::Vec2f getVelocityAtPos( const ci::Vec2f &pos ) const;
 	
+	// the velocity at count normalized positions (x[k], y[k]) into (velX[k], velY[k]), from the same cell getVelocityAtPos() reads.
+	// vectorised, and safe to call from several threads at once
+	void getVelocityAtPositions( const float *x, const float *y, int count, float *velX, float *velY ) const;
+	
 	// get info at fluid cell pixels (i, j) if you know it. range: (0..NX-1), (0..NY-1)
 	inline	void getInfoAtCell(int i, int j, ci::Vec2f *vel, ci::Color *color = NULL) const;
 	
@@ -142,6 +149,22 @@ public:
 	bool getVorticityConfinement();
 	ciMsaFluidSolver& setWrap( bool bx, bool by );
 	
+	// relax in red-black order instead of row by row: the rows of each colour are spread across threads and vectorised.
+	// converges like the default ordering but the results differ slightly
+	ciMsaFluidSolver& enableRedBlack(bool b);
+	bool getRedBlack();
+	
+	// solve the pressure in project() with multigrid V-cycles rather than solverIterations relaxation sweeps.
+	// this solves the pressure equation properly, so the fluid is noticeably less compressible than with the default relaxation
+	ciMsaFluidSolver& enableMultigrid(bool b);
+	bool getMultigrid();
+	ciMsaFluidSolver& setMultigridCycles(int cycles = FLUID_DEFAULT_MULTIGRID_CYCLES);
+	
+	// advect with a MacCormack step: the fields are advected forward, back again, and corrected by half the error of the
+	// round trip. Keeps much more of the detail of the velocity and color at low resolutions, for about three times the cost of advection
+	ciMsaFluidSolver& enableMacCormack(bool b);
+	bool getMacCormack();
+	
 	// returns average density of fluid 
 	float getAvgDensity() const;
 	
@@ -159,13 +182,20 @@ public:
 	float	*g, *gOld;
 	float	*b, *bOld;
 	
-	ci::Vec2f	*uv, *uvOld;
+	float	*u, *uOld;		// the velocity is kept as a plane of x and a plane of y
+	float	*v, *vOld;
 
 	float	*curl;
 	
+	float	*_planes;		// the block all of the fields above are planes of, see reset()
+	
 	bool	doRGB;				// for monochrome, only update r
 	bool	doVorticityConfinement;
+	bool	doRedBlack;
+	bool	doMultigrid;
+	bool	doMacCormack;
 	int		solverIterations;
+	int		multigridCycles;
 	
 	float	colorDiffusion;
 	float	viscocity;
@@ -190,32 +220,50 @@ public:
 	float	_uniformity;			// this will hold the _uniformity of the last frame (how uniform the color is);
 	float	_avgSpeed;
 	
+	// a grid of the multigrid pressure solve, level 0 is the size of the fluid
+	struct MultigridLevel {
+		int					nx, ny;
+		std::vector<float>	p, f, r;	// pressure, right hand side and residual, (nx + 2) * (ny + 2) each
+		std::vector<float>	wx, wy;		// the width of each column and height of each row, ghosts included, in cells of the level
+		bool				uniform;	// no column or row is short, see neighbourSum()
+	};
+	std::vector<MultigridLevel>	multigridLevels;
+	
+	std::vector<float>	macCormackPlanes;		// the fields advected back by macCormackCorrect(), _numCells each
+	
 	void	destroy();
 	
 	inline	float	calcCurl(int i, int j);
-	void	vorticityConfinement(ci::Vec2f *Fvc_xy);
+	void	vorticityConfinement(float *Fvc_x, float *Fvc_y);
 	
 	void	addSource(float *x, float *x0);
 	void	addSourceUV();		// does both U and V in one go
 	void	addSourceRGB();	// does R, G, and B in one go
 	
-	void	advect(int b, float *d, const float *d0, const ci::Vec2f *duv);
-	void	advect2d( ci::Vec2f *uv, const ci::Vec2f *duv );
-	void	advectRGB(int b, const ci::Vec2f *duv);
+	void	advect(int b, float *d, const float *d0, const float *du, const float *dv);
+	void	advect2d( float *x, float *y, const float *du, const float *dv );
+	void	advectRGB(int b, const float *du, const float *dv);
+	void	advectFadeR(const float *du, const float *dv);		// advect() and fadeR() in one pass
+	void	advectFadeRGB(const float *du, const float *dv);	// advectRGB() and fadeRGB() in one pass
+	void	macCormackCorrect( float *const d[3], const float *const d0[3], int numFields, const float *du, const float *dv );
 	
 	void	diffuse(int b, float *c, float *c0, float diff);
 	void	diffuseRGB(int b, float diff);
 	void	diffuseUV(float diff);
 	
-	void	project(ci::Vec2f *xy, ci::Vec2f *pDiv);
+	// p is left holding the pressure, and q zeroed down its side columns
+	void	project(float *x, float *y, float *p, float *q);
 	void	linearSolver(int b, float *x, const float *x0, float a, float c);
-	void	linearSolverProject( ci::Vec2f *pdiv );
+	void	linearSolverProject( float *p );
 	void	linearSolverRGB( float a, float c);
 	void	linearSolverUV(float a, float c);
+	void	multigridProject( float *p );
+	void	multigridVCycle( int level );
+	void	multigridRelax( MultigridLevel &level );
+	void	setBoundaryLevel( float *x, int nx, int ny );
 	
 	void	setBoundary(int b, float *x);
-	void	setBoundary02d(ci::Vec2f* x);
-	void	setBoundary2d(int b, ci::Vec2f *xy );
+	void	setBoundary2d(int b, float *x, float *y );
 	void	setBoundaryRGB();
 	
 	void	swapUV();
@@ -224,6 +272,7 @@ public:
 	void	swapR();
 	void	swapRGB();
 	
+	void	fadeUV();
 	void	fadeR();
 	void	fadeRGB();
 };
@@ -243,7 +292,7 @@ inline int ciMsaFluidSolver::getIndexForNormalizedPosition(float x, float y) con
 
 inline	void ciMsaFluidSolver::getInfoAtCell(int i, ci::Vec2f *vel, ci::Color *color) const {
 	if(vel)
-		vel->set(uv[i].x * _invNX, uv[i].y * _invNY);
+		vel->set(u[i] * _invNX, v[i] * _invNY);
 	if(color)
 	{
 		if(doRGB)
@@ -265,7 +314,7 @@ inline ci::Vec2f ciMsaFluidSolver::getVelocityAtPos( const ci::Vec2f &pos ) cons
 	i = ci::constrain<int>( i, 0, _NX+1 );
 	j = ci::constrain<int>( j, 0, _NY+1 );
 	int o = FLUID_IX( i, j );
-	return ci::Vec2f( uv[o].x, uv[o].y );	
+	return ci::Vec2f( u[o], v[o] );	
 }
 
 inline	void ciMsaFluidSolver::getInfoAtCell(int i, int j, ci::Vec2f *vel, ci::Color *color) const {
@@ -285,8 +334,8 @@ inline void ciMsaFluidSolver::addForceAtPos(const ci::Vec2f &pos, const ci::Vec2
 inline	void ciMsaFluidSolver::addForceAtCell(int i, int j, const ci::Vec2f &force )
 {
 	int index = FLUID_IX(i, j);
-	uv[index].x += force.x;
-	uv[index].y += force.y;
+	u[index] += force.x;
+	v[index] += force.y;
 }
 
 inline void ciMsaFluidSolver::addColorAtCell(int i, int j, float r, float g, float b )
@@ -23,10 +23,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <algorithm>
 
 #include "cinder/Perlin.h"
 #include "cinder/CinderMath.h"
 #include "cinder/Rand.h"
+#include "cinder/ip/Parallel.h"
 
 namespace cinder {
 
@@ -34,6 +36,32 @@ static inline float fade( float t ) { return t * t * t * (t * (t * 6 - 15) + 10)
 static inline float dfade( float t ) { return 30.0f * t * t * ( t * ( t - 2.0f ) + 1.0f ); }
 inline float nlerp(float t, float a, float b) { return a + t * (b - a); }
 
+// the gradients of simplex noise, picked by the permutation table mod 12. 2D noise uses the first two components
+static const float SIMPLEX_GRADS[12][3] = {	{ 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+											{ 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+											{ 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+// skewing and unskewing factors for 2 and 3 dimensions
+static const float SIMPLEX_F2 = 0.366025403f, SIMPLEX_G2 = 0.211324865f;
+static const float SIMPLEX_F3 = 1.0f / 3.0f, SIMPLEX_G3 = 1.0f / 6.0f;
+
+static inline float simplexCorner( float x, float y, const float *g )
+{
+	float t = 0.5f - x * x - y * y;
+	if( t < 0 )
+		return 0;
+	t *= t;
+	return t * t * ( g[0] * x + g[1] * y );
+}
+
+static inline float simplexCorner( float x, float y, float z, const float *g )
+{
+	float t = 0.6f - x * x - y * y - z * z;
+	if( t < 0 )
+		return 0;
+	t *= t;
+	return t * t * ( g[0] * x + g[1] * y + g[2] * z );
+}
+
 Perlin::Perlin( uint8_t aOctaves, int32_t aSeed )
 	: mOctaves( aOctaves ), mSeed( aSeed ){
 	initPermutationTable();
@@ -279,6 +307,92 @@ Vec3f Perlin::dnoise( float x, float y, float z ) const
 					dw * ( k3 + k6*u + k5*v + k7*u*v ) );
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// simplex
+float Perlin::simplex( float x, float y ) const
+{
+	// skew the input space to find the cell, and unskew the cell's origin back
+	const float s = ( x + y ) * SIMPLEX_F2;
+	const float i = floorf( x + s ), j = floorf( y + s );
+	const float t = ( i + j ) * SIMPLEX_G2;
+	const float x0 = x - ( i - t ), y0 = y - ( j - t );
+
+	// the cell is split into two triangles along its diagonal, the middle corner is a step along x in the lower one
+	const int32_t i1 = ( x0 > y0 ) ? 1 : 0, j1 = 1 - i1;
+	const float x1 = x0 - i1 + SIMPLEX_G2, y1 = y0 - j1 + SIMPLEX_G2;
+	const float x2 = x0 - 1 + 2 * SIMPLEX_G2, y2 = y0 - 1 + 2 * SIMPLEX_G2;
+
+	const int32_t ii = ((int32_t)i) & 255, jj = ((int32_t)j) & 255;
+	const float n0 = simplexCorner( x0, y0, SIMPLEX_GRADS[mPerms[ii + mPerms[jj]] % 12] );
+	const float n1 = simplexCorner( x1, y1, SIMPLEX_GRADS[mPerms[ii + i1 + mPerms[jj + j1]] % 12] );
+	const float n2 = simplexCorner( x2, y2, SIMPLEX_GRADS[mPerms[ii + 1 + mPerms[jj + 1]] % 12] );
+
+	return 70 * ( n0 + n1 + n2 );
+}
+
+float Perlin::simplex( float x, float y, float z ) const
+{
+	const float s = ( x + y + z ) * SIMPLEX_F3;
+	const float i = floorf( x + s ), j = floorf( y + s ), k = floorf( z + s );
+	const float t = ( i + j + k ) * SIMPLEX_G3;
+	const float x0 = x - ( i - t ), y0 = y - ( j - t ), z0 = z - ( k - t );
+
+	// the cell is split into six tetrahedra, the second and third corners step along the largest and next largest of x0, y0 and z0
+	int32_t i1, j1, k1, i2, j2, k2;
+	if( x0 >= y0 ) {
+		if( y0 >= z0 )		{ i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+		else if( x0 >= z0 )	{ i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
+		else				{ i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+	}
+	else {
+		if( y0 < z0 )		{ i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
+		else if( x0 < z0 )	{ i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
+		else				{ i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+	}
+	const float x1 = x0 - i1 + SIMPLEX_G3, y1 = y0 - j1 + SIMPLEX_G3, z1 = z0 - k1 + SIMPLEX_G3;
+	const float x2 = x0 - i2 + 2 * SIMPLEX_G3, y2 = y0 - j2 + 2 * SIMPLEX_G3, z2 = z0 - k2 + 2 * SIMPLEX_G3;
+	const float x3 = x0 - 1 + 3 * SIMPLEX_G3, y3 = y0 - 1 + 3 * SIMPLEX_G3, z3 = z0 - 1 + 3 * SIMPLEX_G3;
+
+	const int32_t ii = ((int32_t)i) & 255, jj = ((int32_t)j) & 255, kk = ((int32_t)k) & 255;
+	const float n0 = simplexCorner( x0, y0, z0, SIMPLEX_GRADS[mPerms[ii + mPerms[jj + mPerms[kk]]] % 12] );
+	const float n1 = simplexCorner( x1, y1, z1, SIMPLEX_GRADS[mPerms[ii + i1 + mPerms[jj + j1 + mPerms[kk + k1]]] % 12] );
+	const float n2 = simplexCorner( x2, y2, z2, SIMPLEX_GRADS[mPerms[ii + i2 + mPerms[jj + j2 + mPerms[kk + k2]]] % 12] );
+	const float n3 = simplexCorner( x3, y3, z3, SIMPLEX_GRADS[mPerms[ii + 1 + mPerms[jj + 1 + mPerms[kk + 1]]] % 12] );
+
+	return 32 * ( n0 + n1 + n2 + n3 );
+}
+
+float Perlin::simplexfBm( const Vec2f &v ) const
+{
+	float result = 0.0f;
+	float amp = 0.5f;
+
+	float x = v.x, y = v.y;
+
+	for( uint8_t i = 0; i < mOctaves; i++ ) {
+		result += simplex( x, y ) * amp;
+		x *= 2.0f; y *= 2.0f;
+		amp *= 0.5f;
+	}
+
+	return result;
+}
+
+float Perlin::simplexfBm( const Vec3f &v ) const
+{
+	float result = 0.0f;
+	float amp = 0.5f;
+	float x = v.x, y = v.y, z = v.z;
+
+	for( uint8_t i = 0; i < mOctaves; i++ ) {
+		result += simplex( x, y, z ) * amp;
+		x *= 2.0f; y *= 2.0f; z *= 2.0f;
+		amp *= 0.5f;
+	}
+
+	return result;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 // grad
 
@@ -306,6 +420,604 @@ float Perlin::grad( int32_t hash, float x, float y, float z ) const
 	return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// batches
+namespace {
+
+#if defined( CINDER_IP_SSE2 )
+// The functions below work on 4 points at a time with the arithmetic of the ones above, so they give exactly the same
+// results. SSE2 has no gathers, the permutation table is looked up a lane at a time.
+
+inline __m128 select_ps( __m128 mask, __m128 a, __m128 b )
+{
+	return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+// floorf() of each lane, for values which fit in an int32_t
+inline __m128 floor_ps( __m128 x )
+{
+	const __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( x ) );
+	return _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, x ), _mm_set1_ps( 1.0f ) ) );
+}
+
+inline __m128 fade_ps( __m128 t )
+{
+	const __m128 inner = _mm_add_ps( _mm_mul_ps( t, _mm_sub_ps( _mm_mul_ps( t, _mm_set1_ps( 6.0f ) ), _mm_set1_ps( 15.0f ) ) ), _mm_set1_ps( 10.0f ) );
+	return _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( t, t ), t ), inner );
+}
+
+// dfade(), with the derivatives too close to 0 replaced by 1 as Perlin::dnoise() does
+inline __m128 dfade_ps( __m128 t )
+{
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 inner = _mm_add_ps( _mm_mul_ps( t, _mm_sub_ps( t, _mm_set1_ps( 2.0f ) ) ), one );
+	const __m128 d = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 30.0f ), t ), t ), inner );
+	return select_ps( _mm_cmplt_ps( d, _mm_set1_ps( 0.000001f ) ), one, d );
+}
+
+inline __m128 nlerp_ps( __m128 t, __m128 a, __m128 b )
+{
+	return _mm_add_ps( a, _mm_mul_ps( t, _mm_sub_ps( b, a ) ) );
+}
+
+// Perlin::grad() of 4 hashes, z is 0 for 2D
+inline __m128 grad_ps( __m128i hash, __m128 x, __m128 y, __m128 z )
+{
+	const __m128i h = _mm_and_si128( hash, _mm_set1_epi32( 15 ) );
+	const __m128 lt8 = _mm_castsi128_ps( _mm_cmplt_epi32( h, _mm_set1_epi32( 8 ) ) );
+	const __m128 lt4 = _mm_castsi128_ps( _mm_cmplt_epi32( h, _mm_set1_epi32( 4 ) ) );
+	const __m128 is12or14 = _mm_castsi128_ps( _mm_or_si128( _mm_cmpeq_epi32( h, _mm_set1_epi32( 12 ) ), _mm_cmpeq_epi32( h, _mm_set1_epi32( 14 ) ) ) );
+	const __m128 u = select_ps( lt8, x, y );
+	const __m128 v = select_ps( lt4, y, select_ps( is12or14, x, z ) );
+	// bits 0 and 1 of the hash flip the signs of u and v
+	const __m128 signU = _mm_castsi128_ps( _mm_slli_epi32( h, 31 ) );
+	const __m128 signV = _mm_castsi128_ps( _mm_slli_epi32( _mm_srli_epi32( h, 1 ), 31 ) );
+	return _mm_add_ps( _mm_xor_ps( u, signU ), _mm_xor_ps( v, signV ) );
+}
+
+// the hashes of the corners of the cells (X, Y) of 4 points, in the order of a, b, c and d in Perlin::noise( x, y ).
+// They are put together in registers, loading a vector straight after storing its lanes one by one stalls
+inline void hashCorners( const uint8_t *perms, __m128i X, __m128i Y, __m128i hashes[4] )
+{
+	int32_t xs[4], ys[4], h[4][4];
+	_mm_storeu_si128( (__m128i*)xs, X );
+	_mm_storeu_si128( (__m128i*)ys, Y );
+	for( int k = 0; k < 4; ++k ) {
+		const int32_t A = perms[xs[k]] + ys[k], B = perms[xs[k] + 1] + ys[k];
+		h[0][k] = perms[perms[A]];
+		h[1][k] = perms[perms[B]];
+		h[2][k] = perms[perms[A + 1]];
+		h[3][k] = perms[perms[B + 1]];
+	}
+	for( int c = 0; c < 4; ++c )
+		hashes[c] = _mm_set_epi32( h[c][3], h[c][2], h[c][1], h[c][0] );
+}
+
+// the hashes of the corners of the cells (X, Y, Z) of 4 points, in the order of a to h in Perlin::noise( x, y, z )
+inline void hashCorners( const uint8_t *perms, __m128i X, __m128i Y, __m128i Z, __m128i hashes[8] )
+{
+	int32_t xs[4], ys[4], zs[4], h[8][4];
+	_mm_storeu_si128( (__m128i*)xs, X );
+	_mm_storeu_si128( (__m128i*)ys, Y );
+	_mm_storeu_si128( (__m128i*)zs, Z );
+	for( int k = 0; k < 4; ++k ) {
+		const int32_t A = perms[xs[k]] + ys[k], AA = perms[A] + zs[k], AB = perms[A + 1] + zs[k];
+		const int32_t B = perms[xs[k] + 1] + ys[k], BA = perms[B] + zs[k], BB = perms[B + 1] + zs[k];
+		h[0][k] = perms[AA];
+		h[1][k] = perms[BA];
+		h[2][k] = perms[AB];
+		h[3][k] = perms[BB];
+		h[4][k] = perms[AA + 1];
+		h[5][k] = perms[BA + 1];
+		h[6][k] = perms[AB + 1];
+		h[7][k] = perms[BB + 1];
+	}
+	for( int c = 0; c < 8; ++c )
+		hashes[c] = _mm_set_epi32( h[c][3], h[c][2], h[c][1], h[c][0] );
+}
+
+inline __m128i cell_epi32( __m128 floored )
+{
+	return _mm_and_si128( _mm_cvttps_epi32( floored ), _mm_set1_epi32( 255 ) );
+}
+
+__m128 noise_ps( const uint8_t *perms, __m128 x, __m128 y )
+{
+	const __m128 fx = floor_ps( x ), fy = floor_ps( y );
+	__m128i h[4];
+	hashCorners( perms, cell_epi32( fx ), cell_epi32( fy ), h );
+	x = _mm_sub_ps( x, fx ); y = _mm_sub_ps( y, fy );
+	const __m128 u = fade_ps( x ), v = fade_ps( y );
+	const __m128 one = _mm_set1_ps( 1.0f ), zero = _mm_setzero_ps();
+	const __m128 x1 = _mm_sub_ps( x, one ), y1 = _mm_sub_ps( y, one );
+
+	return nlerp_ps( v, nlerp_ps( u, grad_ps( h[0], x, y, zero ), grad_ps( h[1], x1, y, zero ) ),
+						nlerp_ps( u, grad_ps( h[2], x, y1, zero ), grad_ps( h[3], x1, y1, zero ) ) );
+}
+
+__m128 noise_ps( const uint8_t *perms, __m128 x, __m128 y, __m128 z )
+{
+	const __m128 fx = floor_ps( x ), fy = floor_ps( y ), fz = floor_ps( z );
+	__m128i h[8];
+	hashCorners( perms, cell_epi32( fx ), cell_epi32( fy ), cell_epi32( fz ), h );
+	x = _mm_sub_ps( x, fx ); y = _mm_sub_ps( y, fy ); z = _mm_sub_ps( z, fz );
+	const __m128 u = fade_ps( x ), v = fade_ps( y ), w = fade_ps( z );
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 x1 = _mm_sub_ps( x, one ), y1 = _mm_sub_ps( y, one ), z1 = _mm_sub_ps( z, one );
+
+	const __m128 a = grad_ps( h[0], x , y , z  );
+	const __m128 b = grad_ps( h[1], x1, y , z  );
+	const __m128 c = grad_ps( h[2], x , y1, z  );
+	const __m128 d = grad_ps( h[3], x1, y1, z  );
+	const __m128 e = grad_ps( h[4], x , y , z1 );
+	const __m128 f = grad_ps( h[5], x1, y , z1 );
+	const __m128 g = grad_ps( h[6], x , y1, z1 );
+	const __m128 hh = grad_ps( h[7], x1, y1, z1 );
+
+	return nlerp_ps( w, nlerp_ps( v, nlerp_ps( u, a, b ), nlerp_ps( u, c, d ) ),
+						nlerp_ps( v, nlerp_ps( u, e, f ), nlerp_ps( u, g, hh ) ) );
+}
+
+// Perlin::dnoise( x, y ), which finds the cell by truncating rather than flooring
+void dnoise_ps( const uint8_t *perms, __m128 x, __m128 y, __m128 &dx, __m128 &dy )
+{
+	const __m128i mask = _mm_set1_epi32( 255 );
+	__m128i h[4];
+	hashCorners( perms, _mm_and_si128( _mm_cvttps_epi32( x ), mask ), _mm_and_si128( _mm_cvttps_epi32( y ), mask ), h );
+	x = _mm_sub_ps( x, floor_ps( x ) ); y = _mm_sub_ps( y, floor_ps( y ) );
+	const __m128 u = fade_ps( x ), v = fade_ps( y );
+	const __m128 du = dfade_ps( x ), dv = dfade_ps( y );
+	const __m128 one = _mm_set1_ps( 1.0f ), zero = _mm_setzero_ps();
+	const __m128 x1 = _mm_sub_ps( x, one ), y1 = _mm_sub_ps( y, one );
+
+	const __m128 a = grad_ps( h[0], x , y , zero );
+	const __m128 b = grad_ps( h[1], x1, y , zero );
+	const __m128 c = grad_ps( h[2], x , y1, zero );
+	const __m128 d = grad_ps( h[3], x1, y1, zero );
+
+	const __m128 k1 = _mm_sub_ps( b, a );
+	const __m128 k2 = _mm_sub_ps( c, a );
+	const __m128 k4 = _mm_add_ps( _mm_sub_ps( _mm_sub_ps( a, b ), c ), d );
+
+	dx = _mm_mul_ps( du, _mm_add_ps( k1, _mm_mul_ps( k4, v ) ) );
+	dy = _mm_mul_ps( dv, _mm_add_ps( k2, _mm_mul_ps( k4, u ) ) );
+}
+
+void dnoise_ps( const uint8_t *perms, __m128 x, __m128 y, __m128 z, __m128 &dx, __m128 &dy, __m128 &dz )
+{
+	const __m128 fx = floor_ps( x ), fy = floor_ps( y ), fz = floor_ps( z );
+	__m128i h[8];
+	hashCorners( perms, cell_epi32( fx ), cell_epi32( fy ), cell_epi32( fz ), h );
+	x = _mm_sub_ps( x, fx ); y = _mm_sub_ps( y, fy ); z = _mm_sub_ps( z, fz );
+	const __m128 u = fade_ps( x ), v = fade_ps( y ), w = fade_ps( z );
+	const __m128 du = dfade_ps( x ), dv = dfade_ps( y ), dw = dfade_ps( z );
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 x1 = _mm_sub_ps( x, one ), y1 = _mm_sub_ps( y, one ), z1 = _mm_sub_ps( z, one );
+
+	const __m128 a = grad_ps( h[0], x , y , z  );
+	const __m128 b = grad_ps( h[1], x1, y , z  );
+	const __m128 c = grad_ps( h[2], x , y1, z  );
+	const __m128 d = grad_ps( h[3], x1, y1, z  );
+	const __m128 e = grad_ps( h[4], x , y , z1 );
+	const __m128 f = grad_ps( h[5], x1, y , z1 );
+	const __m128 g = grad_ps( h[6], x , y1, z1 );
+	const __m128 hh = grad_ps( h[7], x1, y1, z1 );
+
+	const __m128 k1 = _mm_sub_ps( b, a );
+	const __m128 k2 = _mm_sub_ps( c, a );
+	const __m128 k3 = _mm_sub_ps( e, a );
+	const __m128 k4 = _mm_add_ps( _mm_sub_ps( _mm_sub_ps( a, b ), c ), d );
+	const __m128 k5 = _mm_add_ps( _mm_sub_ps( _mm_sub_ps( a, c ), e ), g );
+	const __m128 k6 = _mm_add_ps( _mm_sub_ps( _mm_sub_ps( a, b ), e ), f );
+	__m128 k7 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_xor_ps( a, _mm_set1_ps( -0.0f ) ), b ), c ), d );
+	k7 = _mm_add_ps( _mm_sub_ps( _mm_sub_ps( _mm_add_ps( k7, e ), f ), g ), hh );
+
+	dx = _mm_mul_ps( du, _mm_add_ps( _mm_add_ps( _mm_add_ps( k1, _mm_mul_ps( k4, v ) ), _mm_mul_ps( k6, w ) ), _mm_mul_ps( _mm_mul_ps( k7, v ), w ) ) );
+	dy = _mm_mul_ps( dv, _mm_add_ps( _mm_add_ps( _mm_add_ps( k2, _mm_mul_ps( k5, w ) ), _mm_mul_ps( k4, u ) ), _mm_mul_ps( _mm_mul_ps( k7, w ), u ) ) );
+	dz = _mm_mul_ps( dw, _mm_add_ps( _mm_add_ps( _mm_add_ps( k3, _mm_mul_ps( k6, u ) ), _mm_mul_ps( k5, v ) ), _mm_mul_ps( _mm_mul_ps( k7, u ), v ) ) );
+}
+
+// simplexCorner() of 4 points, the gradients looked up from SIMPLEX_GRADS by index
+inline __m128 simplexCorner_ps( __m128 x, __m128 y, const int32_t grads[4] )
+{
+	const __m128 gx = _mm_set_ps( SIMPLEX_GRADS[grads[3]][0], SIMPLEX_GRADS[grads[2]][0], SIMPLEX_GRADS[grads[1]][0], SIMPLEX_GRADS[grads[0]][0] );
+	const __m128 gy = _mm_set_ps( SIMPLEX_GRADS[grads[3]][1], SIMPLEX_GRADS[grads[2]][1], SIMPLEX_GRADS[grads[1]][1], SIMPLEX_GRADS[grads[0]][1] );
+	__m128 t = _mm_sub_ps( _mm_sub_ps( _mm_set1_ps( 0.5f ), _mm_mul_ps( x, x ) ), _mm_mul_ps( y, y ) );
+	const __m128 outside = _mm_cmplt_ps( t, _mm_setzero_ps() );
+	t = _mm_mul_ps( t, t );
+	const __m128 n = _mm_mul_ps( _mm_mul_ps( t, t ), _mm_add_ps( _mm_mul_ps( gx, x ), _mm_mul_ps( gy, y ) ) );
+	return _mm_andnot_ps( outside, n );
+}
+
+inline __m128 simplexCorner_ps( __m128 x, __m128 y, __m128 z, const int32_t grads[4] )
+{
+	const __m128 gx = _mm_set_ps( SIMPLEX_GRADS[grads[3]][0], SIMPLEX_GRADS[grads[2]][0], SIMPLEX_GRADS[grads[1]][0], SIMPLEX_GRADS[grads[0]][0] );
+	const __m128 gy = _mm_set_ps( SIMPLEX_GRADS[grads[3]][1], SIMPLEX_GRADS[grads[2]][1], SIMPLEX_GRADS[grads[1]][1], SIMPLEX_GRADS[grads[0]][1] );
+	const __m128 gz = _mm_set_ps( SIMPLEX_GRADS[grads[3]][2], SIMPLEX_GRADS[grads[2]][2], SIMPLEX_GRADS[grads[1]][2], SIMPLEX_GRADS[grads[0]][2] );
+	__m128 t = _mm_sub_ps( _mm_sub_ps( _mm_sub_ps( _mm_set1_ps( 0.6f ), _mm_mul_ps( x, x ) ), _mm_mul_ps( y, y ) ), _mm_mul_ps( z, z ) );
+	const __m128 outside = _mm_cmplt_ps( t, _mm_setzero_ps() );
+	t = _mm_mul_ps( t, t );
+	const __m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( gx, x ), _mm_mul_ps( gy, y ) ), _mm_mul_ps( gz, z ) );
+	return _mm_andnot_ps( outside, _mm_mul_ps( _mm_mul_ps( t, t ), dot ) );
+}
+
+__m128 simplex_ps( const uint8_t *perms, __m128 x, __m128 y )
+{
+	const __m128 one = _mm_set1_ps( 1.0f ), g2 = _mm_set1_ps( SIMPLEX_G2 );
+	const __m128 s = _mm_mul_ps( _mm_add_ps( x, y ), _mm_set1_ps( SIMPLEX_F2 ) );
+	const __m128 i = floor_ps( _mm_add_ps( x, s ) ), j = floor_ps( _mm_add_ps( y, s ) );
+	const __m128 t = _mm_mul_ps( _mm_add_ps( i, j ), g2 );
+	const __m128 x0 = _mm_sub_ps( x, _mm_sub_ps( i, t ) ), y0 = _mm_sub_ps( y, _mm_sub_ps( j, t ) );
+
+	const __m128 lower = _mm_cmpgt_ps( x0, y0 );
+	const __m128 i1 = _mm_and_ps( lower, one ), j1 = _mm_andnot_ps( lower, one );
+	const __m128 x1 = _mm_add_ps( _mm_sub_ps( x0, i1 ), g2 ), y1 = _mm_add_ps( _mm_sub_ps( y0, j1 ), g2 );
+	const __m128 twoG2 = _mm_set1_ps( 2 * SIMPLEX_G2 );
+	const __m128 x2 = _mm_add_ps( _mm_sub_ps( x0, one ), twoG2 ), y2 = _mm_add_ps( _mm_sub_ps( y0, one ), twoG2 );
+
+	int32_t ii[4], jj[4], i1s[4], grads[3][4];
+	_mm_storeu_si128( (__m128i*)ii, cell_epi32( i ) );
+	_mm_storeu_si128( (__m128i*)jj, cell_epi32( j ) );
+	_mm_storeu_si128( (__m128i*)i1s, _mm_cvttps_epi32( i1 ) );
+	for( int k = 0; k < 4; ++k ) {
+		grads[0][k] = perms[ii[k] + perms[jj[k]]] % 12;
+		grads[1][k] = perms[ii[k] + i1s[k] + perms[jj[k] + 1 - i1s[k]]] % 12;
+		grads[2][k] = perms[ii[k] + 1 + perms[jj[k] + 1]] % 12;
+	}
+
+	const __m128 n = _mm_add_ps( _mm_add_ps( simplexCorner_ps( x0, y0, grads[0] ), simplexCorner_ps( x1, y1, grads[1] ) ), simplexCorner_ps( x2, y2, grads[2] ) );
+	return _mm_mul_ps( _mm_set1_ps( 70.0f ), n );
+}
+
+__m128 simplex_ps( const uint8_t *perms, __m128 x, __m128 y, __m128 z )
+{
+	const __m128 one = _mm_set1_ps( 1.0f ), g3 = _mm_set1_ps( SIMPLEX_G3 );
+	const __m128 s = _mm_mul_ps( _mm_add_ps( _mm_add_ps( x, y ), z ), _mm_set1_ps( SIMPLEX_F3 ) );
+	const __m128 i = floor_ps( _mm_add_ps( x, s ) ), j = floor_ps( _mm_add_ps( y, s ) ), k = floor_ps( _mm_add_ps( z, s ) );
+	const __m128 t = _mm_mul_ps( _mm_add_ps( _mm_add_ps( i, j ), k ), g3 );
+	const __m128 x0 = _mm_sub_ps( x, _mm_sub_ps( i, t ) ), y0 = _mm_sub_ps( y, _mm_sub_ps( j, t ) ), z0 = _mm_sub_ps( z, _mm_sub_ps( k, t ) );
+
+	// the branches of Perlin::simplex( x, y, z ) as masks
+	const __m128 xy = _mm_cmpge_ps( x0, y0 ), yz = _mm_cmpge_ps( y0, z0 ), xz = _mm_cmpge_ps( x0, z0 );
+	const __m128 i1 = _mm_and_ps( _mm_and_ps( xy, _mm_or_ps( yz, xz ) ), one );
+	const __m128 j1 = _mm_and_ps( _mm_andnot_ps( xy, yz ), one );
+	const __m128 k1 = _mm_andnot_ps( yz, _mm_andnot_ps( _mm_and_ps( xy, xz ), one ) );
+	const __m128 i2 = _mm_and_ps( _mm_or_ps( xy, _mm_and_ps( yz, xz ) ), one );
+	const __m128 j2 = _mm_andnot_ps( _mm_andnot_ps( yz, xy ), one );
+	const __m128 k2 = _mm_andnot_ps( _mm_and_ps( yz, _mm_or_ps( xy, xz ) ), one );
+
+	const __m128 twoG3 = _mm_set1_ps( 2 * SIMPLEX_G3 ), threeG3 = _mm_set1_ps( 3 * SIMPLEX_G3 );
+	const __m128 x1 = _mm_add_ps( _mm_sub_ps( x0, i1 ), g3 ), y1 = _mm_add_ps( _mm_sub_ps( y0, j1 ), g3 ), z1 = _mm_add_ps( _mm_sub_ps( z0, k1 ), g3 );
+	const __m128 x2 = _mm_add_ps( _mm_sub_ps( x0, i2 ), twoG3 ), y2 = _mm_add_ps( _mm_sub_ps( y0, j2 ), twoG3 ), z2 = _mm_add_ps( _mm_sub_ps( z0, k2 ), twoG3 );
+	const __m128 x3 = _mm_add_ps( _mm_sub_ps( x0, one ), threeG3 ), y3 = _mm_add_ps( _mm_sub_ps( y0, one ), threeG3 ), z3 = _mm_add_ps( _mm_sub_ps( z0, one ), threeG3 );
+
+	int32_t ii[4], jj[4], kk[4], steps[6][4], grads[4][4];
+	_mm_storeu_si128( (__m128i*)ii, cell_epi32( i ) );
+	_mm_storeu_si128( (__m128i*)jj, cell_epi32( j ) );
+	_mm_storeu_si128( (__m128i*)kk, cell_epi32( k ) );
+	const __m128 stepVectors[6] = { i1, j1, k1, i2, j2, k2 };
+	for( int c = 0; c < 6; ++c )
+		_mm_storeu_si128( (__m128i*)steps[c], _mm_cvttps_epi32( stepVectors[c] ) );
+	for( int l = 0; l < 4; ++l ) {
+		grads[0][l] = perms[ii[l] + perms[jj[l] + perms[kk[l]]]] % 12;
+		grads[1][l] = perms[ii[l] + steps[0][l] + perms[jj[l] + steps[1][l] + perms[kk[l] + steps[2][l]]]] % 12;
+		grads[2][l] = perms[ii[l] + steps[3][l] + perms[jj[l] + steps[4][l] + perms[kk[l] + steps[5][l]]]] % 12;
+		grads[3][l] = perms[ii[l] + 1 + perms[jj[l] + 1 + perms[kk[l] + 1]]] % 12;
+	}
+
+	const __m128 n = _mm_add_ps( _mm_add_ps( _mm_add_ps( simplexCorner_ps( x0, y0, z0, grads[0] ), simplexCorner_ps( x1, y1, z1, grads[1] ) ),
+											 simplexCorner_ps( x2, y2, z2, grads[2] ) ), simplexCorner_ps( x3, y3, z3, grads[3] ) );
+	return _mm_mul_ps( _mm_set1_ps( 32.0f ), n );
+}
+
+inline void loadPositions( const Vec2f *p, __m128 &x, __m128 &y, __m128 & )
+{
+	x = _mm_set_ps( p[3].x, p[2].x, p[1].x, p[0].x );
+	y = _mm_set_ps( p[3].y, p[2].y, p[1].y, p[0].y );
+}
+
+inline void loadPositions( const Vec3f *p, __m128 &x, __m128 &y, __m128 &z )
+{
+	x = _mm_set_ps( p[3].x, p[2].x, p[1].x, p[0].x );
+	y = _mm_set_ps( p[3].y, p[2].y, p[1].y, p[0].y );
+	z = _mm_set_ps( p[3].z, p[2].z, p[1].z, p[0].z );
+}
+#endif
+
+// The noise the batch functions sum octaves of: the 4 lane version and the one point version to finish off with
+struct ClassicNoise {
+#if defined( CINDER_IP_SSE2 )
+	static __m128	noise( const uint8_t *perms, __m128 x, __m128 y ) { return noise_ps( perms, x, y ); }
+	static __m128	noise( const uint8_t *perms, __m128 x, __m128 y, __m128 z ) { return noise_ps( perms, x, y, z ); }
+#endif
+	static float	fBm( const Perlin &perlin, const Vec2f &v ) { return perlin.fBm( v ); }
+	static float	fBm( const Perlin &perlin, const Vec3f &v ) { return perlin.fBm( v ); }
+};
+
+struct SimplexNoise {
+#if defined( CINDER_IP_SSE2 )
+	static __m128	noise( const uint8_t *perms, __m128 x, __m128 y ) { return simplex_ps( perms, x, y ); }
+	static __m128	noise( const uint8_t *perms, __m128 x, __m128 y, __m128 z ) { return simplex_ps( perms, x, y, z ); }
+#endif
+	static float	fBm( const Perlin &perlin, const Vec2f &v ) { return perlin.simplexfBm( v ); }
+	static float	fBm( const Perlin &perlin, const Vec3f &v ) { return perlin.simplexfBm( v ); }
+};
+
+#if defined( CINDER_IP_SSE2 )
+template<typename NOISE>
+__m128 fBm_ps( const uint8_t *perms, uint8_t octaves, __m128 x, __m128 y )
+{
+	const __m128 two = _mm_set1_ps( 2.0f );
+	__m128 result = _mm_setzero_ps();
+	float amp = 0.5f;
+
+	for( uint8_t i = 0; i < octaves; i++ ) {
+		result = _mm_add_ps( result, _mm_mul_ps( NOISE::noise( perms, x, y ), _mm_set1_ps( amp ) ) );
+		x = _mm_mul_ps( x, two ); y = _mm_mul_ps( y, two );
+		amp *= 0.5f;
+	}
+
+	return result;
+}
+
+template<typename NOISE>
+__m128 fBm_ps( const uint8_t *perms, uint8_t octaves, __m128 x, __m128 y, __m128 z )
+{
+	const __m128 two = _mm_set1_ps( 2.0f );
+	__m128 result = _mm_setzero_ps();
+	float amp = 0.5f;
+
+	for( uint8_t i = 0; i < octaves; i++ ) {
+		result = _mm_add_ps( result, _mm_mul_ps( NOISE::noise( perms, x, y, z ), _mm_set1_ps( amp ) ) );
+		x = _mm_mul_ps( x, two ); y = _mm_mul_ps( y, two ); z = _mm_mul_ps( z, two );
+		amp *= 0.5f;
+	}
+
+	return result;
+}
+
+template<typename NOISE>
+inline __m128 fBm_ps( const uint8_t *perms, uint8_t octaves, const Vec2f *positions )
+{
+	__m128 x, y, z;
+	loadPositions( positions, x, y, z );
+	return fBm_ps<NOISE>( perms, octaves, x, y );
+}
+
+template<typename NOISE>
+inline __m128 fBm_ps( const uint8_t *perms, uint8_t octaves, const Vec3f *positions )
+{
+	__m128 x, y, z;
+	loadPositions( positions, x, y, z );
+	return fBm_ps<NOISE>( perms, octaves, x, y, z );
+}
+
+void dfBm_ps( const uint8_t *perms, uint8_t octaves, const Vec2f *positions, Vec2f *results )
+{
+	const __m128 two = _mm_set1_ps( 2.0f );
+	__m128 x, y, z, dx, dy;
+	loadPositions( positions, x, y, z );
+	__m128 resultX = _mm_setzero_ps(), resultY = _mm_setzero_ps();
+	float amp = 0.5f;
+
+	for( uint8_t i = 0; i < octaves; i++ ) {
+		const __m128 ampV = _mm_set1_ps( amp );
+		dnoise_ps( perms, x, y, dx, dy );
+		resultX = _mm_add_ps( resultX, _mm_mul_ps( dx, ampV ) );
+		resultY = _mm_add_ps( resultY, _mm_mul_ps( dy, ampV ) );
+		x = _mm_mul_ps( x, two ); y = _mm_mul_ps( y, two );
+		amp *= 0.5f;
+	}
+
+	float rx[4], ry[4];
+	_mm_storeu_ps( rx, resultX );
+	_mm_storeu_ps( ry, resultY );
+	for( int k = 0; k < 4; ++k )
+		results[k] = Vec2f( rx[k], ry[k] );
+}
+
+void dfBm_ps( const uint8_t *perms, uint8_t octaves, const Vec3f *positions, Vec3f *results )
+{
+	const __m128 two = _mm_set1_ps( 2.0f );
+	__m128 x, y, z, dx, dy, dz;
+	loadPositions( positions, x, y, z );
+	__m128 resultX = _mm_setzero_ps(), resultY = _mm_setzero_ps(), resultZ = _mm_setzero_ps();
+	float amp = 0.5f;
+
+	for( uint8_t i = 0; i < octaves; i++ ) {
+		const __m128 ampV = _mm_set1_ps( amp );
+		dnoise_ps( perms, x, y, z, dx, dy, dz );
+		resultX = _mm_add_ps( resultX, _mm_mul_ps( dx, ampV ) );
+		resultY = _mm_add_ps( resultY, _mm_mul_ps( dy, ampV ) );
+		resultZ = _mm_add_ps( resultZ, _mm_mul_ps( dz, ampV ) );
+		x = _mm_mul_ps( x, two ); y = _mm_mul_ps( y, two ); z = _mm_mul_ps( z, two );
+		amp *= 0.5f;
+	}
+
+	float rx[4], ry[4], rz[4];
+	_mm_storeu_ps( rx, resultX );
+	_mm_storeu_ps( ry, resultY );
+	_mm_storeu_ps( rz, resultZ );
+	for( int k = 0; k < 4; ++k )
+		results[k] = Vec3f( rx[k], ry[k], rz[k] );
+}
+#endif
+
+// Fills the rows [y1, y2) of a channel with fBm of offset + ( x, y ) * scale, or of a slice through z = offset.z
+template<typename NOISE>
+struct FbmChannelBand {
+	const Perlin	*perlin;
+	const uint8_t	*perms;
+	uint8_t			octaves;
+	uint8_t			*data;
+	int32_t			rowBytes, increment, width;
+	Vec3f			offset;
+	Vec2f			scale;
+	bool			slice;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		for( int32_t y = y1; y < y2; ++y ) {
+			float *dstPtr = reinterpret_cast<float*>( data + y * rowBytes );
+			const float py = offset.y + y * scale.y;
+			int32_t x = 0;
+#if defined( CINDER_IP_SSE2 )
+			if( ip::useSse2() ) {
+				const __m128 offsetX = _mm_set1_ps( offset.x ), scaleX = _mm_set1_ps( scale.x ), pyV = _mm_set1_ps( py ), pzV = _mm_set1_ps( offset.z );
+				for( ; x + 4 <= width; x += 4 ) {
+					const __m128 px = _mm_add_ps( offsetX, _mm_mul_ps( _mm_cvtepi32_ps( _mm_add_epi32( _mm_set1_epi32( x ), _mm_set_epi32( 3, 2, 1, 0 ) ) ), scaleX ) );
+					const __m128 result = slice ? fBm_ps<NOISE>( perms, octaves, px, pyV, pzV ) : fBm_ps<NOISE>( perms, octaves, px, pyV );
+					if( increment == 1 )
+						_mm_storeu_ps( dstPtr + x, result );
+					else {
+						float values[4];
+						_mm_storeu_ps( values, result );
+						for( int k = 0; k < 4; ++k )
+							dstPtr[( x + k ) * increment] = values[k];
+					}
+				}
+			}
+#endif
+			for( ; x < width; ++x ) {
+				const float px = offset.x + x * scale.x;
+				dstPtr[x * increment] = slice ? NOISE::fBm( *perlin, Vec3f( px, py, offset.z ) ) : NOISE::fBm( *perlin, Vec2f( px, py ) );
+			}
+		}
+	}
+};
+
+// fBm of the positions [first, last) of an array
+template<typename NOISE, typename VEC>
+struct FbmArrayBand {
+	const Perlin	*perlin;
+	const uint8_t	*perms;
+	uint8_t			octaves;
+	const VEC		*positions;
+	float			*results;
+
+	void operator()( int32_t first, int32_t last ) const
+	{
+		int32_t i = first;
+#if defined( CINDER_IP_SSE2 )
+		if( ip::useSse2() ) {
+			for( ; i + 4 <= last; i += 4 )
+				_mm_storeu_ps( results + i, fBm_ps<NOISE>( perms, octaves, positions + i ) );
+		}
+#endif
+		for( ; i < last; ++i )
+			results[i] = NOISE::fBm( *perlin, positions[i] );
+	}
+};
+
+// dfBm of the positions [first, last) of an array
+template<typename VEC>
+struct DfbmArrayBand {
+	const Perlin	*perlin;
+	const uint8_t	*perms;
+	uint8_t			octaves;
+	const VEC		*positions;
+	VEC				*results;
+
+	void operator()( int32_t first, int32_t last ) const
+	{
+		int32_t i = first;
+#if defined( CINDER_IP_SSE2 )
+		if( ip::useSse2() ) {
+			for( ; i + 4 <= last; i += 4 )
+				dfBm_ps( perms, octaves, positions + i, results + i );
+		}
+#endif
+		for( ; i < last; ++i )
+			results[i] = perlin->dfBm( positions[i] );
+	}
+};
+
+// parallelRows() sizes its bands in pixels of a cheap ip function. One octave of noise at a point
+// costs about this many of those, so a batch of a few thousand points is already worth spreading out
+const int32_t OCTAVE_PIXEL_COST = 16;
+
+int32_t pointCost( const Perlin &perlin )
+{
+	return std::max<int32_t>( perlin.getOctaves(), 1 ) * OCTAVE_PIXEL_COST;
+}
+
+template<typename NOISE>
+void fillChannel( const Perlin &perlin, const uint8_t *perms, Channel32f *channel, const Vec3f &offset, const Vec2f &scale, bool slice )
+{
+	FbmChannelBand<NOISE> band;
+	band.perlin = &perlin;
+	band.perms = perms;
+	band.octaves = perlin.getOctaves();
+	band.data = reinterpret_cast<uint8_t*>( channel->getData() );
+	band.rowBytes = channel->getRowBytes();
+	band.increment = channel->getIncrement();
+	band.width = channel->getWidth();
+	band.offset = offset;
+	band.scale = scale;
+	band.slice = slice;
+	ip::parallelRows( 0, channel->getHeight(), channel->getWidth() * pointCost( perlin ), band );
+}
+
+template<typename NOISE, typename VEC>
+void fillArray( const Perlin &perlin, const uint8_t *perms, const VEC *positions, size_t count, float *results )
+{
+	const FbmArrayBand<NOISE, VEC> band = { &perlin, perms, perlin.getOctaves(), positions, results };
+	// every position is a row one point wide
+	ip::parallelRows( 0, (int32_t)count, pointCost( perlin ), band );
+}
+
+} // anonymous namespace
+
+void Perlin::fBm( Channel32f *channel, const Vec2f &offset, const Vec2f &scale ) const
+{
+	fillChannel<ClassicNoise>( *this, mPerms, channel, Vec3f( offset.x, offset.y, 0 ), scale, false );
+}
+
+void Perlin::fBm( Channel32f *channel, const Vec3f &offset, const Vec2f &scale ) const
+{
+	fillChannel<ClassicNoise>( *this, mPerms, channel, offset, scale, true );
+}
+
+void Perlin::fBm( const Vec2f *positions, size_t count, float *results ) const
+{
+	fillArray<ClassicNoise>( *this, mPerms, positions, count, results );
+}
+
+void Perlin::fBm( const Vec3f *positions, size_t count, float *results ) const
+{
+	fillArray<ClassicNoise>( *this, mPerms, positions, count, results );
+}
+
+void Perlin::dfBm( const Vec2f *positions, size_t count, Vec2f *results ) const
+{
+	const DfbmArrayBand<Vec2f> band = { this, mPerms, mOctaves, positions, results };
+	ip::parallelRows( 0, (int32_t)count, pointCost( *this ), band );
+}
+
+void Perlin::dfBm( const Vec3f *positions, size_t count, Vec3f *results ) const
+{
+	const DfbmArrayBand<Vec3f> band = { this, mPerms, mOctaves, positions, results };
+	ip::parallelRows( 0, (int32_t)count, pointCost( *this ), band );
+}
+
+void Perlin::simplexfBm( Channel32f *channel, const Vec2f &offset, const Vec2f &scale ) const
+{
+	fillChannel<SimplexNoise>( *this, mPerms, channel, Vec3f( offset.x, offset.y, 0 ), scale, false );
+}
+
+void Perlin::simplexfBm( Channel32f *channel, const Vec3f &offset, const Vec2f &scale ) const
+{
+	fillChannel<SimplexNoise>( *this, mPerms, channel, offset, scale, true );
+}
+
+void Perlin::simplexfBm( const Vec2f *positions, size_t count, float *results ) const
+{
+	fillArray<SimplexNoise>( *this, mPerms, positions, count, results );
+}
 
+void Perlin::simplexfBm( const Vec3f *positions, size_t count, float *results ) const
+{
+	fillArray<SimplexNoise>( *this, mPerms, positions, count, results );
+}
 
 } // namespace cinder
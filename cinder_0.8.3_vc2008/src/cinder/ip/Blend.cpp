@@ -23,6 +23,7 @@
 
 #include "cinder/ip/Blend.h"
 #include "cinder/ip/Fill.h"
+#include "cinder/ip/Parallel.h"
 
 using namespace std;
 
@@ -35,154 +36,242 @@ namespace cinder { namespace ip {
 	αr×Cr = (1–αs)×Cd + (1–αd)×Cs + B(Cd, αd, Cs, αs)				Premult * Premult
 */
 
+#if defined( CINDER_IP_SSE2 )
+// Blends count pixels of 4 bytes which have the same channel offsets in src and dst, 4 at a time. Only for the
+// modes whose arithmetic divides by 255 alone, which div255_epi16() reproduces exactly - every mode but an
+// unpremultiplied background with alpha. Returns the number of pixels done.
+template<bool DSTALPHA, bool DSTPREMULT, bool SRCPREMULT>
+int32_t blendPixels_u8( const uint8_t *src, uint8_t *dst, int32_t count, uint8_t alphaOffset )
+{
+	const __m128i zero = _mm_setzero_si128(), v255 = _mm_set1_epi16( 255 ), lowBytes = _mm_set1_epi16( 0xFF );
+	const __m128i alphaMask = _mm_sll_epi32( _mm_set1_epi32( 0xFF ), _mm_cvtsi32_si128( alphaOffset * 8 ) );
+	const __m128i alphaMask16[2] = { _mm_unpacklo_epi8( alphaMask, alphaMask ), _mm_unpackhi_epi8( alphaMask, alphaMask ) };
+
+	int32_t i = 0;
+	for( ; i + 4 <= count; i += 4 ) {
+		const __m128i s = _mm_loadu_si128( (const __m128i*)( src + i * 4 ) ), d = _mm_loadu_si128( (const __m128i*)( dst + i * 4 ) );
+		const __m128i alphaS = broadcastByte_epi32( s, alphaOffset ), alphaD = broadcastByte_epi32( d, alphaOffset );
+		__m128i result[2];
+		for( int h = 0; h < 2; ++h ) {
+			const __m128i sh = h ? _mm_unpackhi_epi8( s, zero ) : _mm_unpacklo_epi8( s, zero );
+			const __m128i dh = h ? _mm_unpackhi_epi8( d, zero ) : _mm_unpacklo_epi8( d, zero );
+			const __m128i alphaSh = h ? _mm_unpackhi_epi8( alphaS, zero ) : _mm_unpacklo_epi8( alphaS, zero );
+			const __m128i invAlphaSh = _mm_sub_epi16( v255, alphaSh );
+			__m128i c;
+			if( SRCPREMULT ) // none * premult, premult * premult: invAlphaS * dst / 255 + src
+				c = _mm_and_si128( _mm_add_epi16( div255_epi16( _mm_mullo_epi16( invAlphaSh, dh ) ), sh ), lowBytes );
+			else // none * unpremult, premult * unpremult: ( invAlphaS * dst + alphaS * src ) / 255
+				c = div255_epi16( _mm_add_epi16( _mm_mullo_epi16( invAlphaSh, dh ), _mm_mullo_epi16( alphaSh, sh ) ) );
+			if( DSTALPHA ) {
+				const __m128i invAlphaDh = _mm_sub_epi16( v255, h ? _mm_unpackhi_epi8( alphaD, zero ) : _mm_unpacklo_epi8( alphaD, zero ) );
+				const __m128i newAlpha = _mm_sub_epi16( v255, div255_epi16( _mm_mullo_epi16( invAlphaSh, invAlphaDh ) ) );
+				c = select_si128( _mm_cmpeq_epi16( newAlpha, zero ), dh, c );
+				result[h] = select_si128( alphaMask16[h], newAlpha, c );
+			}
+			else
+				result[h] = select_si128( alphaMask16[h], dh, c );
+		}
+		_mm_storeu_si128( (__m128i*)( dst + i * 4 ), _mm_packus_epi16( result[0], result[1] ) );
+	}
+	return i;
+}
+#endif
+
+template<bool DSTALPHA, bool DSTPREMULT, bool SRCPREMULT>
+struct BlendBand_u8 {
+	Surface8u			*background;
+	const Surface8u		*foreground;
+	Area				srcArea;
+	Vec2i				absOffset;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const bool SRCALPHA = true;
+		const int32_t srcRowBytes = foreground->getRowBytes();
+		const uint8_t sR = foreground->getChannelOrder().getRedOffset();
+		const uint8_t sG = foreground->getChannelOrder().getGreenOffset();
+		const uint8_t sB = foreground->getChannelOrder().getBlueOffset();
+		const uint8_t sA = foreground->getChannelOrder().getAlphaOffset();
+		const uint8_t srcInc = foreground->getPixelInc();
+		const int32_t dstRowBytes = background->getRowBytes();
+		const uint8_t dR = background->getChannelOrder().getRedOffset();
+		const uint8_t dG = background->getChannelOrder().getGreenOffset();
+		const uint8_t dB = background->getChannelOrder().getBlueOffset();
+		const uint8_t dA = DSTALPHA ? (background->getChannelOrder().getAlphaOffset()) : 0;
+		const uint8_t dstInc = background->getPixelInc();	
+		const int32_t width = srcArea.getWidth();
+#if defined( CINDER_IP_SSE2 )
+		const bool vectorize = ( ! DSTALPHA || DSTPREMULT ) && useSse2() && ( srcInc == 4 ) && ( dstInc == 4 ) && ( sR == dR ) && ( sG == dG ) && ( sB == dB );
+#endif
+
+		for( int32_t y = y1; y < y2; ++y ) {
+			const uint8_t *src = reinterpret_cast<const uint8_t*>( reinterpret_cast<const uint8_t*>( foreground->getData() + srcArea.x1 * srcInc ) + ( srcArea.y1 + y ) * srcRowBytes );
+			uint8_t *dst = reinterpret_cast<uint8_t*>( reinterpret_cast<uint8_t*>( background->getData() + absOffset.x * dstInc ) + ( y + absOffset.y ) * dstRowBytes );
+			int32_t x = 0;
+#if defined( CINDER_IP_SSE2 )
+			if( vectorize ) {
+				x = blendPixels_u8<DSTALPHA,DSTPREMULT,SRCPREMULT>( src, dst, width, sA );
+				src += x * 4;
+				dst += x * 4;
+			}
+#endif
+			for( ; x < width; ++x ) {
+				const uint8_t alphaS = (SRCALPHA) ? src[sA] : 255;
+				const uint8_t invAlphaS = (SRCALPHA) ? CHANTRAIT<uint8_t>::inverse(src[sA]) : 0;
+				const uint8_t alphaD = (DSTALPHA) ? dst[dA] : CHANTRAIT<uint8_t>::max();
+				const uint8_t invAlphaD = (DSTALPHA) ? CHANTRAIT<uint8_t>::inverse(dst[dA]) : 0;
+				if( DSTALPHA )
+					dst[dA] = 255 - invAlphaS * invAlphaD / 255;			
+				if( ( ! DSTALPHA ) || dst[dA] ) {
+					if( ! DSTALPHA && ! SRCPREMULT ) { // none * unpremult -> none
+						dst[dR] = ( invAlphaS * dst[dR] + alphaS * src[sR] ) / 255;
+						dst[dG] = ( invAlphaS * dst[dG] + alphaS * src[sG] ) / 255;
+						dst[dB] = ( invAlphaS * dst[dB] + alphaS * src[sB] ) / 255;
+					}			
+					else if( ! DSTALPHA && SRCPREMULT ) { // none * premult -> none
+						dst[dR] = invAlphaS * dst[dR] / 255 + src[sR];
+						dst[dG] = invAlphaS * dst[dG] / 255 + src[sG];
+						dst[dB] = invAlphaS * dst[dB] / 255 + src[sB];
+					}
+					else if( ! DSTPREMULT && ! SRCPREMULT ) { // unpremult * unpremult -> unpremult
+						dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) / ( 255 * dst[dA] );
+						dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) / ( 255 * dst[dA] );
+						dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) / ( 255 * dst[dA] );
+					}
+					else if( ! DSTPREMULT && SRCPREMULT ) { // unpremult * premult -> unpremult
+						dst[dR] = ( invAlphaS * alphaD * dst[dR] / 255 + invAlphaD * src[sR] + alphaD * src[sR] ) / dst[dA];
+						dst[dG] = ( invAlphaS * alphaD * dst[dG] / 255 + invAlphaD * src[sG] + alphaD * src[sG] ) / dst[dA];
+						dst[dB] = ( invAlphaS * alphaD * dst[dB] / 255 + invAlphaD * src[sB] + alphaD * src[sB] ) / dst[dA];
+					}
+					else if( DSTPREMULT && SRCPREMULT ) { // premult * premult -> premult
+						dst[dR] = ( invAlphaS * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR] ) / 255;
+						dst[dG] = ( invAlphaS * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG] ) / 255;
+						dst[dB] = ( invAlphaS * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB] ) / 255;
+					}
+					else if( DSTPREMULT && ! SRCPREMULT ) { // premult * unpremult -> premult
+						dst[dR] = ( invAlphaS * dst[dR] + ( invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) / 255 ) / 255;
+						dst[dG] = ( invAlphaS * dst[dG] + ( invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) / 255 ) / 255;
+						dst[dB] = ( invAlphaS * dst[dB] + ( invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) / 255 ) / 255;
+					}
+				}
+				src += srcInc;
+				dst += dstInc;
+			}
+		}
+	}
+};
+
 template<bool DSTALPHA, bool DSTPREMULT, bool SRCPREMULT>
 void blendImpl_u8( Surface8u *background, const Surface8u &foreground, const Area &srcArea, Vec2i absOffset )
 {
-	bool SRCALPHA = foreground.hasAlpha();
-	const int32_t srcRowBytes = foreground.getRowBytes();
-	const uint8_t sR = foreground.getChannelOrder().getRedOffset();
-	const uint8_t sG = foreground.getChannelOrder().getGreenOffset();
-	const uint8_t sB = foreground.getChannelOrder().getBlueOffset();
-	const uint8_t sA = SRCALPHA ? (foreground.getChannelOrder().getAlphaOffset()) : 0;	
-	const uint8_t srcInc = foreground.getPixelInc();
-	const int32_t dstRowBytes = background->getRowBytes();
-	const uint8_t dR = background->getChannelOrder().getRedOffset();
-	const uint8_t dG = background->getChannelOrder().getGreenOffset();
-	const uint8_t dB = background->getChannelOrder().getBlueOffset();
-	const uint8_t dA = DSTALPHA ? (background->getChannelOrder().getAlphaOffset()) : 0;
-	const uint8_t dstInc = background->getPixelInc();	
-	const int32_t width = srcArea.getWidth();
-	
-	if( ! SRCALPHA ) {// normal blend with no src alpha is a copy
+	if( ! foreground.hasAlpha() ) {// normal blend with no src alpha is a copy
 		Vec2i relativeOffset = absOffset - srcArea.getUL();
 		background->copyFrom( foreground, srcArea, relativeOffset );
 		if( DSTALPHA )
 			ip::fill( &background->getChannelAlpha(), (uint8_t)255 );
 		return;
 	}
-	
-	for( int32_t y = 0; y < srcArea.getHeight(); ++y ) {
-		const uint8_t *src = reinterpret_cast<const uint8_t*>( reinterpret_cast<const uint8_t*>( foreground.getData() + srcArea.x1 * 4 ) + ( srcArea.y1 + y ) * srcRowBytes );
-		uint8_t *dst = reinterpret_cast<uint8_t*>( reinterpret_cast<uint8_t*>( background->getData() + absOffset.x * 4 ) + ( y + absOffset.y ) * dstRowBytes );
-		for( int32_t x = 0; x < width; ++x ) {
-			const uint8_t alphaS = (SRCALPHA) ? src[sA] : 255;
-			const uint8_t invAlphaS = (SRCALPHA) ? CHANTRAIT<uint8_t>::inverse(src[sA]) : 0;
-			const uint8_t alphaD = (DSTALPHA) ? dst[dA] : CHANTRAIT<uint8_t>::max();
-			const uint8_t invAlphaD = (DSTALPHA) ? CHANTRAIT<uint8_t>::inverse(dst[dA]) : 0;
-			if( DSTALPHA )
-				dst[dA] = 255 - invAlphaS * invAlphaD / 255;			
-			if( ( ! DSTALPHA ) || dst[dA] ) {
-				if( ! DSTALPHA && ! SRCPREMULT ) { // none * unpremult -> none
-					dst[dR] = ( invAlphaS * dst[dR] + alphaS * src[sR] ) / 255;
-					dst[dG] = ( invAlphaS * dst[dG] + alphaS * src[sG] ) / 255;
-					dst[dB] = ( invAlphaS * dst[dB] + alphaS * src[sB] ) / 255;
-				}			
-				else if( ! DSTALPHA && SRCPREMULT ) { // none * premult -> none
-					dst[dR] = invAlphaS * dst[dR] / 255 + src[sR];
-					dst[dG] = invAlphaS * dst[dG] / 255 + src[sG];
-					dst[dB] = invAlphaS * dst[dB] / 255 + src[sB];
-				}
-				else if( ! DSTPREMULT && ! SRCPREMULT ) { // unpremult * unpremult -> unpremult
-					dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) / ( 255 * dst[dA] );
-					dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) / ( 255 * dst[dA] );
-					dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) / ( 255 * dst[dA] );
-				}
-				else if( ! DSTPREMULT && SRCPREMULT ) { // unpremult * premult -> unpremult
-					dst[dR] = ( invAlphaS * alphaD * dst[dR] / 255 + invAlphaD * src[sR] + alphaD * src[sR] ) / dst[dA];
-					dst[dG] = ( invAlphaS * alphaD * dst[dG] / 255 + invAlphaD * src[sG] + alphaD * src[sG] ) / dst[dA];
-					dst[dB] = ( invAlphaS * alphaD * dst[dB] / 255 + invAlphaD * src[sB] + alphaD * src[sB] ) / dst[dA];
-				}
-				else if( DSTPREMULT && SRCPREMULT ) { // premult * premult -> premult
-					dst[dR] = ( invAlphaS * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR] ) / 255;
-					dst[dG] = ( invAlphaS * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG] ) / 255;
-					dst[dB] = ( invAlphaS * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB] ) / 255;
-				}
-				else if( DSTPREMULT && ! SRCPREMULT ) { // premult * unpremult -> premult
-					dst[dR] = ( invAlphaS * dst[dR] + ( invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) / 255 ) / 255;
-					dst[dG] = ( invAlphaS * dst[dG] + ( invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) / 255 ) / 255;
-					dst[dB] = ( invAlphaS * dst[dB] + ( invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) / 255 ) / 255;
+
+	BlendBand_u8<DSTALPHA,DSTPREMULT,SRCPREMULT> band;
+	band.background = background;
+	band.foreground = &foreground;
+	band.srcArea = srcArea;
+	band.absOffset = absOffset;
+	parallelRows( 0, srcArea.getHeight(), srcArea.getWidth(), band );
+}
+
+template<bool DSTALPHA, bool DSTPREMULT, bool SRCPREMULT>
+struct BlendBand_float {
+	Surface32f			*background;
+	const Surface32f	*foreground;
+	Area				srcArea;
+	Vec2i				absOffset;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const bool SRCALPHA = true;
+		const int32_t srcRowBytes = foreground->getRowBytes();
+		const uint8_t sR = foreground->getChannelOrder().getRedOffset();
+		const uint8_t sG = foreground->getChannelOrder().getGreenOffset();
+		const uint8_t sB = foreground->getChannelOrder().getBlueOffset();
+		const uint8_t sA = foreground->getChannelOrder().getAlphaOffset();
+		const uint8_t srcInc = foreground->getPixelInc();
+		const int32_t dstRowBytes = background->getRowBytes();
+		const uint8_t dR = background->getChannelOrder().getRedOffset();
+		const uint8_t dG = background->getChannelOrder().getGreenOffset();
+		const uint8_t dB = background->getChannelOrder().getBlueOffset();
+		const uint8_t dA = DSTALPHA ? (background->getChannelOrder().getAlphaOffset()) : 0;
+		const uint8_t dstInc = background->getPixelInc();	
+		const int32_t width = srcArea.getWidth();
+
+		for( int32_t y = y1; y < y2; ++y ) {
+			const float *src = reinterpret_cast<const float*>( reinterpret_cast<const uint8_t*>( foreground->getData() + srcArea.x1 * srcInc ) + ( srcArea.y1 + y ) * srcRowBytes );
+			float *dst = reinterpret_cast<float*>( reinterpret_cast<uint8_t*>( background->getData() + absOffset.x * dstInc ) + ( y + absOffset.y ) * dstRowBytes );
+			for( int32_t x = 0; x < width; ++x ) {
+				const float alphaS = (SRCALPHA) ? src[sA] : 1;
+				const float invAlphaS = (SRCALPHA) ? CHANTRAIT<float>::inverse(src[sA]) : 0;
+				const float alphaD = (DSTALPHA) ? dst[dA] : CHANTRAIT<float>::max();
+				const float invAlphaD = (DSTALPHA) ? CHANTRAIT<float>::inverse(dst[dA]) : 0;
+				if( DSTALPHA )
+					dst[dA] = 1 - invAlphaS * invAlphaD;
+				if( ( ! DSTALPHA ) || dst[dA] ) {
+					if( ! DSTALPHA && ! SRCPREMULT ) { // none * unpremult -> none
+						dst[dR] = invAlphaS * dst[dR] + alphaS * src[sR];
+						dst[dG] = invAlphaS * dst[dG] + alphaS * src[sG];
+						dst[dB] = invAlphaS * dst[dB] + alphaS * src[sB];
+					}			
+					else if( ! DSTALPHA && SRCPREMULT ) { // none * premult -> none
+						dst[dR] = invAlphaS * dst[dR] + src[sR];
+						dst[dG] = invAlphaS * dst[dG] + src[sG];
+						dst[dB] = invAlphaS * dst[dB] + src[sB];
+					}
+					else if( ! DSTPREMULT && ! SRCPREMULT ) { // unpremult * unpremult -> unpremult
+						float invDstA = 1.0f / dst[dA];
+						dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) * invDstA;
+						dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) * invDstA;
+						dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) * invDstA;
+					}
+					else if( ! DSTPREMULT && SRCPREMULT ) { // unpremult * premult -> unpremult
+						float invDstA = 1.0f / dst[dA];
+						dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR] ) * invDstA;
+						dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG] ) * invDstA;
+						dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB] ) * invDstA;
+					}
+					else if( DSTPREMULT && SRCPREMULT ) { // premult * premult -> premult
+						dst[dR] = invAlphaS * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR];
+						dst[dG] = invAlphaS * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG];
+						dst[dB] = invAlphaS * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB];
+					}
+					else if( DSTPREMULT && ! SRCPREMULT ) { // premult * unpremult -> premult
+						dst[dR] = invAlphaS * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR];
+						dst[dG] = invAlphaS * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG];
+						dst[dB] = invAlphaS * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB];
+					}
 				}
+				src += srcInc;
+				dst += dstInc;
 			}
-			src += srcInc;
-			dst += dstInc;
 		}
 	}
-}
+};
 
 template<bool DSTALPHA, bool DSTPREMULT, bool SRCPREMULT>
 void blendImpl_float( Surface32f *background, const Surface32f &foreground, const Area &srcArea, Vec2i absOffset )
 {
-	bool SRCALPHA = foreground.hasAlpha();
-	const int32_t srcRowBytes = foreground.getRowBytes();
-	const uint8_t sR = foreground.getChannelOrder().getRedOffset();
-	const uint8_t sG = foreground.getChannelOrder().getGreenOffset();
-	const uint8_t sB = foreground.getChannelOrder().getBlueOffset();
-	const uint8_t sA = SRCALPHA ? (foreground.getChannelOrder().getAlphaOffset()) : 0;	
-	const uint8_t srcInc = foreground.getPixelInc();
-	const int32_t dstRowBytes = background->getRowBytes();
-	const uint8_t dR = background->getChannelOrder().getRedOffset();
-	const uint8_t dG = background->getChannelOrder().getGreenOffset();
-	const uint8_t dB = background->getChannelOrder().getBlueOffset();
-	const uint8_t dA = DSTALPHA ? (background->getChannelOrder().getAlphaOffset()) : 0;
-	const uint8_t dstInc = background->getPixelInc();	
-	const int32_t width = srcArea.getWidth();
-	
-	if( ! SRCALPHA ) {// normal blend with no src alpha is a copy
+	if( ! foreground.hasAlpha() ) {// normal blend with no src alpha is a copy
 		Vec2i relativeOffset = absOffset - srcArea.getUL();
 		background->copyFrom( foreground, srcArea, relativeOffset );
 		if( DSTALPHA )
 			ip::fill( &background->getChannelAlpha(), 1.0f );
 		return;
 	}
-	
-	for( int32_t y = 0; y < srcArea.getHeight(); ++y ) {
-		const float *src = reinterpret_cast<const float*>( reinterpret_cast<const uint8_t*>( foreground.getData() + srcArea.x1 * 4 ) + ( srcArea.y1 + y ) * srcRowBytes );
-		float *dst = reinterpret_cast<float*>( reinterpret_cast<uint8_t*>( background->getData() + absOffset.x * 4 ) + ( y + absOffset.y ) * dstRowBytes );
-		for( int32_t x = 0; x < width; ++x ) {
-			const float alphaS = (SRCALPHA) ? src[sA] : 1;
-			const float invAlphaS = (SRCALPHA) ? CHANTRAIT<float>::inverse(src[sA]) : 0;
-			const float alphaD = (DSTALPHA) ? dst[dA] : CHANTRAIT<float>::max();
-			const float invAlphaD = (DSTALPHA) ? CHANTRAIT<float>::inverse(dst[dA]) : 0;
-			if( DSTALPHA )
-				dst[dA] = 1 - invAlphaS * invAlphaD;
-			if( ( ! DSTALPHA ) || dst[dA] ) {
-				if( ! DSTALPHA && ! SRCPREMULT ) { // none * unpremult -> none
-					dst[dR] = invAlphaS * dst[dR] + alphaS * src[sR];
-					dst[dG] = invAlphaS * dst[dG] + alphaS * src[sG];
-					dst[dB] = invAlphaS * dst[dB] + alphaS * src[sB];
-				}			
-				else if( ! DSTALPHA && SRCPREMULT ) { // none * premult -> none
-					dst[dR] = invAlphaS * dst[dR] + src[sR];
-					dst[dG] = invAlphaS * dst[dG] + src[sG];
-					dst[dB] = invAlphaS * dst[dB] + src[sB];
-				}
-				else if( ! DSTPREMULT && ! SRCPREMULT ) { // unpremult * unpremult -> unpremult
-					float invDstA = 1.0f / dst[dA];
-					dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR] ) * invDstA;
-					dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG] ) * invDstA;
-					dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB] ) * invDstA;
-				}
-				else if( ! DSTPREMULT && SRCPREMULT ) { // unpremult * premult -> unpremult
-					float invDstA = 1.0f / dst[dA];
-					dst[dR] = ( invAlphaS * alphaD * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR] ) * invDstA;
-					dst[dG] = ( invAlphaS * alphaD * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG] ) * invDstA;
-					dst[dB] = ( invAlphaS * alphaD * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB] ) * invDstA;
-				}
-				else if( DSTPREMULT && SRCPREMULT ) { // premult * premult -> premult
-					dst[dR] = invAlphaS * dst[dR] + invAlphaD * src[sR] + alphaD * src[sR];
-					dst[dG] = invAlphaS * dst[dG] + invAlphaD * src[sG] + alphaD * src[sG];
-					dst[dB] = invAlphaS * dst[dB] + invAlphaD * src[sB] + alphaD * src[sB];
-				}
-				else if( DSTPREMULT && ! SRCPREMULT ) { // premult * unpremult -> premult
-					dst[dR] = invAlphaS * dst[dR] + invAlphaD * alphaS * src[sR] + alphaD * alphaS * src[sR];
-					dst[dG] = invAlphaS * dst[dG] + invAlphaD * alphaS * src[sG] + alphaD * alphaS * src[sG];
-					dst[dB] = invAlphaS * dst[dB] + invAlphaD * alphaS * src[sB] + alphaD * alphaS * src[sB];
-				}
-			}
-			src += srcInc;
-			dst += dstInc;
-		}
-	}
+
+	BlendBand_float<DSTALPHA,DSTPREMULT,SRCPREMULT> band;
+	band.background = background;
+	band.foreground = &foreground;
+	band.srcArea = srcArea;
+	band.absOffset = absOffset;
+	parallelRows( 0, srcArea.getHeight(), srcArea.getWidth(), band );
 }
 
 void blend( Surface8u *background, const Surface8u &foreground, const Area &srcArea, const Vec2i &dstRelativeOffset )
@@ -23,6 +23,8 @@
 #include "cinder/ip/EdgeDetect.h"
 #include "cinder/Surface.h"
 #include "cinder/CinderMath.h"
+#include "cinder/ChanTraits.h"
+#include "cinder/ip/Parallel.h"
 
 namespace cinder { namespace ip {
 
@@ -32,42 +34,158 @@ namespace cinder { namespace ip {
 // -1  0  1    -1 -2 -1
 // NOTE: this leaves garbage in the top and bottom rows, as well as the left and right columns
 
+// filters count values of a row which are srcInc apart, writing them dstInc apart. The horizontal neighbours of a value are step values away
+template<typename T>
+void sobelStrided( const T *above, const T *center, const T *below, int32_t step, int32_t srcInc, T *dst, int32_t dstInc, int32_t count )
+{
+	typedef typename CHANTRAIT<T>::SignedSum S;
+	const T maxValue = CHANTRAIT<T>::max();
+	for( int32_t i = 0; i < count; ++i ) {
+		const S sumX = -above[-step] + above[step] - 2 * center[-step] + 2 * center[step] - below[-step] + below[step];
+		const S sumY = above[-step] + 2 * above[0] + above[step] - below[-step] - 2 * below[0] - below[step];
+		const S magnitude = static_cast<S>( math<float>::sqrt( float( sumX * sumX + sumY * sumY ) ) );
+		*dst = ( magnitude > maxValue ) ? maxValue : static_cast<T>( magnitude );
+		above += srcInc; center += srcInc; below += srcInc;
+		dst += dstInc;
+	}
+}
+
+// filters count consecutive values of a row, the horizontal neighbours of a value are step values away
+template<typename T>
+void sobelValues( const T *above, const T *center, const T *below, int32_t step, T *dst, int32_t count )
+{
+	sobelStrided( above, center, below, step, 1, dst, 1, count );
+}
+
+#if defined( CINDER_IP_SSE2 )
+template<>
+void sobelValues<uint8_t>( const uint8_t *above, const uint8_t *center, const uint8_t *below, int32_t step, uint8_t *dst, int32_t count )
+{
+	int32_t i = 0;
+	if( useSse2() ) {
+		const __m128i zero = _mm_setzero_si128();
+		for( ; i + 8 <= count; i += 8 ) {
+			const __m128i a0 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( above + i - step ) ), zero );
+			const __m128i a1 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( above + i ) ), zero );
+			const __m128i a2 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( above + i + step ) ), zero );
+			const __m128i c0 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( center + i - step ) ), zero );
+			const __m128i c2 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( center + i + step ) ), zero );
+			const __m128i b0 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( below + i - step ) ), zero );
+			const __m128i b1 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( below + i ) ), zero );
+			const __m128i b2 = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)( below + i + step ) ), zero );
+			const __m128i sumX = _mm_add_epi16( _mm_add_epi16( _mm_sub_epi16( a2, a0 ), _mm_sub_epi16( b2, b0 ) ), _mm_slli_epi16( _mm_sub_epi16( c2, c0 ), 1 ) );
+			const __m128i sumY = _mm_sub_epi16( _mm_add_epi16( _mm_add_epi16( a0, a2 ), _mm_slli_epi16( a1, 1 ) ), _mm_add_epi16( _mm_add_epi16( b0, b2 ), _mm_slli_epi16( b1, 1 ) ) );
+			// madd of the interleaved sums gives sumX^2 + sumY^2 in 32 bits, exact as in the float of the scalar code
+			const __m128i lo = _mm_unpacklo_epi16( sumX, sumY ), hi = _mm_unpackhi_epi16( sumX, sumY );
+			const __m128i magLo = _mm_cvttps_epi32( _mm_sqrt_ps( _mm_cvtepi32_ps( _mm_madd_epi16( lo, lo ) ) ) );
+			const __m128i magHi = _mm_cvttps_epi32( _mm_sqrt_ps( _mm_cvtepi32_ps( _mm_madd_epi16( hi, hi ) ) ) );
+			const __m128i mag = _mm_packs_epi32( magLo, magHi );
+			_mm_storel_epi64( (__m128i*)( dst + i ), _mm_packus_epi16( mag, mag ) );
+		}
+	}
+	sobelStrided( above + i, center + i, below + i, step, 1, dst + i, 1, count - i );
+}
+
+template<>
+void sobelValues<float>( const float *above, const float *center, const float *below, int32_t step, float *dst, int32_t count )
+{
+	int32_t i = 0;
+	if( useSse2() ) {
+		const __m128 two = _mm_set1_ps( 2.0f ), maxValue = _mm_set1_ps( CHANTRAIT<float>::max() );
+		for( ; i + 4 <= count; i += 4 ) {
+			const __m128 a0 = _mm_loadu_ps( above + i - step ), a1 = _mm_loadu_ps( above + i ), a2 = _mm_loadu_ps( above + i + step );
+			const __m128 c0 = _mm_loadu_ps( center + i - step ), c2 = _mm_loadu_ps( center + i + step );
+			const __m128 b0 = _mm_loadu_ps( below + i - step ), b1 = _mm_loadu_ps( below + i ), b2 = _mm_loadu_ps( below + i + step );
+			// summed in the order of the scalar code so the results match
+			__m128 sumX = _mm_sub_ps( a2, a0 );
+			sumX = _mm_sub_ps( sumX, _mm_mul_ps( two, c0 ) );
+			sumX = _mm_add_ps( sumX, _mm_mul_ps( two, c2 ) );
+			sumX = _mm_add_ps( _mm_sub_ps( sumX, b0 ), b2 );
+			__m128 sumY = _mm_add_ps( _mm_add_ps( a0, _mm_mul_ps( two, a1 ) ), a2 );
+			sumY = _mm_sub_ps( _mm_sub_ps( sumY, b0 ), _mm_mul_ps( two, b1 ) );
+			sumY = _mm_sub_ps( sumY, b2 );
+			const __m128 magnitude = _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( sumX, sumX ), _mm_mul_ps( sumY, sumY ) ) );
+			_mm_storeu_ps( dst + i, _mm_min_ps( magnitude, maxValue ) );
+		}
+	}
+	sobelStrided( above + i, center + i, below + i, step, 1, dst + i, 1, count - i );
+}
+#endif
+
+// the rows of the source area between y1 and y2 whose neighbours are all inside it. Either a channel
+// or, with step set to the pixel size, every channel of an interleaved surface at once
+template<typename T>
+struct SobelBand {
+	const uint8_t	*srcData;
+	int32_t			srcRowBytes;
+	int8_t			srcInc;
+	uint8_t			*dstData;
+	int32_t			dstRowBytes;
+	int8_t			dstInc;
+	int32_t			width;		// pixels of each row, including the left and right columns
+	int32_t			step;		// values per pixel if the rows are processed as a whole, 0 otherwise
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		for( int32_t y = y1; y < y2; ++y ) {
+			const T *src = reinterpret_cast<const T*>( srcData + y * srcRowBytes ) + srcInc;
+			T *dst = reinterpret_cast<T*>( dstData + y * dstRowBytes ) + dstInc;
+			const T *above = reinterpret_cast<const T*>( reinterpret_cast<const uint8_t*>( src ) - srcRowBytes );
+			const T *below = reinterpret_cast<const T*>( reinterpret_cast<const uint8_t*>( src ) + srcRowBytes );
+			if( step ) {
+				sobelValues( above, src, below, step, dst, ( width - 2 ) * step );
+				continue;
+			}
+			sobelStrided( above, src, below, srcInc, srcInc, dst, dstInc, width - 2 );
+		}
+	}
+};
+
 template<typename T>
 void edgeDetectSobel( const ChannelT<T> &srcChannel, const Area &srcArea, const Vec2i &dstLT, ChannelT<T> *dstChannel )
 {
 	std::pair<Area,Vec2i> srcDst = clippedSrcDst( srcChannel.getBounds(), srcArea, dstChannel->getBounds(), dstLT );
 	const Area &area( srcDst.first );
 	const Vec2i &dstOffset( srcDst.second );
-	typename CHANTRAIT<T>::Sum sumX, sumY;
 
-	int32_t srcRowBytes = srcChannel.getRowBytes();
-	int8_t srcPixelBytes = srcChannel.getIncrement() * sizeof(T);
-	int8_t dstPixelBytes = dstChannel->getIncrement() * sizeof(T);
-	const T maxValue = CHANTRAIT<T>::max();
-	for( int32_t y = 1; y < area.getHeight() - 1; ++y ) {
-		const uint8_t *srcLine = reinterpret_cast<const uint8_t*>( srcChannel.getData( area.getX1() + 1, area.getY1() + y ) );
-		uint8_t *dstLine = reinterpret_cast<uint8_t*>( dstChannel->getData( dstOffset.x + area.getX1() + 1, dstOffset.y + y ) );
-		for( int32_t x = area.getX1() + 1; x < area.getX2() - 1; ++x ) {
-//			sumX = -srcLine[-srcRowPixels-srcPixelStride] + srcLine[-srcRowPixels+srcPixelStride] - 2 * srcLine[-srcPixelStride] + 2 * srcLine[srcPixelStride] - srcLine[srcRowPixels-srcPixelStride] + srcLine[srcRowPixels+srcPixelStride];
-			sumX = -*(T*)(srcLine-srcRowBytes-srcPixelBytes) + *(T*)(srcLine-srcRowBytes+srcPixelBytes) - 2 * *(T*)(srcLine-srcPixelBytes) + 2 * *(T*)(srcLine+srcPixelBytes) - *(T*)(srcLine+srcRowBytes-srcPixelBytes) + *(T*)(srcLine+srcRowBytes+srcPixelBytes);
-//			sumY = srcLine[-srcRowPixels-srcPixelStride] + 2 * srcLine[-srcRowPixels] + srcLine[-srcRowPixels + srcPixelStride]				- srcLine[srcRowPixels-srcPixelStride] - 2 * srcLine[srcRowPixels] - srcLine[srcRowPixels+srcPixelStride];
-			sumY = *(T*)(srcLine-srcRowBytes-srcPixelBytes) + 2 * *(T*)(srcLine-srcRowBytes) + *(T*)(srcLine-srcRowBytes+srcPixelBytes) - *(T*)(srcLine+srcRowBytes-srcPixelBytes) - 2 * *(T*)(srcLine+srcPixelBytes) - *(T*)(srcLine+srcRowBytes+srcPixelBytes);
-			sumX = static_cast<typename CHANTRAIT<T>::Sum>( math<float>::sqrt( float( sumX * sumX + sumY * sumY ) ) );
-			if( sumX > maxValue ) sumX = maxValue;
-			*dstLine = static_cast<uint8_t>( sumX );
-			dstLine += dstPixelBytes;
-			srcLine += srcPixelBytes;
-		}
-	}
+	SobelBand<T> band;
+	band.srcData = reinterpret_cast<const uint8_t*>( srcChannel.getData( area.getUL() ) );
+	band.srcRowBytes = srcChannel.getRowBytes();
+	band.srcInc = srcChannel.getIncrement();
+	band.dstData = reinterpret_cast<uint8_t*>( dstChannel->getData( dstOffset ) );
+	band.dstRowBytes = dstChannel->getRowBytes();
+	band.dstInc = dstChannel->getIncrement();
+	band.width = area.getWidth();
+	band.step = ( band.srcInc == 1 && band.dstInc == 1 ) ? 1 : 0;
+	parallelRows( 1, area.getHeight() - 1, area.getWidth(), band );
 }
 
 template<typename T>
 void edgeDetectSobel( const SurfaceT<T> &srcSurface, const Area &srcArea, const Vec2i &dstLT, SurfaceT<T> *dstSurface )
 {
+	// the same layout without a padding channel lets every channel be filtered in one pass
+	const bool alpha = srcSurface.hasAlpha() && dstSurface->hasAlpha();
+	if( ( srcSurface.getChannelOrder() == dstSurface->getChannelOrder() ) && ( alpha || srcSurface.getPixelInc() == 3 ) ) {
+		std::pair<Area,Vec2i> srcDst = clippedSrcDst( srcSurface.getBounds(), srcArea, dstSurface->getBounds(), dstLT );
+		const Area &area( srcDst.first );
+
+		SobelBand<T> band;
+		band.srcData = reinterpret_cast<const uint8_t*>( srcSurface.getData( area.getUL() ) );
+		band.srcRowBytes = srcSurface.getRowBytes();
+		band.srcInc = srcSurface.getPixelInc();
+		band.dstData = reinterpret_cast<uint8_t*>( dstSurface->getData( srcDst.second ) );
+		band.dstRowBytes = dstSurface->getRowBytes();
+		band.dstInc = dstSurface->getPixelInc();
+		band.width = area.getWidth();
+		band.step = band.srcInc;
+		parallelRows( 1, area.getHeight() - 1, area.getWidth() * band.step, band );
+		return;
+	}
+
 	edgeDetectSobel( srcSurface.getChannelRed(), srcArea, dstLT, &dstSurface->getChannelRed() );
 	edgeDetectSobel( srcSurface.getChannelGreen(), srcArea, dstLT, &dstSurface->getChannelGreen() );
 	edgeDetectSobel( srcSurface.getChannelBlue(), srcArea, dstLT, &dstSurface->getChannelBlue() );
-	if( srcSurface.hasAlpha() && dstSurface->hasAlpha() )
+	if( alpha )
 		edgeDetectSobel( srcSurface.getChannelAlpha(), srcArea, dstLT, &dstSurface->getChannelAlpha() );
 }
 
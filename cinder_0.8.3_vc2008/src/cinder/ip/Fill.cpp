@@ -21,27 +21,91 @@
 */
 
 #include "cinder/ip/Fill.h"
+#include "cinder/ip/Parallel.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace cinder { namespace ip {
 
+// Fills rows with a pixel. Pixels which are overwritten whole are copied from the start of the row in
+// doubling runs, a pixel of 4 values with one of them kept (the alpha of a ColorT fill) is blended in 16 bytes at a time.
+template<typename T>
+struct FillBand {
+	uint8_t		*data;
+	int32_t		rowBytes;
+	int32_t		width;
+	uint8_t		pixelInc;
+	T			pixel[4];
+	int8_t		keepOffset;		// the value of each pixel left alone, or -1
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		const int32_t count = width * pixelInc;
+		for( int32_t y = y1; y < y2; ++y ) {
+			T *dstPtr = reinterpret_cast<T*>( data + y * rowBytes );
+			if( keepOffset < 0 ) {
+				for( uint8_t c = 0; c < pixelInc && c < count; ++c )
+					dstPtr[c] = pixel[c];
+				for( int32_t done = pixelInc; done < count; done *= 2 )
+					memcpy( dstPtr + done, dstPtr, std::min( done, count - done ) * sizeof(T) );
+				continue;
+			}
+
+			int32_t i = 0;
+#if defined( CINDER_IP_SSE2 )
+			if( useSse2() && ( pixelInc == 4 ) ) {
+				// 16 bytes hold a whole number of pixels for every channel type
+				T pattern[16 / sizeof(T)], keep[16 / sizeof(T)];
+				for( size_t k = 0; k < 16 / sizeof(T); ++k ) {
+					pattern[k] = ( (int8_t)( k % 4 ) == keepOffset ) ? 0 : pixel[k % 4];
+					memset( &keep[k], ( (int8_t)( k % 4 ) == keepOffset ) ? 0xFF : 0, sizeof(T) );
+				}
+				const __m128i patternV = _mm_loadu_si128( (const __m128i*)pattern ), keepV = _mm_loadu_si128( (const __m128i*)keep );
+				for( ; ( i + (int32_t)( 16 / sizeof(T) ) ) <= count; i += 16 / sizeof(T) ) {
+					const __m128i d = _mm_loadu_si128( (const __m128i*)( dstPtr + i ) );
+					_mm_storeu_si128( (__m128i*)( dstPtr + i ), _mm_or_si128( _mm_and_si128( keepV, d ), patternV ) );
+				}
+			}
+#endif
+			const int8_t o0 = ( keepOffset == 0 ) ? 1 : 0, o1 = ( keepOffset <= 1 ) ? 2 : 1, o2 = ( keepOffset <= 2 ) ? 3 : 2;
+			for( ; i < count; i += pixelInc ) {
+				dstPtr[i + o0] = pixel[o0];
+				dstPtr[i + o1] = pixel[o1];
+				dstPtr[i + o2] = pixel[o2];
+			}
+		}
+	}
+};
+
+template<typename T>
+void fillRows( SurfaceT<T> *surface, const Area &clippedArea, const T pixel[4], int8_t keepOffset )
+{
+	FillBand<T> band;
+	band.data = reinterpret_cast<uint8_t*>( surface->getData( clippedArea.getUL() ) );
+	band.rowBytes = surface->getRowBytes();
+	band.width = clippedArea.getWidth();
+	band.pixelInc = surface->getPixelInc();
+	for( int c = 0; c < 4; ++c )
+		band.pixel[c] = pixel[c];
+	band.keepOffset = keepOffset;
+	parallelRows( 0, clippedArea.getHeight(), clippedArea.getWidth(), band );
+}
+
 template<typename T>
 void fill_impl( SurfaceT<T> *surface, const ColorT<T> &color, const Area &area )
 {
 	const Area clippedArea = area.getClipBy( surface->getBounds() );
+	if( clippedArea.calcArea() <= 0 )
+		return;
 
-	int32_t rowBytes = surface->getRowBytes();
-	uint8_t pixelInc = surface->getPixelInc();
-	const T red = color.r, green = color.g, blue = color.b;
-	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			dstPtr[redOffset] = red;
-			dstPtr[greenOffset] = green;
-			dstPtr[blueOffset] = blue;
-			dstPtr += pixelInc;
-		}
-	}
+	// a fourth value - alpha or padding - is left as it is
+	T pixel[4] = { 0, 0, 0, 0 };
+	pixel[surface->getRedOffset()] = color.r;
+	pixel[surface->getGreenOffset()] = color.g;
+	pixel[surface->getBlueOffset()] = color.b;
+	const int8_t keepOffset = ( surface->getPixelInc() == 4 ) ? ( 6 - surface->getRedOffset() - surface->getGreenOffset() - surface->getBlueOffset() ) : -1;
+	fillRows( surface, clippedArea, pixel, keepOffset );
 }
 
 template<typename T>
@@ -54,21 +118,15 @@ void fill_impl( SurfaceT<T> *surface, const ColorAT<T> &color, const Area &area
 	}
 	
 	const Area clippedArea = area.getClipBy( surface->getBounds() );
+	if( clippedArea.calcArea() <= 0 )
+		return;
 
-	int32_t rowBytes = surface->getRowBytes();
-	uint8_t pixelInc = surface->getPixelInc();
-	const T red = color.r, green = color.g, blue = color.b, alpha = color.a;
-	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset(), alphaOffset = surface->getAlphaOffset();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			dstPtr[redOffset] = red;
-			dstPtr[greenOffset] = green;
-			dstPtr[blueOffset] = blue;
-			dstPtr[alphaOffset] = alpha;
-			dstPtr += pixelInc;
-		}
-	}
+	T pixel[4];
+	pixel[surface->getRedOffset()] = color.r;
+	pixel[surface->getGreenOffset()] = color.g;
+	pixel[surface->getBlueOffset()] = color.b;
+	pixel[surface->getAlphaOffset()] = color.a;
+	fillRows( surface, clippedArea, pixel, -1 );
 }
 
 template<typename T, typename Y>
@@ -99,20 +157,47 @@ void fill( SurfaceT<T> *surface, const ColorAT<Y> &color, const Area &area )
 	fill_impl( surface, nativeColor, area );
 }
 
+template<typename T>
+struct FillChannelBand {
+	uint8_t		*data;
+	int32_t		rowBytes;
+	int32_t		width;
+	uint8_t		inc;
+	T			value;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		for( int32_t y = y1; y < y2; ++y ) {
+			T *dstPtr = reinterpret_cast<T*>( data + y * rowBytes );
+			if( inc == 1 ) {
+				dstPtr[0] = value;
+				for( int32_t done = 1; done < width; done *= 2 )
+					memcpy( dstPtr + done, dstPtr, std::min( done, width - done ) * sizeof(T) );
+			}
+			else {
+				for( int32_t x = 0; x < width; ++x ) {
+					*dstPtr = value;
+					dstPtr += inc;
+				}
+			}
+		}
+	}
+};
+
 template<typename T>
 void fill( ChannelT<T> *channel, T value, const Area &area )
 {
 	const Area clippedArea = area.getClipBy( channel->getBounds() );
-	
-	int32_t rowBytes = channel->getRowBytes();
-	uint8_t inc = channel->getIncrement();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( channel->getData() + clippedArea.getX1() * inc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			*dstPtr = value;
-			dstPtr += inc;
-		}
-	}	
+	if( clippedArea.calcArea() <= 0 )
+		return;
+
+	FillChannelBand<T> band;
+	band.data = reinterpret_cast<uint8_t*>( channel->getData( clippedArea.getUL() ) );
+	band.rowBytes = channel->getRowBytes();
+	band.width = clippedArea.getWidth();
+	band.inc = channel->getIncrement();
+	band.value = value;
+	parallelRows( 0, clippedArea.getHeight(), clippedArea.getWidth(), band );
 }
 
 template<typename T>
@@ -22,75 +22,216 @@
 
 #include "cinder/ip/Grayscale.h"
 #include "cinder/ChanTraits.h"
+#include "cinder/ip/Parallel.h"
 
 namespace cinder { namespace ip {
 
+// The rows of a surface -> surface or surface -> channel conversion. Each row goes through
+// grayscaleRow(), which the SSE2 versions below replace for 4 channel Surface8u and Surface32f.
 template<typename T>
-void grayscale( const SurfaceT<T> &srcSurface, SurfaceT<T> *dstSurface )
-{
-	Area area = srcSurface.getBounds().getClipBy( dstSurface->getBounds() );
+struct GrayscaleBand {
+	const SurfaceT<T>	*src;
+	SurfaceT<T>			*dstSurface;
+	ChannelT<T>			*dstChannel;
+	Area				area;
 
+	void operator()( int32_t y1, int32_t y2 ) const;
+};
+
+template<typename T>
+void grayscaleRowScalar( const SurfaceT<T> &srcSurface, const T *srcPtr, SurfaceT<T> *dstSurface, T *dstPtr, int32_t width )
+{
 	int8_t srcPixelInc = srcSurface.getPixelInc();
 	uint8_t srcRedOffset = srcSurface.getRedOffset(), srcGreenOffset = srcSurface.getGreenOffset(), srcBlueOffset = srcSurface.getBlueOffset();
 	uint8_t dstRedOffset = dstSurface->getRedOffset(), dstGreenOffset = dstSurface->getGreenOffset(), dstBlueOffset = dstSurface->getBlueOffset();	
 	int8_t dstPixelInc = dstSurface->getPixelInc();
-	for( int32_t y = 0; y < area.getHeight(); ++y ) {
-		T *dstPtr = dstSurface->getData( Vec2i( area.getX1(), y ) );
-		const T *srcPtr = srcSurface.getData( Vec2i( area.getX1(), y ) );
-		for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
-			T gray = CHANTRAIT<T>::grayscale( srcPtr[srcRedOffset], srcPtr[srcGreenOffset], srcPtr[srcBlueOffset] );
-			dstPtr[dstRedOffset] = gray;
-			dstPtr[dstGreenOffset] = gray;
-			dstPtr[dstBlueOffset] = gray;
-			dstPtr += dstPixelInc;
-			srcPtr += srcPixelInc;
-		}
+	for( int32_t x = 0; x < width; ++x ) {
+		T gray = CHANTRAIT<T>::grayscale( srcPtr[srcRedOffset], srcPtr[srcGreenOffset], srcPtr[srcBlueOffset] );
+		dstPtr[dstRedOffset] = gray;
+		dstPtr[dstGreenOffset] = gray;
+		dstPtr[dstBlueOffset] = gray;
+		dstPtr += dstPixelInc;
+		srcPtr += srcPixelInc;
 	}
 }
 
 template<typename T>
-void grayscale( const SurfaceT<T> &srcSurface, ChannelT<T> *dstChannel )
+void grayscaleRowScalar( const SurfaceT<T> &srcSurface, const T *srcPtr, ChannelT<T> *dstChannel, T *dstPtr, int32_t width )
 {
-	Area area = srcSurface.getBounds().getClipBy( dstChannel->getBounds() );
-
 	int8_t srcPixelInc = srcSurface.getPixelInc();
 	uint8_t srcRedOffset = srcSurface.getRedOffset(), srcGreenOffset = srcSurface.getGreenOffset(), srcBlueOffset = srcSurface.getBlueOffset();
 	int8_t dstPixelInc = dstChannel->getIncrement();
-	for( int32_t y = 0; y < area.getHeight(); ++y ) {
-		T *dstPtr = dstChannel->getData( Vec2i( area.getX1(), y ) );
-		const T *srcPtr = srcSurface.getData( Vec2i( area.getX1(), y ) );
-		for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
-			*dstPtr = CHANTRAIT<T>::grayscale( srcPtr[srcRedOffset], srcPtr[srcGreenOffset], srcPtr[srcBlueOffset] );
-			dstPtr += dstPixelInc;
-			srcPtr += srcPixelInc;
-		}
+	for( int32_t x = 0; x < width; ++x ) {
+		*dstPtr = CHANTRAIT<T>::grayscale( srcPtr[srcRedOffset], srcPtr[srcGreenOffset], srcPtr[srcBlueOffset] );
+		dstPtr += dstPixelInc;
+		srcPtr += srcPixelInc;
 	}
 }
 
-template<>
-void grayscale( const Surface8u &srcSurface, Channel8u *dstChannel )
+template<typename T>
+void grayscaleRow( const SurfaceT<T> &srcSurface, const T *srcPtr, SurfaceT<T> *dstSurface, T *dstPtr, int32_t width )
 {
-	Area area = srcSurface.getBounds().getClipBy( dstChannel->getBounds() );
+	grayscaleRowScalar( srcSurface, srcPtr, dstSurface, dstPtr, width );
+}
 
+template<typename T>
+void grayscaleRow( const SurfaceT<T> &srcSurface, const T *srcPtr, ChannelT<T> *dstChannel, T *dstPtr, int32_t width )
+{
+	grayscaleRowScalar( srcSurface, srcPtr, dstChannel, dstPtr, width );
+}
+
+template<>
+void grayscaleRow( const Surface8u &srcSurface, const uint8_t *srcPtr, Channel8u *dstChannel, uint8_t *dstPtr, int32_t width )
+{
 	int8_t srcPixelInc = srcSurface.getPixelInc();
 	uint8_t srcRedOffset = srcSurface.getRedOffset(), srcGreenOffset = srcSurface.getGreenOffset(), srcBlueOffset = srcSurface.getBlueOffset();
 	int8_t dstPixelInc = dstChannel->getIncrement();
 	const uint8_t redWeight = 74, greenWeight = 147, blueWeight = 35;
-	for( int32_t y = 0; y < area.getHeight(); ++y ) {
-		uint8_t *dstPtr = dstChannel->getData( Vec2i( area.getX1(), y ) );
-		const uint8_t *srcPtr = srcSurface.getData( Vec2i( area.getX1(), y ) );
-		for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
-			uint32_t sum = srcPtr[srcRedOffset] * redWeight + srcPtr[srcGreenOffset] * greenWeight + srcPtr[srcBlueOffset] * blueWeight;
-			*dstPtr = static_cast<uint8_t>( sum >> 8 );
-			dstPtr += dstPixelInc;
-			srcPtr += srcPixelInc;
+	int32_t x = 0;
+#if defined( CINDER_IP_SSE2 )
+	if( useSse2() && ( srcPixelInc == 4 ) && ( dstPixelInc == 1 ) ) {
+		// a madd per pair of channels, then the two halves of every pixel added up
+		int16_t weights[4] = { 0, 0, 0, 0 };
+		weights[srcRedOffset] = redWeight; weights[srcGreenOffset] = greenWeight; weights[srcBlueOffset] = blueWeight;
+		const __m128i w = _mm_setr_epi16( weights[0], weights[1], weights[2], weights[3], weights[0], weights[1], weights[2], weights[3] );
+		const __m128i zero = _mm_setzero_si128();
+		for( ; x + 8 <= width; x += 8 ) {
+			__m128i sums[4];
+			for( int k = 0; k < 2; ++k ) {
+				const __m128i px = _mm_loadu_si128( (const __m128i*)( srcPtr + x * 4 + k * 16 ) );
+				const __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8( px, zero ), w ), hi = _mm_madd_epi16( _mm_unpackhi_epi8( px, zero ), w );
+				sums[k * 2] = lo; sums[k * 2 + 1] = hi;
+			}
+			// every pixel is now two adjacent 32 bit lanes, sum them and shift
+			__m128i gray[2];
+			for( int k = 0; k < 2; ++k ) {
+				const __m128i a = sums[k * 2], b = sums[k * 2 + 1];
+				const __m128i even = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( a ), _mm_castsi128_ps( b ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+				const __m128i odd = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( a ), _mm_castsi128_ps( b ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+				gray[k] = _mm_srli_epi32( _mm_add_epi32( even, odd ), 8 );
+			}
+			const __m128i packed = _mm_packs_epi32( gray[0], gray[1] );
+			_mm_storel_epi64( (__m128i*)( dstPtr + x ), _mm_packus_epi16( packed, packed ) );
+		}
+		srcPtr += x * 4;
+		dstPtr += x;
+	}
+#endif
+	for( ; x < width; ++x ) {
+		uint32_t sum = srcPtr[srcRedOffset] * redWeight + srcPtr[srcGreenOffset] * greenWeight + srcPtr[srcBlueOffset] * blueWeight;
+		*dstPtr = static_cast<uint8_t>( sum >> 8 );
+		dstPtr += dstPixelInc;
+		srcPtr += srcPixelInc;
+	}
+}
+
+#if defined( CINDER_IP_SSE2 )
+template<>
+void grayscaleRow( const Surface8u &srcSurface, const uint8_t *srcPtr, Surface8u *dstSurface, uint8_t *dstPtr, int32_t width )
+{
+	int32_t x = 0;
+	if( useSse2() && ( srcSurface.getPixelInc() == 4 ) && ( dstSurface->getPixelInc() == 4 ) ) {
+		// CHANTRAIT<uint8_t>::grayscale() with the weights laid out like the source channels
+		int16_t weights[4] = { 0, 0, 0, 0 };
+		weights[srcSurface.getRedOffset()] = 54; weights[srcSurface.getGreenOffset()] = 183; weights[srcSurface.getBlueOffset()] = 19;
+		const __m128i w = _mm_setr_epi16( weights[0], weights[1], weights[2], weights[3], weights[0], weights[1], weights[2], weights[3] );
+		const __m128i zero = _mm_setzero_si128();
+		// the fourth byte of the destination is left alone
+		const uint8_t dstKeep = 6 - dstSurface->getRedOffset() - dstSurface->getGreenOffset() - dstSurface->getBlueOffset();
+		const __m128i keepMask = _mm_set1_epi32( 0xFF << ( dstKeep * 8 ) );
+		for( ; x + 4 <= width; x += 4 ) {
+			const __m128i px = _mm_loadu_si128( (const __m128i*)( srcPtr + x * 4 ) );
+			const __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8( px, zero ), w ), hi = _mm_madd_epi16( _mm_unpackhi_epi8( px, zero ), w );
+			const __m128i even = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+			const __m128i odd = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+			__m128i gray = _mm_srli_epi32( _mm_add_epi32( even, odd ), 8 );
+			gray = _mm_or_si128( gray, _mm_slli_epi32( gray, 8 ) );
+			gray = _mm_or_si128( gray, _mm_slli_epi32( gray, 16 ) );
+			const __m128i d = _mm_loadu_si128( (const __m128i*)( dstPtr + x * 4 ) );
+			_mm_storeu_si128( (__m128i*)( dstPtr + x * 4 ), select_si128( keepMask, d, gray ) );
+		}
+	}
+	grayscaleRowScalar( srcSurface, srcPtr + x * srcSurface.getPixelInc(), dstSurface, dstPtr + x * dstSurface->getPixelInc(), width - x );
+}
+
+// 4 pixels of 4 floats transposed into a vector per channel
+static inline __m128 grayscale4( const float *srcPtr, uint8_t redOffset, uint8_t greenOffset, uint8_t blueOffset )
+{
+	__m128 ch[4] = { _mm_loadu_ps( srcPtr ), _mm_loadu_ps( srcPtr + 4 ), _mm_loadu_ps( srcPtr + 8 ), _mm_loadu_ps( srcPtr + 12 ) };
+	_MM_TRANSPOSE4_PS( ch[0], ch[1], ch[2], ch[3] );
+	// same order of operations as CHANTRAIT<float>::grayscale()
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ch[redOffset], _mm_set1_ps( 0.2126f ) ), _mm_mul_ps( ch[greenOffset], _mm_set1_ps( 0.7152f ) ) ), _mm_mul_ps( ch[blueOffset], _mm_set1_ps( 0.0722f ) ) );
+}
+
+template<>
+void grayscaleRow( const Surface32f &srcSurface, const float *srcPtr, Surface32f *dstSurface, float *dstPtr, int32_t width )
+{
+	int32_t x = 0;
+	if( useSse2() && ( srcSurface.getPixelInc() == 4 ) ) {
+		const int8_t dstPixelInc = dstSurface->getPixelInc();
+		const uint8_t dstRedOffset = dstSurface->getRedOffset(), dstGreenOffset = dstSurface->getGreenOffset(), dstBlueOffset = dstSurface->getBlueOffset();
+		for( ; x + 4 <= width; x += 4 ) {
+			float gray[4];
+			_mm_storeu_ps( gray, grayscale4( srcPtr + x * 4, srcSurface.getRedOffset(), srcSurface.getGreenOffset(), srcSurface.getBlueOffset() ) );
+			for( int k = 0; k < 4; ++k ) {
+				float *dst = dstPtr + ( x + k ) * dstPixelInc;
+				dst[dstRedOffset] = dst[dstGreenOffset] = dst[dstBlueOffset] = gray[k];
+			}
 		}
 	}
+	grayscaleRowScalar( srcSurface, srcPtr + x * srcSurface.getPixelInc(), dstSurface, dstPtr + x * dstSurface->getPixelInc(), width - x );
+}
+
+template<>
+void grayscaleRow( const Surface32f &srcSurface, const float *srcPtr, Channel32f *dstChannel, float *dstPtr, int32_t width )
+{
+	int32_t x = 0;
+	if( useSse2() && ( srcSurface.getPixelInc() == 4 ) && ( dstChannel->getIncrement() == 1 ) ) {
+		for( ; x + 4 <= width; x += 4 )
+			_mm_storeu_ps( dstPtr + x, grayscale4( srcPtr + x * 4, srcSurface.getRedOffset(), srcSurface.getGreenOffset(), srcSurface.getBlueOffset() ) );
+	}
+	grayscaleRowScalar( srcSurface, srcPtr + x * srcSurface.getPixelInc(), dstChannel, dstPtr + x * dstChannel->getIncrement(), width - x );
+}
+#endif
+
+template<typename T>
+void GrayscaleBand<T>::operator()( int32_t y1, int32_t y2 ) const
+{
+	for( int32_t y = y1; y < y2; ++y ) {
+		const T *srcPtr = src->getData( Vec2i( area.getX1(), y ) );
+		if( dstSurface )
+			grayscaleRow( *src, srcPtr, dstSurface, dstSurface->getData( Vec2i( area.getX1(), y ) ), area.getWidth() );
+		else
+			grayscaleRow( *src, srcPtr, dstChannel, dstChannel->getData( Vec2i( area.getX1(), y ) ), area.getWidth() );
+	}
+}
+
+template<typename T>
+void grayscale( const SurfaceT<T> &srcSurface, SurfaceT<T> *dstSurface )
+{
+	GrayscaleBand<T> band;
+	band.src = &srcSurface;
+	band.dstSurface = dstSurface;
+	band.dstChannel = 0;
+	band.area = srcSurface.getBounds().getClipBy( dstSurface->getBounds() );
+	parallelRows( band.area.getY1(), band.area.getY2(), band.area.getWidth(), band );
+}
+
+template<typename T>
+void grayscale( const SurfaceT<T> &srcSurface, ChannelT<T> *dstChannel )
+{
+	GrayscaleBand<T> band;
+	band.src = &srcSurface;
+	band.dstSurface = 0;
+	band.dstChannel = dstChannel;
+	band.area = srcSurface.getBounds().getClipBy( dstChannel->getBounds() );
+	parallelRows( band.area.getY1(), band.area.getY2(), band.area.getWidth(), band );
 }
 
 #define grayscale_PROTOTYPES(r,data,T)\
 	template void grayscale( const SurfaceT<T> &srcSurface, SurfaceT<T> *dstSurface );
 	
+template void grayscale( const SurfaceT<uint8_t> &srcSurface, ChannelT<uint8_t> *dstChannel );
 template void grayscale( const SurfaceT<float> &srcSurface, ChannelT<float> *dstChannel );
 
 BOOST_PP_SEQ_FOR_EACH( grayscale_PROTOTYPES, ~, CHANNEL_TYPES )
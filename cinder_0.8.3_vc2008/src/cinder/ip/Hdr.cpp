@@ -24,30 +24,188 @@
 #include "cinder/ip/Grayscale.h"
 #include "cinder/ChanTraits.h"
 #include "cinder/ip/Fill.h"
+#include "cinder/ip/Parallel.h"
+#include "cinder/Thread.h"
+
+#include <algorithm>
 
 
 namespace cinder { namespace ip {
 
+namespace {
+
+// Finds the minimum and maximum of the red, green and blue values (or of a channel's values) of a band of rows and merges
+// them into the result under a mutex. Every band starts from the same seed value so the result matches a single pass.
+struct MinMaxBand {
+	const uint8_t	*data;
+	int32_t			rowBytes;
+	int32_t			width;
+	uint8_t			pixelInc;
+	int8_t			skipOffset;		// the alpha or padding value of a 4 value pixel, or -1
+	uint8_t			redOffset, greenOffset, blueOffset;
+	bool			channel;
+	float			seed;
+
+	mutable std::mutex	mutex;
+	mutable float		resultMin, resultMax;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		float minVal = seed, maxVal = seed;
+#if defined( CINDER_IP_SSE2 )
+		const bool sse2 = useSse2() && ( ( channel && pixelInc == 1 ) || ( ! channel && ( pixelInc == 3 || pixelInc == 4 ) ) );
+		__m128i skipMask = _mm_setzero_si128();
+		if( skipOffset >= 0 ) {
+			int32_t mask[4] = { 0, 0, 0, 0 };
+			mask[skipOffset] = -1;
+			skipMask = _mm_loadu_si128( (const __m128i*)mask );
+		}
+		__m128 minV = _mm_set1_ps( seed ), maxV = minV;
+#endif
+		for( int32_t y = y1; y < y2; ++y ) {
+			const float *srcPtr = reinterpret_cast<const float*>( data + y * rowBytes );
+			int32_t x = 0;
+#if defined( CINDER_IP_SSE2 )
+			if( sse2 ) {
+				// 3 value pixels and channels are flat runs of values, 4 value pixels are a vector each with the skipped lane replaced by the seed
+				const int32_t count = width * pixelInc;
+				int32_t i = 0;
+				for( ; i + 4 <= count; i += 4 ) {
+					__m128 v = _mm_loadu_ps( srcPtr + i );
+					if( skipOffset >= 0 )
+						v = _mm_castsi128_ps( select_si128( skipMask, _mm_castps_si128( minV ), _mm_castps_si128( v ) ) );
+					minV = _mm_min_ps( v, minV );
+					if( skipOffset >= 0 )
+						v = _mm_castsi128_ps( select_si128( skipMask, _mm_castps_si128( maxV ), _mm_castps_si128( v ) ) );
+					maxV = _mm_max_ps( v, maxV );
+				}
+				for( ; i < count; ++i ) {
+					minVal = std::min( minVal, srcPtr[i] );
+					maxVal = std::max( maxVal, srcPtr[i] );
+				}
+				continue;
+			}
+#endif
+			for( ; x < width; ++x ) {
+				if( channel ) {
+					minVal = std::min( minVal, *srcPtr );
+					maxVal = std::max( maxVal, *srcPtr );
+				}
+				else {
+					minVal = std::min( minVal, srcPtr[redOffset] );
+					maxVal = std::max( maxVal, srcPtr[redOffset] );
+					minVal = std::min( minVal, srcPtr[greenOffset] );
+					maxVal = std::max( maxVal, srcPtr[greenOffset] );
+					minVal = std::min( minVal, srcPtr[blueOffset] );
+					maxVal = std::max( maxVal, srcPtr[blueOffset] );
+				}
+				srcPtr += pixelInc;
+			}
+		}
+#if defined( CINDER_IP_SSE2 )
+		float lanes[4];
+		_mm_storeu_ps( lanes, minV );
+		for( int i = 0; i < 4; ++i )
+			minVal = std::min( minVal, lanes[i] );
+		_mm_storeu_ps( lanes, maxV );
+		for( int i = 0; i < 4; ++i )
+			maxVal = std::max( maxVal, lanes[i] );
+#endif
+
+		std::lock_guard<std::mutex> lock( mutex );
+		resultMin = std::min( resultMin, minVal );
+		resultMax = std::max( resultMax, maxVal );
+	}
+};
+
+// Maps the red, green and blue values (or a channel's values) from [minVal, maxVal] to [0, 1]
+struct NormalizeBand {
+	uint8_t		*data;
+	int32_t		rowBytes;
+	int32_t		width;
+	uint8_t		pixelInc;
+	int8_t		skipOffset;
+	uint8_t		redOffset, greenOffset, blueOffset;
+	bool		channel;
+	float		minVal, scale;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+#if defined( CINDER_IP_SSE2 )
+		const bool sse2 = useSse2() && ( ( channel && pixelInc == 1 ) || ( ! channel && ( pixelInc == 3 || pixelInc == 4 ) ) );
+		__m128i skipMask = _mm_setzero_si128();
+		if( skipOffset >= 0 ) {
+			int32_t mask[4] = { 0, 0, 0, 0 };
+			mask[skipOffset] = -1;
+			skipMask = _mm_loadu_si128( (const __m128i*)mask );
+		}
+		const __m128 minV = _mm_set1_ps( minVal ), scaleV = _mm_set1_ps( scale );
+#endif
+		for( int32_t y = y1; y < y2; ++y ) {
+			float *dstPtr = reinterpret_cast<float*>( data + y * rowBytes );
+#if defined( CINDER_IP_SSE2 )
+			if( sse2 ) {
+				const int32_t count = width * pixelInc;
+				int32_t i = 0;
+				for( ; i + 4 <= count; i += 4 ) {
+					const __m128 v = _mm_loadu_ps( dstPtr + i );
+					const __m128 n = _mm_mul_ps( _mm_sub_ps( v, minV ), scaleV );
+					_mm_storeu_ps( dstPtr + i, _mm_castsi128_ps( select_si128( skipMask, _mm_castps_si128( v ), _mm_castps_si128( n ) ) ) );
+				}
+				for( ; i < count; ++i )
+					dstPtr[i] = ( dstPtr[i] - minVal ) * scale;
+				continue;
+			}
+#endif
+			for( int32_t x = 0; x < width; ++x ) {
+				if( channel )
+					*dstPtr = ( *dstPtr - minVal ) * scale;
+				else {
+					dstPtr[redOffset] = ( dstPtr[redOffset] - minVal ) * scale;
+					dstPtr[greenOffset] = ( dstPtr[greenOffset] - minVal ) * scale;
+					dstPtr[blueOffset] = ( dstPtr[blueOffset] - minVal ) * scale;
+				}
+				dstPtr += pixelInc;
+			}
+		}
+	}
+};
+
+template<typename BAND>
+void setupSurfaceBand( BAND *band, const Surface32f &surface )
+{
+	band->rowBytes = surface.getRowBytes();
+	band->width = surface.getWidth();
+	band->pixelInc = surface.getPixelInc();
+	band->redOffset = surface.getRedOffset();
+	band->greenOffset = surface.getGreenOffset();
+	band->blueOffset = surface.getBlueOffset();
+	band->skipOffset = ( band->pixelInc == 4 ) ? ( 6 - band->redOffset - band->greenOffset - band->blueOffset ) : -1;
+	band->channel = false;
+}
+
+template<typename BAND>
+void setupChannelBand( BAND *band, const Channel32f &channel )
+{
+	band->rowBytes = channel.getRowBytes();
+	band->width = channel.getWidth();
+	band->pixelInc = channel.getIncrement();
+	band->redOffset = band->greenOffset = band->blueOffset = 0;
+	band->skipOffset = -1;
+	band->channel = true;
+}
+
+} // anonymous namespace
+
 void hdrNormalize( Surface32f *surface )
 {
 	// first take histogram to find the minimum and maximum values present
-	float minVal = *(surface->getDataRed( Vec2i::zero() )), maxVal = *(surface->getDataRed( Vec2i::zero() ));
-
-	const int8_t pixelInc = surface->getPixelInc();
-	const uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset();
-	for( int32_t y = 0; y < surface->getHeight(); ++y ) {
-		const float *srcPtr = surface->getData( Vec2i( 0, y ) );
-		for( int32_t x = 0; x < surface->getWidth(); ++x ) {
-			minVal = std::min( minVal, srcPtr[redOffset] );
-			maxVal = std::max( maxVal, srcPtr[redOffset] );
-			minVal = std::min( minVal, srcPtr[greenOffset] );
-			maxVal = std::max( maxVal, srcPtr[greenOffset] );
-			minVal = std::min( minVal, srcPtr[blueOffset] );
-			maxVal = std::max( maxVal, srcPtr[blueOffset] );
-
-			srcPtr += pixelInc;
-		}
-	}
+	MinMaxBand minMax;
+	setupSurfaceBand( &minMax, *surface );
+	minMax.data = reinterpret_cast<const uint8_t*>( surface->getData() );
+	minMax.seed = minMax.resultMin = minMax.resultMax = *(surface->getDataRed( Vec2i::zero() ));
+	parallelRows( 0, surface->getHeight(), surface->getWidth(), minMax );
+	const float minVal = minMax.resultMin, maxVal = minMax.resultMax;
 	
 	// if min==max then we should just fill with black
 	if( minVal == maxVal ) {
@@ -55,17 +213,12 @@ void hdrNormalize( Surface32f *surface )
 		return;
 	}
 	
-	float scale = 1.0f / ( maxVal - minVal );
-	for( int32_t y = 0; y < surface->getHeight(); ++y ) {
-		float *dstPtr = surface->getData( Vec2i( 0, y ) );
-		for( int32_t x = 0; x < surface->getWidth(); ++x ) {
-			dstPtr[redOffset] = ( dstPtr[redOffset] - minVal ) * scale;
-			dstPtr[greenOffset] = ( dstPtr[greenOffset] - minVal ) * scale;
-			dstPtr[blueOffset] = ( dstPtr[blueOffset] - minVal ) * scale;
-
-			dstPtr += pixelInc;
-		}
-	}	
+	NormalizeBand normalize;
+	setupSurfaceBand( &normalize, *surface );
+	normalize.data = reinterpret_cast<uint8_t*>( surface->getData() );
+	normalize.minVal = minVal;
+	normalize.scale = 1.0f / ( maxVal - minVal );
+	parallelRows( 0, surface->getHeight(), surface->getWidth(), normalize );
 }
 
 void hdrNormalize( Channel32f *channel )
@@ -80,27 +233,23 @@ void hdrNormalize( Channel32f *channel )
 		return;
 	}
 	
-	float scale = 1.0f / ( maxVal - minVal );
-	Channel32f::Iter iter = channel->getIter();
-	while( iter.line() ) {
-		while( iter.pixel() ) {
-			iter.v() = ( iter.v() - minVal ) * scale;
-		}
-	}
+	NormalizeBand normalize;
+	setupChannelBand( &normalize, *channel );
+	normalize.data = reinterpret_cast<uint8_t*>( channel->getData() );
+	normalize.minVal = minVal;
+	normalize.scale = 1.0f / ( maxVal - minVal );
+	parallelRows( 0, channel->getHeight(), channel->getWidth(), normalize );
 }
 
 void getMinMax( const Channel32f &channel, float *resultMin, float *resultMax )
 {
-	float minVal = *(channel.getData( Vec2i::zero() )), maxVal = *(channel.getData( Vec2i::zero() ));
-	Channel32f::ConstIter iter = channel.getIter();
-	while( iter.line() ) {
-		while( iter.pixel() ) {
-			minVal = std::min( minVal, iter.v() );
-			maxVal = std::max( maxVal, iter.v() );
-		}
-	}
-	*resultMin = minVal;
-	*resultMax = maxVal;
+	MinMaxBand minMax;
+	setupChannelBand( &minMax, channel );
+	minMax.data = reinterpret_cast<const uint8_t*>( channel.getData() );
+	minMax.seed = minMax.resultMin = minMax.resultMax = *(channel.getData( Vec2i::zero() ));
+	parallelRows( 0, channel.getHeight(), channel.getWidth(), minMax );
+	*resultMin = minMax.resultMin;
+	*resultMax = minMax.resultMax;
 }
 
 } } // namespace cinder::ip
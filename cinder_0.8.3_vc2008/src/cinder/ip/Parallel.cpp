@@ -0,0 +1,173 @@
+/*
+ Copyright (c) 2010, The Barbarian Group
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cinder/ip/Parallel.h"
+#include "cinder/Thread.h"
+#include "cinder/System.h"
+
+#include <boost/thread/once.hpp>
+#include <vector>
+#include <algorithm>
+
+namespace cinder { namespace ip {
+
+// bands below this many pixels cost more to hand to a thread than they take to process
+static const int32_t MIN_BAND_PIXELS = 32 * 1024;
+
+// A thread per core after the first, sleeping until a caller hands out the bands of a task.
+// The caller works on bands too. Only one task runs at a time, a second caller - or a task
+// calling back into parallelRows() - simply runs its bands itself.
+class RowBandPool {
+  public:
+	static RowBandPool*	instance();
+
+	int32_t		getNumThreads() const { return (int32_t)mThreads.size() + 1; }
+	void		run( int32_t y1, int32_t y2, int32_t numBands, const RowBandTask &task );
+
+  private:
+	RowBandPool();
+
+	void		workerLoop();
+	void		runBand( int32_t band ) const;
+
+	static void	create();
+
+	static RowBandPool		*sInstance;
+	static boost::once_flag	sOnceFlag;
+
+	std::vector<std::shared_ptr<std::thread> >	mThreads;
+	std::mutex					mSubmitMutex, mMutex;
+	std::condition_variable		mWorkCond, mDoneCond;
+	const RowBandTask			*mTask;
+	int32_t						mY1, mY2, mNumBands, mNextBand, mBandsDone;
+};
+
+RowBandPool* RowBandPool::sInstance = 0;
+boost::once_flag RowBandPool::sOnceFlag = BOOST_ONCE_INIT;
+
+RowBandPool* RowBandPool::instance()
+{
+	boost::call_once( &RowBandPool::create, sOnceFlag );
+	return sInstance;
+}
+
+// never destroyed, the workers are left asleep at exit
+void RowBandPool::create()
+{
+	sInstance = new RowBandPool;
+}
+
+RowBandPool::RowBandPool()
+	: mTask( 0 ), mY1( 0 ), mY2( 0 ), mNumBands( 0 ), mNextBand( 0 ), mBandsDone( 0 )
+{
+	const int32_t numCores = std::max<int32_t>( std::thread::hardware_concurrency(), 1 );
+	for( int32_t i = 1; i < numCores; ++i )
+		mThreads.push_back( std::shared_ptr<std::thread>( new std::thread( &RowBandPool::workerLoop, this ) ) );
+}
+
+void RowBandPool::runBand( int32_t band ) const
+{
+	const int32_t height = mY2 - mY1;
+	(*mTask)( mY1 + height * band / mNumBands, mY1 + height * ( band + 1 ) / mNumBands );
+}
+
+void RowBandPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	for( ;; ) {
+		while( mNextBand >= mNumBands )
+			mWorkCond.wait( lock );
+		const int32_t band = mNextBand++;
+		lock.unlock();
+		runBand( band );
+		lock.lock();
+		if( ++mBandsDone == mNumBands )
+			mDoneCond.notify_all();
+	}
+}
+
+void RowBandPool::run( int32_t y1, int32_t y2, int32_t numBands, const RowBandTask &task )
+{
+	std::unique_lock<std::mutex> submitLock( mSubmitMutex, boost::try_to_lock );
+	if( ! submitLock.owns_lock() ) {
+		task( y1, y2 );
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock( mMutex );
+	mTask = &task;
+	mY1 = y1;
+	mY2 = y2;
+	mNumBands = numBands;
+	mNextBand = 0;
+	mBandsDone = 0;
+	mWorkCond.notify_all();
+
+	while( mNextBand < mNumBands ) {
+		const int32_t band = mNextBand++;
+		lock.unlock();
+		runBand( band );
+		lock.lock();
+		++mBandsDone;
+	}
+	while( mBandsDone < mNumBands )
+		mDoneCond.wait( lock );
+	mTask = 0;
+}
+
+void runRowBands( int32_t y1, int32_t y2, int32_t width, const RowBandTask &task )
+{
+	if( y2 <= y1 )
+		return;
+
+	const int64_t pixels = (int64_t)std::max<int32_t>( width, 1 ) * ( y2 - y1 );
+	int32_t numBands = (int32_t)std::min<int64_t>( pixels / MIN_BAND_PIXELS, y2 - y1 );
+	if( numBands > 1 ) {
+		RowBandPool *pool = RowBandPool::instance();
+		numBands = std::min( numBands, pool->getNumThreads() );
+		if( numBands > 1 ) {
+			pool->run( y1, y2, numBands, task );
+			return;
+		}
+	}
+
+	task( y1, y2 );
+}
+
+int32_t getNumRowBandThreads()
+{
+	return RowBandPool::instance()->getNumThreads();
+}
+
+bool useSse2()
+{
+#if defined( _M_X64 ) || defined( __x86_64__ )
+	return true;
+#elif defined( CINDER_IP_SSE2 )
+	static const bool sse2 = System::hasSse2();
+	return sse2;
+#else
+	return false;
+#endif
+}
+
+} } // namespace cinder::ip
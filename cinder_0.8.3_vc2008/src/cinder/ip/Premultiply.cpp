@@ -22,96 +22,203 @@
 
 #include "cinder/ip/Premultiply.h"
 #include "cinder/ChanTraits.h"
+#include "cinder/ip/Parallel.h"
 
 namespace cinder { namespace ip {
 
-// this is a candidate for sse2
+// premultiplies count pixels of a row
 template<typename T>
-void premultiply( SurfaceT<T> *surface )
+void premultiplyPixelsScalar( T *dstPtr, int32_t count, uint8_t pixelInc, uint8_t redOffset, uint8_t greenOffset, uint8_t blueOffset, uint8_t alphaOffset )
 {
-	const Area clippedArea = surface->getBounds();
+	for( int32_t x = 0; x < count; ++x ) {
+		// The basic formula for unpremultiplication is to divide by the alpha
+		T alpha = dstPtr[alphaOffset];
+		
+		dstPtr[redOffset] = CHANTRAIT<T>::premultiply( dstPtr[redOffset], alpha );
+		dstPtr[greenOffset] = CHANTRAIT<T>::premultiply( dstPtr[greenOffset], alpha );
+		dstPtr[blueOffset] = CHANTRAIT<T>::premultiply( dstPtr[blueOffset], alpha );
+		dstPtr += pixelInc;
+	}
+}
 
-	if( ! surface->hasAlpha() )
-		return;
+static void unpremultiplyPixelsScalar( uint8_t *dstPtr, int32_t count, uint8_t pixelInc, uint8_t redOffset, uint8_t greenOffset, uint8_t blueOffset, uint8_t alphaOffset )
+{
+	for( int32_t x = 0; x < count; ++x ) {
+		// The basic formula for unpremultiplication is to divide by the alpha
+		// which in 8bit pixel arithmetic is to multiply by 255 and divide by the alpha
+		uint8_t alpha = dstPtr[alphaOffset];
+		if( alpha ) {
+			dstPtr[redOffset] = dstPtr[redOffset] * 255 / alpha;
+			dstPtr[greenOffset] = dstPtr[greenOffset] * 255 / alpha;
+			dstPtr[blueOffset] = dstPtr[blueOffset] * 255 / alpha;
+		}
+		dstPtr += pixelInc;
+	}
+}
 
-	surface->setPremultiplied( true );
+static void unpremultiplyPixelsScalar( float *dstPtr, int32_t count, uint8_t pixelInc, uint8_t redOffset, uint8_t greenOffset, uint8_t blueOffset, uint8_t alphaOffset )
+{
+	for( int32_t x = 0; x < count; ++x ) {
+		// The basic formula for unpremultiplication is to divide by the alpha
+		if( dstPtr[alphaOffset] != 0 ) {
+			float invAlpha = 1.0f / dstPtr[alphaOffset];
+			dstPtr[redOffset] *= invAlpha;
+			dstPtr[greenOffset] *= invAlpha;
+			dstPtr[blueOffset] *= invAlpha;
+		}
+		dstPtr += pixelInc;
+	}
+}
 
-	int32_t rowBytes = surface->getRowBytes();
-	uint8_t pixelInc = surface->getPixelInc();
-	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset(), alphaOffset = surface->getAlphaOffset();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			// The basic formula for unpremultiplication is to divide by the alpha
-			T alpha = dstPtr[alphaOffset];
-			
-			dstPtr[redOffset] = CHANTRAIT<T>::premultiply( dstPtr[redOffset], alpha );
-			dstPtr[greenOffset] = CHANTRAIT<T>::premultiply( dstPtr[greenOffset], alpha );
-			dstPtr[blueOffset] = CHANTRAIT<T>::premultiply( dstPtr[blueOffset], alpha );
-			dstPtr += pixelInc;
+// The SSE2 versions spread each pixel's alpha over its lanes and keep the alpha lane as it was.
+// They return the number of pixels done and leave the end of the row to the scalar code.
+template<typename T>
+int32_t premultiplyPixelsSse2( T *dstPtr, int32_t count, uint8_t alphaOffset ) { return 0; }
+template<typename T>
+int32_t unpremultiplyPixelsSse2( T *dstPtr, int32_t count, uint8_t alphaOffset ) { return 0; }
+
+#if defined( CINDER_IP_SSE2 )
+template<>
+int32_t premultiplyPixelsSse2<uint8_t>( uint8_t *dstPtr, int32_t count, uint8_t alphaOffset )
+{
+	const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set1_epi32( 0xFF << ( alphaOffset * 8 ) );
+	int32_t x = 0;
+	for( ; x + 4 <= count; x += 4 ) {
+		const __m128i px = _mm_loadu_si128( (const __m128i*)( dstPtr + x * 4 ) ), alpha = broadcastByte_epi32( px, alphaOffset );
+		// a * c / 255, exactly
+		const __m128i lo = div255_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( px, zero ), _mm_unpacklo_epi8( alpha, zero ) ) );
+		const __m128i hi = div255_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( px, zero ), _mm_unpackhi_epi8( alpha, zero ) ) );
+		_mm_storeu_si128( (__m128i*)( dstPtr + x * 4 ), select_si128( alphaMask, px, _mm_packus_epi16( lo, hi ) ) );
+	}
+	return x;
+}
+
+template<>
+int32_t unpremultiplyPixelsSse2<uint8_t>( uint8_t *dstPtr, int32_t count, uint8_t alphaOffset )
+{
+	const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set1_epi32( 0xFF << ( alphaOffset * 8 ) ), lowBytes = _mm_set1_epi32( 0xFF );
+	const __m128 v255 = _mm_set1_ps( 255.0f );
+	int32_t x = 0;
+	for( ; x + 4 <= count; x += 4 ) {
+		const __m128i px = _mm_loadu_si128( (const __m128i*)( dstPtr + x * 4 ) ), alpha = broadcastByte_epi32( px, alphaOffset );
+		// c * 255 / a in floats, the quotient of these small integers truncates to the same value as the integer division
+		__m128i words[2];
+		for( int h = 0; h < 2; ++h ) {
+			const __m128i c16 = h ? _mm_unpackhi_epi8( px, zero ) : _mm_unpacklo_epi8( px, zero );
+			const __m128i a16 = h ? _mm_unpackhi_epi8( alpha, zero ) : _mm_unpacklo_epi8( alpha, zero );
+			const __m128i qLo = _mm_cvttps_epi32( _mm_div_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( c16, zero ) ), v255 ), _mm_cvtepi32_ps( _mm_unpacklo_epi16( a16, zero ) ) ) );
+			const __m128i qHi = _mm_cvttps_epi32( _mm_div_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( c16, zero ) ), v255 ), _mm_cvtepi32_ps( _mm_unpackhi_epi16( a16, zero ) ) ) );
+			// the scalar code stores the quotient to 8 bits, which wraps when a color exceeds its alpha
+			words[h] = _mm_packs_epi32( _mm_and_si128( qLo, lowBytes ), _mm_and_si128( qHi, lowBytes ) );
 		}
+		const __m128i keep = _mm_or_si128( alphaMask, _mm_cmpeq_epi8( alpha, zero ) );
+		_mm_storeu_si128( (__m128i*)( dstPtr + x * 4 ), select_si128( keep, px, _mm_packus_epi16( words[0], words[1] ) ) );
 	}
+	return x;
+}
+
+// the alpha of a pixel in all 4 lanes
+static inline __m128 broadcastAlpha( __m128 px, uint8_t alphaOffset )
+{
+	switch( alphaOffset ) {
+		case 0: return _mm_shuffle_ps( px, px, _MM_SHUFFLE( 0, 0, 0, 0 ) );
+		case 1: return _mm_shuffle_ps( px, px, _MM_SHUFFLE( 1, 1, 1, 1 ) );
+		case 2: return _mm_shuffle_ps( px, px, _MM_SHUFFLE( 2, 2, 2, 2 ) );
+		default: return _mm_shuffle_ps( px, px, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+	}
+}
+
+static inline __m128 alphaLaneMask( uint8_t alphaOffset )
+{
+	int32_t mask[4] = { 0, 0, 0, 0 };
+	mask[alphaOffset] = -1;
+	return _mm_castsi128_ps( _mm_setr_epi32( mask[0], mask[1], mask[2], mask[3] ) );
 }
 
-// this is a candidate for sse2
 template<>
-void unpremultiply<uint8_t>( SurfaceT<uint8_t> *surface )
+int32_t premultiplyPixelsSse2<float>( float *dstPtr, int32_t count, uint8_t alphaOffset )
 {
-	const Area clippedArea = surface->getBounds();
+	const __m128 alphaMask = alphaLaneMask( alphaOffset );
+	for( int32_t x = 0; x < count; ++x ) {
+		const __m128 px = _mm_loadu_ps( dstPtr + x * 4 );
+		const __m128 premult = _mm_mul_ps( px, broadcastAlpha( px, alphaOffset ) );
+		_mm_storeu_ps( dstPtr + x * 4, _mm_or_ps( _mm_and_ps( alphaMask, px ), _mm_andnot_ps( alphaMask, premult ) ) );
+	}
+	return count;
+}
 
-	if( ! surface->hasAlpha() )
-		return;
+template<>
+int32_t unpremultiplyPixelsSse2<float>( float *dstPtr, int32_t count, uint8_t alphaOffset )
+{
+	const __m128 alphaLane = alphaLaneMask( alphaOffset ), one = _mm_set1_ps( 1.0f ), zero = _mm_setzero_ps();
+	for( int32_t x = 0; x < count; ++x ) {
+		const __m128 px = _mm_loadu_ps( dstPtr + x * 4 ), alpha = broadcastAlpha( px, alphaOffset );
+		const __m128 unpremult = _mm_mul_ps( px, _mm_div_ps( one, alpha ) );
+		const __m128 keep = _mm_or_ps( alphaLane, _mm_cmpeq_ps( alpha, zero ) );
+		_mm_storeu_ps( dstPtr + x * 4, _mm_or_ps( _mm_and_ps( keep, px ), _mm_andnot_ps( keep, unpremult ) ) );
+	}
+	return count;
+}
+#endif
 
-	surface->setPremultiplied( false );
+template<typename T>
+struct PremultiplyBand {
+	SurfaceT<T>		*surface;
+	bool			premult;
+
+	void operator()( int32_t y1, int32_t y2 ) const;
+};
 
+template<typename T>
+void PremultiplyBand<T>::operator()( int32_t y1, int32_t y2 ) const
+{
+	const Area clippedArea = surface->getBounds();
 	int32_t rowBytes = surface->getRowBytes();
 	uint8_t pixelInc = surface->getPixelInc();
 	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset(), alphaOffset = surface->getAlphaOffset();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		uint8_t *dstPtr = reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes;
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			// The basic formula for unpremultiplication is to divide by the alpha
-			// which in 8bit pixel arithmetic is to multiply by 255 and divide by the alpha
-			uint8_t alpha = dstPtr[alphaOffset];
-			if( alpha ) {
-				dstPtr[redOffset] = dstPtr[redOffset] * 255 / alpha;
-				dstPtr[greenOffset] = dstPtr[greenOffset] * 255 / alpha;
-				dstPtr[blueOffset] = dstPtr[blueOffset] * 255 / alpha;
-			}
-			dstPtr += pixelInc;
-		}
-	}	
+	const bool sse2 = useSse2() && ( pixelInc == 4 );
+	for( int32_t y = y1; y < y2; ++y ) {
+		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
+		int32_t x = 0;
+		if( sse2 )
+			x = premult ? premultiplyPixelsSse2( dstPtr, clippedArea.getWidth(), alphaOffset ) : unpremultiplyPixelsSse2( dstPtr, clippedArea.getWidth(), alphaOffset );
+		if( premult )
+			premultiplyPixelsScalar( dstPtr + x * pixelInc, clippedArea.getWidth() - x, pixelInc, redOffset, greenOffset, blueOffset, alphaOffset );
+		else
+			unpremultiplyPixelsScalar( dstPtr + x * pixelInc, clippedArea.getWidth() - x, pixelInc, redOffset, greenOffset, blueOffset, alphaOffset );
+	}
 }
 
-template<>
-void unpremultiply<float>( SurfaceT<float> *surface )
+template<typename T>
+void premultiply( SurfaceT<T> *surface )
 {
-	const Area clippedArea = surface->getBounds();
+	if( ! surface->hasAlpha() )
+		return;
+
+	surface->setPremultiplied( true );
 
+	PremultiplyBand<T> band;
+	band.surface = surface;
+	band.premult = true;
+	parallelRows( 0, surface->getHeight(), surface->getWidth(), band );
+}
+
+template<typename T>
+void unpremultiply( SurfaceT<T> *surface )
+{
 	if( ! surface->hasAlpha() )
 		return;
 
 	surface->setPremultiplied( false );
 
-	int32_t rowBytes = surface->getRowBytes();
-	uint8_t pixelInc = surface->getPixelInc();
-	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset(), alphaOffset = surface->getAlphaOffset();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		float *dstPtr = reinterpret_cast<float*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			// The basic formula for unpremultiplication is to divide by the alpha
-			if( dstPtr[alphaOffset] != 0 ) {
-				float invAlpha = 1.0f / dstPtr[alphaOffset];
-				dstPtr[redOffset] *= invAlpha;
-				dstPtr[greenOffset] *= invAlpha;
-				dstPtr[blueOffset] *= invAlpha;
-			}
-			dstPtr += pixelInc;
-		}
-	}	
+	PremultiplyBand<T> band;
+	band.surface = surface;
+	band.premult = false;
+	parallelRows( 0, surface->getHeight(), surface->getWidth(), band );
 }
 
-
+template void unpremultiply( SurfaceT<uint8_t> *surface );
+template void unpremultiply( SurfaceT<float> *surface );
 
 #define premult_PROTOTYPES(r,data,T)\
 	template void premultiply( SurfaceT<T> *Surface );
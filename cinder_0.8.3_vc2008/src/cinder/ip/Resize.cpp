@@ -25,6 +25,8 @@
 #include "cinder/Filter.h"
 #include "cinder/Rect.h"
 #include "cinder/ChanTraits.h"
+#include "cinder/Thread.h"
+#include "cinder/ip/Parallel.h"
 
 #include <math.h>
 #include <vector>
@@ -32,6 +34,9 @@ using std::vector;
 using std::pair;
 #include <limits>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <typeinfo>
 
 namespace cinder { namespace ip {
 
@@ -138,42 +143,65 @@ void scanlineFilterChannelToBuffer( WeightTable<WT> *weights, int32_t x, int32_t
 	}	
 }
 
+struct ResampleGeometry {
+	Area			clippedDstArea;
+	int32_t			srcWidth, srcHeight, dstWidth, dstHeight;
+	int32_t			srcOffsetX, srcOffsetY;
+	Mapping			m;
+	FilterParams	filterParamsX, filterParamsY;
+};
+
+// clips the areas and derives the mapping and filter sizes, returns false if nothing is left to resample
+static bool setupResampleGeometry( const Area &srcBounds, const Area &srcArea, const Area &dstBounds, const Area &dstArea, const FilterBase &filter, ResampleGeometry *g )
+{
+	Rectf clippedSrcRect;
+	getClippedScaledRects( srcBounds, Rectf( srcArea ), dstBounds, dstArea, &clippedSrcRect, &g->clippedDstArea );
+	
+	if ( ( clippedSrcRect.getWidth() <= 0 ) || ( g->clippedDstArea.getWidth() <= 0 ) 
+		|| ( clippedSrcRect.getHeight() <= 0 ) || ( g->clippedDstArea.getHeight() <= 0 ) )
+		return false;
+	
+	Mapping &m = g->m;
+	g->dstWidth = (int32_t)g->clippedDstArea.getWidth(); g->dstHeight = (int32_t)g->clippedDstArea.getHeight();
+	g->srcWidth = (int32_t)clippedSrcRect.getWidth(); g->srcHeight = (int32_t)clippedSrcRect.getHeight();
+	g->srcOffsetX = static_cast<int32_t>( floor( clippedSrcRect.getX1() ) );
+	g->srcOffsetY = static_cast<int32_t>( floor( clippedSrcRect.getY1() ) );
+
+	m.sx = g->dstWidth / (float)g->srcWidth;
+	m.sy = g->dstHeight / (float)g->srcHeight;
+	m.tx = g->clippedDstArea.getX1() - 0.5f - m.sx * ( clippedSrcRect.getX1() - 0.5f );
+	m.ty = g->clippedDstArea.getY1() - 0.5f - m.sy * ( clippedSrcRect.getY1() - 0.5f );
+	m.ux = g->clippedDstArea.getX1() - m.sx * ( clippedSrcRect.getX1()- 0.5f ) - m.tx;
+	m.uy = g->clippedDstArea.getY1() - m.sy * ( clippedSrcRect.getY1()- 0.5f ) - m.ty;
+
+	g->filterParamsX.scale = std::max( 1.0f, 1.0f / m.sx );
+	g->filterParamsX.supp = std::max( 0.5f, g->filterParamsX.scale * filter.getSupport() );
+	g->filterParamsX.width = (int32_t)ceil( 2.0f * g->filterParamsX.supp );
+
+	g->filterParamsY.scale = std::max( 1.0f, 1.0f / m.sy );
+	g->filterParamsY.supp = std::max( 0.5f, g->filterParamsY.scale * filter.getSupport() );
+	g->filterParamsY.width = (int32_t)ceil( 2.0f * g->filterParamsY.supp );
+
+	return true;
+}
+
 // assumes channels are of same dimensions
 template<typename T>
 void resample( const vector<const ChannelT<T>*> &srcChannels, const FilterBase &filter, const Area &srcArea, const Area &dstArea, const vector<ChannelT<T>*> &dstChannels )
 {
-	Rectf clippedSrcRect;
-	Area clippedDstArea;
-	getClippedScaledRects( srcChannels[0]->getBounds(), Rectf( srcArea ), dstChannels[0]->getBounds(), dstArea, &clippedSrcRect, &clippedDstArea );
-	
-	if ( ( clippedSrcRect.getWidth() <= 0 ) || ( clippedDstArea.getWidth() <= 0 ) 
-		|| ( clippedSrcRect.getHeight() <= 0 ) || ( clippedDstArea.getHeight() <= 0 ) )
+	ResampleGeometry g;
+	if( ! setupResampleGeometry( srcChannels[0]->getBounds(), srcArea, dstChannels[0]->getBounds(), dstArea, filter, &g ) )
 		return;
 	
-	FilterParams filterParamsX, filterParamsY;
-	Mapping m;
+	const Area &clippedDstArea = g.clippedDstArea;
+	const Mapping &m = g.m;
+	const FilterParams &filterParamsX = g.filterParamsX, &filterParamsY = g.filterParamsY;
 	std::shared_ptr<typename SCALETRAIT<T>::SUMT> accum;
-	int32_t dstWidth = (int32_t)clippedDstArea.getWidth(), dstHeight = (int32_t)clippedDstArea.getHeight();
-	int32_t srcWidth = (int32_t)clippedSrcRect.getWidth(), srcHeight = (int32_t)clippedSrcRect.getHeight();
-	int32_t srcOffsetX = static_cast<int32_t>( floor( clippedSrcRect.getX1() ) );
-	int32_t srcOffsetY = static_cast<int32_t>( floor( clippedSrcRect.getY1() ) );
+	int32_t dstWidth = g.dstWidth, dstHeight = g.dstHeight;
+	int32_t srcWidth = g.srcWidth, srcHeight = g.srcHeight;
+	int32_t srcOffsetX = g.srcOffsetX, srcOffsetY = g.srcOffsetY;
 	vector<pair<int32_t,std::shared_ptr<typename SCALETRAIT<T>::SUMT> > > linesBuffer;
 
-	m.sx = dstWidth / (float)srcWidth;
-	m.sy = dstHeight / (float)srcHeight;
-	m.tx = clippedDstArea.getX1() - 0.5f - m.sx * ( clippedSrcRect.getX1() - 0.5f );
-	m.ty = clippedDstArea.getY1() - 0.5f - m.sy * ( clippedSrcRect.getY1() - 0.5f );
-	m.ux = clippedDstArea.getX1() - m.sx * ( clippedSrcRect.getX1()- 0.5f ) - m.tx;
-	m.uy = clippedDstArea.getY1() - m.sy * ( clippedSrcRect.getY1()- 0.5f ) - m.ty;
-
-	filterParamsX.scale = std::max( 1.0f, 1.0f / m.sx );
-	filterParamsX.supp = std::max( 0.5f, filterParamsX.scale * filter.getSupport() );
-	filterParamsX.width = (int32_t)ceil( 2.0f * filterParamsX.supp );
-
-	filterParamsY.scale = std::max( 1.0f, 1.0f / m.sy );
-	filterParamsY.supp = std::max( 0.5f, filterParamsY.scale * filter.getSupport() );
-	filterParamsY.width = (int32_t)ceil( 2.0f * filterParamsY.supp );
-
 	for( int32_t i = 0; i < filterParamsY.width; i++ )
 		linesBuffer.push_back( std::make_pair( -1, std::shared_ptr<typename SCALETRAIT<T>::SUMT>( new typename SCALETRAIT<T>::SUMT[dstWidth], checked_array_deleter<typename SCALETRAIT<T>::SUMT>() ) ) );
 
@@ -306,9 +334,395 @@ void makeWeightTable( int32_t b, float cen, const FilterBase &filter, const Filt
 	}   
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// Interleaved fast path
+// Surfaces whose source and destination share a channel order without a padding channel are
+// filtered with all channels of a pixel at once rather than one ChannelT at a time. The arithmetic
+// is the one of resample() - same weight tables, same fixed point for uint8_t, same order of the
+// float sums - so the result is identical. The weight tables are cached per geometry and the
+// destination rows are split into bands with parallelRows().
+
+// the weight tables of one source -> destination geometry
+template<typename T>
+struct ResizeTables {
+	typedef typename SCALETRAIT<T>::SUMT	SUMT;
+
+	int32_t				xTaps, yTaps;		// weights per destination pixel / row
+	vector<int32_t>		xStart, xCount, yStart, yCount;
+	vector<SUMT>		xWeights, yWeights;
+	vector<int16_t>		xWeights16, yWeights16;	// uint8_t only, for _mm_madd_epi16
+	bool				fitsInt16;			// uint8_t only, weights and filtered lines fit into int16_t
+};
+
+struct ResizeKey {
+	const std::type_info	*filterType;
+	float					filterSamples[9];
+	int32_t					srcWidth, srcHeight, dstWidth, dstHeight;
+	float					sx, sy, ux, uy;
+
+	bool operator==( const ResizeKey &rhs ) const {
+		return ( *filterType == *rhs.filterType ) && ( memcmp( filterSamples, rhs.filterSamples, sizeof(filterSamples) ) == 0 )
+			&& ( srcWidth == rhs.srcWidth ) && ( srcHeight == rhs.srcHeight ) && ( dstWidth == rhs.dstWidth ) && ( dstHeight == rhs.dstHeight )
+			&& ( sx == rhs.sx ) && ( sy == rhs.sy ) && ( ux == rhs.ux ) && ( uy == rhs.uy );
+	}
+};
+
+// filters like FilterMitchell have parameters besides the support, so the key samples the filter itself
+static ResizeKey makeResizeKey( const FilterBase &filter, const ResampleGeometry &g )
+{
+	ResizeKey key;
+	key.filterType = &typeid( filter );
+	key.filterSamples[0] = filter.getSupport();
+	for( int i = 1; i < 9; ++i )
+		key.filterSamples[i] = filter( ( i - 0.5f ) * filter.getSupport() / 8 );
+	key.srcWidth = g.srcWidth; key.srcHeight = g.srcHeight;
+	key.dstWidth = g.dstWidth; key.dstHeight = g.dstHeight;
+	key.sx = g.m.sx; key.sy = g.m.sy;
+	key.ux = g.m.ux; key.uy = g.m.uy;
+	return key;
+}
+
+template<typename T>
+std::shared_ptr<ResizeTables<T> > makeResizeTables( const FilterBase &filter, const ResampleGeometry &g )
+{
+	typedef typename SCALETRAIT<T>::SUMT SUMT;
+	std::shared_ptr<ResizeTables<T> > tables( new ResizeTables<T> );
+	ResizeTables<T> &t = *tables;
+	WeightTable<SUMT> wt;
+
+	t.xTaps = g.filterParamsX.width;
+	t.xStart.resize( g.dstWidth ); t.xCount.resize( g.dstWidth );
+	t.xWeights.resize( g.dstWidth * t.xTaps, 0 );
+	for( int32_t bx = 0; bx < g.dstWidth; ++bx ) {
+		wt.weight = &t.xWeights[bx * t.xTaps];
+		makeWeightTable<T,SUMT>( bx, MAP(bx, g.m.sx, g.m.ux), filter, &g.filterParamsX, g.srcWidth, true, &wt );
+		t.xStart[bx] = wt.start; t.xCount[bx] = wt.end - wt.start;
+	}
+
+	t.yTaps = g.filterParamsY.width;
+	t.yStart.resize( g.dstHeight ); t.yCount.resize( g.dstHeight );
+	t.yWeights.resize( g.dstHeight * t.yTaps, 0 );
+	for( int32_t by = 0; by < g.dstHeight; ++by ) {
+		wt.weight = &t.yWeights[by * t.yTaps];
+		makeWeightTable<T,SUMT>( by, MAP(by, g.m.sy, g.m.uy), filter, &g.filterParamsY, g.srcHeight, false, &wt );
+		t.yStart[by] = wt.start; t.yCount[by] = wt.end - wt.start;
+	}
+
+	// the vectorised uint8_t passes multiply 16 bit weights by 8 bit pixels and hold the
+	// filtered lines as int16_t, which all but pathological filters allow
+	t.fitsInt16 = std::numeric_limits<SUMT>::is_integer;
+	for( int32_t bx = 0; bx < g.dstWidth && t.fitsInt16; ++bx ) {
+		int32_t pos = 0, neg = 0;
+		for( int32_t k = 0; k < t.xCount[bx]; ++k ) {
+			int32_t w = (int32_t)t.xWeights[bx * t.xTaps + k];
+			( w > 0 ? pos : neg ) += w;
+			t.fitsInt16 = t.fitsInt16 && ( w >= -32768 ) && ( w <= 32767 );
+		}
+		t.fitsInt16 = t.fitsInt16 && ( ( pos * 255 + 128 ) >> 8 ) <= 32767 && ( ( neg * 255 + 128 ) >> 8 ) >= -32768;
+	}
+	for( size_t i = 0; i < t.yWeights.size() && t.fitsInt16; ++i )
+		t.fitsInt16 = ( (int32_t)t.yWeights[i] >= -32768 ) && ( (int32_t)t.yWeights[i] <= 32767 );
+	if( t.fitsInt16 ) {
+		t.xWeights16.assign( t.xWeights.begin(), t.xWeights.end() );
+		t.yWeights16.assign( t.yWeights.begin(), t.yWeights.end() );
+	}
+
+	return tables;
+}
+
+static std::mutex sResizeCacheMutex;
+
+// the few most recently used geometries, capture loops resize every frame the same way
+template<typename T>
+struct ResizeCache {
+	static const size_t MAX_ENTRIES = 4;
+	static vector<pair<ResizeKey,std::shared_ptr<ResizeTables<T> > > > sEntries;
+
+	static std::shared_ptr<ResizeTables<T> > get( const FilterBase &filter, const ResampleGeometry &g )
+	{
+		const ResizeKey key = makeResizeKey( filter, g );
+		{
+			std::lock_guard<std::mutex> lock( sResizeCacheMutex );
+			for( size_t i = 0; i < sEntries.size(); ++i ) {
+				if( sEntries[i].first == key ) {
+					std::rotate( sEntries.begin(), sEntries.begin() + i, sEntries.begin() + i + 1 );
+					return sEntries[0].second;
+				}
+			}
+		}
+
+		std::shared_ptr<ResizeTables<T> > tables = makeResizeTables<T>( filter, g );
+		std::lock_guard<std::mutex> lock( sResizeCacheMutex );
+		sEntries.insert( sEntries.begin(), std::make_pair( key, tables ) );
+		if( sEntries.size() > MAX_ENTRIES )
+			sEntries.pop_back();
+		return tables;
+	}
+};
+
+template<typename T>
+vector<pair<ResizeKey,std::shared_ptr<ResizeTables<T> > > > ResizeCache<T>::sEntries;
+
+#if defined( CINDER_IP_SSE2 )
+// loads n <= 16 bytes without reading past p + n
+static inline __m128i loadPartial( const void *p, size_t n )
+{
+	union { __m128i v; uint8_t b[16]; } tmp;
+	tmp.v = _mm_setzero_si128();
+	memcpy( tmp.b, p, n );
+	return tmp.v;
+}
+
+static inline __m128i loadBytes4( const void *p )
+{
+	int32_t v;
+	memcpy( &v, p, 4 );
+	return _mm_cvtsi32_si128( v );
+}
+#endif
+
+// one row of the horizontal pass, interleaved source row -> one filtered line of dstWidth * C values.
+// srcLimit is the number of values that may be read from src, the vector loads stay inside it
+template<int C>
+void filterRowInterleaved( const ResizeTables<uint8_t> &t, const uint8_t *src, int32_t srcLimit, int16_t *line, bool sse2 )
+{
+	const int32_t dstWidth = (int32_t)t.xStart.size();
+
+	for( int32_t b = 0; b < dstWidth; ++b ) {
+		const int32_t count = t.xCount[b];
+		const int16_t *w = &t.xWeights16[b * t.xTaps];
+		const uint8_t *s = src + t.xStart[b] * C;
+		const int32_t avail = srcLimit - t.xStart[b] * C;
+		int16_t *out = line + b * C;
+
+#if defined( CINDER_IP_SSE2 )
+		if( sse2 ) {
+			// two taps at a time: bytes a0 b0 a1 b1 .. widened to 16 bits, one madd adds both per channel
+			const __m128i zero = _mm_setzero_si128();
+			__m128i sum = _mm_set1_epi32( 1 << 7 );
+			int32_t k = 0;
+			for( ; k + 2 <= count; k += 2 ) {
+				__m128i px = ( k * C + 8 <= avail ) ? _mm_loadl_epi64( (const __m128i*)( s + k * C ) ) : loadPartial( s + k * C, 2 * C );
+				px = _mm_unpacklo_epi8( _mm_unpacklo_epi8( px, _mm_srli_si128( px, C ) ), zero );
+				sum = _mm_add_epi32( sum, _mm_madd_epi16( px, _mm_set1_epi32( (uint16_t)w[k] | ( (uint32_t)(uint16_t)w[k + 1] << 16 ) ) ) );
+			}
+			if( k < count ) {
+				__m128i px = ( k * C + 4 <= avail ) ? loadBytes4( s + k * C ) : loadPartial( s + k * C, C );
+				px = _mm_unpacklo_epi16( _mm_unpacklo_epi8( px, zero ), zero );
+				sum = _mm_add_epi32( sum, _mm_madd_epi16( px, _mm_set1_epi32( (uint16_t)w[k] ) ) );
+			}
+			// the line has one value of padding, so C == 3 may store four
+			sum = _mm_srai_epi32( sum, 8 );
+			_mm_storel_epi64( (__m128i*)out, _mm_packs_epi32( sum, sum ) );
+			continue;
+		}
+#endif
+		int32_t sum[C];
+		for( int c = 0; c < C; ++c )
+			sum[c] = 1 << 7;
+		for( int32_t k = 0; k < count; ++k )
+			for( int c = 0; c < C; ++c )
+				sum[c] += w[k] * s[k * C + c];
+		for( int c = 0; c < C; ++c )
+			out[c] = (int16_t)SCALETRAIT<uint8_t>::CHANNELTOBUFFER( sum[c] );
+	}
+}
+
+template<int C>
+void filterRowInterleaved( const ResizeTables<float> &t, const float *src, int32_t srcLimit, float *line, bool sse2 )
+{
+	const int32_t dstWidth = (int32_t)t.xStart.size();
+
+	for( int32_t b = 0; b < dstWidth; ++b ) {
+		const int32_t count = t.xCount[b];
+		const float *w = &t.xWeights[b * t.xTaps];
+		const float *s = src + t.xStart[b] * C;
+		const int32_t avail = srcLimit - t.xStart[b] * C;
+		float *out = line + b * C;
+
+#if defined( CINDER_IP_SSE2 )
+		if( sse2 ) {
+			__m128 sum = _mm_setzero_ps();
+			for( int32_t k = 0; k < count; ++k ) {
+				__m128 px = ( k * C + 4 <= avail ) ? _mm_loadu_ps( s + k * C ) : _mm_castsi128_ps( loadPartial( s + k * C, C * sizeof(float) ) );
+				sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( w[k] ), px ) );
+			}
+			_mm_storeu_ps( out, sum );
+			continue;
+		}
+#endif
+		float sum[C];
+		for( int c = 0; c < C; ++c )
+			sum[c] = 0;
+		for( int32_t k = 0; k < count; ++k )
+			for( int c = 0; c < C; ++c )
+				sum[c] += w[k] * s[k * C + c];
+		for( int c = 0; c < C; ++c )
+			out[c] = sum[c];
+	}
+}
+
+// the vertical pass, the filtered lines of one destination row -> width values of the row
+static void accumulateLines( const ResizeTables<uint8_t> &t, int32_t dstY, const int16_t * const *lines, int32_t width, uint8_t *dst, bool sse2 )
+{
+	const int32_t count = t.yCount[dstY];
+	const int16_t *w = &t.yWeights16[dstY * t.yTaps];
+	int32_t x = 0;
+
+#if defined( CINDER_IP_SSE2 )
+	if( sse2 ) {
+		const __m128i half = _mm_set1_epi32( SCALETRAIT<uint8_t>::HALFFINALSHIFT ), zero = _mm_setzero_si128();
+		for( ; x + 8 <= width; x += 8 ) {
+			__m128i lo = half, hi = half;
+			int32_t k = 0;
+			for( ; k + 2 <= count; k += 2 ) {
+				const __m128i a = _mm_loadu_si128( (const __m128i*)( lines[k] + x ) ), b = _mm_loadu_si128( (const __m128i*)( lines[k + 1] + x ) );
+				const __m128i wk = _mm_set1_epi32( (uint16_t)w[k] | ( (uint32_t)(uint16_t)w[k + 1] << 16 ) );
+				lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), wk ) );
+				hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), wk ) );
+			}
+			if( k < count ) {
+				const __m128i a = _mm_loadu_si128( (const __m128i*)( lines[k] + x ) ), wk = _mm_set1_epi32( (uint16_t)w[k] );
+				lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, zero ), wk ) );
+				hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, zero ), wk ) );
+			}
+			// the saturating packs clamp to [0,255] like ACCUMTOCHANNEL
+			lo = _mm_srai_epi32( lo, SCALETRAIT<uint8_t>::FINALSHIFT );
+			hi = _mm_srai_epi32( hi, SCALETRAIT<uint8_t>::FINALSHIFT );
+			const __m128i packed = _mm_packs_epi32( lo, hi );
+			_mm_storel_epi64( (__m128i*)( dst + x ), _mm_packus_epi16( packed, packed ) );
+		}
+	}
+#endif
+	for( ; x < width; ++x ) {
+		int32_t sum = 0;
+		for( int32_t k = 0; k < count; ++k )
+			sum += lines[k][x] * w[k];
+		dst[x] = SCALETRAIT<uint8_t>::ACCUMTOCHANNEL( sum );
+	}
+}
+
+static void accumulateLines( const ResizeTables<float> &t, int32_t dstY, const float * const *lines, int32_t width, float *dst, bool sse2 )
+{
+	const int32_t count = t.yCount[dstY];
+	const float *w = &t.yWeights[dstY * t.yTaps];
+	int32_t x = 0;
+
+#if defined( CINDER_IP_SSE2 )
+	if( sse2 ) {
+		for( ; x + 4 <= width; x += 4 ) {
+			__m128 sum = _mm_setzero_ps();
+			for( int32_t k = 0; k < count; ++k )
+				sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( lines[k] + x ), _mm_set1_ps( w[k] ) ) );
+			_mm_storeu_ps( dst + x, sum );
+		}
+	}
+#endif
+	for( ; x < width; ++x ) {
+		float sum = 0;
+		for( int32_t k = 0; k < count; ++k )
+			sum += lines[k][x] * w[k];
+		dst[x] = sum;
+	}
+}
+
+// the rows of one band of the destination, every band keeps its own ring of filtered source lines
+template<typename T, typename LT, int C>
+struct ResizeBand {
+	const ResizeTables<T>	*tables;
+	const uint8_t			*srcData;
+	size_t					srcRowBytes;
+	int32_t					srcLimit;
+	uint8_t					*dstData;
+	size_t					dstRowBytes;
+	bool					sse2;
+
+	void operator()( int32_t dstY1, int32_t dstY2 ) const
+	{
+		const ResizeTables<T> &t = *tables;
+		const int32_t width = (int32_t)t.xStart.size() * C;
+		vector<LT> ringBuffer( t.yTaps * ( width + 1 ) );
+		vector<int32_t> ringRow( t.yTaps, -1 );
+		vector<const LT*> lines( t.yTaps );
+
+		for( int32_t dstY = dstY1; dstY < dstY2; ++dstY ) {
+			for( int32_t k = 0; k < t.yCount[dstY]; ++k ) {
+				const int32_t srcY = t.yStart[dstY] + k, slot = srcY % t.yTaps;
+				LT *line = &ringBuffer[slot * ( width + 1 )];
+				if( ringRow[slot] != srcY ) {
+					filterRowInterleaved<C>( t, (const T*)( srcData + srcY * srcRowBytes ), srcLimit, line, sse2 );
+					ringRow[slot] = srcY;
+				}
+				lines[k] = line;
+			}
+			accumulateLines( t, dstY, &lines[0], width, (T*)( dstData + dstY * dstRowBytes ), sse2 );
+		}
+	}
+};
+
+template<typename T, typename LT, int C>
+void runResizeBands( const ResizeTables<T> &tables, const SurfaceT<T> &srcSurface, SurfaceT<T> *dstSurface, const ResampleGeometry &g )
+{
+	ResizeBand<T,LT,C> band;
+	band.tables = &tables;
+	band.srcData = (const uint8_t*)srcSurface.getData( Vec2i( g.srcOffsetX, g.srcOffsetY ) );
+	band.srcRowBytes = srcSurface.getRowBytes();
+	band.srcLimit = ( srcSurface.getWidth() - g.srcOffsetX ) * C;
+	band.dstData = (uint8_t*)dstSurface->getData( g.clippedDstArea.getUL() );
+	band.dstRowBytes = dstSurface->getRowBytes();
+	band.sse2 = useSse2();
+
+	// the work of a destination row is the source pixels it filters
+	parallelRows( 0, g.dstHeight, (int32_t)( (int64_t)g.srcWidth * g.srcHeight / g.dstHeight ), band );
+}
+
+// returns false if the surfaces don't suit the fast path and resample() has to do it
+template<typename T, typename LT>
+bool resampleInterleaved( const SurfaceT<T> &srcSurface, const Area &srcArea, SurfaceT<T> *dstSurface, const Area &dstArea, const FilterBase &filter )
+{
+	const int32_t channels = srcSurface.hasAlpha() ? 4 : 3;
+	if( ! ( srcSurface.getChannelOrder() == dstSurface->getChannelOrder() ) || ( srcSurface.getPixelInc() != channels ) )
+		return false;
+
+	ResampleGeometry g;
+	if( ! setupResampleGeometry( srcSurface.getBounds(), srcArea, dstSurface->getBounds(), dstArea, filter, &g ) )
+		return true;
+
+	std::shared_ptr<ResizeTables<T> > tables = ResizeCache<T>::get( filter, g );
+	if( std::numeric_limits<typename SCALETRAIT<T>::SUMT>::is_integer && ! tables->fitsInt16 )
+		return false;
+
+	if( channels == 4 )
+		runResizeBands<T,LT,4>( *tables, srcSurface, dstSurface, g );
+	else
+		runResizeBands<T,LT,3>( *tables, srcSurface, dstSurface, g );
+	return true;
+}
+
+template<typename T>
+bool resizeInterleaved( const SurfaceT<T> &srcSurface, const Area &srcArea, SurfaceT<T> *dstSurface, const Area &dstArea, const FilterBase &filter )
+{
+	return false;
+}
+
+template<>
+bool resizeInterleaved<uint8_t>( const Surface8u &srcSurface, const Area &srcArea, Surface8u *dstSurface, const Area &dstArea, const FilterBase &filter )
+{
+	return resampleInterleaved<uint8_t,int16_t>( srcSurface, srcArea, dstSurface, dstArea, filter );
+}
+
+template<>
+bool resizeInterleaved<float>( const Surface32f &srcSurface, const Area &srcArea, Surface32f *dstSurface, const Area &dstArea, const FilterBase &filter )
+{
+	return resampleInterleaved<float,float>( srcSurface, srcArea, dstSurface, dstArea, filter );
+}
+
 template<typename T>
 void resize( const SurfaceT<T> &srcSurface, const Area &srcArea, SurfaceT<T> *dstSurface, const Area &dstArea, const FilterBase &filter )
 {
+	if( resizeInterleaved( srcSurface, srcArea, dstSurface, dstArea, filter ) )
+		return;
+
 	vector<const ChannelT<T>*> srcChannels;
 	vector<ChannelT<T>*> dstChannels;
 
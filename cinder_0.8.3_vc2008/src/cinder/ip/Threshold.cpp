@@ -21,77 +21,149 @@
 */
 
 #include "cinder/ip/Threshold.h"
+#include "cinder/ip/Parallel.h"
 #include "cinder/ChanTraits.h"
 
 #include <stdlib.h>
 
 namespace cinder { namespace ip {
 
+// thresholds count values, leaving those of dst alone whose position modulo 4 has its bit set in keepMask
 template<typename T>
-void thresholdImpl( SurfaceT<T> *surface, T value, const Area &area )
+void thresholdScalar( const T *src, T *dst, int32_t count, uint8_t keepMask, T value )
+{
+	const T maxValue = CHANTRAIT<T>::max();
+	for( int32_t i = 0; i < count; ++i ) {
+		const T result = ( src[i] > value ) ? maxValue : 0;
+		dst[i] = ( ( keepMask >> ( i & 3 ) ) & 1 ) ? dst[i] : result;
+	}
+}
+
+template<typename T>
+void thresholdValues( const T *src, T *dst, int32_t count, uint8_t keepMask, T value )
+{
+	thresholdScalar( src, dst, count, keepMask, value );
+}
+
+template<>
+void thresholdValues<uint8_t>( const uint8_t *src, uint8_t *dst, int32_t count, uint8_t keepMask, uint8_t value )
 {
-	const Area clippedArea = area.getClipBy( surface->getBounds() );
-	int32_t rowBytes = surface->getRowBytes();
-	uint8_t pixelInc = surface->getPixelInc();
-	uint8_t redOffset = surface->getRedOffset(), greenOffset = surface->getGreenOffset(), blueOffset = surface->getBlueOffset();
-	T maxValue = CHANTRAIT<T>::max();
-	for( int32_t y = clippedArea.getY1(); y < clippedArea.getY2(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( surface->getData() + clippedArea.getX1() * pixelInc ) + y * rowBytes );
-		for( int32_t x = 0; x < clippedArea.getWidth(); ++x ) {
-			dstPtr[redOffset] = ( dstPtr[redOffset] > value ) ? maxValue : 0;
-			dstPtr[greenOffset] = ( dstPtr[greenOffset] > value ) ? maxValue : 0;
-			dstPtr[blueOffset] = ( dstPtr[blueOffset] > value ) ? maxValue : 0;;
-			dstPtr += pixelInc;
+	int32_t i = 0;
+#if defined( CINDER_IP_SSE2 )
+	if( useSse2() ) {
+		const __m128i v = _mm_set1_epi8( (char)value ), zero = _mm_setzero_si128();
+		const __m128i keep = _mm_set1_epi32( ( ( keepMask & 1 ) ? 0xFF : 0 ) | ( ( keepMask & 2 ) ? 0xFF00 : 0 ) | ( ( keepMask & 4 ) ? 0xFF0000 : 0 ) | ( ( keepMask & 8 ) ? 0xFF000000 : 0 ) );
+		for( ; i + 16 <= count; i += 16 ) {
+			// src > value exactly where the saturating difference is nonzero
+			const __m128i below = _mm_cmpeq_epi8( _mm_subs_epu8( _mm_loadu_si128( (const __m128i*)( src + i ) ), v ), zero );
+			const __m128i kept = _mm_and_si128( keep, _mm_loadu_si128( (const __m128i*)( dst + i ) ) );
+			_mm_storeu_si128( (__m128i*)( dst + i ), _mm_or_si128( kept, _mm_andnot_si128( _mm_or_si128( keep, below ), _mm_cmpeq_epi8( zero, zero ) ) ) );
 		}
-	}	
+	}
+#endif
+	// i is a multiple of 16 so the positions of the kept values don't shift
+	thresholdScalar( src + i, dst + i, count - i, keepMask, value );
 }
 
+template<typename T>
+struct ThresholdSurfaceBand {
+	const SurfaceT<T>	*src;
+	SurfaceT<T>			*dst;
+	Area				area;
+	Vec2i				dstLT;
+	T					value;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		int8_t srcPixelInc = src->getPixelInc();
+		uint8_t srcRedOffset = src->getRedOffset(), srcGreenOffset = src->getGreenOffset(), srcBlueOffset = src->getBlueOffset();
+		int8_t dstPixelInc = dst->getPixelInc();
+		uint8_t dstRedOffset = dst->getRedOffset(), dstGreenOffset = dst->getGreenOffset(), dstBlueOffset = dst->getBlueOffset();
+		const T maxValue = CHANTRAIT<T>::max();
+
+		// with the same layout on both sides whole rows are thresholded at once, minus the alpha or padding of 4 channel pixels
+		const bool sameLayout = src->getChannelOrder() == dst->getChannelOrder();
+		const uint8_t keepMask = ( srcPixelInc == 4 ) ? ( 1 << ( 6 - srcRedOffset - srcGreenOffset - srcBlueOffset ) ) : 0;
+
+		for( int32_t y = y1; y < y2; ++y ) {
+			T *dstPtr = dst->getData( Vec2i( dstLT.x, dstLT.y + y ) );
+			const T *srcPtr = src->getData( Vec2i( area.getX1(), area.getY1() + y ) );
+			if( sameLayout ) {
+				thresholdValues( srcPtr, dstPtr, area.getWidth() * srcPixelInc, keepMask, value );
+				continue;
+			}
+			for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
+				dstPtr[dstRedOffset] = ( srcPtr[srcRedOffset] > value ) ? maxValue : 0;
+				dstPtr[dstGreenOffset] = ( srcPtr[srcGreenOffset] > value ) ? maxValue : 0;
+				dstPtr[dstBlueOffset] = ( srcPtr[srcBlueOffset] > value ) ? maxValue : 0;
+				dstPtr += dstPixelInc;
+				srcPtr += srcPixelInc;
+			}
+		}
+	}
+};
+
 template<typename T>
 void thresholdImpl( const SurfaceT<T> &srcSurface, T value, const Area &srcArea, const Vec2i &dstLT, SurfaceT<T> *dstSurface )
 {
 	std::pair<Area,Vec2i> srcDst = clippedSrcDst( srcSurface.getBounds(), srcArea, dstSurface->getBounds(), dstLT );
-	const Area &area( srcDst.first );
-	const Vec2i &dstOffset( srcDst.second );
-
-	int32_t srcRowBytes = srcSurface.getRowBytes();
-	int8_t srcPixelInc = srcSurface.getPixelInc();
-	uint8_t srcRedOffset = srcSurface.getRedOffset(), srcGreenOffset = srcSurface.getGreenOffset(), srcBlueOffset = srcSurface.getBlueOffset();
-	int32_t dstRowBytes = dstSurface->getRowBytes();
-	int8_t dstPixelInc = dstSurface->getPixelInc();
-	uint8_t dstRedOffset = dstSurface->getRedOffset(), dstGreenOffset = dstSurface->getGreenOffset(), dstBlueOffset = dstSurface->getBlueOffset();
-	const T maxValue = CHANTRAIT<T>::max();
-	for( int32_t y = 0; y < area.getHeight(); ++y ) {
-		T *dstPtr = reinterpret_cast<T*>( reinterpret_cast<uint8_t*>( dstSurface->getData() + ( dstOffset.x + area.getX1() ) * dstPixelInc ) + ( y + dstOffset.y ) * dstRowBytes );
-		const T *srcPtr = reinterpret_cast<const T*>( reinterpret_cast<const uint8_t*>( srcSurface.getData() + area.getX1() * srcPixelInc ) + ( y + area.getY1() ) * srcRowBytes );
-		for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
-			dstPtr[dstRedOffset] = ( srcPtr[srcRedOffset] > value ) ? maxValue : 0;
-			dstPtr[dstGreenOffset] = ( srcPtr[srcGreenOffset] > value ) ? maxValue : 0;
-			dstPtr[dstBlueOffset] = ( srcPtr[srcBlueOffset] > value ) ? maxValue : 0;;			
-			dstPtr += dstPixelInc;
-			srcPtr += srcPixelInc;
+
+	ThresholdSurfaceBand<T> band;
+	band.src = &srcSurface;
+	band.dst = dstSurface;
+	band.area = srcDst.first;
+	band.dstLT = srcDst.second;
+	band.value = value;
+	parallelRows( 0, band.area.getHeight(), band.area.getWidth(), band );
+}
+
+template<typename T>
+void thresholdImpl( SurfaceT<T> *surface, T value, const Area &area )
+{
+	thresholdImpl( *surface, value, area, area.getUL(), surface );
+}
+
+template<typename T>
+struct ThresholdChannelBand {
+	const ChannelT<T>	*src;
+	ChannelT<T>			*dst;
+	Area				area;
+	Vec2i				dstLT;
+	T					value;
+
+	void operator()( int32_t y1, int32_t y2 ) const
+	{
+		int8_t srcInc = src->getIncrement();
+		int8_t dstInc = dst->getIncrement();
+		const T maxValue = CHANTRAIT<T>::max();
+		for( int32_t y = y1; y < y2; ++y ) {
+			T *dstPtr = dst->getData( Vec2i( dstLT.x, dstLT.y + y ) );
+			const T *srcPtr = src->getData( Vec2i( area.getX1(), area.getY1() + y ) );
+			if( ( srcInc == 1 ) && ( dstInc == 1 ) ) {
+				thresholdValues( srcPtr, dstPtr, area.getWidth(), 0, value );
+				continue;
+			}
+			for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
+				*dstPtr = ( *srcPtr > value ) ? maxValue : 0;
+				dstPtr += dstInc;
+				srcPtr += srcInc;
+			}
 		}
 	}
-}
+};
 
 template<typename T>
 void thresholdImpl( const ChannelT<T> &srcChannel, T value, const Area &srcArea, const Vec2i &dstLT, ChannelT<T> *dstChannel )
 {
 	std::pair<Area,Vec2i> srcDst = clippedSrcDst( srcChannel.getBounds(), srcArea, dstChannel->getBounds(), dstLT );
-	const Area &area( srcDst.first );
-	const Vec2i &dstOffset( srcDst.second );
 
-	int8_t srcInc = srcChannel.getIncrement();
-	int8_t dstInc = dstChannel->getIncrement();
-	const T maxValue = CHANTRAIT<T>::max();
-	for( int32_t y = 0; y < area.getHeight(); ++y ) {
-		T *dstPtr = dstChannel->getData( Vec2i( area.getX1(), y ) + dstOffset );
-		const T *srcPtr = srcChannel.getData( Vec2i( area.getX1(), y ) );
-		for( int32_t x = area.getX1(); x < area.getX2(); ++x ) {
-			*dstPtr = ( *srcPtr > value ) ? maxValue : 0;
-			dstPtr += dstInc;
-			srcPtr += srcInc;
-		}
-	}
+	ThresholdChannelBand<T> band;
+	band.src = &srcChannel;
+	band.dst = dstChannel;
+	band.area = srcDst.first;
+	band.dstLT = srcDst.second;
+	band.value = value;
+	parallelRows( 0, band.area.getHeight(), band.area.getWidth(), band );
 }
 
 template<typename T>
@@ -118,100 +190,92 @@ void threshold( const ChannelT<T> &srcChannel, T value, ChannelT<T> *dstChannel
 	thresholdImpl( srcChannel, value, srcChannel.getBounds(), Vec2i::zero(), dstChannel );
 }
 
-template<typename T>
-void calculateAdaptiveThreshold( const ChannelT<T> *srcChannel, typename CHANTRAIT<T>::Accum *integralImage, int32_t windowSize, float percentageDelta, ChannelT<T> *dstChannel )
-{
+// the rows [j1,j2) of an adaptive threshold, ZERO selects calculateAdaptiveThresholdZero()'s comparison
+template<typename T, bool ZERO>
+struct AdaptiveThresholdBand {
 	typedef typename CHANTRAIT<T>::Accum SUMT; 
 
-	int32_t imageWidth = srcChannel->getWidth();
-	int32_t imageHeight = srcChannel->getHeight();
-
-	int s2 = windowSize / 2;
-	uint8_t srcInc = srcChannel->getIncrement();
-	uint8_t dstInc = dstChannel->getIncrement();
-
-	SUMT comparisonMult = static_cast<SUMT>( ( 1.0f - percentageDelta ) * 256 );
-	const T maxValue = CHANTRAIT<T>::max();
-
-	// perform thresholding
-	for( int32_t j = 0; j < imageHeight; j++ ) {
-		T *dstLine = dstChannel->getData( 0, j );
-		T *dst = dstLine;
-		const T *srcLine = srcChannel->getData( 0, j );
-		const T *src = srcLine;
-		for( int32_t i = 0; i< imageWidth; i++ ) {
-
-			// set the SxS region
-			int32_t x1 = i - s2, x2 = i + s2;
-			int32_t y1 = j - s2, y2 = j + s2;
-
-			// check the border
-			if( x1 < 0 ) x1 = 0;
-			if( x2 >= imageWidth ) x2 = imageWidth - 1;
-			if( y1 < 0 ) y1 = 0;
-			if( y2 >= imageHeight ) y2 = imageHeight - 1;
-			
-			int32_t count = ( x2 - x1 ) * ( y2 - y1 );
-
-			// I(x,y)=s(x2,y2)-s(x1,y2)-s(x2,y1)+s(x1,x1)
-			SUMT sum =	integralImage[y2 * imageWidth + x2] -
-						integralImage[y1 * imageWidth + x2] -
-						integralImage[y2 * imageWidth + x1] +
-						integralImage[y1 * imageWidth + x1];
-
-			*dst = ( (SUMT)(*src * count) < (sum * comparisonMult / 256) ) ? 0 : maxValue;
-			dst += dstInc;
-			src += srcInc;
+	const ChannelT<T>	*srcChannel;
+	ChannelT<T>			*dstChannel;
+	const SUMT			*integralImage;
+	int32_t				windowSize;
+	SUMT				comparisonMult;
+
+	void operator()( int32_t j1, int32_t j2 ) const
+	{
+		int32_t imageWidth = srcChannel->getWidth();
+		int32_t imageHeight = srcChannel->getHeight();
+
+		int s2 = windowSize / 2;
+		uint8_t srcInc = srcChannel->getIncrement();
+		uint8_t dstInc = dstChannel->getIncrement();
+		const T maxValue = CHANTRAIT<T>::max();
+
+		for( int32_t j = j1; j < j2; j++ ) {
+			T *dstLine = dstChannel->getData( 0, j );
+			T *dst = dstLine;
+			const T *srcLine = srcChannel->getData( 0, j );
+			const T *src = srcLine;
+			for( int32_t i = 0; i< imageWidth; i++ ) {
+
+				// set the SxS region
+				int32_t x1 = i - s2, x2 = i + s2;
+				int32_t y1 = j - s2, y2 = j + s2;
+
+				// check the border
+				if( x1 < 0 ) x1 = 0;
+				if( x2 >= imageWidth ) x2 = imageWidth - 1;
+				if( y1 < 0 ) y1 = 0;
+				if( y2 >= imageHeight ) y2 = imageHeight - 1;
+				
+				int32_t count = ( x2 - x1 ) * ( y2 - y1 );
+
+				// I(x,y)=s(x2,y2)-s(x1,y2)-s(x2,y1)+s(x1,x1)
+				SUMT sum =	integralImage[y2 * imageWidth + x2] -
+							integralImage[y1 * imageWidth + x2] -
+							integralImage[y2 * imageWidth + x1] +
+							integralImage[y1 * imageWidth + x1];
+
+				if( ZERO ) {
+					//*dst = ( (*dst * count) < sum ) ? 0 : maxValue;
+					int32_t diffSignExtended = (int32_t)( sum - *src * count );
+					diffSignExtended >>= 31;
+					*dst = (T)(diffSignExtended & 0xFF);
+				}
+				else
+					*dst = ( (SUMT)(*src * count) < (sum * comparisonMult / 256) ) ? 0 : maxValue;
+				dst += dstInc;
+				src += srcInc;
+			}
 		}
 	}
-}
+};
 
 template<typename T>
-void calculateAdaptiveThresholdZero( const ChannelT<T> *srcChannel, typename CHANTRAIT<T>::Accum *integralImage, int32_t windowSize, ChannelT<T> *dstChannel )
+void calculateAdaptiveThreshold( const ChannelT<T> *srcChannel, typename CHANTRAIT<T>::Accum *integralImage, int32_t windowSize, float percentageDelta, ChannelT<T> *dstChannel )
 {
 	typedef typename CHANTRAIT<T>::Accum SUMT; 
 
-	int32_t imageWidth = srcChannel->getWidth();
-	int32_t imageHeight = srcChannel->getHeight();
-	int s2 = windowSize / 2;
-	uint8_t srcInc = srcChannel->getIncrement();
-	uint8_t dstInc = dstChannel->getIncrement();
-
-	// perform thresholding
-	for( int32_t j = 0; j < imageHeight; j++ ) {
-		T *dstLine = dstChannel->getData( 0, j );
-		T *dst = dstLine;
-		const T *srcLine = srcChannel->getData( 0, j );
-		const T *src = srcLine;
-		for( int32_t i = 0; i< imageWidth; i++ ) {
-
-			// set the SxS region
-			int32_t x1 = i - s2, x2 = i + s2;
-			int32_t y1 = j - s2, y2 = j + s2;
-
-			// check the border
-			if( x1 < 0 ) x1 = 0;
-			if( x2 >= imageWidth ) x2 = imageWidth - 1;
-			if( y1 < 0 ) y1 = 0;
-			if( y2 >= imageHeight ) y2 = imageHeight - 1;
-			
-			int32_t count = ( x2 - x1 ) * ( y2 - y1 );
-
-			// I(x,y)=s(x2,y2)-s(x1,y2)-s(x2,y1)+s(x1,x1)
-			SUMT sum =	integralImage[y2 * imageWidth + x2] -
-						integralImage[y1 * imageWidth + x2] -
-						integralImage[y2 * imageWidth + x1] +
-						integralImage[y1 * imageWidth + x1];
-
-			//*dst = ( (*dst * count) < sum ) ? 0 : maxValue;
-			int32_t diffSignExtended = (int32_t)( sum - *src * count );
-			diffSignExtended >>= 31;
-			*dst = (T)(diffSignExtended & 0xFF);
-			dst += dstInc;
-			src += srcInc;
-		}
-	}
+	// every pixel reads only its own source value and the integral image, so the rows are independent even in place
+	AdaptiveThresholdBand<T,false> band;
+	band.srcChannel = srcChannel;
+	band.dstChannel = dstChannel;
+	band.integralImage = integralImage;
+	band.windowSize = windowSize;
+	band.comparisonMult = static_cast<SUMT>( ( 1.0f - percentageDelta ) * 256 );
+	parallelRows( 0, srcChannel->getHeight(), srcChannel->getWidth(), band );
+}
 
+template<typename T>
+void calculateAdaptiveThresholdZero( const ChannelT<T> *srcChannel, typename CHANTRAIT<T>::Accum *integralImage, int32_t windowSize, ChannelT<T> *dstChannel )
+{
+	AdaptiveThresholdBand<T,true> band;
+	band.srcChannel = srcChannel;
+	band.dstChannel = dstChannel;
+	band.integralImage = integralImage;
+	band.windowSize = windowSize;
+	band.comparisonMult = 0;
+	parallelRows( 0, srcChannel->getHeight(), srcChannel->getWidth(), band );
 }
 
 template<typename T>